@@ -33,3155 +33,8091 @@
 #ifndef _TREE_H_
 #define _TREE_H_
 
+// The allocators, move support, emplace functions and parallel sort need
+// C++11; MSVC reports an older __cplusplus unless asked not to.
+#if __cplusplus < 201103L && !defined( _MSC_VER )
+#error "tree.h needs C++11 or later, e.g. -std=c++11"
+#endif
+
 #include <cassert>
 #include <memory>
+#include <new>
+#include <utility>
+#include <type_traits>
 #include <stdexcept>
 #include <iterator>
 #include <string>
+#include <istream>
+#include <ostream>
 #include <vector>
-#include <set>
-#include <queue>
 #include <algorithm>
+#include <functional>
+#include <exception>
 #include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <cstdlib>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+#ifdef _WIN32
+#include <malloc.h>
+#endif
 
 //////////////////////////////////////////////////////////////////////////
-/// TreeNode
+/// TreePolicy
 //////////////////////////////////////////////////////////////////////////
-template< class T >
-class _TreeNode
-{
-public:
-    _TreeNode(          );
-    _TreeNode( const T& );
+// Compile-time switches for the optional bookkeeping of a Tree. Derive from
+// TreeDefaultPolicy and override the switches you need, e.g.
+//     struct CountingPolicy : TreeDefaultPolicy
+//     {
+//         static const bool countNodes = true;
+//     };
+//     Tree< int, std::allocator< _TreeNode< int > >, CountingPolicy > tr;
+// Bookkeeping that is switched off costs neither time nor space. The
+// lcaIndex, intervalLabels and levelIndex queries rebuild their index inside
+// const calls, so with those a tree shared between threads needs a lock even
+// for reading.
+struct TreeDefaultPolicy
+{
+	static const bool countNodes   = false;   // size() in O(1)
+	static const bool subtreeSizes = false;   // size( it ), rank(), nodeAt() and
+	                                          // preOrderIterator::operator+= in O(depth * fanout)
+	static const bool childIndex   = false;   // child(), sibling(), index() and
+	                                          // numberOfChildren() in O(1)
+	static const size_t childIndexThreshold = 16;   // fanout from which childIndex keeps
+	                                                // an array of the children
+	static const bool indexLinks   = false;   // 32-bit links into a TreeNodePool instead
+	                                          // of pointers; the allocator is ignored and
+	                                          // the pool keeps its memory until the
+	                                          // process ends
+	static const bool reducedLinks = false;   // no lastChild and prevSibling links, walking
+	                                          // backwards does not compile or is O(fanout)
+	static const bool leafChain    = false;   // leaves threaded into a list, leafIterator steps
+	                                          // and beginLeaf( top ) / endLeaf( top ) in O(1)
+	static const bool levelLinks   = false;   // nodes of equal depth linked left to right,
+	                                          // fixedDepthIterator and nextAtSameDepth() in O(1)
+	static const bool lcaIndex     = false;   // lowestCommonAncestor() in O(1), the first query
+	                                          // after a change takes O(n log n) to rebuild
+	static const bool intervalLabels = false; // isAncestor(), isDescendant() and isInSubTree() in
+	                                          // O(1), the first query after a change relabels
+	                                          // the smallest subtree holding the changes
+	static const bool levelIndex   = false;   // level() in O(1) and ancestor() in O(log n), the
+	                                          // first query after a change takes O(n) to rebuild
+	static const bool subtreeHashes = false;  // subtreeHash() cached per node, equal() and
+	                                          // equalSubTree() reject most mismatches in O(1);
+	                                          // data changed through an iterator must be
+	                                          // reported with dataChanged(). Queries fill the
+	                                          // cache, its entries are atomic so that const
+	                                          // calls may run on several threads at once
+};
 
-    _TreeNode<T> *parent     ;
-    _TreeNode<T> *firstChild ;
-    _TreeNode<T> *lastChild  ;
-    _TreeNode<T> *prevSibling;
-    _TreeNode<T> *nextSibling;
-    T            data        ;
+// Node count of a Tree, an empty base unless the policy asks for it.
+template< bool Enabled_ >
+class TreeNodeCount
+{
+protected:
+	void   adjustNodeCount( ptrdiff_t      ) {}
+	void   resetNodeCount(                 ) {}
+	void   swapNodeCount(   TreeNodeCount& ) {}
+	size_t nodeCount(                      ) const { return 0; }
 };
 
-template< class T >
-_TreeNode< T >::_TreeNode()
-                    : parent(      0 ),
-				      firstChild(  0 ),
-				      lastChild(   0 ),
-				      prevSibling( 0 ),
-				      nextSibling( 0 ){}
+template<>
+class TreeNodeCount< true >
+{
+protected:
+	TreeNodeCount() : count( 0 ) {}
 
-template< class T >
-_TreeNode< T >::_TreeNode( const T& value )
-                    : parent(      0 ),
-				      firstChild(  0 ),
-				      lastChild(   0 ),
-				      prevSibling( 0 ),
-				      nextSibling( 0 ),
-				      data(    value ){}
+	void   adjustNodeCount( ptrdiff_t n          ) { count += n; }
+	void   resetNodeCount(                       ) { count = 0; }
+	void   swapNodeCount(   TreeNodeCount& other ) { std::swap( count, other.count ); }
+	size_t nodeCount(                            ) const { return count; }
+
+private:
+	size_t count;
+};
 
 
 //////////////////////////////////////////////////////////////////////////
-/// Tree
+/// TreeNodePool
 //////////////////////////////////////////////////////////////////////////
-template< class T, class TreeNodeAllocator_ = std::allocator< _TreeNode<T> > >
-class Tree
+// Process-wide store for the nodes of trees whose policy asks for
+// indexLinks, so that a node can be named by a 32-bit index instead of a
+// pointer. Nodes are cut from chunks aligned to their size, a node finds
+// its chunk by masking its address. An index holds the chunk number in its
+// high bits and the slot in the low bits, 0 is the null link.
+// Chunks are kept until the process ends: freed nodes are reused, but the
+// memory never goes back to the system. Every thread keeps a short list of
+// free nodes of its own and takes the lock only to move a batch of them to
+// or from the shared list; turning an index into a node takes no lock.
+template< class Node_ >
+class TreeNodePool
 {
-protected:
-    typedef _TreeNode< T > TREE_NODE;
-
 public:
-	typedef T value_type;
+	static Node_         *allocate(                 );
+	static void           deallocate( Node_ *       );
+	static std::uint32_t  indexOf(    const Node_ * );
+	static Node_         *nodeAt(     std::uint32_t );
 
-	class iteratorBase     ;
-	class preOrderIterator ;
-	class postOrderIterator;
-	class siblingIterator  ;
-	class leafIterator     ;
+private:
+	static const size_t chunkBytes = size_t( 1 ) << 20;
+	static const size_t maxChunks  = size_t( 1 ) << 16;
+	static const size_t batch      = 64;   // nodes moved between a thread and the pool at once
 
-	Tree(                                      );
-	Tree( const T&                             );
-	Tree( const iteratorBase&                  );
-	Tree( const Tree< T, TreeNodeAllocator_ >& );
-	
-	~Tree();
+	// free nodes chained through their first four bytes
+	struct freeList
+	{
+		std::uint32_t first;
+		size_t        count;
+	};
 
-    Tree< T, TreeNodeAllocator_ >& operator=( const Tree< T, TreeNodeAllocator_ >& );
+	struct state
+	{
+		std::mutex mutex     ;
+		size_t     chunkCount;
+		size_t     used      ;   // slots handed out from the newest chunk
+		freeList   free      ;
+	};
 
-    class iteratorBase
+	// the free nodes of one thread, handed back when the thread ends
+	struct cache : freeList
 	{
-	public:
-		typedef T                               value_type       ;
-		typedef T*                              pointer          ;
-		typedef T&                              reference        ;
-		typedef size_t                          size_type        ;
-		typedef ptrdiff_t                       difference_type  ;
-		typedef std::bidirectional_iterator_tag iterator_category;
+		~cache();
+	};
 
-		iteratorBase(             );
-		iteratorBase( TREE_NODE * );
+	// zero before any constructor runs, so nodeAt() needs no guard
+	static char *chunks[ maxChunks ];
 
-		reference operator*( ) const;
-        pointer   operator->() const;
+	static state& pool( );
+	static cache& local();
 
-        void skipChildren(           );
-		void skipChildren( bool skip );
+	static constexpr size_t   headerBytes();
+	static constexpr size_t   slots(      );
+	static constexpr unsigned slotBits(   );
+	static constexpr unsigned bitsFor( size_t );
 
-		size_t numberOfChildren() const;
+	static void   push( freeList&, Node_ * );
+	static Node_ *pop(  freeList&          );
 
-        siblingIterator begin() const;
-		siblingIterator end(  ) const;
+	static void refill( cache&         );
+	static void spill(  cache&, size_t );
+	static void grow(   state&         );
+};
 
-        TREE_NODE *node;
+template< class Node_ >
+char *TreeNodePool< Node_ >::chunks[ TreeNodePool< Node_ >::maxChunks ];
 
-	protected:
-		bool skipCurrentChildren;
+template< class Node_ >
+TreeNodePool< Node_ >::cache::~cache()
+{
+	spill( *this, this->count );
+}
 
-	};
+template< class Node_ >
+constexpr size_t TreeNodePool< Node_ >::headerBytes()
+{
+	// the chunk number, padded so that the first node is aligned
+	return ( sizeof( std::uint32_t ) + alignof( Node_ ) - 1 ) / alignof( Node_ ) * alignof( Node_ );
+}
 
-	// Depth-first iterator, first accessing the node, then its children
-	class preOrderIterator : public iteratorBase
-	{
-	public:
+template< class Node_ >
+constexpr size_t TreeNodePool< Node_ >::slots()
+{
+	return ( chunkBytes - headerBytes() ) / sizeof( Node_ );
+}
 
-		preOrderIterator(                        );
-		preOrderIterator( TREE_NODE *            );
-        preOrderIterator( const iteratorBase&    );
-		preOrderIterator( const siblingIterator& );
+template< class Node_ >
+constexpr unsigned TreeNodePool< Node_ >::bitsFor( size_t num )
+{
+	return num <= 1 ? 0 : 1 + bitsFor( ( num + 1 ) / 2 );
+}
 
-		bool operator==( const preOrderIterator& ) const;
-		bool operator!=( const preOrderIterator& ) const;
+template< class Node_ >
+constexpr unsigned TreeNodePool< Node_ >::slotBits()
+{
+	return bitsFor( slots() );
+}
 
-        preOrderIterator& operator++(        );
-        preOrderIterator& operator--(        );
-		preOrderIterator  operator++( int    );
-		preOrderIterator  operator--( int    );
-		preOrderIterator& operator+=( size_t );
-		preOrderIterator& operator-=( size_t );
-	};
+template< class Node_ >
+typename TreeNodePool< Node_ >::state& TreeNodePool< Node_ >::pool()
+{
+	static state s;
+	return s;
+}
 
-	// Depth-first iterator, first accessing the children, then the node
-	class postOrderIterator : public iteratorBase
+template< class Node_ >
+typename TreeNodePool< Node_ >::cache& TreeNodePool< Node_ >::local()
+{
+	static thread_local cache c;
+	return c;
+}
+
+template< class Node_ >
+Node_ *TreeNodePool< Node_ >::allocate()
+{
+	static_assert( slotBits() + 16 <= 32, "tree: node too small for TreeNodePool" );
+
+	cache& c = local();
+	if( c.count == 0 )
 	{
-	public:
-		postOrderIterator(                        );
-		postOrderIterator( TREE_NODE *            );
-		postOrderIterator( const iteratorBase&    );
-		postOrderIterator( const siblingIterator& );
+		refill( c );
+	}
+	return pop( c );
+}
 
-		bool operator==( const postOrderIterator& ) const;
-		bool operator!=( const postOrderIterator& ) const;
+template< class Node_ >
+void TreeNodePool< Node_ >::deallocate( Node_ *node )
+{
+	cache& c = local();
+	push( c, node );
+	if( c.count >= 2 * batch )
+	{
+		spill( c, batch );
+	}
+}
 
-		postOrderIterator& operator++(        );
-		postOrderIterator& operator--(        );
-		postOrderIterator  operator++( int    );
-		postOrderIterator  operator--( int    );
-		postOrderIterator& operator+=( size_t );
-		postOrderIterator& operator-=( size_t );
+template< class Node_ >
+std::uint32_t TreeNodePool< Node_ >::indexOf( const Node_ *node )
+{
+	if( node == 0 )
+	{
+		return 0;
+	}
 
-		void descendAll();
-	};
+	std::uintptr_t chunk = reinterpret_cast< std::uintptr_t >( node ) & ~std::uintptr_t( chunkBytes - 1 );
+	std::uint32_t  slot  = std::uint32_t( ( reinterpret_cast< std::uintptr_t >( node ) - chunk - headerBytes() ) / sizeof( Node_ ) );
 
-	// BreadthFirstQueuedIterator
-	class breadthFirstQueuedIterator : public iteratorBase
+	return ( *reinterpret_cast< const std::uint32_t * >( chunk ) << slotBits() ) | slot;
+}
+
+template< class Node_ >
+Node_ *TreeNodePool< Node_ >::nodeAt( std::uint32_t index )
+{
+	if( index == 0 )
 	{
-	public:
-		breadthFirstQueuedIterator(                     );
-		breadthFirstQueuedIterator( TREE_NODE *         );
-		breadthFirstQueuedIterator( const iteratorBase& );
+		return 0;
+	}
+	char *chunk = chunks[ index >> slotBits() ];
+	return reinterpret_cast< Node_ * >( chunk + headerBytes() + ( index & ( ( 1u << slotBits() ) - 1 ) ) * sizeof( Node_ ) );
+}
 
-		bool operator==( const breadthFirstQueuedIterator& ) const;
-		bool operator!=( const breadthFirstQueuedIterator& ) const;
+template< class Node_ >
+void TreeNodePool< Node_ >::push( freeList& list, Node_ *node )
+{
+	*reinterpret_cast< std::uint32_t * >( node ) = list.first;
+	list.first = indexOf( node );
+	++list.count;
+}
 
-		breadthFirstQueuedIterator& operator++(        );
-		breadthFirstQueuedIterator  operator++( int    );
-		breadthFirstQueuedIterator& operator+=( size_t );
+template< class Node_ >
+Node_ *TreeNodePool< Node_ >::pop( freeList& list )
+{
+	Node_ *ret = nodeAt( list.first );
+	list.first = *reinterpret_cast< std::uint32_t * >( ret );
+	--list.count;
+	return ret;
+}
 
-	private:
-		std::queue< TREE_NODE * > traversalQueue;
-	};
+// Fills an empty cache with a batch from the shared list, or else with
+// fresh slots, growing the pool only when nothing at all is left.
+template< class Node_ >
+void TreeNodePool< Node_ >::refill( cache& c )
+{
+	state& s = pool();
+	std::lock_guard< std::mutex > lock( s.mutex );
 
-//	typedef preOrderIterator           ITERATOR;
-//	typedef breadthFirstQueuedIterator BREADTH_FIRST_ITERATOR;
+	while( c.count < batch && s.free.count != 0 )
+	{
+		push( c, pop( s.free ) );
+	}
+	if( c.count != 0 )
+	{
+		return;
+	}
 
-	// FixedDepthIterator
-	class fixedDepthIterator : public iteratorBase
+	if( s.chunkCount == 0 || s.used == slots() )
 	{
-	public:
-		fixedDepthIterator(                           );
-		fixedDepthIterator( TREE_NODE *               );
-		fixedDepthIterator( const iteratorBase &      );
-		fixedDepthIterator( const siblingIterator&    );
-		fixedDepthIterator( const fixedDepthIterator& );
+		grow( s );
+	}
 
-		bool operator==( const fixedDepthIterator& ) const;
-		bool operator!=( const fixedDepthIterator& ) const;
+	// pushed from the top down so that they come out in address order
+	size_t take = slots() - s.used;
+	if( take > batch )
+	{
+		take = batch;
+	}
+	std::uint32_t base = std::uint32_t( ( s.chunkCount - 1 ) << slotBits() );
+	for( size_t i = s.used + take; i-- > s.used; )
+	{
+		push( c, nodeAt( base | std::uint32_t( i ) ) );
+	}
+	s.used += take;
+}
 
-		fixedDepthIterator& operator++(        );
-		fixedDepthIterator& operator--(        );
-		fixedDepthIterator  operator++( int    );
-		fixedDepthIterator  operator--( int    );
-		fixedDepthIterator& operator+=( size_t );
-		fixedDepthIterator& operator-=( size_t );
+template< class Node_ >
+void TreeNodePool< Node_ >::spill( cache& c, size_t num )
+{
+	if( num == 0 )
+	{
+		return;
+	}
 
-		TREE_NODE *topNode;
-	};
+	state& s = pool();
+	std::lock_guard< std::mutex > lock( s.mutex );
 
-	// SiblingIterator
-	class siblingIterator : public iteratorBase
+	while( num-- != 0 )
 	{
-	public:
+		push( s.free, pop( c ) );
+	}
+}
 
-		siblingIterator(                        );
-		siblingIterator( TREE_NODE *            );
-		siblingIterator( const siblingIterator& );
-		siblingIterator( const iteratorBase&    );
+template< class Node_ >
+void TreeNodePool< Node_ >::grow( state& s )
+{
+	if( s.chunkCount == maxChunks )
+	{
+		throw std::bad_alloc();
+	}
 
-		bool operator==( const siblingIterator& ) const;
-		bool operator!=( const siblingIterator& ) const;
+	void *chunk = 0;
+#ifdef _WIN32
+	chunk = _aligned_malloc( chunkBytes, chunkBytes );
+#else
+	if( posix_memalign( &chunk, chunkBytes, chunkBytes ) != 0 )
+	{
+		chunk = 0;
+	}
+#endif
+	if( chunk == 0 )
+	{
+		throw std::bad_alloc();
+	}
 
-		siblingIterator& operator++(        );
-		siblingIterator& operator--(        );
-		siblingIterator  operator++( int    );
-		siblingIterator  operator--( int    );
-		siblingIterator& operator+=( size_t );
-		siblingIterator& operator-=( size_t );
+	*static_cast< std::uint32_t * >( chunk ) = std::uint32_t( s.chunkCount );
+	chunks[ s.chunkCount ] = static_cast< char * >( chunk );
 
-		TREE_NODE *rangeFirst() const;
-		TREE_NODE *rangeLast( ) const;
-		
-		TREE_NODE *parent;
-		
-	private:
-		void setParent();
-	};
+	// slot 0 of chunk 0 would have index 0
+	s.used = ( s.chunkCount == 0 ? 1 : 0 );
+	++s.chunkCount;
+}
 
-    // LeafIterator
-	class leafIterator : public iteratorBase
+// A link stored as a pool index. It converts to and from a node pointer,
+// so code written against pointer links works unchanged.
+template< class Node_ >
+class _TreeNodeIndexLink
+{
+public:
+	_TreeNodeIndexLink(               ) : index( 0 ) {}
+	_TreeNodeIndexLink( Node_ *node ) : index( TreeNodePool< Node_ >::indexOf( node ) ) {}
+
+	_TreeNodeIndexLink& operator=( Node_ *node )
 	{
-	public:
-		leafIterator(                                 );
-		leafIterator( TREE_NODE *, TREE_NODE *top = 0 );
-		leafIterator( const siblingIterator&          );
-		leafIterator( const iteratorBase&             );
+		index = TreeNodePool< Node_ >::indexOf( node );
+		return *this;
+	}
 
-        bool operator==( const leafIterator& ) const;
-		bool operator!=( const leafIterator& ) const;
+	operator Node_ *(  ) const { return TreeNodePool< Node_ >::nodeAt( index ); }
+	Node_ *operator->( ) const { return TreeNodePool< Node_ >::nodeAt( index ); }
 
-		leafIterator& operator++(        );
-		leafIterator& operator--(        );
-		leafIterator  operator++( int    );
-		leafIterator  operator--( int    );
-		leafIterator& operator+=( size_t );
-		leafIterator& operator-=( size_t );
+private:
+	std::uint32_t index;
+};
 
-	private:
-		TREE_NODE *topNode;
+// Std-style allocator over TreeNodePool, Tree uses it for indexLinks nodes
+// whatever allocator it was given. Only single nodes can be allocated.
+template< class T >
+class TreeNodePoolAllocator
+{
+public:
+	typedef T         value_type     ;
+	typedef T*        pointer        ;
+	typedef const T*  const_pointer  ;
+	typedef T&        reference      ;
+	typedef const T&  const_reference;
+	typedef size_t    size_type      ;
+	typedef ptrdiff_t difference_type;
+
+	template< class U >
+	struct rebind
+	{
+		typedef TreeNodePoolAllocator< U > other;
 	};
 
+	TreeNodePoolAllocator() {}
+	template< class U >
+	TreeNodePoolAllocator( const TreeNodePoolAllocator< U >& ) {}
 
-	inline preOrderIterator begin() const;
-	inline preOrderIterator end(  ) const;
+	pointer allocate( size_type num, const void * = 0 )
+	{
+		assert( num == 1 );
+		return TreeNodePool< T >::allocate();
+	}
 
-	postOrderIterator beginPost() const;
-	postOrderIterator endPost(  ) const;
+	void deallocate( pointer p, size_type )
+	{
+		TreeNodePool< T >::deallocate( p );
+	}
 
-	fixedDepthIterator beginFixed( const iteratorBase&, size_t ) const;
-    fixedDepthIterator endFixed(   const iteratorBase&, size_t ) const;
-
-	
-    breadthFirstQueuedIterator beginBreadthFirst() const;
-	breadthFirstQueuedIterator endBreadthFirst(  ) const;
-
-    siblingIterator beginSibling( const iteratorBase& ) const;
-	siblingIterator endSibling(   const iteratorBase& ) const;
-
-	leafIterator beginLeaf() const;
-	leafIterator endLeaf(  ) const;
-
-    leafIterator beginLeaf( const iteratorBase& top ) const;
-	leafIterator endLeaf(   const iteratorBase& top ) const;
-
-    template< typename iter > static iter parent( iter );
-
-	template< typename iter > iter previousSibling( iter ) const;
-    template< typename iter > iter nextSibling(     iter ) const;
-	template< typename iter > iter nextAtSameDepth( iter ) const;
-
-	void clear();   // clear all nodes of the tree.
-
-	template< typename iter > iter erase( iter );
-
-	void eraseChildren( const iteratorBase& );
-
-	template< typename iter > iter appendChild(  iter );
-	template< typename iter > iter prependChild( iter );
-
-	template< typename iter > iter appendChild(  iter, const T& );
-	template< typename iter > iter prependChild( iter, const T& );
-
-	template< typename iter > iter appendChild(  iter, iter );
-	template< typename iter > iter prependChild( iter, iter );
-
-	template< typename iter > iter appendChildren(  iter, siblingIterator, siblingIterator );
-	template< typename iter > iter prependChildren( iter, siblingIterator, siblingIterator );
-
-    preOrderIterator setHead( const T& );
-
-	template< typename iter > iter insert( iter           , const T& );
-	siblingIterator                insert( siblingIterator, const T& );
+	template< class... Args >
+	void construct( pointer p, Args&&... args )
+	{
+		::new( static_cast< void * >( p ) ) T( std::forward< Args >( args )... );
+	}
 
-	template< typename iter > iter insertSubtree( iter, const iteratorBase& );
+	void destroy( pointer p )
+	{
+		p->~T();
+	}
 
-	template< typename iter > iter insertAfter( iter, const T& );
+	bool operator==( const TreeNodePoolAllocator& ) const { return true;  }
+	bool operator!=( const TreeNodePoolAllocator& ) const { return false; }
+};
 
-	template< typename iter > iter insertSubtreeAfter( iter, const iteratorBase& );
 
-    template< typename iter > iter replace( iter, const T&            );
+//////////////////////////////////////////////////////////////////////////
+/// TreeNode
+//////////////////////////////////////////////////////////////////////////
+// Tag for the _TreeNode constructor that builds data in place.
+struct TreeNodeEmplace
+{
+};
 
-	template< typename iter > iter replace( iter, const iteratorBase& );
+// Number of nodes in the subtree below and including a node, an empty base
+// unless the policy asks for subtreeSizes.
+template< bool Enabled_ >
+class _TreeNodeSize
+{
+public:
+	size_t subtreeSize(           ) const { return 0; }
+	void   growSubtree( ptrdiff_t )       {}
+};
 
-	siblingIterator                replace( siblingIterator,
-		                                    siblingIterator,
-							                siblingIterator,
-							                siblingIterator );
+template<>
+class _TreeNodeSize< true >
+{
+public:
+	_TreeNodeSize() : size( 1 ) {}
 
-	template< typename iter > iter flatten( iter );
+	size_t subtreeSize(             ) const { return size; }
+	void   growSubtree( ptrdiff_t n )       { size += n; }
 
-	template< typename iter > iter reparent( iter, siblingIterator, siblingIterator );
-    template< typename iter > iter reparent( iter, iter );
+private:
+	size_t size;
+};
 
-    template< typename iter > iter wrap( iter, const T& );
+// Child bookkeeping of a node, an empty base unless the policy asks for
+// childIndex. A node counts its children, and once it has more than
+// Threshold_ of them keeps an array of them. Appending or removing the last
+// child updates the array, any other change drops its contents and the
+// next lookup fills it again.
+template< bool Enabled_, class Node_, size_t Threshold_ >
+class _TreeNodeChildren
+{
+public:
+	size_t childCount(                ) const { return 0;     }
+	bool   wide(                      ) const { return false; }
+	Node_ *childAt( size_t            )       { return 0;     }
+	size_t indexOf( const Node_ *     )       { return 0;     }
+	void   childLinked(   Node_ *     )       {}
+	void   childUnlinked( Node_ *     )       {}
+	void   childrenChanged( ptrdiff_t )       {}
+};
 
-	template< typename iter > iter moveAfter(  iter, iter );
-	template< typename iter > iter moveBefore( iter, iter );
-    siblingIterator                moveBefore( siblingIterator,
-		                                       siblingIterator );
-	template< typename iter > iter moveOntop(  iter, iter );
+template< class Node_, size_t Threshold_ >
+class _TreeNodeChildren< true, Node_, Threshold_ >
+{
+public:
+	_TreeNodeChildren(                          ) : count( 0 ), position( 0 ), children( 0 ) {}
+	_TreeNodeChildren( const _TreeNodeChildren& ) : count( 0 ), position( 0 ), children( 0 ) {}
+	~_TreeNodeChildren() { delete children; }
 
-	void merge( siblingIterator                      , 
-		        siblingIterator                      , 
-				siblingIterator                      , 
-				siblingIterator                      , 
-				bool            duplicateLeaves=false  );
+	size_t childCount() const { return count; }
+	bool   wide(      ) const { return count > Threshold_; }
 
-	void sort( siblingIterator              ,
-		       siblingIterator              ,
-		       bool               deep=false  );
-	template< class StrictWeakOrdering > 
-	void sort( siblingIterator              ,
-	           siblingIterator              ,
-	           StrictWeakOrdering           ,
-			   bool               deep=false  );
+	// only for wide nodes
+	Node_ *childAt( size_t            );
+	size_t indexOf( const Node_ *child );
 
-	template< typename iter >
-	bool equal( const iter&,
-		        const iter&,
-				const iter&  ) const;
-	template< typename iter, class BinaryPredicate >
-	bool equal( const iter&          ,
-		        const iter&          ,
-				const iter&          ,
-				      BinaryPredicate  ) const;
-	
-	template< typename iter >
-    bool equalSubTree( const iter&,
-		               const iter& ) const;
-    template< typename iter, class BinaryPredicate >
-	bool equalSubTree( const iter&          ,
-		               const iter&          ,
-          				     BinaryPredicate  ) const;
+	void childLinked(     Node_ *   );   // after child is linked in
+	void childUnlinked(   Node_ *   );   // before child is linked out
+	void childrenChanged( ptrdiff_t );
 
-	Tree subTree( siblingIterator,
-		          siblingIterator  ) const;
-    void subTree( Tree&,
-		          siblingIterator,
-				  siblingIterator  ) const;
+private:
+	_TreeNodeChildren& operator=( const _TreeNodeChildren& );
 
-    void swap( siblingIterator );
-	void swap( preOrderIterator, preOrderIterator );
+	void index();
 
-    size_t size(                     ) const;
-	size_t size( const iteratorBase& ) const;
+	size_t                  count   ;
+	size_t                  position;   // index below the parent, valid while
+	                                    // the parent's array is
+	std::vector< Node_ * > *children;
+};
 
-	bool empty() const;
+template< class Node_, size_t Threshold_ >
+Node_ *_TreeNodeChildren< true, Node_, Threshold_ >::childAt( size_t num )
+{
+	if( num >= count )
+	{
+		return 0;
+	}
+	index();
+	return ( *children )[ num ];
+}
 
-	static int depth( const iteratorBase&  );
-	static int depth( const iteratorBase&,
-		              const iteratorBase&  );
+template< class Node_, size_t Threshold_ >
+size_t _TreeNodeChildren< true, Node_, Threshold_ >::indexOf( const Node_ *child )
+{
+	index();
+	return child->position;
+}
 
-	int maxDepth(                     ) const;
-	int maxDepth( const iteratorBase& ) const;
+template< class Node_, size_t Threshold_ >
+void _TreeNodeChildren< true, Node_, Threshold_ >::childLinked( Node_ *child )
+{
+	++count;
+	if( children != 0 )
+	{
+		if( child->nextSibling == 0 && children->size() + 1 == count )
+		{
+			child->position = children->size();
+			children->push_back( child );
+		}
+		else
+		{
+			children->clear();
+		}
+	}
+}
 
-	static size_t numberOfChildren( const iteratorBase& );
+template< class Node_, size_t Threshold_ >
+void _TreeNodeChildren< true, Node_, Threshold_ >::childUnlinked( Node_ *child )
+{
+	if( children != 0 )
+	{
+		if( child->nextSibling == 0 && children->size() == count )
+		{
+			children->pop_back();
+		}
+		else
+		{
+			children->clear();
+		}
+	}
+	--count;
+}
 
-	size_t numberOfSiblings( const iteratorBase& ) const;
+template< class Node_, size_t Threshold_ >
+void _TreeNodeChildren< true, Node_, Threshold_ >::childrenChanged( ptrdiff_t n )
+{
+	count += n;
+	if( children != 0 )
+	{
+		children->clear();
+	}
+}
 
-    bool isInSubTree( const iteratorBase&,
-		              const iteratorBase&,
-					  const iteratorBase&  ) const;
+template< class Node_, size_t Threshold_ >
+void _TreeNodeChildren< true, Node_, Threshold_ >::index()
+{
+	if( children == 0 )
+	{
+		children = new std::vector< Node_ * >();
+	}
+	else if( children->size() == count )
+	{
+		return;
+	}
 
-    bool isValid( const iteratorBase& ) const;
+	children->clear();
+	children->reserve( count );
+	for( Node_ *it = static_cast< Node_ * >( this )->firstChild; it != 0; it = it->nextSibling )
+	{
+		it->position = children->size();
+		children->push_back( it );
+	}
+}
 
-	preOrderIterator lowestCommonAncestor( const iteratorBase&,
-		                                   const iteratorBase&  ) const;
+// Type of the links of a node, a pointer or a TreeNodePool index.
+template< class Node_, bool IndexLinks_ >
+struct _TreeNodeLink
+{
+	typedef typename std::conditional< IndexLinks_, _TreeNodeIndexLink< Node_ >, Node_ * >::type type;
+};
 
-    size_t index( siblingIterator it ) const;
+// The lastChild and prevSibling links. Tree reads and writes them through
+// these members only, so that a node without them (the reducedLinks policy)
+// can find them by walking forward instead; prevSiblingNode() is given the
+// start of the top level for that.
+template< bool Enabled_, class Node_, bool IndexLinks_ >
+class _TreeNodeBackLinks
+{
+public:
+	_TreeNodeBackLinks() : lastChild( 0 ), prevSibling( 0 ) {}
 
-	static siblingIterator child( const iteratorBase&, size_t );
+	Node_ *lastChildNode(             ) const { return lastChild;   }
+	Node_ *prevSiblingNode( Node_ *   ) const { return prevSibling; }
+	void   setLastChild(    Node_ *n  )       { lastChild   = n;    }
+	void   setPrevSibling(  Node_ *n  )       { prevSibling = n;    }
 
-    siblingIterator sibling( const iteratorBase&, size_t );
+	typename _TreeNodeLink< Node_, IndexLinks_ >::type lastChild  ;
+	typename _TreeNodeLink< Node_, IndexLinks_ >::type prevSibling;
+};
 
-	void debug_verify_consistency() const;
+template< class Node_, bool IndexLinks_ >
+class _TreeNodeBackLinks< false, Node_, IndexLinks_ >
+{
+public:
+	Node_ *lastChildNode(              ) const;
+	Node_ *prevSiblingNode( Node_ *top ) const;
+	void   setLastChild(    Node_ *    )       {}
+	void   setPrevSibling(  Node_ *    )       {}
+};
 
-	class iteratorBaseLess
+template< class Node_, bool IndexLinks_ >
+Node_ *_TreeNodeBackLinks< false, Node_, IndexLinks_ >::lastChildNode() const
+{
+	Node_ *ret = static_cast< const Node_ * >( this )->firstChild;
+	if( ret != 0 )
 	{
-	public:
-		bool operator()( const typename Tree< T, TreeNodeAllocator_ >::iteratorBase& one,
-			             const typename Tree< T, TreeNodeAllocator_ >::iteratorBase& two ) const
+		while( ret->nextSibling != 0 )
 		{
-			return one.node < two.node;
+			ret = ret->nextSibling;
 		}
-	};
-
+	}
+	return ret;
+}
 
-	TREE_NODE *head, *feet;
+template< class Node_, bool IndexLinks_ >
+Node_ *_TreeNodeBackLinks< false, Node_, IndexLinks_ >::prevSiblingNode( Node_ *top ) const
+{
+	const Node_ *self = static_cast< const Node_ * >( this );
+	Node_       *ret  = ( self->parent != 0 ? ( Node_ * )self->parent->firstChild : top );
 
-private:
-    TreeNodeAllocator_ alloc_;
-	void headInitialise();
+	if( ret == self )
+	{
+		return 0;
+	}
+	while( ret->nextSibling != self )
+	{
+		ret = ret->nextSibling;
+	}
+	return ret;
+}
 
-	void copy( const Tree< T, TreeNodeAllocator_ >& other );
+// Leaf threading of a node, an empty base unless the policy asks for
+// leafChain. The two links mean different things depending on whether the
+// node has children: a leaf keeps the previous and the next leaf of the
+// tree in them, any other node the first and the last leaf below it.
+template< bool Enabled_, class Node_, bool IndexLinks_ >
+class _TreeNodeLeaves
+{
+public:
+	Node_ *leftLeafNode(         ) const { return 0; }
+	Node_ *rightLeafNode(        ) const { return 0; }
+	void   setLeftLeaf(  Node_ * )       {}
+	void   setRightLeaf( Node_ * )       {}
+	Node_ *firstLeaf(            ) const { return 0; }
+	Node_ *lastLeaf(             ) const { return 0; }
+};
 
-	template< class StrictWeakOrdering >
-	class compareNodes
-	{
-	public:
-		compareNodes( StrictWeakOrdering inComp ) : comp( inComp ){};
+template< class Node_, bool IndexLinks_ >
+class _TreeNodeLeaves< true, Node_, IndexLinks_ >
+{
+public:
+	_TreeNodeLeaves() : leftLeaf( 0 ), rightLeaf( 0 ) {}
 
-		bool operator()( const TREE_NODE *a, const TREE_NODE *b )
-		{
-		    return comp( a->data, b->data );
-		}
+	Node_ *leftLeafNode(           ) const { return leftLeaf;  }
+	Node_ *rightLeafNode(          ) const { return rightLeaf; }
+	void   setLeftLeaf(  Node_ *n  )       { leftLeaf  = n;    }
+	void   setRightLeaf( Node_ *n  )       { rightLeaf = n;    }
 
-	private:
-		StrictWeakOrdering comp;
-	};
+	// the node itself for a leaf
+	Node_ *firstLeaf() const;
+	Node_ *lastLeaf(  ) const;
 
+private:
+	typename _TreeNodeLink< Node_, IndexLinks_ >::type leftLeaf ;
+	typename _TreeNodeLink< Node_, IndexLinks_ >::type rightLeaf;
 };
 
-//////////////////////////////////////////////////////////////////////////
-/// Tree 
-//////////////////////////////////////////////////////////////////////////
-template< class T, class TreeNodeAllocator_ >
-Tree< T, TreeNodeAllocator_ >::Tree()
+template< class Node_, bool IndexLinks_ >
+Node_ *_TreeNodeLeaves< true, Node_, IndexLinks_ >::firstLeaf() const
 {
-    headInitialise();
+	const Node_ *self = static_cast< const Node_ * >( this );
+	return ( self->firstChild != 0 ? ( Node_ * )leftLeaf : ( Node_ * )self );
 }
 
-template< class T, class TreeNodeAllocator_ >
-Tree< T, TreeNodeAllocator_ >::Tree( const T& x )
+template< class Node_, bool IndexLinks_ >
+Node_ *_TreeNodeLeaves< true, Node_, IndexLinks_ >::lastLeaf() const
 {
-    headInitialise();
-	setHead( x );
+	const Node_ *self = static_cast< const Node_ * >( this );
+	return ( self->firstChild != 0 ? ( Node_ * )rightLeaf : ( Node_ * )self );
 }
 
-template< class T, class TreeNodeAllocator_ >
-Tree< T, TreeNodeAllocator_ >::Tree( const iteratorBase& other )
+// Links to the neighbours at the same depth, an empty base unless the
+// policy asks for levelLinks. Every depth forms one list across the whole
+// tree, left to right, ended by 0 on both sides.
+template< bool Enabled_, class Node_, bool IndexLinks_ >
+class _TreeNodeLevelLinks
 {
-    headInitialise();
-	setHead( ( *other ) );
-	replace( begin(), other );
-}
+public:
+	Node_ *prevAtDepthNode(         ) const { return 0; }
+	Node_ *nextAtDepthNode(         ) const { return 0; }
+	void   setPrevAtDepth(  Node_ * )       {}
+	void   setNextAtDepth(  Node_ * )       {}
+};
 
-template< class T, class TreeNodeAllocator_ >
-Tree< T, TreeNodeAllocator_ >::Tree( const Tree< T,TreeNodeAllocator_ >& other )
+template< class Node_, bool IndexLinks_ >
+class _TreeNodeLevelLinks< true, Node_, IndexLinks_ >
 {
-   clear();
-   preOrderIterator it = other.begin();
-   preOrderIterator to = begin();
+public:
+	_TreeNodeLevelLinks() : prevAtDepth( 0 ), nextAtDepth( 0 ) {}
 
-   while( it != other.end() )
-   {
-       to = insert( to, ( *it ) );
-	   it.skipChildren();
-	   ++it;
-   }
-   to = begin();
-   it = other.begin();
+	Node_ *prevAtDepthNode(           ) const { return prevAtDepth; }
+	Node_ *nextAtDepthNode(           ) const { return nextAtDepth; }
+	void   setPrevAtDepth(  Node_ *n  )       { prevAtDepth = n;    }
+	void   setNextAtDepth(  Node_ *n  )       { nextAtDepth = n;    }
 
-   while( it != other.end() )
-   {
-       to = replace( to, it );
-	   to.skipChildren();
-	   it.skipChildren();
-	   ++to;
-	   ++it;
-   }
-}
+private:
+	typename _TreeNodeLink< Node_, IndexLinks_ >::type prevAtDepth;
+	typename _TreeNodeLink< Node_, IndexLinks_ >::type nextAtDepth;
+};
 
-template< class T, class TreeNodeAllocator_ >
-Tree< T, TreeNodeAllocator_ >::~Tree()
+// Number of a node in the pre-order numbering of a TreeOrderIndex, an
+// empty base unless the policy asks for an index built on it.
+template< bool Enabled_ >
+class _TreeNodeOrder
 {
-     clear();
-	 alloc_.destroy( head );
-	 alloc_.destroy( feet );
-	 alloc_.deallocate( head, 1 );
-	 alloc_.deallocate( feet, 1 );
-}
+public:
+	std::uint32_t orderNumber(                ) const { return 0; }
+	void          setOrderNumber( std::uint32_t )       {}
+};
 
-template< class T, class TreeNodeAllocator_ >
-void Tree< T, TreeNodeAllocator_ >::headInitialise()
+template<>
+class _TreeNodeOrder< true >
 {
-    head = alloc_.allocate( 1, 0 );
-	feet = alloc_.allocate( 1, 0 );
-	alloc_.construct( head, _TreeNode< T >() );
-	alloc_.construct( feet, _TreeNode< T >() );
+public:
+	_TreeNodeOrder() : number( 0 ) {}
 
-    head->parent      = 0   ;
-	head->firstChild  = 0   ;
-	head->lastChild   = 0   ;
-	head->prevSibling = 0   ;
-	head->nextSibling = feet;
+	std::uint32_t orderNumber(                  ) const { return number; }
+	void          setOrderNumber( std::uint32_t n )       { number = n;    }
 
-	feet->parent      = 0   ;
-	feet->firstChild  = 0   ;
-	feet->lastChild   = 0   ;
-	feet->prevSibling = head;
-	feet->nextSibling = 0   ;
-}
+private:
+	std::uint32_t number;
+};
 
-template< class T, class TreeNodeAllocator_ >
-void Tree< T, TreeNodeAllocator_ >::copy( const Tree< T, TreeNodeAllocator_ >& other )
+// Labels of a node in the interval labelling of a TreeIntervalLabels: the
+// labels of every node below lie strictly between its entry and its exit.
+template< bool Enabled_ >
+class _TreeNodeInterval
 {
-	clear();
-	preOrderIterator it = other.begin();
-	preOrderIterator to = begin();
+public:
+	std::uint64_t entryLabel(                ) const { return 0; }
+	std::uint64_t exitLabel(                 ) const { return 0; }
+	void          setEntryLabel( std::uint64_t )       {}
+	void          setExitLabel(  std::uint64_t )       {}
+};
+
+template<>
+class _TreeNodeInterval< true >
+{
+public:
+	_TreeNodeInterval() : entry( 0 ), exit( 0 ) {}
+
+	std::uint64_t entryLabel(                  ) const { return entry; }
+	std::uint64_t exitLabel(                   ) const { return exit;  }
+	void          setEntryLabel( std::uint64_t l )       { entry = l;    }
+	void          setExitLabel(  std::uint64_t l )       { exit  = l;    }
+
+private:
+	std::uint64_t entry;
+	std::uint64_t exit ;
+};
+
+// Cached hash of the subtree below a node for subtreeHashes, 0 while it is
+// unknown. A node with a known hash has known hashes all the way down.
+// const queries fill it in, threads that race on it write the same value,
+// so relaxed atomic access is all the guarding it needs.
+template< bool Enabled_ >
+class _TreeNodeHash
+{
+public:
+	size_t subtreeHash(           ) const { return 0; }
+	void   setSubtreeHash( size_t ) const {}
+};
+
+template<>
+class _TreeNodeHash< true >
+{
+public:
+	_TreeNodeHash(                            ) : hash( 0 ) {}
+	_TreeNodeHash( const _TreeNodeHash& other ) : hash( other.subtreeHash() ) {}
+
+	size_t subtreeHash(             ) const { return hash.load( std::memory_order_relaxed ); }
+	void   setSubtreeHash( size_t h ) const { hash.store( h, std::memory_order_relaxed ); }
+
+private:
+	mutable std::atomic< size_t > hash;
+};
+
+template< class T, class TreePolicy_ = TreeDefaultPolicy >
+class _TreeNode : public _TreeNodeSize< TreePolicy_::subtreeSizes >,
+                  public _TreeNodeChildren< TreePolicy_::childIndex, _TreeNode< T, TreePolicy_ >, TreePolicy_::childIndexThreshold >,
+                  public _TreeNodeBackLinks< !TreePolicy_::reducedLinks, _TreeNode< T, TreePolicy_ >, TreePolicy_::indexLinks >,
+                  public _TreeNodeLeaves< TreePolicy_::leafChain, _TreeNode< T, TreePolicy_ >, TreePolicy_::indexLinks >,
+                  public _TreeNodeLevelLinks< TreePolicy_::levelLinks, _TreeNode< T, TreePolicy_ >, TreePolicy_::indexLinks >,
+                  public _TreeNodeOrder< TreePolicy_::lcaIndex || TreePolicy_::levelIndex >,
+                  public _TreeNodeInterval< TreePolicy_::intervalLabels >,
+                  public _TreeNodeHash< TreePolicy_::subtreeHashes >
+{
+public:
+	typedef typename _TreeNodeLink< _TreeNode, TreePolicy_::indexLinks >::type TREE_LINK;
+
+    _TreeNode(          );
+    _TreeNode( const T& );
+	template< class... Args >
+	_TreeNode( TreeNodeEmplace, Args&&... );
+
+    TREE_LINK parent     ;
+    TREE_LINK firstChild ;
+    TREE_LINK nextSibling;
+    T         data       ;
+};
+
+template< class T, class TreePolicy_ >
+_TreeNode< T, TreePolicy_ >::_TreeNode()
+                    : parent(      0 ),
+				      firstChild(  0 ),
+				      nextSibling( 0 ){}
+
+template< class T, class TreePolicy_ >
+_TreeNode< T, TreePolicy_ >::_TreeNode( const T& value )
+                    : parent(      0 ),
+				      firstChild(  0 ),
+				      nextSibling( 0 ),
+				      data(    value ){}
+
+template< class T, class TreePolicy_ >
+template< class... Args >
+_TreeNode< T, TreePolicy_ >::_TreeNode( TreeNodeEmplace, Args&&... args )
+                    : parent(      0 ),
+				      firstChild(  0 ),
+				      nextSibling( 0 ),
+				      data( std::forward< Args >( args )... ){}
+
+
+//////////////////////////////////////////////////////////////////////////
+/// TreeArenaAllocator
+//////////////////////////////////////////////////////////////////////////
+// Node allocator for Tree, e.g.
+//     Tree< std::string, TreeArenaAllocator< _TreeNode< std::string > > >
+// Nodes are cut from large contiguous blocks and freed nodes are kept on a
+// free list for reuse. Each allocator object owns its blocks and releases
+// them all at once when it is destroyed. Memory can only go back to the
+// allocator it came from, which is why the allocator moves but cannot be
+// copied or converted: it is not a standard Allocator and works only as
+// the allocator of a Tree, which never copies it. Freed nodes hold the
+// free list link, so T has to be a node, or at least as large as a pointer.
+template< class T, size_t FirstBlockSize_ = 64, size_t MaxBlockSize_ = 65536 >
+class TreeArenaAllocator
+{
+public:
+	typedef T         value_type     ;
+	typedef T*        pointer        ;
+	typedef const T*  const_pointer  ;
+	typedef T&        reference      ;
+	typedef const T&  const_reference;
+	typedef size_t    size_type      ;
+	typedef ptrdiff_t difference_type;
+
+	template< class U >
+	struct rebind
+	{
+		typedef TreeArenaAllocator< U, FirstBlockSize_, MaxBlockSize_ > other;
+	};
+
+	TreeArenaAllocator(                      );
+	TreeArenaAllocator( TreeArenaAllocator&& ) noexcept;
+
+	~TreeArenaAllocator();
+
+	TreeArenaAllocator& operator=( TreeArenaAllocator&& ) noexcept;
+
+	pointer allocate(   size_type, const void *hint = 0 );
+	void    deallocate( pointer  , size_type            );
+
+	template< class... Args >
+	void construct( pointer, Args&&... );
+	void destroy(   pointer            );
+
+	size_type max_size() const;
+	size_type capacity() const;   // nodes held by all blocks, used or not
+
+	void reserve( size_type );   // make room for this many single allocations
+	void release(           );   // drop every node at once, no destructors are run
+
+	// equal only to itself, no other allocator can free its nodes
+	bool operator==( const TreeArenaAllocator& ) const;
+	bool operator!=( const TreeArenaAllocator& ) const;
+
+private:
+	TreeArenaAllocator(            const TreeArenaAllocator& );   // not copyable
+	TreeArenaAllocator& operator=( const TreeArenaAllocator& );
+
+	struct block
+	{
+		block     *next    ;
+		size_type  capacity;
+	};
+
+	struct freeNode
+	{
+		freeNode *next;
+	};
+
+	static_assert( sizeof( T ) >= sizeof( freeNode ), "tree: node too small for the arena free list" );
+
+	static size_type headerNodes();
+
+	void grow(       size_type );
+	void freeBlocks(           );
+
+	block     *blocks       ;
+	pointer    cursor       ;   // first unused node of the newest block
+	pointer    limit        ;
+	freeNode  *freeList     ;
+	size_type  freeCount    ;
+	size_type  nextBlockSize;
+};
+
+template< class T, size_t FirstBlockSize_, size_t MaxBlockSize_ >
+TreeArenaAllocator< T, FirstBlockSize_, MaxBlockSize_ >::TreeArenaAllocator()
+: blocks( 0 ), cursor( 0 ), limit( 0 ), freeList( 0 ), freeCount( 0 ), nextBlockSize( FirstBlockSize_ )
+{
+}
+
+template< class T, size_t FirstBlockSize_, size_t MaxBlockSize_ >
+TreeArenaAllocator< T, FirstBlockSize_, MaxBlockSize_ >::TreeArenaAllocator( TreeArenaAllocator&& other ) noexcept
+: blocks( other.blocks ), cursor( other.cursor ), limit( other.limit ), freeList( other.freeList ), freeCount( other.freeCount ), nextBlockSize( other.nextBlockSize )
+{
+	other.blocks        = 0;
+	other.cursor        = 0;
+	other.limit         = 0;
+	other.freeList      = 0;
+	other.freeCount     = 0;
+	other.nextBlockSize = FirstBlockSize_;
+}
+
+template< class T, size_t FirstBlockSize_, size_t MaxBlockSize_ >
+TreeArenaAllocator< T, FirstBlockSize_, MaxBlockSize_ >::~TreeArenaAllocator()
+{
+	freeBlocks();
+}
+
+template< class T, size_t FirstBlockSize_, size_t MaxBlockSize_ >
+TreeArenaAllocator< T, FirstBlockSize_, MaxBlockSize_ >& TreeArenaAllocator< T, FirstBlockSize_, MaxBlockSize_ >::operator=( TreeArenaAllocator&& other ) noexcept
+{
+	if( this != &other )
+	{
+		freeBlocks();
+
+		blocks        = other.blocks       ;
+		cursor        = other.cursor       ;
+		limit         = other.limit        ;
+		freeList      = other.freeList     ;
+		freeCount     = other.freeCount    ;
+		nextBlockSize = other.nextBlockSize;
+
+		other.blocks        = 0;
+		other.cursor        = 0;
+		other.limit         = 0;
+		other.freeList      = 0;
+		other.freeCount     = 0;
+		other.nextBlockSize = FirstBlockSize_;
+	}
+	return *this;
+}
+
+template< class T, size_t FirstBlockSize_, size_t MaxBlockSize_ >
+typename TreeArenaAllocator< T, FirstBlockSize_, MaxBlockSize_ >::pointer TreeArenaAllocator< T, FirstBlockSize_, MaxBlockSize_ >::allocate( size_type n, const void * )
+{
+	if( n == 1 && freeList != 0 )
+	{
+		pointer ret = reinterpret_cast< pointer >( freeList );
+		freeList = freeList->next;
+		--freeCount;
+		return ret;
+	}
+
+	if( size_type( limit - cursor ) < n )
+	{
+		grow( n );
+	}
+
+	pointer ret = cursor;
+	cursor += n;
+	return ret;
+}
+
+template< class T, size_t FirstBlockSize_, size_t MaxBlockSize_ >
+void TreeArenaAllocator< T, FirstBlockSize_, MaxBlockSize_ >::deallocate( pointer p, size_type n )
+{
+	// nodes of a batch are put back one by one, so they can be reused singly
+	while( n > 0 )
+	{
+		--n;
+		freeNode *tmp = reinterpret_cast< freeNode * >( p + n );
+		tmp->next = freeList;
+		freeList  = tmp;
+		++freeCount;
+	}
+}
+
+template< class T, size_t FirstBlockSize_, size_t MaxBlockSize_ >
+template< class... Args >
+void TreeArenaAllocator< T, FirstBlockSize_, MaxBlockSize_ >::construct( pointer p, Args&&... args )
+{
+	new( ( void * )p ) T( std::forward< Args >( args )... );
+}
+
+template< class T, size_t FirstBlockSize_, size_t MaxBlockSize_ >
+void TreeArenaAllocator< T, FirstBlockSize_, MaxBlockSize_ >::destroy( pointer p )
+{
+	p->~T();
+}
+
+template< class T, size_t FirstBlockSize_, size_t MaxBlockSize_ >
+typename TreeArenaAllocator< T, FirstBlockSize_, MaxBlockSize_ >::size_type TreeArenaAllocator< T, FirstBlockSize_, MaxBlockSize_ >::max_size() const
+{
+	return size_type( -1 ) / sizeof( T );
+}
+
+template< class T, size_t FirstBlockSize_, size_t MaxBlockSize_ >
+typename TreeArenaAllocator< T, FirstBlockSize_, MaxBlockSize_ >::size_type TreeArenaAllocator< T, FirstBlockSize_, MaxBlockSize_ >::capacity() const
+{
+	size_type ret = 0;
+	for( block *b = blocks; b != 0; b = b->next )
+	{
+		ret += b->capacity;
+	}
+	return ret;
+}
+
+template< class T, size_t FirstBlockSize_, size_t MaxBlockSize_ >
+void TreeArenaAllocator< T, FirstBlockSize_, MaxBlockSize_ >::reserve( size_type n )
+{
+	const size_type available = size_type( limit - cursor ) + freeCount;
+	if( available < n )
+	{
+		grow( n - available );
+	}
+}
+
+template< class T, size_t FirstBlockSize_, size_t MaxBlockSize_ >
+void TreeArenaAllocator< T, FirstBlockSize_, MaxBlockSize_ >::release()
+{
+	if( blocks == 0 )
+	{
+		return;
+	}
+
+	// keep the largest block for the next round
+	block *keep = blocks;
+	for( block *b = blocks->next; b != 0; b = b->next )
+	{
+		if( b->capacity > keep->capacity )
+		{
+			keep = b;
+		}
+	}
+
+	block *tmp = blocks;
+	while( tmp != 0 )
+	{
+		block *next = tmp->next;
+		if( tmp != keep )
+		{
+			::operator delete( tmp );
+		}
+		tmp = next;
+	}
+	blocks       = keep;
+	blocks->next = 0;
+
+	cursor    = reinterpret_cast< pointer >( blocks ) + headerNodes();
+	limit     = cursor + blocks->capacity;
+	freeList  = 0;
+	freeCount = 0;
+}
+
+template< class T, size_t FirstBlockSize_, size_t MaxBlockSize_ >
+bool TreeArenaAllocator< T, FirstBlockSize_, MaxBlockSize_ >::operator==( const TreeArenaAllocator& other ) const
+{
+	return this == &other;
+}
+
+template< class T, size_t FirstBlockSize_, size_t MaxBlockSize_ >
+bool TreeArenaAllocator< T, FirstBlockSize_, MaxBlockSize_ >::operator!=( const TreeArenaAllocator& other ) const
+{
+	return this != &other;
+}
+
+template< class T, size_t FirstBlockSize_, size_t MaxBlockSize_ >
+typename TreeArenaAllocator< T, FirstBlockSize_, MaxBlockSize_ >::size_type TreeArenaAllocator< T, FirstBlockSize_, MaxBlockSize_ >::headerNodes()
+{
+	// the block header occupies the first node slots, which keeps the nodes
+	// behind it aligned
+	return ( sizeof( block ) + sizeof( T ) - 1 ) / sizeof( T );
+}
+
+template< class T, size_t FirstBlockSize_, size_t MaxBlockSize_ >
+void TreeArenaAllocator< T, FirstBlockSize_, MaxBlockSize_ >::grow( size_type n )
+{
+	const size_type count = std::max( nextBlockSize, n );
+	if( count > max_size() - headerNodes() )
+	{
+		throw std::bad_alloc();
+	}
+
+	block *tmp = static_cast< block * >( ::operator new( ( headerNodes() + count ) * sizeof( T ) ) );
+	tmp->next     = blocks;
+	tmp->capacity = count ;
+	blocks = tmp;
+
+	// whatever is left of the previous block goes to the free list
+	if( cursor != limit )
+	{
+		deallocate( cursor, size_type( limit - cursor ) );
+	}
+
+	cursor = reinterpret_cast< pointer >( tmp ) + headerNodes();
+	limit  = cursor + count;
+
+	if( nextBlockSize < MaxBlockSize_ )
+	{
+		nextBlockSize = std::min( nextBlockSize * 2, size_type( MaxBlockSize_ ) );
+	}
+}
+
+template< class T, size_t FirstBlockSize_, size_t MaxBlockSize_ >
+void TreeArenaAllocator< T, FirstBlockSize_, MaxBlockSize_ >::freeBlocks()
+{
+	while( blocks != 0 )
+	{
+		block *next = blocks->next;
+		::operator delete( blocks );
+		blocks = next;
+	}
+}
+
+// Tells Tree whether all nodes of an allocator can be dropped in one call
+// instead of being deallocated one by one.
+template< class TreeNodeAllocator_ >
+struct TreeNodeAllocatorTraits
+{
+	static const bool bulkRelease = false;
+	static const bool reserves    = false;
+
+	static void release( TreeNodeAllocator_& )
+	{
+	}
+
+	static void reserve( TreeNodeAllocator_&, size_t )
+	{
+	}
+};
+
+template< class T, size_t FirstBlockSize_, size_t MaxBlockSize_ >
+struct TreeNodeAllocatorTraits< TreeArenaAllocator< T, FirstBlockSize_, MaxBlockSize_ > >
+{
+	static const bool bulkRelease = true;
+	static const bool reserves    = true;
+
+	static void release( TreeArenaAllocator< T, FirstBlockSize_, MaxBlockSize_ >& alloc )
+	{
+		alloc.release();
+	}
+
+	static void reserve( TreeArenaAllocator< T, FirstBlockSize_, MaxBlockSize_ >& alloc, size_t num )
+	{
+		alloc.reserve( num );
+	}
+};
+
+
+//////////////////////////////////////////////////////////////////////////
+/// TreeOrderIndex
+//////////////////////////////////////////////////////////////////////////
+// Pre-order numbering of all nodes of a Tree and the query tables built
+// over it, an empty base unless the policy asks for such a table. Every
+// change to the shape of the tree drops the lot; the next query numbers
+// the nodes again in one walk and builds the table it needs. Queries are
+// const but may rebuild, so threads sharing a tree should let one query
+// go first.
+template< bool Enabled_, class Node_ >
+class TreeOrderIndex
+{
+protected:
+	void   orderChanged(                                      ) const {}
+	void   swapOrderIndex( TreeOrderIndex&                    )       {}
+	Node_ *commonAncestor( Node_ *, Node_ *, Node_ *, Node_ *  ) const { return 0; }
+	size_t nodeDepth(      Node_ *, Node_ *, Node_ *           ) const { return 0; }
+	Node_ *levelAncestor(  Node_ *, size_t, Node_ *, Node_ *   ) const { return 0; }
+};
+
+template< class Node_ >
+class TreeOrderIndex< true, Node_ >
+{
+protected:
+	TreeOrderIndex() : numbered( false ), lcaBuilt( false ), levelsBuilt( false ) {}
+
+	void orderChanged() const { numbered = false; lcaBuilt = false; levelsBuilt = false; }
+	void swapOrderIndex( TreeOrderIndex& );
+
+	// the nodes of the tree run from first up to end in pre-order
+
+	// the lowest node both lie below or are, 0 if they are in different
+	// trees of the top level
+	Node_ *commonAncestor( Node_ *, Node_ *, Node_ *first, Node_ *end ) const;
+
+	// the number of nodes above, and the node k above, 0 if there is none
+	size_t nodeDepth(     Node_ *,           Node_ *first, Node_ *end ) const;
+	Node_ *levelAncestor( Node_ *, size_t k, Node_ *first, Node_ *end ) const;
+
+private:
+	void number(      Node_ *first, Node_ *end ) const;
+	void buildLca(                             ) const;
+	void buildLevels(                          ) const;
+
+	mutable bool numbered   ;
+	mutable bool lcaBuilt   ;
+	mutable bool levelsBuilt;
+
+	mutable std::vector< Node_ * >       nodes ;   // in pre-order
+	mutable std::vector< std::uint32_t > depths;
+
+	// for the lowest common ancestor: row k of table holds, for every i,
+	// the depth and the parent number of the shallowest node among i to
+	// i + 2^k - 1 as depth << 32 | parent, and logs[ n ] is the integer
+	// log2 of n
+	mutable std::vector< std::uint64_t > table;
+	mutable std::vector< unsigned char > logs ;
+
+	// for level ancestors: the numbers of all nodes ordered by depth and
+	// then pre-order, those of depth d from levelStart[ d ] on
+	mutable std::vector< std::uint32_t > levels    ;
+	mutable std::vector< std::uint32_t > levelStart;
+};
+
+template< class Node_ >
+void TreeOrderIndex< true, Node_ >::swapOrderIndex( TreeOrderIndex& other )
+{
+	std::swap( numbered, other.numbered );
+	std::swap( lcaBuilt, other.lcaBuilt );
+	std::swap( levelsBuilt, other.levelsBuilt );
+	nodes.swap(  other.nodes  );
+	depths.swap( other.depths );
+	table.swap(  other.table  );
+	logs.swap(   other.logs   );
+	levels.swap(     other.levels     );
+	levelStart.swap( other.levelStart );
+}
+
+template< class Node_ >
+void TreeOrderIndex< true, Node_ >::number( Node_ *first, Node_ *end ) const
+{
+	nodes.clear();
+	depths.clear();
+
+	Node_         *cur   = first;
+	std::uint32_t  depth = 0    ;
+	while( cur != end )
+	{
+		cur->setOrderNumber( std::uint32_t( nodes.size() ) );
+		nodes.push_back( cur );
+		depths.push_back( depth );
+
+		if( cur->firstChild != 0 )
+		{
+			cur = cur->firstChild;
+			++depth;
+			continue;
+		}
+		while( cur->nextSibling == 0 )
+		{
+			cur = cur->parent;
+			--depth;
+		}
+		cur = cur->nextSibling;
+	}
+	numbered = true;
+}
+
+template< class Node_ >
+void TreeOrderIndex< true, Node_ >::buildLca() const
+{
+	size_t n = nodes.size();
+
+	logs.assign( n + 1, 0 );
+	for( size_t i = 2; i <= n; ++i )
+	{
+		logs[ i ] = logs[ i / 2 ] + 1;
+	}
+
+	size_t rows = ( n > 0 ? logs[ n ] + 1 : 0 );
+	table.resize( rows * n );
+	for( size_t i = 0; i < n; ++i )
+	{
+		std::uint64_t parent = ( depths[ i ] != 0 ? nodes[ i ]->parent->orderNumber() : 0 );
+		table[ i ] = std::uint64_t( depths[ i ] ) << 32 | parent;
+	}
+	for( size_t k = 1; k < rows; ++k )
+	{
+		std::uint64_t *row  = &table[ k * n ];
+		std::uint64_t *prev = row - n;
+		size_t         half = size_t( 1 ) << ( k - 1 );
+		for( size_t i = 0; i + 2 * half <= n; ++i )
+		{
+			row[ i ] = std::min( prev[ i ], prev[ i + half ] );
+		}
+	}
+	lcaBuilt = true;
+}
+
+// Below the common ancestor the nodes between the two in pre-order are
+// never shallower than the child of it on the way to the later one, and
+// every node that deep among them is a child of it.
+template< class Node_ >
+Node_ *TreeOrderIndex< true, Node_ >::commonAncestor( Node_ *one, Node_ *two, Node_ *first, Node_ *end ) const
+{
+	if( !numbered )
+	{
+		number( first, end );
+	}
+	if( !lcaBuilt )
+	{
+		buildLca();
+	}
+
+	size_t lo = one->orderNumber();
+	size_t hi = two->orderNumber();
+	if( lo == hi )
+	{
+		return one;
+	}
+	if( lo > hi )
+	{
+		std::swap( lo, hi );
+	}
+
+	// shallowest of lo + 1 to hi
+	size_t               k   = logs[ hi - lo ];
+	const std::uint64_t *row = &table[ k * nodes.size() ];
+	std::uint64_t        key = std::min( row[ lo + 1 ], row[ hi + 1 - ( size_t( 1 ) << k ) ] );
+	return ( key >> 32 == 0 ? 0 : nodes[ std::uint32_t( key ) ] );
+}
+
+template< class Node_ >
+void TreeOrderIndex< true, Node_ >::buildLevels() const
+{
+	std::uint32_t height = 0;
+	for( size_t i = 0; i < depths.size(); ++i )
+	{
+		height = std::max( height, depths[ i ] );
+	}
+
+	levelStart.assign( height + 2, 0 );
+	for( size_t i = 0; i < depths.size(); ++i )
+	{
+		++levelStart[ depths[ i ] + 1 ];
+	}
+	for( size_t d = 1; d < levelStart.size(); ++d )
+	{
+		levelStart[ d ] += levelStart[ d - 1 ];
+	}
+
+	std::vector< std::uint32_t > next( levelStart.begin(), levelStart.end() - 1 );
+	levels.resize( depths.size() );
+	for( size_t i = 0; i < depths.size(); ++i )
+	{
+		levels[ next[ depths[ i ] ]++ ] = std::uint32_t( i );
+	}
+	levelsBuilt = true;
+}
+
+template< class Node_ >
+size_t TreeOrderIndex< true, Node_ >::nodeDepth( Node_ *node, Node_ *first, Node_ *end ) const
+{
+	if( !numbered )
+	{
+		number( first, end );
+	}
+	return depths[ node->orderNumber() ];
+}
+
+// The ancestor at a depth is the last node of that depth before the node
+// in pre-order, everything in between lies below the ancestor.
+template< class Node_ >
+Node_ *TreeOrderIndex< true, Node_ >::levelAncestor( Node_ *node, size_t k, Node_ *first, Node_ *end ) const
+{
+	// a few hops up cost less than the cache misses of a search
+	if( k < 16 )
+	{
+		for( ; k > 0 && node != 0; --k )
+		{
+			node = node->parent;
+		}
+		return node;
+	}
+
+	if( !numbered )
+	{
+		number( first, end );
+	}
+	if( !levelsBuilt )
+	{
+		buildLevels();
+	}
+
+	std::uint32_t i = node->orderNumber();
+	if( k > depths[ i ] )
+	{
+		return 0;
+	}
+	size_t d = depths[ i ] - k;
+	const std::uint32_t *level = &levels[ 0 ];
+	return nodes[ *( std::upper_bound( level + levelStart[ d ], level + levelStart[ d + 1 ], i ) - 1 ) ];
+}
+
+// Entry and exit labels of all nodes of a Tree in pre-order, spread out so
+// that a node lies below another exactly when its labels lie between the
+// other's. A change only marks the smallest subtree holding all changes so
+// far; the next query relabels that subtree inside the labels its top
+// already has and relabels the whole tree only when they run out. Like
+// TreeOrderIndex, queries may relabel, so threads sharing a tree should
+// let one query go first.
+template< bool Enabled_, class Node_ >
+class TreeIntervalLabels
+{
+protected:
+	void labelsChanged(      Node_ *             ) const {}
+	void swapIntervalLabels( TreeIntervalLabels& )       {}
+	void refreshLabels(      Node_ *, Node_ *    ) const {}
+};
+
+template< class Node_ >
+class TreeIntervalLabels< true, Node_ >
+{
+protected:
+	TreeIntervalLabels() : labelled( false ), dirty( 0 ) {}
+
+	// something below node changed, 0 for the top level
+	void labelsChanged( Node_ *node ) const;
+	void swapIntervalLabels( TreeIntervalLabels& );
+
+	// brings the labels up to date; the nodes of the tree run from first
+	// up to end in pre-order
+	void refreshLabels( Node_ *first, Node_ *end ) const;
+
+private:
+	static std::uint64_t label( Node_ *top, std::uint64_t next, std::uint64_t step );
+
+	mutable bool   labelled;
+	mutable Node_ *dirty   ;   // top of the subtree to relabel, 0 for none
+};
+
+template< class Node_ >
+void TreeIntervalLabels< true, Node_ >::labelsChanged( Node_ *node ) const
+{
+	if( !labelled )
+	{
+		return;
+	}
+	if( node == 0 )
+	{
+		labelled = false;
+		dirty    = 0;
+		return;
+	}
+	if( dirty == 0 || dirty == node )
+	{
+		dirty = node;
+		return;
+	}
+
+	// the lowest node holding both
+	size_t  da = 0;
+	size_t  db = 0;
+	Node_  *a  = dirty;
+	Node_  *b  = node ;
+	for( Node_ *it = a; it->parent != 0; it = it->parent )
+	{
+		++da;
+	}
+	for( Node_ *it = b; it->parent != 0; it = it->parent )
+	{
+		++db;
+	}
+	for( ; da > db; --da )
+	{
+		a = a->parent;
+	}
+	for( ; db > da; --db )
+	{
+		b = b->parent;
+	}
+	while( a != b )
+	{
+		a = a->parent;
+		b = b->parent;
+	}
+	dirty = a;
+	if( dirty == 0 )
+	{
+		labelled = false;
+	}
+}
+
+template< class Node_ >
+void TreeIntervalLabels< true, Node_ >::swapIntervalLabels( TreeIntervalLabels& other )
+{
+	std::swap( labelled, other.labelled );
+	std::swap( dirty   , other.dirty    );
+}
+
+// Labels top and everything below in pre-order, step apart starting at
+// next, and returns the label after the last.
+template< class Node_ >
+std::uint64_t TreeIntervalLabels< true, Node_ >::label( Node_ *top, std::uint64_t next, std::uint64_t step )
+{
+	Node_ *cur = top;
+	for( ; ; )
+	{
+		cur->setEntryLabel( next );
+		next += step;
+		if( cur->firstChild != 0 )
+		{
+			cur = cur->firstChild;
+			continue;
+		}
+		for( ; ; )
+		{
+			cur->setExitLabel( next );
+			next += step;
+			if( cur == top )
+			{
+				return next;
+			}
+			if( cur->nextSibling != 0 )
+			{
+				cur = cur->nextSibling;
+				break;
+			}
+			cur = cur->parent;
+		}
+	}
+}
+
+template< class Node_ >
+void TreeIntervalLabels< true, Node_ >::refreshLabels( Node_ *first, Node_ *end ) const
+{
+	if( labelled && dirty == 0 )
+	{
+		return;
+	}
+
+	// a first pass with a step of one counts the labels needed, the
+	// labels it leaves are overwritten by the second
+	if( labelled )
+	{
+		// the labels of dirty stay, those below are spread between them
+		std::uint64_t count = 0;
+		for( Node_ *it = dirty->firstChild; it != 0; it = it->nextSibling )
+		{
+			count = label( it, count, 1 );
+		}
+		std::uint64_t step = ( dirty->exitLabel() - dirty->entryLabel() ) / ( count + 1 );
+		if( step != 0 )
+		{
+			std::uint64_t next = dirty->entryLabel() + step;
+			for( Node_ *it = dirty->firstChild; it != 0; it = it->nextSibling )
+			{
+				next = label( it, next, step );
+			}
+			dirty = 0;
+			return;
+		}
+	}
+
+	std::uint64_t count = 0;
+	for( Node_ *it = first; it != end; it = it->nextSibling )
+	{
+		count = label( it, count, 1 );
+	}
+	std::uint64_t step = std::uint64_t( -1 ) / ( count + 2 );
+	std::uint64_t next = step;
+	for( Node_ *it = first; it != end; it = it->nextSibling )
+	{
+		next = label( it, next, step );
+	}
+	labelled = true;
+	dirty    = 0;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// FrozenTree
+//////////////////////////////////////////////////////////////////////////
+// Read-only snapshot of a Tree, made by Tree::freeze(). Nodes are numbered
+// in pre-order and their links kept in flat arrays: the subtree of node i
+// is the range [ i, subtreeEnd( i ) ), its first child is i + 1 and its
+// next sibling subtreeEnd( i ). The children of every node are also listed
+// contiguously, so that child( it, n ) is O(1). Iterators are indices into
+// these arrays and never chase pointers.
+template< class T >
+class FrozenTree
+{
+public:
+	typedef T             value_type;
+	typedef std::uint32_t index_type;
+
+	static const index_type npos = index_type( -1 );
+
+	class iteratorBase      ;
+	class preOrderIterator  ;
+	class postOrderIterator ;
+	class siblingIterator   ;
+	class leafIterator      ;
+	class fixedDepthIterator;
+
+	class iteratorBase
+	{
+	public:
+		typedef T                         value_type       ;
+		typedef const T*                  pointer          ;
+		typedef const T&                  reference        ;
+		typedef size_t                    size_type        ;
+		typedef ptrdiff_t                 difference_type  ;
+		typedef std::forward_iterator_tag iterator_category;
+
+		iteratorBase(                              );
+		iteratorBase( const FrozenTree *, index_type );
+
+		const T& operator*()  const;
+		const T* operator->() const;
+
+		bool operator==( const iteratorBase& ) const;
+		bool operator!=( const iteratorBase& ) const;
+
+		size_t numberOfChildren() const;
+
+		siblingIterator begin() const;
+		siblingIterator end(  ) const;
+
+		const FrozenTree *tree;
+		index_type        pos ;   // pre-order number of the node
+	};
+
+	class preOrderIterator : public iteratorBase
+	{
+	public:
+		typedef std::bidirectional_iterator_tag iterator_category;
+
+		preOrderIterator(                              );
+		preOrderIterator( const FrozenTree *, index_type );
+		preOrderIterator( const iteratorBase&            );
+
+		preOrderIterator& operator++(     );
+		preOrderIterator& operator--(     );
+		preOrderIterator  operator++( int );
+		preOrderIterator  operator--( int );
+		preOrderIterator& operator+=( size_t );
+		preOrderIterator& operator-=( size_t );
+
+		void skipChildren();
+
+	private:
+		bool skipCurrentChildren;
+	};
+
+	class postOrderIterator : public iteratorBase
+	{
+	public:
+		postOrderIterator(                              );
+		postOrderIterator( const FrozenTree *, index_type );
+		postOrderIterator( const iteratorBase&            );
+
+		postOrderIterator& operator++(     );
+		postOrderIterator  operator++( int );
+
+		void descendAll();
+	};
+
+	class siblingIterator : public iteratorBase
+	{
+	public:
+		siblingIterator(                              );
+		siblingIterator( const FrozenTree *, index_type );
+		siblingIterator( const iteratorBase&            );
+
+		siblingIterator& operator++(     );
+		siblingIterator  operator++( int );
+	};
+
+	class leafIterator : public iteratorBase
+	{
+	public:
+		leafIterator(                                          );
+		leafIterator( const FrozenTree *, index_type, index_type );
+
+		leafIterator& operator++(     );
+		leafIterator  operator++( int );
+
+	private:
+		index_type limit;   // end of the subtree the leaves are taken from
+	};
+
+	class fixedDepthIterator : public iteratorBase
+	{
+	public:
+		fixedDepthIterator(                                                    );
+		fixedDepthIterator( const FrozenTree *, index_type, index_type, size_t );
+
+		fixedDepthIterator& operator++(     );
+		fixedDepthIterator  operator++( int );
+
+	private:
+		index_type limit;
+		size_t     level;   // absolute depth of the nodes visited
+	};
+
+	FrozenTree();
+
+	size_t size( ) const;
+	bool   empty() const;
+
+	preOrderIterator   begin(     ) const;
+	preOrderIterator   end(       ) const;
+	postOrderIterator  beginPost( ) const;
+	postOrderIterator  endPost(   ) const;
+	siblingIterator    beginSibling( const iteratorBase& ) const;
+	siblingIterator    endSibling(   const iteratorBase& ) const;
+	leafIterator       beginLeaf(    ) const;
+	leafIterator       endLeaf(      ) const;
+	leafIterator       beginLeaf( const iteratorBase& top ) const;
+	leafIterator       endLeaf(   const iteratorBase& top ) const;
+	fixedDepthIterator beginFixed( const iteratorBase&, size_t ) const;
+	fixedDepthIterator endFixed(   const iteratorBase&, size_t ) const;
+
+	preOrderIterator parent( const iteratorBase& ) const;   // end() for top level nodes
+
+	size_t size(             const iteratorBase& ) const;
+	size_t depth(            const iteratorBase& ) const;
+	size_t numberOfChildren( const iteratorBase& ) const;
+
+	siblingIterator child( const iteratorBase&, size_t ) const;
+
+	index_type subtreeEnd( index_type ) const;
+
+private:
+	template< class, class, class > friend class Tree;
+
+	void linkChildren();
+
+	std::vector< T          > data_      ;
+	std::vector< index_type > parent_    ;   // npos at the top level
+	std::vector< index_type > end_       ;
+	std::vector< index_type > depth_     ;
+	std::vector< index_type > childBegin_;   // children of i are children_[ childBegin_[ i ] ]
+	std::vector< index_type > children_  ;   // up to children_[ childBegin_[ i + 1 ] ]
+};
+
+template< class T >
+const typename FrozenTree< T >::index_type FrozenTree< T >::npos;
+
+// IteratorBase
+template< class T >
+FrozenTree< T >::iteratorBase::iteratorBase()
+: tree( 0 ), pos( 0 )
+{
+}
+
+template< class T >
+FrozenTree< T >::iteratorBase::iteratorBase( const FrozenTree *tr, index_type ps )
+: tree( tr ), pos( ps )
+{
+}
+
+template< class T >
+const T& FrozenTree< T >::iteratorBase::operator*() const
+{
+	return tree->data_[ pos ];
+}
+
+template< class T >
+const T* FrozenTree< T >::iteratorBase::operator->() const
+{
+	return &( tree->data_[ pos ] );
+}
+
+template< class T >
+bool FrozenTree< T >::iteratorBase::operator==( const iteratorBase& other ) const
+{
+	return pos == other.pos;
+}
+
+template< class T >
+bool FrozenTree< T >::iteratorBase::operator!=( const iteratorBase& other ) const
+{
+	return pos != other.pos;
+}
+
+template< class T >
+size_t FrozenTree< T >::iteratorBase::numberOfChildren() const
+{
+	return tree->childBegin_[ pos + 1 ] - tree->childBegin_[ pos ];
+}
+
+template< class T >
+typename FrozenTree< T >::siblingIterator FrozenTree< T >::iteratorBase::begin() const
+{
+	return siblingIterator( tree, pos + 1 );
+}
+
+template< class T >
+typename FrozenTree< T >::siblingIterator FrozenTree< T >::iteratorBase::end() const
+{
+	return siblingIterator( tree, tree->end_[ pos ] );
+}
+
+// PreOrderIterator
+template< class T >
+FrozenTree< T >::preOrderIterator::preOrderIterator()
+: iteratorBase(), skipCurrentChildren( false )
+{
+}
+
+template< class T >
+FrozenTree< T >::preOrderIterator::preOrderIterator( const FrozenTree *tr, index_type ps )
+: iteratorBase( tr, ps ), skipCurrentChildren( false )
+{
+}
+
+template< class T >
+FrozenTree< T >::preOrderIterator::preOrderIterator( const iteratorBase& other )
+: iteratorBase( other ), skipCurrentChildren( false )
+{
+}
+
+template< class T >
+typename FrozenTree< T >::preOrderIterator& FrozenTree< T >::preOrderIterator::operator++()
+{
+	if( skipCurrentChildren )
+	{
+		skipCurrentChildren = false;
+		this->pos = this->tree->end_[ this->pos ];
+	}
+	else
+	{
+		++this->pos;
+	}
+	return *this;
+}
+
+template< class T >
+typename FrozenTree< T >::preOrderIterator& FrozenTree< T >::preOrderIterator::operator--()
+{
+	--this->pos;
+	return *this;
+}
+
+template< class T >
+typename FrozenTree< T >::preOrderIterator FrozenTree< T >::preOrderIterator::operator++( int )
+{
+	preOrderIterator copy = *this;
+	++( *this );
+	return copy;
+}
+
+template< class T >
+typename FrozenTree< T >::preOrderIterator FrozenTree< T >::preOrderIterator::operator--( int )
+{
+	preOrderIterator copy = *this;
+	--this->pos;
+	return copy;
+}
+
+template< class T >
+typename FrozenTree< T >::preOrderIterator& FrozenTree< T >::preOrderIterator::operator+=( size_t num )
+{
+	this->pos += index_type( num );
+	return *this;
+}
+
+template< class T >
+typename FrozenTree< T >::preOrderIterator& FrozenTree< T >::preOrderIterator::operator-=( size_t num )
+{
+	this->pos -= index_type( num );
+	return *this;
+}
+
+// The next operator++ jumps over the subtree of the current node.
+template< class T >
+void FrozenTree< T >::preOrderIterator::skipChildren()
+{
+	skipCurrentChildren = true;
+}
+
+// PostOrderIterator
+template< class T >
+FrozenTree< T >::postOrderIterator::postOrderIterator()
+: iteratorBase()
+{
+}
+
+template< class T >
+FrozenTree< T >::postOrderIterator::postOrderIterator( const FrozenTree *tr, index_type ps )
+: iteratorBase( tr, ps )
+{
+}
+
+template< class T >
+FrozenTree< T >::postOrderIterator::postOrderIterator( const iteratorBase& other )
+: iteratorBase( other )
+{
+}
+
+// After a node comes the first leaf below its next sibling or, for a last
+// child, its parent.
+template< class T >
+typename FrozenTree< T >::postOrderIterator& FrozenTree< T >::postOrderIterator::operator++()
+{
+	const FrozenTree *tr = this->tree;
+	index_type par = tr->parent_[ this->pos ];
+	index_type nxt = tr->end_[ this->pos ];
+
+	if( nxt < ( par == npos ? index_type( tr->size() ) : tr->end_[ par ] ) )
+	{
+		this->pos = nxt;
+		descendAll();
+	}
+	else
+	{
+		this->pos = ( par == npos ? index_type( tr->size() ) : par );
+	}
+	return *this;
+}
+
+template< class T >
+typename FrozenTree< T >::postOrderIterator FrozenTree< T >::postOrderIterator::operator++( int )
+{
+	postOrderIterator copy = *this;
+	++( *this );
+	return copy;
+}
+
+template< class T >
+void FrozenTree< T >::postOrderIterator::descendAll()
+{
+	while( this->tree->end_[ this->pos ] != this->pos + 1 )
+	{
+		++this->pos;
+	}
+}
+
+// SiblingIterator
+template< class T >
+FrozenTree< T >::siblingIterator::siblingIterator()
+: iteratorBase()
+{
+}
+
+template< class T >
+FrozenTree< T >::siblingIterator::siblingIterator( const FrozenTree *tr, index_type ps )
+: iteratorBase( tr, ps )
+{
+}
+
+template< class T >
+FrozenTree< T >::siblingIterator::siblingIterator( const iteratorBase& other )
+: iteratorBase( other )
+{
+}
+
+template< class T >
+typename FrozenTree< T >::siblingIterator& FrozenTree< T >::siblingIterator::operator++()
+{
+	this->pos = this->tree->end_[ this->pos ];
+	return *this;
+}
+
+template< class T >
+typename FrozenTree< T >::siblingIterator FrozenTree< T >::siblingIterator::operator++( int )
+{
+	siblingIterator copy = *this;
+	++( *this );
+	return copy;
+}
+
+// LeafIterator
+template< class T >
+FrozenTree< T >::leafIterator::leafIterator()
+: iteratorBase(), limit( 0 )
+{
+}
+
+template< class T >
+FrozenTree< T >::leafIterator::leafIterator( const FrozenTree *tr, index_type ps, index_type lm )
+: iteratorBase( tr, ps ), limit( lm )
+{
+	while( this->pos < limit && tr->end_[ this->pos ] != this->pos + 1 )
+	{
+		++this->pos;
+	}
+}
+
+// Every inner node has its first child right after it, so the next leaf
+// is found by stepping forward.
+template< class T >
+typename FrozenTree< T >::leafIterator& FrozenTree< T >::leafIterator::operator++()
+{
+	++this->pos;
+	while( this->pos < limit && this->tree->end_[ this->pos ] != this->pos + 1 )
+	{
+		++this->pos;
+	}
+	return *this;
+}
+
+template< class T >
+typename FrozenTree< T >::leafIterator FrozenTree< T >::leafIterator::operator++( int )
+{
+	leafIterator copy = *this;
+	++( *this );
+	return copy;
+}
+
+// FixedDepthIterator
+template< class T >
+FrozenTree< T >::fixedDepthIterator::fixedDepthIterator()
+: iteratorBase(), limit( 0 ), level( 0 )
+{
+}
+
+template< class T >
+FrozenTree< T >::fixedDepthIterator::fixedDepthIterator( const FrozenTree *tr, index_type ps, index_type lm, size_t lv )
+: iteratorBase( tr, ps ), limit( lm ), level( lv )
+{
+	while( this->pos < limit && tr->depth_[ this->pos ] != level )
+	{
+		++this->pos;
+	}
+}
+
+// Skips the subtree of the current node, then walks down to the next node
+// at the same depth; nodes deeper than that are never visited.
+template< class T >
+typename FrozenTree< T >::fixedDepthIterator& FrozenTree< T >::fixedDepthIterator::operator++()
+{
+	this->pos = this->tree->end_[ this->pos ];
+	while( this->pos < limit && this->tree->depth_[ this->pos ] != level )
+	{
+		++this->pos;
+	}
+	return *this;
+}
+
+template< class T >
+typename FrozenTree< T >::fixedDepthIterator FrozenTree< T >::fixedDepthIterator::operator++( int )
+{
+	fixedDepthIterator copy = *this;
+	++( *this );
+	return copy;
+}
+
+// FrozenTree
+template< class T >
+FrozenTree< T >::FrozenTree()
+: childBegin_( 1, 0 )
+{
+}
+
+template< class T >
+size_t FrozenTree< T >::size() const
+{
+	return data_.size();
+}
+
+template< class T >
+bool FrozenTree< T >::empty() const
+{
+	return data_.empty();
+}
+
+template< class T >
+typename FrozenTree< T >::preOrderIterator FrozenTree< T >::begin() const
+{
+	return preOrderIterator( this, 0 );
+}
+
+template< class T >
+typename FrozenTree< T >::preOrderIterator FrozenTree< T >::end() const
+{
+	return preOrderIterator( this, index_type( size() ) );
+}
+
+template< class T >
+typename FrozenTree< T >::postOrderIterator FrozenTree< T >::beginPost() const
+{
+	postOrderIterator ret( this, 0 );
+	if( !empty() )
+	{
+		ret.descendAll();
+	}
+	return ret;
+}
+
+template< class T >
+typename FrozenTree< T >::postOrderIterator FrozenTree< T >::endPost() const
+{
+	return postOrderIterator( this, index_type( size() ) );
+}
+
+template< class T >
+typename FrozenTree< T >::siblingIterator FrozenTree< T >::beginSibling( const iteratorBase& pos ) const
+{
+	return pos.begin();
+}
+
+template< class T >
+typename FrozenTree< T >::siblingIterator FrozenTree< T >::endSibling( const iteratorBase& pos ) const
+{
+	return pos.end();
+}
+
+template< class T >
+typename FrozenTree< T >::leafIterator FrozenTree< T >::beginLeaf() const
+{
+	return leafIterator( this, 0, index_type( size() ) );
+}
+
+template< class T >
+typename FrozenTree< T >::leafIterator FrozenTree< T >::endLeaf() const
+{
+	return leafIterator( this, index_type( size() ), index_type( size() ) );
+}
+
+// A childless top has no leaves below it, as in Tree.
+template< class T >
+typename FrozenTree< T >::leafIterator FrozenTree< T >::beginLeaf( const iteratorBase& top ) const
+{
+	if( end_[ top.pos ] == top.pos + 1 )
+	{
+		return endLeaf( top );
+	}
+	return leafIterator( this, top.pos, end_[ top.pos ] );
+}
+
+template< class T >
+typename FrozenTree< T >::leafIterator FrozenTree< T >::endLeaf( const iteratorBase& top ) const
+{
+	return leafIterator( this, end_[ top.pos ], end_[ top.pos ] );
+}
+
+template< class T >
+typename FrozenTree< T >::fixedDepthIterator FrozenTree< T >::beginFixed( const iteratorBase& pos, size_t dp ) const
+{
+	fixedDepthIterator ret( this, pos.pos, end_[ pos.pos ], depth_[ pos.pos ] + dp );
+	if( ret.pos == end_[ pos.pos ] )
+	{
+		throw std::range_error( "tree: beginFixed out of range" );
+	}
+	return ret;
+}
+
+template< class T >
+typename FrozenTree< T >::fixedDepthIterator FrozenTree< T >::endFixed( const iteratorBase& pos, size_t dp ) const
+{
+	return fixedDepthIterator( this, end_[ pos.pos ], end_[ pos.pos ], depth_[ pos.pos ] + dp );
+}
+
+template< class T >
+typename FrozenTree< T >::preOrderIterator FrozenTree< T >::parent( const iteratorBase& it ) const
+{
+	if( parent_[ it.pos ] == npos )
+	{
+		return end();
+	}
+	return preOrderIterator( this, parent_[ it.pos ] );
+}
+
+template< class T >
+size_t FrozenTree< T >::size( const iteratorBase& top ) const
+{
+	return end_[ top.pos ] - top.pos;
+}
+
+template< class T >
+size_t FrozenTree< T >::depth( const iteratorBase& it ) const
+{
+	return depth_[ it.pos ];
+}
+
+template< class T >
+size_t FrozenTree< T >::numberOfChildren( const iteratorBase& it ) const
+{
+	return it.numberOfChildren();
+}
+
+template< class T >
+typename FrozenTree< T >::siblingIterator FrozenTree< T >::child( const iteratorBase& it, size_t num ) const
+{
+	if( num >= it.numberOfChildren() )
+	{
+		return it.end();
+	}
+	return siblingIterator( this, children_[ childBegin_[ it.pos ] + num ] );
+}
+
+template< class T >
+typename FrozenTree< T >::index_type FrozenTree< T >::subtreeEnd( index_type pos ) const
+{
+	return end_[ pos ];
+}
+
+// Lists the children of every node, counting them first from parent_.
+template< class T >
+void FrozenTree< T >::linkChildren()
+{
+	size_t num = size();
+
+	childBegin_.assign( num + 1, 0 );
+	for( size_t i = 0; i < num; ++i )
+	{
+		if( parent_[ i ] != npos )
+		{
+			++childBegin_[ parent_[ i ] + 1 ];
+		}
+	}
+	for( size_t i = 0; i < num; ++i )
+	{
+		childBegin_[ i + 1 ] += childBegin_[ i ];
+	}
+
+	children_.resize( childBegin_[ num ] );
+	std::vector< index_type > fill( childBegin_.begin(), childBegin_.end() - 1 );
+	for( size_t i = 0; i < num; ++i )
+	{
+		if( parent_[ i ] != npos )
+		{
+			children_[ fill[ parent_[ i ] ]++ ] = index_type( i );
+		}
+	}
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+/// TreeCodec
+//////////////////////////////////////////////////////////////////////////
+// Numbers and bytes of the binary form of Tree::write() and Tree::read().
+// Numbers are written seven bits to a byte, low bits first, with the top
+// bit set on every byte but the last. Running out of input throws.
+struct TreeBinary
+{
+	static const std::uint8_t  version      = 2;
+	static const std::uint32_t byteOrder    = 0x01020304;          // written as the writer stores it
+	static const size_t        reserveLimit = size_t( 1 ) << 16;   // nodes read() reserves at most
+
+	static void putNumber( std::ostream& out, std::uint64_t num )
+	{
+		char buf[ 10 ];
+		int  len = 0;
+		while( num >= 0x80 )
+		{
+			buf[ len++ ] = char( num | 0x80 );
+			num >>= 7;
+		}
+		buf[ len++ ] = char( num );
+		putBytes( out, buf, len );
+	}
+
+	static std::uint64_t getNumber( std::istream& in )
+	{
+		std::streambuf *buf = in.rdbuf();
+		std::uint64_t   num = 0;
+		for( int shift = 0; shift < 64; shift += 7 )
+		{
+			int c = buf->sbumpc();
+			if( c == std::char_traits< char >::eof() )
+			{
+				cutShort( in );
+			}
+			num |= std::uint64_t( c & 0x7F ) << shift;
+			if( ( c & 0x80 ) == 0 )
+			{
+				return num;
+			}
+		}
+		throw std::runtime_error( "tree: bad number in binary tree" );
+	}
+
+	static void putBytes( std::ostream& out, const char *bytes, std::streamsize len )
+	{
+		if( out.rdbuf()->sputn( bytes, len ) != len )
+		{
+			out.setstate( std::ios_base::badbit );
+		}
+	}
+
+	static void getBytes( std::istream& in, char *bytes, std::streamsize len )
+	{
+		if( in.rdbuf()->sgetn( bytes, len ) != len )
+		{
+			cutShort( in );
+		}
+	}
+
+	static void cutShort( std::istream& in )
+	{
+		in.setstate( std::ios_base::eofbit | std::ios_base::failbit );
+		throw std::runtime_error( "tree: binary tree cut short" );
+	}
+};
+
+// Writes and reads the data of one node. The default copies trivially
+// copyable types byte for byte, in the byte order of the machine, which
+// the header records so that read() refuses the other one. For other types
+// specialise it, or hand Tree::write() and Tree::read() an object with the
+// same two members.
+template< class T >
+struct TreeCodec
+{
+	static_assert( std::is_trivially_copyable< T >::value, "TreeCodec has to be specialised for this type" );
+
+	void write( std::ostream& out, const T& x )
+	{
+		TreeBinary::putBytes( out, reinterpret_cast< const char * >( &x ), sizeof( T ) );
+	}
+
+	T read( std::istream& in )
+	{
+		T x;
+		TreeBinary::getBytes( in, reinterpret_cast< char * >( &x ), sizeof( T ) );
+		return x;
+	}
+};
+
+// Strings go as their length and their bytes.
+template<>
+struct TreeCodec< std::string >
+{
+	void write( std::ostream& out, const std::string& x )
+	{
+		TreeBinary::putNumber( out, x.size() );
+		TreeBinary::putBytes(  out, x.data(), std::streamsize( x.size() ) );
+	}
+
+	// read in pieces, so a damaged length runs out of input before memory
+	std::string read( std::istream& in )
+	{
+		std::uint64_t len = TreeBinary::getNumber( in );
+		std::string   x;
+		while( len > 0 )
+		{
+			char   buf[ 4096 ];
+			size_t num = len < sizeof( buf ) ? size_t( len ) : sizeof( buf );
+			TreeBinary::getBytes( in, buf, std::streamsize( num ) );
+			x.append( buf, num );
+			len -= num;
+		}
+		return x;
+	}
+};
+
+
+//////////////////////////////////////////////////////////////////////////
+/// Tree
+//////////////////////////////////////////////////////////////////////////
+
+// Tells Tree::merge() whether it can look nodes up by a std::hash of their data.
+template< class T, class = void >
+struct TreeHashable : std::false_type
+{
+};
+
+template< class T >
+struct TreeHashable< T, decltype( void( std::hash< T >()( std::declval< const T& >() ) ) ) > : std::true_type
+{
+};
+
+template< class T, class TreeNodeAllocator_ = std::allocator< _TreeNode<T> >, class TreePolicy_ = TreeDefaultPolicy >
+class Tree : private TreeNodeCount< TreePolicy_::countNodes >,
+             private TreeOrderIndex< TreePolicy_::lcaIndex || TreePolicy_::levelIndex, _TreeNode< T, TreePolicy_ > >,
+             private TreeIntervalLabels< TreePolicy_::intervalLabels, _TreeNode< T, TreePolicy_ > >
+{
+protected:
+    typedef _TreeNode< T, TreePolicy_ > TREE_NODE;
+
+	// the allocator given is rebound to the node type the policy asks for
+	typedef typename std::conditional< TreePolicy_::indexLinks,
+	                                   TreeNodePoolAllocator< TREE_NODE >,
+	                                   typename std::allocator_traits< TreeNodeAllocator_ >::template rebind_alloc< TREE_NODE > >::type TREE_NODE_ALLOCATOR;
+
+public:
+	typedef T value_type;
+
+	class iteratorBase     ;
+	class preOrderIterator ;
+	class postOrderIterator;
+	class siblingIterator  ;
+	class leafIterator     ;
+
+	Tree(                                      );
+	Tree( const T&                             );
+	Tree( T&&                                  );
+	Tree( const iteratorBase&                  );
+	Tree( const Tree< T, TreeNodeAllocator_, TreePolicy_ >& );
+	Tree(       Tree< T, TreeNodeAllocator_, TreePolicy_ >&& );   // the source is left empty, with
+	                                                              // sentinels of its own
+	~Tree();
+
+    Tree< T, TreeNodeAllocator_, TreePolicy_ >& operator=( const Tree< T, TreeNodeAllocator_, TreePolicy_ >&  );
+	Tree< T, TreeNodeAllocator_, TreePolicy_ >& operator=(       Tree< T, TreeNodeAllocator_, TreePolicy_ >&& ) noexcept;
+
+	void swap( Tree< T, TreeNodeAllocator_, TreePolicy_ >& ) noexcept;
+
+    class iteratorBase
+	{
+	public:
+		typedef T                               value_type       ;
+		typedef T*                              pointer          ;
+		typedef T&                              reference        ;
+		typedef size_t                          size_type        ;
+		typedef ptrdiff_t                       difference_type  ;
+		typedef std::bidirectional_iterator_tag iterator_category;
+
+		iteratorBase(             );
+		iteratorBase( TREE_NODE * );
+
+		reference operator*( ) const;
+        pointer   operator->() const;
+
+        void skipChildren(           );
+		void skipChildren( bool skip );
+
+		size_t numberOfChildren() const;
+
+        siblingIterator begin() const;
+		siblingIterator end(  ) const;
+
+        TREE_NODE *node;
+
+	protected:
+		bool skipCurrentChildren;
+
+	};
+
+	// Depth-first iterator, first accessing the node, then its children
+	class preOrderIterator : public iteratorBase
+	{
+	public:
+
+		preOrderIterator(                        );
+		preOrderIterator( TREE_NODE *            );
+        preOrderIterator( const iteratorBase&    );
+		preOrderIterator( const siblingIterator& );
+
+		bool operator==( const preOrderIterator& ) const;
+		bool operator!=( const preOrderIterator& ) const;
+
+        preOrderIterator& operator++(        );
+        preOrderIterator& operator--(        );
+		preOrderIterator  operator++( int    );
+		preOrderIterator  operator--( int    );
+		preOrderIterator& operator+=( size_t );
+		preOrderIterator& operator-=( size_t );
+	};
+
+	// Depth-first iterator, first accessing the children, then the node
+	class postOrderIterator : public iteratorBase
+	{
+	public:
+		postOrderIterator(                        );
+		postOrderIterator( TREE_NODE *            );
+		postOrderIterator( const iteratorBase&    );
+		postOrderIterator( const siblingIterator& );
+
+		bool operator==( const postOrderIterator& ) const;
+		bool operator!=( const postOrderIterator& ) const;
+
+		postOrderIterator& operator++(        );
+		postOrderIterator& operator--(        );
+		postOrderIterator  operator++( int    );
+		postOrderIterator  operator--( int    );
+		postOrderIterator& operator+=( size_t );
+		postOrderIterator& operator-=( size_t );
+
+		void descendAll();
+	};
+
+	// BreadthFirstQueuedIterator
+	class breadthFirstQueuedIterator : public iteratorBase
+	{
+	public:
+		breadthFirstQueuedIterator(                     );
+		breadthFirstQueuedIterator( TREE_NODE *         );
+		breadthFirstQueuedIterator( const iteratorBase& );
+
+		bool operator==( const breadthFirstQueuedIterator& ) const;
+		bool operator!=( const breadthFirstQueuedIterator& ) const;
+
+		breadthFirstQueuedIterator& operator++(        );
+		breadthFirstQueuedIterator  operator++( int    );
+		breadthFirstQueuedIterator& operator+=( size_t );
+
+	private:
+		friend class Tree;
+
+		// Window of the breadth-first order shared by all copies of one
+		// traversal. Copies only hold a position into it, so copying an
+		// iterator never copies the queue; nodes are expanded lazily and
+		// the consumed prefix is dropped once a single iterator is left.
+		struct traversalQueue
+		{
+			std::vector< TREE_NODE * > nodes   ;
+			size_t                     first   ;   // Position of nodes[ 0 ]
+			size_t                     expanded;   // Next position whose children are not queued yet
+		};
+
+		void start( TREE_NODE * );
+
+		std::shared_ptr< traversalQueue > queue   ;
+		size_t                            position;
+	};
+
+//	typedef preOrderIterator           ITERATOR;
+//	typedef breadthFirstQueuedIterator BREADTH_FIRST_ITERATOR;
+
+	// FixedDepthIterator
+	class fixedDepthIterator : public iteratorBase
+	{
+	public:
+		fixedDepthIterator(                           );
+		fixedDepthIterator( TREE_NODE *               );
+		fixedDepthIterator( const iteratorBase &      );
+		fixedDepthIterator( const siblingIterator&    );
+		fixedDepthIterator( const fixedDepthIterator& );
+
+		bool operator==( const fixedDepthIterator& ) const;
+		bool operator!=( const fixedDepthIterator& ) const;
+
+		fixedDepthIterator& operator++(        );
+		fixedDepthIterator& operator--(        );
+		fixedDepthIterator  operator++( int    );
+		fixedDepthIterator  operator--( int    );
+		fixedDepthIterator& operator+=( size_t );
+		fixedDepthIterator& operator-=( size_t );
+
+		TREE_NODE *topNode;
+
+	private:
+		friend class Tree;
+
+		// with levelLinks, the first and last node at this depth below
+		// topNode, 0 when iterating across the whole tree
+		TREE_NODE *firstNode;
+		TREE_NODE *lastNode ;
+	};
+
+	// SiblingIterator
+	class siblingIterator : public iteratorBase
+	{
+	public:
+
+		siblingIterator(                        );
+		siblingIterator( TREE_NODE *            );
+		siblingIterator( const siblingIterator& ) = default;
+		siblingIterator( const iteratorBase&    );
+
+		bool operator==( const siblingIterator& ) const;
+		bool operator!=( const siblingIterator& ) const;
+
+		siblingIterator& operator++(        );
+		siblingIterator& operator--(        );
+		siblingIterator  operator++( int    );
+		siblingIterator  operator--( int    );
+		siblingIterator& operator+=( size_t );
+		siblingIterator& operator-=( size_t );
+
+		TREE_NODE *rangeFirst() const;
+		TREE_NODE *rangeLast( ) const;
+		
+		TREE_NODE *parent;
+		
+	private:
+		void setParent();
+	};
+
+    // LeafIterator
+	class leafIterator : public iteratorBase
+	{
+	public:
+		leafIterator(                                 );
+		leafIterator( TREE_NODE *, TREE_NODE *top = 0 );
+		leafIterator( const siblingIterator&          );
+		leafIterator( const iteratorBase&             );
+
+        bool operator==( const leafIterator& ) const;
+		bool operator!=( const leafIterator& ) const;
+
+		leafIterator& operator++(        );
+		leafIterator& operator--(        );
+		leafIterator  operator++( int    );
+		leafIterator  operator--( int    );
+		leafIterator& operator+=( size_t );
+		leafIterator& operator-=( size_t );
+
+	private:
+		TREE_NODE *topNode;
+	};
+
+
+	inline preOrderIterator begin() const;
+	inline preOrderIterator end(  ) const;
+
+	postOrderIterator beginPost() const;
+	postOrderIterator endPost(  ) const;
+
+	fixedDepthIterator beginFixed( const iteratorBase&, size_t ) const;
+    fixedDepthIterator endFixed(   const iteratorBase&, size_t ) const;
+
+	
+    breadthFirstQueuedIterator beginBreadthFirst() const;
+	breadthFirstQueuedIterator endBreadthFirst(  ) const;
+
+    siblingIterator beginSibling( const iteratorBase& ) const;
+	siblingIterator endSibling(   const iteratorBase& ) const;
+
+	leafIterator beginLeaf() const;
+	leafIterator endLeaf(  ) const;
+
+    leafIterator beginLeaf( const iteratorBase& top ) const;
+	leafIterator endLeaf(   const iteratorBase& top ) const;
+
+    template< typename iter > static iter parent( iter );
+
+	template< typename iter > iter previousSibling( iter ) const;
+    template< typename iter > iter nextSibling(     iter ) const;
+	template< typename iter > iter nextAtSameDepth( iter ) const;
+
+	void clear();   // clear all nodes of the tree.
+
+	template< typename iter > iter erase( iter );
+
+	void eraseChildren( const iteratorBase& );
+
+	template< typename iter > iter appendChild(  iter );
+	template< typename iter > iter prependChild( iter );
+
+	template< typename iter > iter appendChild(  iter, const T& );
+	template< typename iter > iter prependChild( iter, const T& );
+	template< typename iter > iter appendChild(  iter, T&&      );
+	template< typename iter > iter prependChild( iter, T&&      );
+
+	template< typename iter > iter appendChild(  iter, iter );
+	template< typename iter > iter prependChild( iter, iter );
+
+	template< typename iter > iter appendChildren(  iter, siblingIterator, siblingIterator );
+	template< typename iter > iter prependChildren( iter, siblingIterator, siblingIterator );
+
+    preOrderIterator setHead( const T& );
+	preOrderIterator setHead( T&&      );
+
+	template< typename iter > iter insert( iter           , const T& );
+	siblingIterator                insert( siblingIterator, const T& );
+	template< typename iter > iter insert( iter           , T&&      );
+	siblingIterator                insert( siblingIterator, T&&      );
+
+	template< typename iter > iter insertSubtree( iter, const iteratorBase& );
+
+	template< typename iter > iter insertAfter( iter, const T& );
+	template< typename iter > iter insertAfter( iter, T&&      );
+
+	template< typename iter > iter insertSubtreeAfter( iter, const iteratorBase& );
+
+    template< typename iter > iter replace( iter, const T&            );
+	template< typename iter > iter replace( iter, T&&                 );
+
+	template< typename iter > iter replace( iter, const iteratorBase& );
+
+	siblingIterator                replace( siblingIterator,
+		                                    siblingIterator,
+							                siblingIterator,
+							                siblingIterator );
+
+	// Build the new node's data from args, without copying a T.
+	template< typename iter, class... Args > iter emplaceChild(      iter, Args&&... );   // as last child
+	template< typename iter, class... Args > iter emplaceFirstChild( iter, Args&&... );
+	template< typename iter, class... Args > iter emplace(           iter, Args&&... );   // before position
+	template< class... Args > siblingIterator     emplace( siblingIterator, Args&&... );
+	template< typename iter, class... Args > iter emplaceAfter(      iter, Args&&... );
+
+	template< typename iter > iter flatten( iter );
+
+	template< typename iter > iter reparent( iter, siblingIterator, siblingIterator );
+    template< typename iter > iter reparent( iter, iter );
+
+    template< typename iter > iter wrap( iter, const T& );
+
+	template< typename iter > iter moveAfter(  iter, iter );
+	template< typename iter > iter moveBefore( iter, iter );
+    siblingIterator                moveBefore( siblingIterator,
+		                                       siblingIterator );
+	template< typename iter > iter moveOntop(  iter, iter );
+
+	void merge( siblingIterator                      , 
+		        siblingIterator                      , 
+				siblingIterator                      , 
+				siblingIterator                      , 
+				bool            duplicateLeaves=false  );
+	// merges the top levels of the trees first to last into to1 to2 as
+	// merge() would one after the other, matching each level only once
+	template< class TreeIterator >
+	void mergeTrees( siblingIterator                      ,
+	                 siblingIterator                      ,
+	                 TreeIterator                         ,
+	                 TreeIterator                         ,
+	                 bool            duplicateLeaves=false  );
+
+	// stable merge sorts in place, deep sorts the children below as well;
+	// a pool is any callable that runs a std::function< void() > on some
+	// thread, a deep sort hands independent subtrees to it
+	void sort( siblingIterator              ,
+		       siblingIterator              ,
+		       bool               deep=false  );
+	template< class StrictWeakOrdering > 
+	void sort( siblingIterator              ,
+	           siblingIterator              ,
+	           StrictWeakOrdering           ,
+			   bool               deep=false  );
+	template< class StrictWeakOrdering, class Pool >
+	void sort( siblingIterator              ,
+	           siblingIterator              ,
+	           StrictWeakOrdering           ,
+	           bool               deep      ,
+	           Pool&                          );
+
+	template< typename iter >
+	bool equal( const iter&,
+		        const iter&,
+				const iter&  ) const;
+	template< typename iter, class BinaryPredicate >
+	bool equal( const iter&          ,
+		        const iter&          ,
+				const iter&          ,
+				      BinaryPredicate  ) const;
+	
+	template< typename iter >
+    bool equalSubTree( const iter&,
+		               const iter& ) const;
+    template< typename iter, class BinaryPredicate >
+	bool equalSubTree( const iter&          ,
+		               const iter&          ,
+          				     BinaryPredicate  ) const;
+
+	// hash of the data and shape of the subtree below a node, only of its
+	// shape when T has no std::hash; O(1) once cached with
+	// TreePolicy_::subtreeHashes and O(size) otherwise
+	size_t subtreeHash( const iteratorBase& ) const;
+
+	// to be called after the data of a node was changed through an iterator
+	void dataChanged( const iteratorBase& );
+
+	FrozenTree< T > freeze() const;   // read-only copy with index based links
+
+	// binary form: a header with the version, the byte order and the number
+	// of nodes, then every node in pre-order as its number of children and
+	// its data as the codec writes it. read() replaces the content in one
+	// pass, linking the nodes as a copy does; on bad input, or input of the
+	// other byte order, it throws std::runtime_error and leaves the tree empty.
+	void write( std::ostream& ) const;
+	void read(  std::istream& );
+	template< class Codec > void write( std::ostream&, Codec& ) const;
+	template< class Codec > void read(  std::istream&, Codec& );
+
+	Tree subTree( siblingIterator,
+		          siblingIterator  ) const;
+    void subTree( Tree&,
+		          siblingIterator,
+				  siblingIterator  ) const;
+
+    void swap( siblingIterator );
+	void swap( preOrderIterator, preOrderIterator );
+
+    size_t size(                     ) const;   // O(1) with TreePolicy_::countNodes
+	size_t size( const iteratorBase& ) const;   // O(1) with TreePolicy_::subtreeSizes
+
+	// pre-order position of a node and the node at a position, both
+	// O(depth * fanout) with TreePolicy_::subtreeSizes and linear otherwise
+	size_t           rank(   const iteratorBase& ) const;
+	preOrderIterator nodeAt( size_t              ) const;
+
+	bool empty() const;
+
+	static int depth( const iteratorBase&  );
+	static int depth( const iteratorBase&,
+		              const iteratorBase&  );
+
+	// level() is depth() looked up in O(1) with TreePolicy_::levelIndex;
+	// ancestor() is end() for k beyond the top level and O(log n) with it
+	size_t           level(    const iteratorBase&           ) const;
+	preOrderIterator ancestor( const iteratorBase&, size_t k ) const;
+
+	int maxDepth(                     ) const;
+	int maxDepth( const iteratorBase& ) const;
+
+	static size_t numberOfChildren( const iteratorBase& );
+
+	size_t numberOfSiblings( const iteratorBase& ) const;
+
+	// whether the first lies in the pre-order range from the second up to
+	// the third; an end before the begin or without a node, such as the
+	// end of a sibling range, leaves the range open to the end of the tree
+    bool isInSubTree( const iteratorBase&,
+		              const iteratorBase&,
+					  const iteratorBase&  ) const;
+
+	// whether the first lies strictly above / below the second
+	bool isAncestor(   const iteratorBase&, const iteratorBase& ) const;
+	bool isDescendant( const iteratorBase&, const iteratorBase& ) const;
+
+    bool isValid( const iteratorBase& ) const;
+
+	// lowest node both lie strictly below, end() if there is none
+	preOrderIterator lowestCommonAncestor( const iteratorBase&,
+		                                   const iteratorBase&  ) const;
+
+    size_t index( siblingIterator it ) const;
+
+	static siblingIterator child( const iteratorBase&, size_t );
+
+    siblingIterator sibling( const iteratorBase&, size_t );
+
+	void debug_verify_consistency() const;
+
+	class iteratorBaseLess
+	{
+	public:
+		bool operator()( const typename Tree< T, TreeNodeAllocator_, TreePolicy_ >::iteratorBase& one,
+			             const typename Tree< T, TreeNodeAllocator_, TreePolicy_ >::iteratorBase& two ) const
+		{
+			return one.node < two.node;
+		}
+	};
+
+
+	TREE_NODE *head, *feet;
+
+private:
+    TREE_NODE_ALLOCATOR alloc_;
+	void headInitialise();
+	void headReset();     // links head and feet as in an empty tree
+	void headDestroy();   // for ~Tree() and for constructors that throw
+
+	// clear() and ~Tree() may drop the whole arena instead of walking the tree
+	static const bool releaseInBulk = TreeNodeAllocatorTraits< TREE_NODE_ALLOCATOR >::bulkRelease &&
+	                                  std::is_trivially_destructible< TREE_NODE >::value;
+
+	// head and feet are kept out of an arena that is dropped in bulk, so
+	// they and end() outlive clear() whatever the allocator
+	typedef std::allocator< TREE_NODE > SENTINEL_ALLOCATOR;
+
+	static const bool constantTimeSize = TreePolicy_::countNodes;
+
+	// merge() looks the siblings of a level up by hash once it merges this
+	// many nodes into it, a scan is cheaper for fewer however long the level
+	static const size_t mergeHashThreshold = 16;
+
+	void copy( const Tree< T, TreeNodeAllocator_, TreePolicy_ >& other );
+
+	TREE_NODE *cloneNode(    const TREE_NODE * );
+	TREE_NODE *cloneSubtree( const TREE_NODE * );
+	void       threadCopied( TREE_NODE *, TREE_NODE *&leaf );
+
+	// read() helpers, the counterparts of cloneNode() and cloneSubtree().
+	// left is the number of nodes the header still allows, open holds the
+	// number of children still to read of every node on the current path.
+	template< class Codec >
+	TREE_NODE *readNode(    std::istream&, Codec&, size_t& left, std::vector< size_t >& open );
+	template< class Codec >
+	TREE_NODE *readSubtree( std::istream&, Codec&, size_t& left, std::vector< size_t >& open );
+
+	// Bulk building for copies, read() and TreeBracketReader, which make a
+	// subtree top down before it is hung into the tree. buildChild() links node
+	// after prev, the last child of parent so far or 0; buildDone() is for
+	// a node once all of its subtree is built, buildTop() for the top.
+	friend class TreeBracketReader;
+
+	void buildChild( TREE_NODE *parent, TREE_NODE *prev, TREE_NODE *node );
+	void buildDone(  TREE_NODE *, TREE_NODE *&leaf );
+	void buildTop(   TREE_NODE *, TREE_NODE *&leaf );
+
+	template< class... Args >
+	TREE_NODE *createNode( Args&&... );
+	TREE_NODE *createSentinel();
+	void       destroySentinel( TREE_NODE * );
+	void       destroyNode( TREE_NODE * );
+
+	// the previous sibling, head for the first node of the top level
+	TREE_NODE *prevSiblingOf( TREE_NODE * ) const;
+
+	void linkLastChild(  TREE_NODE *, TREE_NODE * );
+	void linkFirstChild( TREE_NODE *, TREE_NODE * );
+	void linkBefore(     TREE_NODE *, TREE_NODE * );
+	void linkAfter(      TREE_NODE *, TREE_NODE * );
+	void unlinkNode(     TREE_NODE *              );
+
+	// keep the child bookkeeping of the parent and the subtree sizes of the
+	// ancestors up to date when a subtree is hung into or taken out of the tree
+	void attached(  TREE_NODE * );
+	void detaching( TREE_NODE * );
+
+	// leafChain upkeep: joinLeaves() makes two leaves neighbours in the
+	// chain, leafBoundsChanged() passes a new first and/or last leaf of node
+	// on to the ancestors it is the first or last descendant of, and
+	// rethreadLeaves() chains the leaves of the siblings first to last
+	// between prev and next after they were put in a new order
+	void joinLeaves(        TREE_NODE *, TREE_NODE *                           );
+	void leafBoundsChanged( TREE_NODE *, TREE_NODE *first, TREE_NODE *last     );
+	void rethreadLeaves(    TREE_NODE *first, TREE_NODE *last, TREE_NODE *prev, TREE_NODE *next );
+
+	// the leaves just outside the subtree below a node, 0 without leafChain
+	TREE_NODE *leafBefore( TREE_NODE * ) const;
+	TREE_NODE *leafAfter(  TREE_NODE * ) const;
+
+	// levelLinks upkeep for the subtrees below the siblings first to last,
+	// whose nodes make up one stretch of each level list: levelBelow() moves
+	// such a stretch one level down, 0 when it runs out, linkLevels() links
+	// the stretches of a new or rearranged range among themselves, and
+	// threadLevels() / unthreadLevels() splice them into and out of the
+	// lists of the tree
+	void levelBelow(     TREE_NODE *&first, TREE_NODE *&last ) const;
+	void linkLevels(     TREE_NODE *first,  TREE_NODE *last  );
+	void threadLevels(   TREE_NODE *first,  TREE_NODE *last  );
+	void unthreadLevels( TREE_NODE *first,  TREE_NODE *last  );
+
+	void destroyChildren( TREE_NODE * );
+
+	// subtreeHashes upkeep: hashChanged() forgets the hashes of a node and
+	// its ancestors, hashOf() works out the hash of a subtree, filling in
+	// the ones below it that are not known
+	void   hashChanged( TREE_NODE * );
+	size_t hashOf( TREE_NODE * ) const;
+
+	template< class StrictWeakOrdering >
+	class compareNodes
+	{
+	public:
+		compareNodes( StrictWeakOrdering inComp ) : comp( inComp ){};
+
+		bool operator()( const TREE_NODE *a, const TREE_NODE *b )
+		{
+		    return comp( a->data, b->data );
+		}
+
+	private:
+		StrictWeakOrdering comp;
+	};
+
+	// sort() helpers. Once a comparison throws, error holds the exception
+	// and no more comparisons are made, but every list is left whole.
+	// sortSiblings() sorts the siblings first to last, prev being the one
+	// before them, with mergeSiblings() and returns the new first and last;
+	// sortChildren() sorts the children of a node and sortBelow() those of
+	// top and of every node below it, children first. Both keep the leaf
+	// chain below the node intact, leaving only its outer links to the
+	// caller.
+	template< class Compare >
+	void sortSiblings( TREE_NODE *&first, TREE_NODE *&last, TREE_NODE *prev, Compare&, std::exception_ptr& error );
+	template< class Compare >
+	static TREE_NODE *mergeSiblings( TREE_NODE *one, TREE_NODE *two, Compare&, std::exception_ptr& error );
+	template< class Compare >
+	void sortChildren( TREE_NODE *, Compare&, std::exception_ptr& error );
+	template< class Compare >
+	void sortBelow(    TREE_NODE *top, Compare&, std::exception_ptr& error );
+
+	typedef std::pair< siblingIterator, siblingIterator > SIBLING_RANGE;
+
+	// std::hash of the data of a node, 0 when T has none
+	static size_t valueHash( const T& x, std::true_type  ) { return std::hash< T >()( x ); }
+	static size_t valueHash( const T&  , std::false_type ) { return 0; }
+
+	// merge() helpers. mergeLevel() merges the source ranges first to last
+	// into the siblings to1 to2, then the children of the source nodes
+	// matched below the nodes they matched. mergeIndex finds the first
+	// sibling equal to a value by a std::hash of it, when T has one.
+	void mergeLevel( siblingIterator, siblingIterator, const SIBLING_RANGE *first, const SIBLING_RANGE *last, bool duplicateLeaves );
+
+	class mergeIndex
+	{
+	public:
+		static const size_t npos = size_t( -1 );
+
+		struct entry
+		{
+			size_t     hash;
+			TREE_NODE *node;
+			size_t     target;   // index of node in the nodes to merge below, npos if none
+		};
+
+		mergeIndex( size_t count );
+
+		// the slot x is in or would go to, with the hash add() needs
+		size_t probe( const T& x, size_t& hash ) const;
+		size_t at( size_t slot ) const { return slots[ slot ]; }   // entry in a slot, npos if free
+		void   add( size_t slot, TREE_NODE *, size_t hash );
+
+		std::vector< entry > entries;
+
+	private:
+		std::vector< size_t > slots;
+		int                   shift;
+	};
+
+	template< class Compare, class Pool >
+	void sortRange(      siblingIterator, siblingIterator, Compare, bool deep, Pool * );
+	template< class Compare, class Pool >
+	void sortInParallel( TREE_NODE *first, TREE_NODE *last, Compare&, std::exception_ptr& error, Pool& );
+};
+
+//////////////////////////////////////////////////////////////////////////
+/// Tree 
+//////////////////////////////////////////////////////////////////////////
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+Tree< T, TreeNodeAllocator_, TreePolicy_ >::Tree()
+{
+    headInitialise();
+}
+
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+Tree< T, TreeNodeAllocator_, TreePolicy_ >::Tree( const T& x )
+{
+    headInitialise();
+	try
+	{
+		setHead( x );
+	}
+	catch( ... )
+	{
+		headDestroy();
+		throw;
+	}
+}
+
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+Tree< T, TreeNodeAllocator_, TreePolicy_ >::Tree( T&& x )
+{
+    headInitialise();
+	try
+	{
+		setHead( std::move( x ) );
+	}
+	catch( ... )
+	{
+		headDestroy();
+		throw;
+	}
+}
+
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+Tree< T, TreeNodeAllocator_, TreePolicy_ >::Tree( const iteratorBase& other )
+{
+    headInitialise();
+	try
+	{
+		setHead( ( *other ) );
+		replace( begin(), other );
+	}
+	catch( ... )
+	{
+		headDestroy();
+		throw;
+	}
+}
+
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+Tree< T, TreeNodeAllocator_, TreePolicy_ >::Tree( const Tree< T, TreeNodeAllocator_, TreePolicy_ >& other )
+{
+	headInitialise();
+	try
+	{
+		copy( other );
+	}
+	catch( ... )
+	{
+		headDestroy();
+		throw;
+	}
+}
+
+// The nodes change hands, the source gets the new sentinels and so stays
+// usable. Making them may throw, so unlike swap() this is not noexcept.
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+Tree< T, TreeNodeAllocator_, TreePolicy_ >::Tree( Tree< T, TreeNodeAllocator_, TreePolicy_ >&& other )
+{
+	headInitialise();
+	swap( other );
+}
+
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+Tree< T, TreeNodeAllocator_, TreePolicy_ >& Tree< T, TreeNodeAllocator_, TreePolicy_ >::operator=( const Tree< T, TreeNodeAllocator_, TreePolicy_ >& other )
+{
+	if( this != &other )
+	{
+		copy( other );
+	}
+	return *this;
+}
+
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+Tree< T, TreeNodeAllocator_, TreePolicy_ >& Tree< T, TreeNodeAllocator_, TreePolicy_ >::operator=( Tree< T, TreeNodeAllocator_, TreePolicy_ >&& other ) noexcept
+{
+	// our old nodes go to other and die with it
+	swap( other );
+	return *this;
+}
+
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+void Tree< T, TreeNodeAllocator_, TreePolicy_ >::swap( Tree< T, TreeNodeAllocator_, TreePolicy_ >& other ) noexcept
+{
+	std::swap( head  , other.head   );
+	std::swap( feet  , other.feet   );
+	std::swap( alloc_, other.alloc_ );
+	this->swapNodeCount( other );
+	this->swapOrderIndex( other );
+	this->swapIntervalLabels( other );
+}
+
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+void swap( Tree< T, TreeNodeAllocator_, TreePolicy_ >& one, Tree< T, TreeNodeAllocator_, TreePolicy_ >& two ) noexcept
+{
+	one.swap( two );
+}
+
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+Tree< T, TreeNodeAllocator_, TreePolicy_ >::~Tree()
+{
+	headDestroy();
+}
+
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+void Tree< T, TreeNodeAllocator_, TreePolicy_ >::headInitialise()
+{
+    head = createSentinel();
+	try
+	{
+		feet = createSentinel();
+	}
+	catch( ... )
+	{
+		destroySentinel( head );
+		head = 0;
+		throw;
+	}
+
+	headReset();
+}
+
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+void Tree< T, TreeNodeAllocator_, TreePolicy_ >::headReset()
+{
+    head->parent      = 0   ;
+	head->firstChild  = 0   ;
+	head->nextSibling = feet;
+	head->setLastChild(   0 );
+	head->setPrevSibling( 0 );
+	head->setRightLeaf(   feet );
+
+	feet->parent      = 0   ;
+	feet->firstChild  = 0   ;
+	feet->nextSibling = 0   ;
+	feet->setLastChild(      0 );
+	feet->setPrevSibling( head );
+	feet->setLeftLeaf(    head );
+
+	this->orderChanged();
+	this->labelsChanged( 0 );
+}
+
+// With releaseInBulk the allocator frees every node when it goes away,
+// only head and feet are left to us.
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+void Tree< T, TreeNodeAllocator_, TreePolicy_ >::headDestroy()
+{
+	if( !releaseInBulk )
+	{
+		clear();
+	}
+	destroySentinel( head );
+	destroySentinel( feet );
+	head = 0;
+	feet = 0;
+}
+
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+void Tree< T, TreeNodeAllocator_, TreePolicy_ >::copy( const Tree< T, TreeNodeAllocator_, TreePolicy_ >& other )
+{
+	clear();
+
+	// counting the nodes first only pays off when size() is cheap
+	if( TreeNodeAllocatorTraits< TREE_NODE_ALLOCATOR >::reserves && constantTimeSize )
+	{
+		TreeNodeAllocatorTraits< TREE_NODE_ALLOCATOR >::reserve( alloc_, other.size() );
+	}
+
+	// a copy that throws leaves the tree empty
+	try
+	{
+		for( TREE_NODE *it = other.head->nextSibling; it != other.feet; it = it->nextSibling )
+		{
+			linkBefore( feet, cloneSubtree( it ) );
+		}
+	}
+	catch( ... )
+	{
+		clear();
+		throw;
+	}
+}
+
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+typename Tree< T, TreeNodeAllocator_, TreePolicy_ >::TREE_NODE *Tree< T, TreeNodeAllocator_, TreePolicy_ >::cloneNode( const TREE_NODE *from )
+{
+	return createNode( from->data );
+}
+
+// Copies the subtree below from in one pre-order walk, linking every new
+// node as it is created. The copy is returned detached, without parent or
+// siblings; if copying some data throws, what was copied is freed.
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+typename Tree< T, TreeNodeAllocator_, TreePolicy_ >::TREE_NODE *Tree< T, TreeNodeAllocator_, TreePolicy_ >::cloneSubtree( const TREE_NODE *from )
+{
+	TREE_NODE       *top  = cloneNode( from );
+	TREE_NODE       *to   = top ;
+	const TREE_NODE *cur  = from;
+	TREE_NODE       *leaf = 0   ;   // last leaf copied so far, for leafChain
+
+	try
+	{
+		for( ; ; )
+		{
+			if( cur->firstChild != 0 )
+			{
+				cur = cur->firstChild;
+
+				TREE_NODE *tmp = cloneNode( cur );
+				buildChild( to, 0, tmp );
+				to = tmp;
+				continue;
+			}
+
+			// to is complete, and so is every parent it is the last child of
+			while( cur != from )
+			{
+				buildDone( to, leaf );
+				if( cur->nextSibling != 0 )
+				{
+					break;
+				}
+				cur = cur->parent;
+				to  = to->parent ;
+			}
+			if( cur == from )
+			{
+				break;
+			}
+			cur = cur->nextSibling;
+
+			TREE_NODE *tmp = cloneNode( cur );
+			buildChild( to->parent, to, tmp );
+			to = tmp;
+		}
+	}
+	catch( ... )
+	{
+		destroyChildren( top );
+		destroyNode( top );
+		throw;
+	}
+
+	buildTop( top, leaf );
+	return top;
+}
+
+// The node count in the header bounds the number of children a node may
+// claim, so a damaged count cannot make read() run away.
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+template< class Codec >
+typename Tree< T, TreeNodeAllocator_, TreePolicy_ >::TREE_NODE *Tree< T, TreeNodeAllocator_, TreePolicy_ >::readNode( std::istream& in, Codec& codec, size_t& left, std::vector< size_t >& open )
+{
+	if( left == 0 )
+	{
+		throw std::runtime_error( "tree: more nodes in binary tree than its header says" );
+	}
+	--left;
+
+	std::uint64_t num = TreeBinary::getNumber( in );
+	if( num > left )
+	{
+		throw std::runtime_error( "tree: more nodes in binary tree than its header says" );
+	}
+
+	TREE_NODE *tmp = createNode( codec.read( in ) );
+	open.push_back( size_t( num ) );
+	return tmp;
+}
+
+// Builds the subtree the way cloneSubtree() copies one, with the number of
+// children read for every node in place of the links of the original.
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+template< class Codec >
+typename Tree< T, TreeNodeAllocator_, TreePolicy_ >::TREE_NODE *Tree< T, TreeNodeAllocator_, TreePolicy_ >::readSubtree( std::istream& in, Codec& codec, size_t& left, std::vector< size_t >& open )
+{
+	TREE_NODE *top  = readNode( in, codec, left, open );
+	TREE_NODE *to   = top;
+	TREE_NODE *leaf = 0  ;   // last leaf read so far, for leafChain
+
+	try
+	{
+		for( ; ; )
+		{
+			if( open.back() > 0 )
+			{
+				--open.back();
+
+				TREE_NODE *tmp = readNode( in, codec, left, open );
+				buildChild( to, 0, tmp );
+				to = tmp;
+				continue;
+			}
+
+			// to is complete, and so is every parent with no children left
+			open.pop_back();
+			while( to != top )
+			{
+				buildDone( to, leaf );
+				if( open.back() > 0 )
+				{
+					break;
+				}
+				open.pop_back();
+				to = to->parent;
+			}
+			if( to == top )
+			{
+				break;
+			}
+			--open.back();
+
+			TREE_NODE *tmp = readNode( in, codec, left, open );
+			buildChild( to->parent, to, tmp );
+			to = tmp;
+		}
+	}
+	catch( ... )
+	{
+		open.clear();
+		destroyChildren( top );
+		destroyNode( top );
+		throw;
+	}
+
+	buildTop( top, leaf );
+	return top;
+}
+
+// The links cloneSubtree() sets, the ones a detached subtree needs.
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+void Tree< T, TreeNodeAllocator_, TreePolicy_ >::buildChild( TREE_NODE *parent, TREE_NODE *prev, TREE_NODE *node )
+{
+	node->parent = parent;
+	if( prev == 0 )
+	{
+		parent->firstChild = node;
+	}
+	else
+	{
+		prev->nextSibling = node;
+		node->setPrevSibling( prev );
+	}
+	parent->setLastChild( node );
+	parent->childLinked( node );
+}
+
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+void Tree< T, TreeNodeAllocator_, TreePolicy_ >::buildDone( TREE_NODE *node, TREE_NODE *&leaf )
+{
+	if( TreePolicy_::leafChain )
+	{
+		threadCopied( node, leaf );
+	}
+	node->parent->growSubtree( node->subtreeSize() );
+}
+
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+void Tree< T, TreeNodeAllocator_, TreePolicy_ >::buildTop( TREE_NODE *top, TREE_NODE *&leaf )
+{
+	if( TreePolicy_::leafChain )
+	{
+		threadCopied( top, leaf );
+	}
+	if( TreePolicy_::levelLinks )
+	{
+		linkLevels( top, top );
+	}
+}
+
+// Leaf threading for cloneSubtree(), node has all of its copy below it.
+// A leaf is chained after leaf and becomes the new leaf, any other node
+// takes its bounds from its first child and from leaf.
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+void Tree< T, TreeNodeAllocator_, TreePolicy_ >::threadCopied( TREE_NODE *node, TREE_NODE *&leaf )
+{
+	if( node->firstChild != 0 )
+	{
+		node->setLeftLeaf(  node->firstChild->firstLeaf() );
+		node->setRightLeaf( leaf );
+		return;
+	}
+
+	node->setLeftLeaf( leaf );
+	if( leaf != 0 )
+	{
+		leaf->setRightLeaf( node );
+	}
+	leaf = node;
+}
+
+// New nodes come out with all links cleared. If the data cannot be made
+// the memory goes back.
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+template< class... Args >
+typename Tree< T, TreeNodeAllocator_, TreePolicy_ >::TREE_NODE *Tree< T, TreeNodeAllocator_, TreePolicy_ >::createNode( Args&&... args )
+{
+	TREE_NODE *tmp = alloc_.allocate( 1, 0 );
+	try
+	{
+		alloc_.construct( tmp, TreeNodeEmplace(), std::forward< Args >( args )... );
+	}
+	catch( ... )
+	{
+		alloc_.deallocate( tmp, 1 );
+		throw;
+	}
+	this->adjustNodeCount( 1 );
+	return tmp;
+}
+
+// head and feet are made in place, so T is never copied for them
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+typename Tree< T, TreeNodeAllocator_, TreePolicy_ >::TREE_NODE *Tree< T, TreeNodeAllocator_, TreePolicy_ >::createSentinel()
+{
+	if( releaseInBulk )
+	{
+		SENTINEL_ALLOCATOR sentinels;
+		TREE_NODE *tmp = sentinels.allocate( 1 );
+		try
+		{
+			std::allocator_traits< SENTINEL_ALLOCATOR >::construct( sentinels, tmp );
+		}
+		catch( ... )
+		{
+			sentinels.deallocate( tmp, 1 );
+			throw;
+		}
+		return tmp;
+	}
+
+	TREE_NODE *tmp = alloc_.allocate( 1, 0 );
+	try
+	{
+		alloc_.construct( tmp );
+	}
+	catch( ... )
+	{
+		alloc_.deallocate( tmp, 1 );
+		throw;
+	}
+	return tmp;
+}
+
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+void Tree< T, TreeNodeAllocator_, TreePolicy_ >::destroySentinel( TREE_NODE *node )
+{
+	if( releaseInBulk )
+	{
+		SENTINEL_ALLOCATOR sentinels;
+		std::allocator_traits< SENTINEL_ALLOCATOR >::destroy( sentinels, node );
+		sentinels.deallocate( node, 1 );
+	}
+	else
+	{
+		alloc_.destroy( node );
+		alloc_.deallocate( node, 1 );
+	}
+}
+
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+void Tree< T, TreeNodeAllocator_, TreePolicy_ >::destroyNode( TREE_NODE *node )
+{
+	alloc_.destroy( node );
+	alloc_.deallocate( node, 1 );
+	this->adjustNodeCount( -1 );
+}
+
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+typename Tree< T, TreeNodeAllocator_, TreePolicy_ >::TREE_NODE *Tree< T, TreeNodeAllocator_, TreePolicy_ >::prevSiblingOf( TREE_NODE *node ) const
+{
+	return node->prevSiblingNode( head );
+}
+
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+void Tree< T, TreeNodeAllocator_, TreePolicy_ >::linkLastChild( TREE_NODE *position, TREE_NODE *tmp )
+{
+	TREE_NODE *last = position->lastChildNode();
+
+	tmp->parent      = position;
+	tmp->nextSibling = 0;
+	tmp->setPrevSibling( last );
+
+	if( last != 0 )
+	{
+		last->nextSibling = tmp;
+	}
+	else
+	{
+		position->firstChild = tmp;
+	}
+	position->setLastChild( tmp );
+	attached( tmp );
+}
+
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+void Tree< T, TreeNodeAllocator_, TreePolicy_ >::linkFirstChild( TREE_NODE *position, TREE_NODE *tmp )
+{
+	tmp->parent      = position;
+	tmp->nextSibling = position->firstChild;
+	tmp->setPrevSibling( 0 );
+
+	if( position->firstChild != 0 )
+	{
+		position->firstChild->setPrevSibling( tmp );
+	}
+	else
+	{
+		position->setLastChild( tmp );
+	}
+	position->firstChild = tmp;
+	attached( tmp );
+}
+
+// position may be feet, which puts tmp at the end of the top level.
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+void Tree< T, TreeNodeAllocator_, TreePolicy_ >::linkBefore( TREE_NODE *position, TREE_NODE *tmp )
+{
+	TREE_NODE *prev = prevSiblingOf( position );
+
+	tmp->parent      = position->parent;
+	tmp->nextSibling = position        ;
+	tmp->setPrevSibling( prev );
+
+	position->setPrevSibling( tmp );
+
+	if( prev == 0 )
+	{
+		if( tmp->parent )
+		{
+			tmp->parent->firstChild = tmp;
+		}
+	}
+	else
+	{
+		prev->nextSibling = tmp;
+	}
+	attached( tmp );
+}
+
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+void Tree< T, TreeNodeAllocator_, TreePolicy_ >::linkAfter( TREE_NODE *position, TREE_NODE *tmp )
+{
+	tmp->parent      = position->parent     ;
+	tmp->nextSibling = position->nextSibling;
+	tmp->setPrevSibling( position );
+
+	position->nextSibling = tmp;
+
+	if( tmp->nextSibling == 0 )
+	{
+		if( tmp->parent )
+		{
+			tmp->parent->setLastChild( tmp );
+		}
+	}
+	else
+	{
+		tmp->nextSibling->setPrevSibling( tmp );
+	}
+	attached( tmp );
+}
+
+// Takes the subtree below node out of its sibling list. The links of node
+// itself are left as they were.
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+void Tree< T, TreeNodeAllocator_, TreePolicy_ >::unlinkNode( TREE_NODE *node )
+{
+	detaching( node );
+
+	TREE_NODE *prev = prevSiblingOf( node );
+
+	if( prev == 0 )
+	{
+		node->parent->firstChild = node->nextSibling;
+	}
+	else
+	{
+		prev->nextSibling = node->nextSibling;
+	}
+
+	if( node->nextSibling == 0 )
+	{
+		node->parent->setLastChild( prev );
+	}
+	else
+	{
+		node->nextSibling->setPrevSibling( prev );
+	}
+}
+
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+void Tree< T, TreeNodeAllocator_, TreePolicy_ >::attached( TREE_NODE *node )
+{
+	this->orderChanged();
+	this->labelsChanged( node->parent );
+	hashChanged( node->parent );
+	if( node->parent != 0 )
+	{
+		node->parent->childLinked( node );
+	}
+	if( TreePolicy_::leafChain )
+	{
+		// the top level always ends in feet, so only a last child can lack
+		// a next sibling
+		TREE_NODE *prev;
+		TREE_NODE *next;
+		if( node->nextSibling != 0 )
+		{
+			next = node->nextSibling->firstLeaf();
+			prev = next->leftLeafNode();
+		}
+		else if( node->parent->firstChild != node )
+		{
+			prev = node->parent->rightLeafNode();
+			next = prev->rightLeafNode();
+		}
+		else
+		{
+			// the parent was a leaf until now
+			prev = node->parent->leftLeafNode();
+			next = node->parent->rightLeafNode();
+		}
+		joinLeaves( prev, node->firstLeaf() );
+		joinLeaves( node->lastLeaf(), next );
+		leafBoundsChanged( node, node->firstLeaf(), node->lastLeaf() );
+	}
+	if( TreePolicy_::levelLinks )
+	{
+		threadLevels( node, node );
+	}
+	if( TreePolicy_::subtreeSizes )
+	{
+		ptrdiff_t n = node->subtreeSize();
+		for( TREE_NODE *it = node->parent; it != 0; it = it->parent )
+		{
+			it->growSubtree( n );
+		}
+	}
+}
+
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+void Tree< T, TreeNodeAllocator_, TreePolicy_ >::detaching( TREE_NODE *node )
+{
+	this->orderChanged();
+	this->labelsChanged( node->parent );
+	hashChanged( node->parent );
+	if( node->parent != 0 )
+	{
+		node->parent->childUnlinked( node );
+	}
+	if( TreePolicy_::leafChain )
+	{
+		// the leaves below node keep their links among themselves
+		TREE_NODE *prev   = leafBefore( node );
+		TREE_NODE *next   = leafAfter(  node );
+		TREE_NODE *parent = node->parent;
+		if( parent != 0 && parent->firstChild == node && node->nextSibling == 0 )
+		{
+			// the parent turns into a leaf
+			joinLeaves( prev, parent );
+			joinLeaves( parent, next );
+			leafBoundsChanged( parent, parent, parent );
+		}
+		else
+		{
+			joinLeaves( prev, next );
+			leafBoundsChanged( node, next, prev );
+		}
+	}
+	if( TreePolicy_::levelLinks )
+	{
+		unthreadLevels( node, node );
+	}
+	if( TreePolicy_::subtreeSizes )
+	{
+		ptrdiff_t n = node->subtreeSize();
+		for( TREE_NODE *it = node->parent; it != 0; it = it->parent )
+		{
+			it->growSubtree( -n );
+		}
+	}
+}
+
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+typename Tree< T, TreeNodeAllocator_, TreePolicy_ >::TREE_NODE *Tree< T, TreeNodeAllocator_, TreePolicy_ >::leafBefore( TREE_NODE *node ) const
+{
+	return ( TreePolicy_::leafChain ? node->firstLeaf()->leftLeafNode() : 0 );
+}
+
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+typename Tree< T, TreeNodeAllocator_, TreePolicy_ >::TREE_NODE *Tree< T, TreeNodeAllocator_, TreePolicy_ >::leafAfter( TREE_NODE *node ) const
+{
+	return ( TreePolicy_::leafChain ? node->lastLeaf()->rightLeafNode() : 0 );
+}
+
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+void Tree< T, TreeNodeAllocator_, TreePolicy_ >::joinLeaves( TREE_NODE *prev, TREE_NODE *next )
+{
+	prev->setRightLeaf( next );
+	next->setLeftLeaf(  prev );
+}
+
+// A 0 for first or last leaves that bound alone.
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+void Tree< T, TreeNodeAllocator_, TreePolicy_ >::leafBoundsChanged( TREE_NODE *node, TREE_NODE *first, TREE_NODE *last )
+{
+	bool leftmost  = first != 0;
+	bool rightmost = last  != 0;
+	for( TREE_NODE *it = node->parent; it != 0; node = it, it = it->parent )
+	{
+		leftmost  = leftmost  && it->firstChild   == node;
+		rightmost = rightmost && node->nextSibling == 0  ;
+		if( !leftmost && !rightmost )
+		{
+			break;
+		}
+		if( leftmost )
+		{
+			it->setLeftLeaf( first );
+		}
+		if( rightmost )
+		{
+			it->setRightLeaf( last );
+		}
+	}
+}
+
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+void Tree< T, TreeNodeAllocator_, TreePolicy_ >::rethreadLeaves( TREE_NODE *first, TREE_NODE *last, TREE_NODE *prev, TREE_NODE *next )
+{
+	for( TREE_NODE *it = first; ; it = it->nextSibling )
+	{
+		joinLeaves( prev, it->firstLeaf() );
+		prev = it->lastLeaf();
+		if( it == last )
+		{
+			break;
+		}
+	}
+	joinLeaves( prev, next );
+	leafBoundsChanged( first, first->firstLeaf(), 0 );
+	leafBoundsChanged( last, 0, last->lastLeaf() );
+}
+
+// The first node with children from the left and the last from the right
+// of the stretch give the bounds of the stretch below.
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+void Tree< T, TreeNodeAllocator_, TreePolicy_ >::levelBelow( TREE_NODE *&first, TREE_NODE *&last ) const
+{
+	while( first->firstChild == 0 )
+	{
+		if( first == last )
+		{
+			first = 0;
+			last  = 0;
+			return;
+		}
+		first = first->nextAtDepthNode();
+	}
+	while( last->firstChild == 0 )
+	{
+		last = last->prevAtDepthNode();
+	}
+	first = first->firstChild    ;
+	last  = last->lastChildNode();
+}
+
+// Walks the range level by level, each stretch serving as the queue for
+// the next, so no memory is needed beyond the links themselves.
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+void Tree< T, TreeNodeAllocator_, TreePolicy_ >::linkLevels( TREE_NODE *first, TREE_NODE *last )
+{
+	TREE_NODE *prev = 0;
+	for( TREE_NODE *it = first; ; it = it->nextSibling )
+	{
+		it->setPrevAtDepth( prev );
+		if( prev != 0 )
+		{
+			prev->setNextAtDepth( it );
+		}
+		prev = it;
+		if( it == last )
+		{
+			break;
+		}
+	}
+
+	while( first != 0 )
+	{
+		TREE_NODE *below = 0;
+		prev = 0;
+		for( TREE_NODE *it = first; ; it = it->nextAtDepthNode() )
+		{
+			for( TREE_NODE *child = it->firstChild; child != 0; child = child->nextSibling )
+			{
+				child->setPrevAtDepth( prev );
+				if( prev != 0 )
+				{
+					prev->setNextAtDepth( child );
+				}
+				else
+				{
+					below = child;
+				}
+				prev = child;
+			}
+			if( it == last )
+			{
+				break;
+			}
+		}
+		first = below;
+		last  = prev ;
+	}
+}
+
+// The stretches must be linked among themselves, their outer links are
+// overwritten. On each level the neighbours are the children of the
+// nearest nodes with children on either side of the neighbours one level
+// up; both sides are searched in step so that the cost is that of the
+// shorter search.
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+void Tree< T, TreeNodeAllocator_, TreePolicy_ >::threadLevels( TREE_NODE *first, TREE_NODE *last )
+{
+	TREE_NODE *prev = 0;
+	TREE_NODE *next = 0;
+
+	if( last->nextSibling != 0 && last->nextSibling != feet )
+	{
+		next = last->nextSibling;
+		prev = next->prevAtDepthNode();
+	}
+	else if( ( prev = prevSiblingOf( first ) ) != 0 && prev != head )
+	{
+		next = prev->nextAtDepthNode();
+	}
+	else if( first->parent != 0 )
+	{
+		// no siblings outside the range, look around the parent instead
+		prev = first->parent->prevAtDepthNode();
+		next = first->parent->nextAtDepthNode();
+		goto below;
+	}
+	else
+	{
+		prev = 0;
+	}
+
+	for( ; ; )
+	{
+		first->setPrevAtDepth( prev );
+		last->setNextAtDepth(  next );
+		if( prev != 0 )
+		{
+			prev->setNextAtDepth( first );
+		}
+		if( next != 0 )
+		{
+			next->setPrevAtDepth( last );
+		}
+
+		levelBelow( first, last );
+		if( first == 0 )
+		{
+			return;
+		}
+below:
+		while( prev != 0 && prev->firstChild == 0 && next != 0 && next->firstChild == 0 )
+		{
+			prev = prev->prevAtDepthNode();
+			next = next->nextAtDepthNode();
+		}
+		while( prev != 0 && prev->firstChild == 0 && next == 0 )
+		{
+			prev = prev->prevAtDepthNode();
+		}
+		while( next != 0 && next->firstChild == 0 && prev == 0 )
+		{
+			next = next->nextAtDepthNode();
+		}
+
+		if( prev != 0 && prev->firstChild != 0 )
+		{
+			prev = prev->lastChildNode();
+			next = prev->nextAtDepthNode();
+		}
+		else if( next != 0 )
+		{
+			next = next->firstChild;
+			prev = next->prevAtDepthNode();
+		}
+	}
+}
+
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+void Tree< T, TreeNodeAllocator_, TreePolicy_ >::unthreadLevels( TREE_NODE *first, TREE_NODE *last )
+{
+	while( first != 0 )
+	{
+		TREE_NODE *prev = first->prevAtDepthNode();
+		TREE_NODE *next = last->nextAtDepthNode() ;
+		if( prev != 0 )
+		{
+			prev->setNextAtDepth( next );
+		}
+		if( next != 0 )
+		{
+			next->setPrevAtDepth( prev );
+		}
+		levelBelow( first, last );
+	}
+}
+
+// Frees everything below node without touching the subtree sizes, node is
+// left childless.
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+void Tree< T, TreeNodeAllocator_, TreePolicy_ >::destroyChildren( TREE_NODE *top )
+{
+	// post-order walk without recursion or a stack: a node is destroyed once
+	// it has no children left, and a parent whose last child went is marked
+	// childless so that it is destroyed next
+	TREE_NODE *cur = top->firstChild;
+
+	while( cur != 0 )
+	{
+		while( cur->firstChild != 0 )
+		{
+			cur = cur->firstChild;
+		}
+
+		TREE_NODE *next = cur->nextSibling;
+		if( next == 0 )
+		{
+			next = cur->parent;
+			next->firstChild = 0;
+			if( next == top )
+			{
+				next = 0;
+			}
+		}
+
+		destroyNode( cur );
+		cur = next;
+	}
+	top->firstChild = 0;
+	top->setLastChild( 0 );
+	top->childrenChanged( -( ptrdiff_t )top->childCount() );
+}
+
+//////////////////////////////////////////////////////////////////////////
+// IteratorBase
+//////////////////////////////////////////////////////////////////////////
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+Tree< T, TreeNodeAllocator_, TreePolicy_ >::iteratorBase::iteratorBase()
+: node( 0 ), skipCurrentChildren( false )
+{
+}
+
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+Tree< T, TreeNodeAllocator_, TreePolicy_ >::iteratorBase::iteratorBase( TREE_NODE *tn )
+: node( tn ), skipCurrentChildren( false )
+{
+}
+
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+T& Tree< T, TreeNodeAllocator_, TreePolicy_ >::iteratorBase::operator*() const
+{
+    return node->data;
+}
+
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+T* Tree< T, TreeNodeAllocator_, TreePolicy_ >::iteratorBase::operator->() const
+{
+    return &( node->data );
+}
+
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+void Tree< T, TreeNodeAllocator_, TreePolicy_ >::iteratorBase::skipChildren()
+{
+    skipCurrentChildren = true;
+}
+
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+void Tree< T, TreeNodeAllocator_, TreePolicy_ >::iteratorBase::skipChildren( bool skip )
+{
+    skipCurrentChildren = skip;
+}
+
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+size_t Tree< T, TreeNodeAllocator_, TreePolicy_ >::iteratorBase::numberOfChildren() const
+{
+	if( TreePolicy_::childIndex )
+	{
+		return node->childCount();
+	}
+
+    TREE_NODE *pos = node->firstChild;
+	if( pos == 0 )
+		return 0;
+
+	size_t ret = 1;
+	while( ( pos = pos->nextSibling ) )
+	{
+	    ++ret;
+	}
+	return ret;
+}
+
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+typename Tree< T, TreeNodeAllocator_, TreePolicy_ >::siblingIterator Tree< T, TreeNodeAllocator_, TreePolicy_ >::iteratorBase::begin() const
+{
+    if( node->firstChild == 0 )
+		return end();
+
+	siblingIterator ret( node->firstChild );
+	ret.parent = this->node;
+	return ret;
+}
+
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+typename Tree< T, TreeNodeAllocator_, TreePolicy_ >::siblingIterator Tree< T, TreeNodeAllocator_, TreePolicy_ >::iteratorBase::end() const
+{
+    siblingIterator ret( 0 );
+	ret.parent = node;
+	return ret;
+}
+
+// PreOrderIterator
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+Tree< T, TreeNodeAllocator_, TreePolicy_ >::preOrderIterator::preOrderIterator()
+: iteratorBase( 0 )
+{
+}
+
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+Tree< T, TreeNodeAllocator_, TreePolicy_ >::preOrderIterator::preOrderIterator( TREE_NODE *tn )
+: iteratorBase( tn )
+{
+}
+
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+Tree< T, TreeNodeAllocator_, TreePolicy_ >::preOrderIterator::preOrderIterator( const iteratorBase& other )
+: iteratorBase( other.node )
+{
+}
+
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+Tree< T, TreeNodeAllocator_, TreePolicy_ >::preOrderIterator::preOrderIterator( const siblingIterator& other )
+: iteratorBase( other.node )
+{
+    if( this->node == 0 )
+	{
+        if( other.rangeLast() != 0 )
+		{
+			this->node = other.rangeLast();
+		}
+		else
+		{
+			this->node = other.parent;
+		}
+		this->skipChildren();
+		++( *this );
+	}
+}
+
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+bool Tree< T, TreeNodeAllocator_, TreePolicy_ >::preOrderIterator::operator==( const preOrderIterator& other ) const
+{
+	if( other.node == this->node )
+		return true;
+	else
+		return false;
+}
+
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+bool Tree< T, TreeNodeAllocator_, TreePolicy_ >::preOrderIterator::operator!=( const preOrderIterator& other ) const
+{
+    if( other.node != this->node )
+		return true;
+	else
+		return false;
+}
+
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+typename Tree< T, TreeNodeAllocator_, TreePolicy_ >::preOrderIterator& Tree< T, TreeNodeAllocator_, TreePolicy_ >::preOrderIterator::operator++()
+{
+    assert( this->node != 0 );
+	if( !this->skipCurrentChildren && this->node->firstChild != 0 )
+	{
+        this->node = this->node->firstChild;
+	}
+	else
+	{
+		this->skipCurrentChildren = false;
+		while( this->node->nextSibling == 0 )
+		{
+			this->node = this->node->parent;
+			if( this->node == 0 )
+			{
+				return *this;
+			}
+		}
+		this->node = this->node->nextSibling;
+	}
+	return *this;
+}
+
+template < class T, class TreeNodeAllocator_, class TreePolicy_ >
+typename Tree< T, TreeNodeAllocator_, TreePolicy_ >::preOrderIterator& Tree< T, TreeNodeAllocator_, TreePolicy_ >::preOrderIterator::operator--()
+{
+	assert( this->node != 0 );
+	if( this->node->prevSibling )
+	{
+		this->node = this->node->prevSibling;
+		while( this->node->lastChild )
+		{
+			this->node = this->node->lastChild;
+		}
+	}
+	else
+	{
+		this->node = this->node->parent;
+		if( this->node == 0 )
+		{
+			return *this;
+		}
+	}
+	return *this;
+}
+
+template < class T, class TreeNodeAllocator_, class TreePolicy_ >
+typename Tree< T, TreeNodeAllocator_, TreePolicy_ >::preOrderIterator Tree< T, TreeNodeAllocator_, TreePolicy_ >::preOrderIterator::operator++( int )
+{
+   preOrderIterator copy = *this;
+   ++( *this );
+   return copy;
+}
+
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+typename Tree< T, TreeNodeAllocator_, TreePolicy_ >::preOrderIterator Tree< T, TreeNodeAllocator_, TreePolicy_ >::preOrderIterator::operator--( int )
+{
+    preOrderIterator copy = *this;
+	--( *this );
+	return copy;
+}
+
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+typename Tree< T, TreeNodeAllocator_, TreePolicy_ >::preOrderIterator& Tree< T, TreeNodeAllocator_, TreePolicy_ >::preOrderIterator::operator+=( size_t num )
+{
+	if( TreePolicy_::subtreeSizes && num > 0 && !this->skipCurrentChildren )
+	{
+		// step into a subtree only when the target lies inside it,
+		// otherwise jump over it as a whole
+		while( num > 0 )
+		{
+			size_t n = this->node->subtreeSize();
+			if( num < n )
+			{
+				this->node = this->node->firstChild;
+				--num;
+				continue;
+			}
+
+			num -= n;
+			while( this->node->nextSibling == 0 )
+			{
+				this->node = this->node->parent;
+				if( this->node == 0 )
+				{
+					return ( *this );
+				}
+			}
+			this->node = this->node->nextSibling;
+		}
+		return ( *this );
+	}
+
+    while( num > 0 )
+	{
+		++( *this );
+		--num;
+	}
+	return ( *this );
+}
+
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+typename Tree< T, TreeNodeAllocator_, TreePolicy_ >::preOrderIterator& Tree< T, TreeNodeAllocator_, TreePolicy_ >::preOrderIterator::operator-=( size_t num )
+{
+    while( num > 0 )
+	{
+		--( *this );
+		--num;
+	}
+	return ( *this );
+}
+
+// PostOrderIterator
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+Tree< T, TreeNodeAllocator_, TreePolicy_ >::postOrderIterator::postOrderIterator()
+: iteratorBase( 0 )
+{
+}
+
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+Tree< T, TreeNodeAllocator_, TreePolicy_ >::postOrderIterator::postOrderIterator( TREE_NODE *tn )
+: iteratorBase( tn )
+{
+}
+
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+Tree< T, TreeNodeAllocator_, TreePolicy_ >::postOrderIterator::postOrderIterator( const iteratorBase& other )
+: iteratorBase( other.node )
+{
+}
+
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+Tree< T, TreeNodeAllocator_, TreePolicy_ >::postOrderIterator::postOrderIterator( const siblingIterator& other)
+: iteratorBase( other.node )
+{
+	if( this->node == 0 )
+	{
+		if( other.rangeLast() != 0 )
+		{
+			this->node = other.rangeLast();
+		}
+		else
+		{
+			this->node = other.parent;
+		}
+		this->skipChildren();
+		++( *this );
+	}
+}
+
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+bool Tree< T, TreeNodeAllocator_, TreePolicy_ >::postOrderIterator::operator==( const postOrderIterator& other ) const
+{
+	if( other.node == this->node )
+		return true;
+	else
+		return false;
+}
+
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+bool Tree< T, TreeNodeAllocator_, TreePolicy_ >::postOrderIterator::operator!=( const postOrderIterator& other ) const
+{
+	if( other.node != this->node )
+		return true;
+	else
+		return false;
+}
+
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+typename Tree< T, TreeNodeAllocator_, TreePolicy_ >::postOrderIterator& Tree< T, TreeNodeAllocator_, TreePolicy_ >::postOrderIterator::operator++()
+{
+    assert( this->node != 0 );
+	if( this->node->nextSibling == 0 )
+	{
+		this->node = this->node->parent;
+		this->skipCurrentChildren = false;
+	}
+	else
+	{
+		this->node = this->node->nextSibling;
+		if( this->skipCurrentChildren )
+		{
+			this->skipCurrentChildren = false;
+		}
+		else
+		{
+			while( this->node->firstChild )
+			{
+				this->node = this->node->firstChild;
+			}
+		}	
+	}
+	return *this;
+}
+
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+typename Tree< T, TreeNodeAllocator_, TreePolicy_ >::postOrderIterator& Tree< T, TreeNodeAllocator_, TreePolicy_ >::postOrderIterator::operator--()
+{
+	assert( this->node != 0 );
+	if( this->skipCurrentChildren || this->node->lastChild == 0 )
+	{
+		this->skipCurrentChildren = false;
+		while( this->node->prevSibling == 0 )
+		{
+			this->node = this->node->parent;
+		}
+		this->node = this->node->prevSibling;
+	}
+	else
+	{
+		this->node = this->node->lastChild;
+	}
+	return *this;
+}
+
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+typename Tree< T, TreeNodeAllocator_, TreePolicy_ >::postOrderIterator Tree< T, TreeNodeAllocator_, TreePolicy_ >::postOrderIterator::operator++( int )
+{
+    postOrderIterator copy = *this;
+	++( *this );
+	return copy;
+}
+
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+typename Tree< T, TreeNodeAllocator_, TreePolicy_ >::postOrderIterator Tree< T, TreeNodeAllocator_, TreePolicy_ >::postOrderIterator::operator--( int )
+{
+    postOrderIterator copy = *this;
+	--( *this );
+	return copy;
+}
+
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+typename Tree< T, TreeNodeAllocator_, TreePolicy_ >::postOrderIterator& Tree< T, TreeNodeAllocator_, TreePolicy_ >::postOrderIterator::operator+=( size_t num )
+{
+    while( num > 0 )
+	{
+		++( *this );
+		--num;
+	}
+	return ( *this );
+}
+
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+typename Tree< T, TreeNodeAllocator_, TreePolicy_ >::postOrderIterator& Tree< T, TreeNodeAllocator_, TreePolicy_ >::postOrderIterator::operator-=( size_t num )
+{
+    while( num > 0 )
+	{
+		--( *this );
+		--num;
+	}
+	return ( *this );
+}
+
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+void Tree< T, TreeNodeAllocator_, TreePolicy_ >::postOrderIterator::descendAll()
+{
+	assert( this->node != 0 );
+	while( this->node->firstChild )
+	{
+		this->node = this->node->firstChild;
+	}
+}
+
+// BreadthFirstQueuedIterator
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+Tree< T, TreeNodeAllocator_, TreePolicy_ >::breadthFirstQueuedIterator::breadthFirstQueuedIterator()
+: iteratorBase(), position( 0 )
+{
+}
+
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+Tree< T, TreeNodeAllocator_, TreePolicy_ >::breadthFirstQueuedIterator::breadthFirstQueuedIterator( TREE_NODE *tn )
+: iteratorBase( tn ), position( 0 )
+{
+	start( tn );
+}
+
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+Tree< T, TreeNodeAllocator_, TreePolicy_ >::breadthFirstQueuedIterator::breadthFirstQueuedIterator( const iteratorBase& other )
+: iteratorBase( other.node ), position( 0 )
+{
+	start( other.node );
+}
+
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+void Tree< T, TreeNodeAllocator_, TreePolicy_ >::breadthFirstQueuedIterator::start( TREE_NODE *tn )
+{
+	if( tn == 0 )
+		return;
+
+	queue = std::make_shared< traversalQueue >();
+	queue->nodes.push_back( tn );
+	queue->first    = 0;
+	queue->expanded = 0;
+}
+
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+bool Tree< T, TreeNodeAllocator_, TreePolicy_ >::breadthFirstQueuedIterator::operator==( const breadthFirstQueuedIterator& other ) const
+{
+	if( other.node == this->node )
+		return true;
+	else
+		return false;
+}
+
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+bool Tree< T, TreeNodeAllocator_, TreePolicy_ >::breadthFirstQueuedIterator::operator!=( const breadthFirstQueuedIterator& other ) const
+{
+	if( other.node != this->node )
+		return true;
+	else
+		return false;
+}
+
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+typename Tree< T, TreeNodeAllocator_, TreePolicy_ >::breadthFirstQueuedIterator& Tree< T, TreeNodeAllocator_, TreePolicy_ >::breadthFirstQueuedIterator::operator++()
+{
+	assert( this->node != 0 );
+	assert( queue );
+
+	traversalQueue& q = *queue;
+	++position;
+
+	// Queue children only once the window runs dry, so a node is expanded
+	// at most once however many copies walk past it.
+	while( position - q.first >= q.nodes.size() && q.expanded < q.first + q.nodes.size() )
+	{
+		for( TREE_NODE *child = q.nodes[ q.expanded - q.first ]->firstChild; child != 0; child = child->nextSibling )
+			q.nodes.push_back( child );
+		++q.expanded;
+	}
+
+	if( position - q.first < q.nodes.size() )
+		this->node = q.nodes[ position - q.first ];
+	else
+		this->node = 0;
+
+	// Nobody else can look back; drop the prefix that is both passed and
+	// expanded once it outweighs the rest, keeping the window about as wide
+	// as the widest level.
+	if( queue.use_count() == 1 )
+	{
+		size_t consumed = std::min( position, q.expanded ) - q.first;
+		if( consumed >= 64 && consumed * 2 >= q.nodes.size() )
+		{
+			q.nodes.erase( q.nodes.begin(), q.nodes.begin() + consumed );
+			q.first += consumed;
+		}
+	}
+
+	if( this->node == 0 )
+		queue.reset();
+
+	return ( *this );
+}
+
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+typename Tree< T, TreeNodeAllocator_, TreePolicy_ >::breadthFirstQueuedIterator Tree< T, TreeNodeAllocator_, TreePolicy_ >::breadthFirstQueuedIterator::operator++( int )
+{
+    breadthFirstQueuedIterator copy = *this;
+	++( *this );
+	return copy;
+}
+
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+typename Tree< T, TreeNodeAllocator_, TreePolicy_ >::breadthFirstQueuedIterator& Tree< T, TreeNodeAllocator_, TreePolicy_ >::breadthFirstQueuedIterator::operator+=( size_t num )
+{
+   while( num > 0 )
+   {
+       ++( *this );
+	   --num;
+   }
+   return ( *this );
+}
+
+// FixedDepthIterator
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+Tree< T, TreeNodeAllocator_, TreePolicy_ >::fixedDepthIterator::fixedDepthIterator()
+: iteratorBase(), topNode( 0 ), firstNode( 0 ), lastNode( 0 )
+{
+}
+
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+Tree< T, TreeNodeAllocator_, TreePolicy_ >::fixedDepthIterator::fixedDepthIterator( TREE_NODE *tn )
+: iteratorBase( tn ), topNode( 0 ), firstNode( 0 ), lastNode( 0 )
+{
+}
+
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+Tree< T, TreeNodeAllocator_, TreePolicy_ >::fixedDepthIterator::fixedDepthIterator( const iteratorBase& other )
+: iteratorBase( other.node ), topNode( 0 ), firstNode( 0 ), lastNode( 0 )
+{
+}
+
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+Tree< T, TreeNodeAllocator_, TreePolicy_ >::fixedDepthIterator::fixedDepthIterator( const siblingIterator& other )
+: iteratorBase( other.node ), topNode( 0 ), firstNode( 0 ), lastNode( 0 )
+{
+}
+
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+Tree< T, TreeNodeAllocator_, TreePolicy_ >::fixedDepthIterator::fixedDepthIterator( const fixedDepthIterator& other )
+: iteratorBase( other.node ), topNode( other.topNode ), firstNode( other.firstNode ), lastNode( other.lastNode )
+{
+}
+
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+bool Tree< T, TreeNodeAllocator_, TreePolicy_ >::fixedDepthIterator::operator==( const fixedDepthIterator& other ) const
+{
+	if( other.node == this->node && other.topNode == topNode )
+		return true;
+	else
+		return false;
+}
+
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+bool Tree< T, TreeNodeAllocator_, TreePolicy_ >::fixedDepthIterator::operator!=( const fixedDepthIterator& other ) const
+{
+	if( other.node != this->node || other.topNode != topNode )
+		return true;
+	else
+		return false;
+}
+
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+typename Tree< T, TreeNodeAllocator_, TreePolicy_ >::fixedDepthIterator& Tree< T, TreeNodeAllocator_, TreePolicy_ >::fixedDepthIterator::operator++()
+{
+	assert( this->node != 0 );
+
+	if( TreePolicy_::levelLinks )
+	{
+		this->node = ( this->node == lastNode ? 0 : this->node->nextAtDepthNode() );
+		return *this;
+	}
+	if( this->node == this->topNode )
+	{
+		this->node = 0;
+		return *this;
+	}
+
+	if( this->node->nextSibling )
+	{
+        this->node = this->node->nextSibling;
+	}
+	else
+	{
+		int relativeDepth = 0;
+upper:
+		do
+		{
+			if( this->node == this->topNode )
+			{
+				this->node = 0;
+				return *this;
+			}
+            this->node = this->node->parent;
+			if( this->node == 0 )
+				return *this;
+			--relativeDepth;
+		}while( this->node->nextSibling == 0 || this->node == this->topNode );
+lower:
+		this->node = this->node->nextSibling;
+		while( this->node->firstChild == 0 )
+		{
+			if( this->node->nextSibling == 0 )
+				goto upper;
+			this->node = this->node->nextSibling;
+			if( this->node == 0 )
+				return *this;
+		}
+		while( relativeDepth < 0 && this->node->firstChild != 0 )
+		{
+			this->node = this->node->firstChild;
+			++relativeDepth;
+		}
+		if( relativeDepth < 0 )
+		{
+            if( this->node->nextSibling == 0 )
+				goto upper;
+			else
+				goto lower;
+		}
+	}
+	return *this;
+}
+
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+typename Tree< T, TreeNodeAllocator_, TreePolicy_ >::fixedDepthIterator& Tree< T, TreeNodeAllocator_, TreePolicy_ >::fixedDepthIterator::operator--()
+{
+	assert( this->node != 0 );
+
+	if( TreePolicy_::levelLinks )
+	{
+		this->node = ( this->node == firstNode ? 0 : this->node->prevAtDepthNode() );
+		return *this;
+	}
+	if( this->node == this->topNode )
+	{
+		this->node = 0;
+		return *this;
+	}
+
+	if( this->node->prevSibling )
+	{
+		this->node = this->node->prevSibling;
+	}
+	else
+	{
+		int relativeDepth = 0;
+upper:
+		do 
+		{
+            if( this->node == this->topNode )
+			{
+				this->node = 0;
+				return *this;
+			}
+			this->node = this->node->parent;
+			if( this->node == 0 )
+				return *this;
+			--relativeDepth;
+		} while( this->node->prevSibling == 0 || this->node == this->topNode );
+lower:
+		this->node = this->node->prevSibling;
+		while( this->node->lastChild == 0 )
+		{
+			if( this->node->prevSibling == 0 )
+				goto upper;
+			this->node = this->node->prevSibling;
+			if( this->node == 0 )
+				return *this;
+		}
+		while( relativeDepth < 0 && this->node->lastChild != 0 )
+		{
+            this->node = this->node->lastChild;
+			++relativeDepth;
+		}
+		if( relativeDepth < 0 )
+		{
+			if( this->node->prevSibling == 0 )
+				goto upper;
+			else
+				goto lower;
+		}
+	}
+	return *this;
+}
+
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+typename Tree< T, TreeNodeAllocator_, TreePolicy_ >::fixedDepthIterator Tree< T, TreeNodeAllocator_, TreePolicy_ >::fixedDepthIterator::operator++( int )
+{
+	fixedDepthIterator copy = *this;
+	++( *this );
+	return copy;
+}
+
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+typename Tree< T, TreeNodeAllocator_, TreePolicy_ >::fixedDepthIterator Tree< T, TreeNodeAllocator_, TreePolicy_ >::fixedDepthIterator::operator--( int )
+{
+	fixedDepthIterator copy = *this;
+	--( *this );
+	return copy;
+}
+
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+typename Tree< T, TreeNodeAllocator_, TreePolicy_ >::fixedDepthIterator& Tree< T, TreeNodeAllocator_, TreePolicy_ >::fixedDepthIterator::operator+=( size_t num )
+{
+	while( num > 0 )
+	{
+		++( *this );
+		--num;
+	}
+	return ( *this );
+}
+
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+typename Tree< T, TreeNodeAllocator_, TreePolicy_ >::fixedDepthIterator& Tree< T, TreeNodeAllocator_, TreePolicy_ >::fixedDepthIterator::operator-=( size_t num )
+{
+	while( num > 0 )
+	{
+		--( *this );
+		--num;
+	}
+	return ( *this );
+}
+
+// SiblingIterator
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+Tree< T, TreeNodeAllocator_, TreePolicy_ >::siblingIterator::siblingIterator()
+: iteratorBase()
+{
+	setParent();
+}
+
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+Tree< T, TreeNodeAllocator_, TreePolicy_ >::siblingIterator::siblingIterator( TREE_NODE *tn )
+: iteratorBase( tn )
+{
+    setParent();
+}
+
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+Tree< T, TreeNodeAllocator_, TreePolicy_ >::siblingIterator::siblingIterator( const iteratorBase& other )
+: iteratorBase( other.node )
+{
+	setParent();
+}
+
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+bool Tree< T, TreeNodeAllocator_, TreePolicy_ >::siblingIterator::operator==( const siblingIterator& other ) const
+{
+	if( other.node == this->node )
+	{
+		return true;
+	}
+	else
+	{
+		return false;
+	}
+}
+
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+bool Tree< T, TreeNodeAllocator_, TreePolicy_ >::siblingIterator::operator!=( const siblingIterator& other ) const
+{
+    if( other.node != this->node )
+	{
+		return true;
+	}
+	else
+	{
+        return false;
+	}
+}
+
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+typename Tree< T, TreeNodeAllocator_, TreePolicy_ >::siblingIterator& Tree< T, TreeNodeAllocator_, TreePolicy_ >::siblingIterator::operator++()
+{
+    if( this->node )
+		this->node = this->node->nextSibling;
+	return *this;
+}
 
-    while( it != other.end() )
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+typename Tree< T, TreeNodeAllocator_, TreePolicy_ >::siblingIterator& Tree< T, TreeNodeAllocator_, TreePolicy_ >::siblingIterator::operator--()
+{
+    if( this->node )
+		this->node = this->node->prevSibling;
+	else
 	{
-		to = insert( to, ( *it ) );
-		it.skipChildren();
-		++it;
+		assert( parent );
+		this->node = parent->lastChild;
+	}
+
+	return *this;
+}
+
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+typename Tree< T, TreeNodeAllocator_, TreePolicy_ >::siblingIterator Tree< T, TreeNodeAllocator_, TreePolicy_ >::siblingIterator::operator++( int )
+{
+    siblingIterator copy = *this;
+	++( *this );
+	return copy;
+}
+
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+typename Tree< T, TreeNodeAllocator_, TreePolicy_ >::siblingIterator Tree< T, TreeNodeAllocator_, TreePolicy_ >::siblingIterator::operator--( int )
+{
+    siblingIterator copy = *this;
+	--( *this );
+	return copy;
+}
+
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+typename Tree< T, TreeNodeAllocator_, TreePolicy_ >::siblingIterator& Tree< T, TreeNodeAllocator_, TreePolicy_ >::siblingIterator::operator+=( size_t num )
+{
+	while( num > 0 )
+	{
+		++( *this );
+		--num;
 	}
-	to = begin();
-	it = other.begin();
+	return ( *this );
+}
 
-	while( it != other.end() )
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+typename Tree< T, TreeNodeAllocator_, TreePolicy_ >::siblingIterator& Tree< T, TreeNodeAllocator_, TreePolicy_ >::siblingIterator::operator-=( size_t num )
+{
+    while( num > 0 )
 	{
-        to.replace( to, it );
-		to.skipChildren();
-		it.skipChildren();
-		++to;
-		++it;
+		--( *this );
+		--num;
+	}
+	return ( *this );
+}
+
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+typename Tree< T, TreeNodeAllocator_, TreePolicy_ >::TREE_NODE *Tree< T, TreeNodeAllocator_, TreePolicy_ >::siblingIterator::rangeFirst() const
+{
+    TREE_NODE *tmp = parent->firstChild;
+	return tmp;
+}
+
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+typename Tree< T, TreeNodeAllocator_, TreePolicy_ >::TREE_NODE *Tree< T, TreeNodeAllocator_, TreePolicy_ >::siblingIterator::rangeLast() const
+{
+    return parent->lastChildNode();
+}
+
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+void Tree< T, TreeNodeAllocator_, TreePolicy_ >::siblingIterator::setParent()
+{
+	parent = 0;
+	if( this->node == 0 )
+		return;
+	if( this->node->parent != 0 )
+		parent = this->node->parent;
+}
+
+// LeafIterator
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+Tree< T, TreeNodeAllocator_, TreePolicy_ >::leafIterator::leafIterator()
+: iteratorBase( 0 ), topNode( 0 )
+{
+}
+
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+Tree< T, TreeNodeAllocator_, TreePolicy_ >::leafIterator::leafIterator( TREE_NODE *tn, TREE_NODE *top )
+: iteratorBase( tn ), topNode( top )
+{
+}
+
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+Tree< T, TreeNodeAllocator_, TreePolicy_ >::leafIterator::leafIterator( const iteratorBase& other )
+: iteratorBase( other.node ), topNode( 0 )
+{
+}
+
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+Tree< T, TreeNodeAllocator_, TreePolicy_ >::leafIterator::leafIterator( const siblingIterator& other )
+: iteratorBase( other.node ), topNode( 0 )
+{
+    if( this->node == 0 )
+	{
+	    if( other.rangeLast() != 0 )
+			this->node = other.rangeLast();
+		else
+			this->node = other.parent;
+		++( *this );
+	}
+}
+
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+bool Tree< T, TreeNodeAllocator_, TreePolicy_ >::leafIterator::operator==( const leafIterator& other ) const
+{
+	if( other.node == this->node && other.topNode == this->topNode )
+	{
+		return true;
+	}
+	else
+	{
+		return false;
+	}
+}
+
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+bool Tree< T, TreeNodeAllocator_, TreePolicy_ >::leafIterator::operator!=( const leafIterator& other ) const
+{
+    if( other.node != this->node )
+	{
+		return true;
+	}
+	else
+	{
+		return false;
+	}
+}
+
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+typename Tree< T, TreeNodeAllocator_, TreePolicy_ >::leafIterator& Tree< T, TreeNodeAllocator_, TreePolicy_ >::leafIterator::operator++()
+{
+	assert( this->node != 0 );
+	if( TreePolicy_::leafChain )
+	{
+		// end( top ) is the leaf after the last one below top
+		if( this->node->firstChild != 0 )
+			this->node = this->node->firstLeaf();
+		else
+			this->node = this->node->rightLeafNode();
+		return *this;
+	}
+	if( this->node->firstChild != 0 )
+	{
+		while( this->node->firstChild )
+		{
+			this->node = this->node->firstChild;
+		}
+	}
+	else
+	{
+	    while( this->node->nextSibling == 0 )
+		{
+			if( this->node->parent == 0 )
+				return *this;
+			this->node = this->node->parent;
+			if( topNode != 0 && this->node == topNode )
+				return *this;
+		}
+		this->node = this->node->nextSibling;
+		while( this->node->firstChild )
+			this->node = this->node->firstChild;
+	}
+	return *this;
+}
+
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+typename Tree< T, TreeNodeAllocator_, TreePolicy_ >::leafIterator& Tree< T, TreeNodeAllocator_, TreePolicy_ >::leafIterator::operator--()
+{
+    assert( this->node != 0 );
+	if( TreePolicy_::leafChain )
+	{
+		if( this->node->firstChild != 0 )
+			this->node = this->node->firstLeaf();
+		this->node = this->node->leftLeafNode();
+		return *this;
+	}
+	while( this->node->prevSibling == 0 )
+	{
+		if( this->node->parent == 0 )
+			return *this;
+		this->node = this->node->parent;
+		if( topNode != 0 && this->node == topNode )
+			return *this;
+	}
+	this->node = this->node->prevSibling;
+
+	while( this->node->lastChild )
+	{
+		this->node = this->node->lastChild;
+	}
+
+	return *this;
+}
+
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+typename Tree< T, TreeNodeAllocator_, TreePolicy_ >::leafIterator Tree< T, TreeNodeAllocator_, TreePolicy_ >::leafIterator::operator++( int )
+{
+    leafIterator copy = *this;
+	++( *this );
+	return copy;
+}
+
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+typename Tree< T, TreeNodeAllocator_, TreePolicy_ >::leafIterator Tree< T, TreeNodeAllocator_, TreePolicy_ >::leafIterator::operator--( int )
+{
+    leafIterator copy = *this;
+	--( *this );
+	return copy;
+}
+
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+typename Tree< T, TreeNodeAllocator_, TreePolicy_ >::leafIterator& Tree< T, TreeNodeAllocator_, TreePolicy_ >::leafIterator::operator+=( size_t num )
+{
+    while( num > 0 )
+	{
+		++( *this );
+		--num;
+	}
+	return ( *this );
+}
+
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+typename Tree< T, TreeNodeAllocator_, TreePolicy_ >::leafIterator& Tree< T, TreeNodeAllocator_, TreePolicy_ >::leafIterator::operator-=( size_t num )
+{
+	while( num > 0 )
+	{
+		--( *this );
+		--num;
 	}
+	return ( *this );
 }
 
 //////////////////////////////////////////////////////////////////////////
-// IteratorBase
+/// Methods for Tree Class
 //////////////////////////////////////////////////////////////////////////
-template< class T, class TreeNodeAllocator_ >
-Tree< T, TreeNodeAllocator_ >::iteratorBase::iteratorBase()
-: node( 0 ), skipCurrentChildren( false )
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+typename Tree< T, TreeNodeAllocator_, TreePolicy_ >::preOrderIterator Tree< T, TreeNodeAllocator_, TreePolicy_ >::begin() const
 {
+	return preOrderIterator( head->nextSibling );
 }
 
-template< class T, class TreeNodeAllocator_ >
-Tree< T, TreeNodeAllocator_ >::iteratorBase::iteratorBase( TREE_NODE *tn )
-: node( tn ), skipCurrentChildren( false )
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+typename Tree< T, TreeNodeAllocator_, TreePolicy_ >::preOrderIterator Tree< T, TreeNodeAllocator_, TreePolicy_ >::end() const
+{
+    return preOrderIterator( feet );
+}
+
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+typename Tree< T, TreeNodeAllocator_, TreePolicy_ >::postOrderIterator Tree< T, TreeNodeAllocator_, TreePolicy_ >::beginPost() const
+{
+    TREE_NODE *tmp = head->nextSibling;
+	if( tmp != feet )
+	{
+		while( tmp->firstChild )
+		{
+			tmp = tmp->firstChild;
+		}
+	}
+	return postOrderIterator( tmp );
+}
+
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+typename Tree< T, TreeNodeAllocator_, TreePolicy_ >::postOrderIterator Tree< T, TreeNodeAllocator_, TreePolicy_ >::endPost() const
+{
+    return postOrderIterator( feet );
+}
+
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+typename Tree< T, TreeNodeAllocator_, TreePolicy_ >::fixedDepthIterator Tree< T, TreeNodeAllocator_, TreePolicy_ >::beginFixed( const iteratorBase& pos, size_t dp ) const
 {
+	typename Tree< T, TreeNodeAllocator_, TreePolicy_ >::fixedDepthIterator ret;
+	ret.topNode = pos.node;
+
+	if( TreePolicy_::levelLinks )
+	{
+		// the nodes dp levels below pos are a stretch of that level's list
+		TREE_NODE *first = pos.node;
+		TREE_NODE *last  = pos.node;
+		for( size_t level = 0; level < dp && first != 0; ++level )
+		{
+			levelBelow( first, last );
+		}
+		if( first == 0 )
+		{
+			throw std::range_error( "tree: beginFixed out of range" );
+		}
+		ret.node      = first;
+		ret.firstNode = first;
+		ret.lastNode  = last ;
+		return ret;
+	}
+
+    TREE_NODE *tmp = pos.node;
+	size_t curdepth = 0;
+
+	while( curdepth < dp )
+	{
+        while( tmp->firstChild == 0 )
+		{
+			if( tmp == ret.topNode )
+			{
+				throw std::range_error( "tree: beginFixed out of range" );
+			}
+			if( tmp->nextSibling == 0 )
+			{
+				do
+				{
+					if( tmp == ret.topNode )
+					{
+						throw std::range_error( "tree: beginFixed out of range" );
+					}
+					tmp = tmp->parent;
+					if( tmp == 0 )
+					{
+						throw std::range_error( "tree: beginFixed out of range" );
+					}
+					--curdepth;
+				}while( tmp->nextSibling == 0 || tmp == ret.topNode );
+			}
+			tmp = tmp->nextSibling;
+		}
+		tmp = tmp->firstChild;
+		++curdepth;
+	}
+	ret.node = tmp;
+	return ret;
 }
 
-template< class T, class TreeNodeAllocator_ >
-T& Tree< T, TreeNodeAllocator_ >::iteratorBase::operator*() const
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+typename Tree< T, TreeNodeAllocator_, TreePolicy_ >::fixedDepthIterator Tree< T, TreeNodeAllocator_, TreePolicy_ >::endFixed( const iteratorBase& pos, size_t ) const
 {
-    return node->data;
+	// operator++ runs out into no node at all, whatever the depth
+	fixedDepthIterator ret;
+	ret.topNode = pos.node;
+	return ret;
 }
 
-template< class T, class TreeNodeAllocator_ >
-T* Tree< T, TreeNodeAllocator_ >::iteratorBase::operator->() const
+// The top level nodes are the first level, so that the whole forest is
+// walked as it is in pre-order; an iterator made from a node walks only
+// the subtree below it.
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+typename Tree< T, TreeNodeAllocator_, TreePolicy_ >::breadthFirstQueuedIterator Tree< T, TreeNodeAllocator_, TreePolicy_ >::beginBreadthFirst() const
 {
-    return &( node->data );
-}
+	if( head->nextSibling == feet )
+	{
+		return endBreadthFirst();
+	}
 
-template< class T, class TreeNodeAllocator_ >
-void Tree< T, TreeNodeAllocator_ >::iteratorBase::skipChildren()
-{
-    skipCurrentChildren = true;
+	breadthFirstQueuedIterator ret( head->nextSibling );
+	for( TREE_NODE *it = head->nextSibling->nextSibling; it != feet; it = it->nextSibling )
+	{
+		ret.queue->nodes.push_back( it );
+	}
+	return ret;
 }
 
-template< class T, class TreeNodeAllocator_ >
-void Tree< T, TreeNodeAllocator_ >::iteratorBase::skipChildren( bool skip )
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+typename Tree< T, TreeNodeAllocator_, TreePolicy_ >::breadthFirstQueuedIterator Tree< T, TreeNodeAllocator_, TreePolicy_ >::endBreadthFirst() const
 {
-    skipCurrentChildren = skip;
+	return breadthFirstQueuedIterator();
 }
 
-template< class T, class TreeNodeAllocator_ >
-size_t Tree< T, TreeNodeAllocator_ >::iteratorBase::numberOfChildren() const
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+typename Tree< T, TreeNodeAllocator_, TreePolicy_ >::siblingIterator Tree< T, TreeNodeAllocator_, TreePolicy_ >::beginSibling( const iteratorBase& pos ) const
 {
-    TREE_NODE *pos = node->firstChild;
-	if( pos == 0 )
-		return 0;
-
-	size_t ret = 1;
-	while( pos !=node->lastChild )
+	assert( pos.node != 0 );
+	if( pos.node->firstChild == 0 )
 	{
-	    ++ret;
-		pos = pos->nextSibling;
+	    return endSibling( pos );
 	}
-	return ret;
-}
-
-template< class T, class TreeNodeAllocator_ >
-typename Tree< T, TreeNodeAllocator_ >::siblingIterator Tree< T, TreeNodeAllocator_ >::iteratorBase::begin() const
-{
-    if( node->firstChild == 0 )
-		return end();
-
-	siblingIterator ret( node->firstChild );
-	ret.parent = this->node;
-	return ret;
+	TREE_NODE *first = pos.node->firstChild;   // an index link needs a conversion of its own
+	return first;
 }
 
-template< class T, class TreeNodeAllocator_ >
-typename Tree< T, TreeNodeAllocator_ >::siblingIterator Tree< T, TreeNodeAllocator_ >::iteratorBase::end() const
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+typename Tree< T, TreeNodeAllocator_, TreePolicy_ >::siblingIterator Tree< T, TreeNodeAllocator_, TreePolicy_ >::endSibling( const iteratorBase& pos ) const
 {
     siblingIterator ret( 0 );
-	ret.parent = node;
+	ret.parent = pos.node;
 	return ret;
 }
 
-// PreOrderIterator
-template< class T, class TreeNodeAllocator_ >
-Tree< T, TreeNodeAllocator_ >::preOrderIterator::preOrderIterator()
-: iteratorBase( 0 )
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+typename Tree< T, TreeNodeAllocator_, TreePolicy_ >::leafIterator Tree< T, TreeNodeAllocator_, TreePolicy_ >::beginLeaf() const
 {
+	if( TreePolicy_::leafChain )
+	{
+		return leafIterator( head->rightLeafNode() );
+	}
+
+	TREE_NODE *tmp = head->nextSibling;
+	if( tmp != feet )
+	{
+	    while( tmp->firstChild )
+		{
+			tmp = tmp->firstChild;
+		}
+	}
+	return leafIterator( tmp );
 }
 
-template< class T, class TreeNodeAllocator_ >
-Tree< T, TreeNodeAllocator_ >::preOrderIterator::preOrderIterator( TREE_NODE *tn )
-: iteratorBase( tn )
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+typename Tree< T, TreeNodeAllocator_, TreePolicy_ >::leafIterator Tree< T, TreeNodeAllocator_, TreePolicy_ >::endLeaf() const
 {
+	return leafIterator( feet );
 }
 
-template< class T, class TreeNodeAllocator_ >
-Tree< T, TreeNodeAllocator_ >::preOrderIterator::preOrderIterator( const iteratorBase& other )
-: iteratorBase( other.node )
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+typename Tree< T, TreeNodeAllocator_, TreePolicy_ >::leafIterator Tree< T, TreeNodeAllocator_, TreePolicy_ >::beginLeaf( const iteratorBase& top ) const
 {
+	if( TreePolicy_::leafChain )
+	{
+		return leafIterator( top.node->firstLeaf(), top.node );
+	}
+
+	TREE_NODE *tmp = top.node;
+	while( tmp->firstChild )
+	{
+		tmp = tmp->firstChild;
+	}
+	return leafIterator( tmp, top.node );
 }
 
-template< class T, class TreeNodeAllocator_ >
-Tree< T, TreeNodeAllocator_ >::preOrderIterator::preOrderIterator( const siblingIterator& other )
-: iteratorBase( other.node )
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+typename Tree< T, TreeNodeAllocator_, TreePolicy_ >::leafIterator Tree< T, TreeNodeAllocator_, TreePolicy_ >::endLeaf( const iteratorBase& top ) const
 {
-    if( this->node == 0 )
+	// a childless top has no leaves below it, as without the chain
+	if( TreePolicy_::leafChain && top.node->firstChild != 0 )
 	{
-        if( other.rangeLast() != 0 )
-		{
-			this->node = other.rangeLast();
-		}
-		else
-		{
-			this->node = other.parent;
-		}
-		this->skipChildren();
-		++( *this );
+		return leafIterator( top.node->lastLeaf()->rightLeafNode(), top.node );
 	}
+	return leafIterator( top.node, top.node );
 }
 
-template< class T, class TreeNodeAllocator_ >
-bool Tree< T, TreeNodeAllocator_ >::preOrderIterator::operator==( const preOrderIterator& other ) const
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+template< typename iter >
+iter Tree< T, TreeNodeAllocator_, TreePolicy_ >::parent( iter position )
 {
-	if( other.node == this->node )
-		return true;
-	else
-		return false;
+	assert( position.node != 0 );
+	return iter( position.node->parent );
 }
 
-template< class T, class TreeNodeAllocator_ >
-bool Tree< T, TreeNodeAllocator_ >::preOrderIterator::operator!=( const preOrderIterator& other ) const
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+template< typename iter >
+iter Tree< T, TreeNodeAllocator_, TreePolicy_ >::previousSibling( iter position ) const
 {
-    if( other.node != this->node )
-		return true;
-	else
-		return false;
+	assert( position.node != 0 );
+	iter ret( position );
+	ret.node = prevSiblingOf( position.node );
+	return ret;
 }
 
-template< class T, class TreeNodeAllocator_ >
-typename Tree< T, TreeNodeAllocator_ >::preOrderIterator& Tree< T, TreeNodeAllocator_ >::preOrderIterator::operator++()
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+template< typename iter >
+iter Tree< T, TreeNodeAllocator_, TreePolicy_ >::nextSibling( iter position ) const
 {
-    assert( this->node != 0 );
-	if( !this->skipCurrentChildren && this->node->firstChild != 0 )
-	{
-        this->node = this->node->firstChild;
-	}
-	else
+	assert( position.node != 0 );
+	iter ret( position );
+	ret.node = position.node->nextSibling;
+	return ret;
+}
+
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+template< typename iter >
+iter Tree< T, TreeNodeAllocator_, TreePolicy_ >::nextAtSameDepth( iter position ) const
+{
+	if( TreePolicy_::levelLinks )
 	{
-		this->skipCurrentChildren = false;
-		while( this->node->nextSibling == 0 )
+		// the top level runs into feet, as its sibling links do
+		TREE_NODE *next = position.node->nextAtDepthNode();
+		if( next == 0 && position.node->parent == 0 )
 		{
-			this->node = this->node->parent;
-			if( this->node == 0 )
-			{
-				return *this;
-			}
+			next = feet;
 		}
-		this->node = this->node->nextSibling;
+		return iter( next );
 	}
-	return *this;
+
+	typename Tree< T, TreeNodeAllocator_, TreePolicy_ >::fixedDepthIterator tmp( position.node );
+
+	++tmp;
+	return iter( tmp );
 }
 
-template < class T, class TreeNodeAllocator_ >
-typename Tree< T, TreeNodeAllocator_ >::preOrderIterator& Tree< T, TreeNodeAllocator_ >::preOrderIterator::operator--()
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+void Tree< T, TreeNodeAllocator_, TreePolicy_ >::clear()
 {
-	assert( this->node != 0 );
-	if( this->node->prevSibling )
+	if( releaseInBulk )
 	{
-		this->node = this->node->prevSibling;
-		while( this->node->lastChild )
+		// head and feet are not in the arena, they stay and so does end()
+		if( head && head->nextSibling != feet )
 		{
-			this->node = this->node->lastChild;
+			TreeNodeAllocatorTraits< TREE_NODE_ALLOCATOR >::release( alloc_ );
+			headReset();
+			this->resetNodeCount();
 		}
 	}
-	else
+	else if( head )
 	{
-		this->node = this->node->parent;
-		if( this->node == 0 )
+		while( head->nextSibling != feet )
 		{
-			return *this;
+			erase( preOrderIterator( head->nextSibling ) ); 
 		}
 	}
-	return *this;
 }
 
-template < class T, class TreeNodeAllocator_ >
-typename Tree< T, TreeNodeAllocator_ >::preOrderIterator Tree< T, TreeNodeAllocator_ >::preOrderIterator::operator++( int )
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+template< class iter >
+iter Tree< T, TreeNodeAllocator_, TreePolicy_ >::erase( iter it )
 {
-   preOrderIterator copy = *this;
-   ++( *this );
-   return copy;
+	TREE_NODE *cur = it.node;
+	assert( cur != head );
+	iter ret = it;
+	ret.skipChildren();
+	++ret;
+	unlinkNode( cur );
+	destroyChildren( cur );
+	destroyNode( cur );
+	return ret;
 }
 
-template< class T, class TreeNodeAllocator_ >
-typename Tree< T, TreeNodeAllocator_ >::preOrderIterator Tree< T, TreeNodeAllocator_ >::preOrderIterator::operator--( int )
-{
-    preOrderIterator copy = *this;
-	--( *this );
-	return copy;
-}
 
-template< class T, class TreeNodeAllocator_ >
-typename Tree< T, TreeNodeAllocator_ >::preOrderIterator& Tree< T, TreeNodeAllocator_ >::preOrderIterator::operator+=( size_t num )
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+void Tree< T, TreeNodeAllocator_, TreePolicy_ >::eraseChildren( const iteratorBase& it )
 {
-    while( num > 0 )
+	if( it.node == 0 )
+		return;
+
+	this->orderChanged();
+	this->labelsChanged( it.node );
+	hashChanged( it.node );
+
+	if( TreePolicy_::subtreeSizes )
 	{
-		++( *this );
-		--num;
+		ptrdiff_t n = it.node->subtreeSize() - 1;
+		for( TREE_NODE *pos = it.node; pos != 0; pos = pos->parent )
+		{
+			pos->growSubtree( -n );
+		}
 	}
-	return ( *this );
-}
 
-template< class T, class TreeNodeAllocator_ >
-typename Tree< T, TreeNodeAllocator_ >::preOrderIterator& Tree< T, TreeNodeAllocator_ >::preOrderIterator::operator-=( size_t num )
-{
-    while( num > 0 )
+	TREE_NODE *prevLeaf = leafBefore( it.node );
+	TREE_NODE *nextLeaf = leafAfter(  it.node );
+
+	if( TreePolicy_::levelLinks && it.node->firstChild != 0 )
 	{
-		--( *this );
-		--num;
+		unthreadLevels( it.node->firstChild, it.node->lastChildNode() );
 	}
-	return ( *this );
-}
+	destroyChildren( it.node );
 
-// PostOrderIterator
-template< class T, class TreeNodeAllocator_ >
-Tree< T, TreeNodeAllocator_ >::postOrderIterator::postOrderIterator()
-: iteratorBase( 0 )
-{
+	if( TreePolicy_::leafChain )
+	{
+		joinLeaves( prevLeaf, it.node );
+		joinLeaves( it.node, nextLeaf );
+		leafBoundsChanged( it.node, it.node, it.node );
+	}
 }
 
-template< class T, class TreeNodeAllocator_ >
-Tree< T, TreeNodeAllocator_ >::postOrderIterator::postOrderIterator( TREE_NODE *tn )
-: iteratorBase( tn )
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+template< typename iter >
+iter Tree< T, TreeNodeAllocator_, TreePolicy_ >::appendChild( iter position )
 {
+	return emplaceChild( position );
 }
 
-template< class T, class TreeNodeAllocator_ >
-Tree< T, TreeNodeAllocator_ >::postOrderIterator::postOrderIterator( const iteratorBase& other )
-: iteratorBase( other.node )
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+template< typename iter >
+iter Tree< T, TreeNodeAllocator_, TreePolicy_ >::prependChild( iter position )
 {
+	return emplaceFirstChild( position );
 }
 
-template< class T, class TreeNodeAllocator_ >
-Tree< T, TreeNodeAllocator_ >::postOrderIterator::postOrderIterator( const siblingIterator& other)
-: iteratorBase( other.node )
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+template< class iter >
+iter Tree< T, TreeNodeAllocator_, TreePolicy_ >::appendChild( iter position, const T& x )
 {
-	if( this->node == 0 )
-	{
-		if( other.rangeLast() != 0 )
-		{
-			this->node = other.rangeLast();
-		}
-		else
-		{
-			this->node = other.parent;
-		}
-		this->skip_children();
-		++( *this );
-	}
+	return emplaceChild( position, x );
 }
 
-template< class T, class TreeNodeAllocator_ >
-bool Tree< T, TreeNodeAllocator_ >::postOrderIterator::operator==( const postOrderIterator& other ) const
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+template< class iter >
+iter Tree< T, TreeNodeAllocator_, TreePolicy_ >::prependChild( iter position, const T& x )
 {
-	if( other.node == this->node )
-		return true;
-	else
-		return false;
+	return emplaceFirstChild( position, x );
 }
 
-template< class T, class TreeNodeAllocator_ >
-bool Tree< T, TreeNodeAllocator_ >::postOrderIterator::operator!=( const postOrderIterator& other ) const
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+template< class iter >
+iter Tree< T, TreeNodeAllocator_, TreePolicy_ >::appendChild( iter position, T&& x )
 {
-	if( other.node != this->node )
-		return true;
-	else
-		return false;
+	return emplaceChild( position, std::move( x ) );
 }
 
-template< class T, class TreeNodeAllocator_ >
-typename Tree< T, TreeNodeAllocator_ >::postOrderIterator& Tree< T, TreeNodeAllocator_ >::postOrderIterator::operator++()
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+template< class iter >
+iter Tree< T, TreeNodeAllocator_, TreePolicy_ >::prependChild( iter position, T&& x )
 {
-    assert( this->node != 0 );
-	if( this->node->nextSibling == 0 )
-	{
-		this->node = this->node->parent;
-		this->skipCurrentChildren = false;
-	}
-	else
-	{
-		this->node = this->node->nextSibling;
-		if( this->skipCurrentChildren )
-		{
-			this->skipCurrentChildren = false;
-		}
-		else
-		{
-			while( this->node->firstChild )
-			{
-				this->node = this->node->firstChild;
-			}
-		}	
-	}
-	return *this;
+	return emplaceFirstChild( position, std::move( x ) );
 }
 
-template< class T, class TreeNodeAllocator_ >
-typename Tree< T, TreeNodeAllocator_ >::postOrderIterator& Tree< T, TreeNodeAllocator_ >::postOrderIterator::operator--()
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+template< class iter >
+iter Tree< T, TreeNodeAllocator_, TreePolicy_ >::appendChild( iter position, iter other )
 {
-	assert( this->node != 0 );
-	if( this->skipCurrentChildren || this->node->lastChild == 0 )
-	{
-		this->skipCurrentChildren = false;
-		while( this->node->prevSibling == 0 )
-		{
-			this->node = this->node->parent;
-		}
-		this->node = this->node->prevSibling;
-	}
-	else
-	{
-		this->node = this->node->lastChild;
-	}
-	return *this;
-}
+	assert( position.node != head );
+	assert( position.node != feet );
+	assert( position.node );
 
-template< class T, class TreeNodeAllocator_ >
-typename Tree< T, TreeNodeAllocator_ >::postOrderIterator Tree< T, TreeNodeAllocator_ >::postOrderIterator::operator++( int )
-{
-    postOrderIterator copy = *this;
-	++( *this );
-	return copy;
+	siblingIterator aargh = appendChild( position, value_type() );
+	return replace( aargh, other );
 }
 
-template< class T, class TreeNodeAllocator_ >
-typename Tree< T, TreeNodeAllocator_ >::postOrderIterator Tree< T, TreeNodeAllocator_ >::postOrderIterator::operator--( int )
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+template< class iter >
+iter Tree< T, TreeNodeAllocator_, TreePolicy_ >::prependChild( iter position, iter other )
 {
-    postOrderIterator copy = *this;
-	--( *this );
-	return copy;
+    assert( position.node != head );
+	assert( position.node != feet );
+	assert( position.node );
+
+	siblingIterator aargh = prependChild( position, value_type() );
+	return replace( aargh, other );
 }
 
-template< class T, class TreeNodeAllocator_ >
-typename Tree< T, TreeNodeAllocator_ >::postOrderIterator& Tree< T, TreeNodeAllocator_ >::postOrderIterator::operator+=( size_t num )
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+template< class iter >
+iter Tree< T, TreeNodeAllocator_, TreePolicy_ >::appendChildren( iter position, siblingIterator from, siblingIterator to )
 {
-    while( num > 0 )
-	{
-		++( *this );
-		--num;
-	}
-	return ( *this );
-}
+	assert( position.node != head );
+	assert( position.node != feet );
+	assert( position.node );
 
-template< class T, class TreeNodeAllocator_ >
-typename Tree< T, TreeNodeAllocator_ >::postOrderIterator& Tree< T, TreeNodeAllocator_ >::postOrderIterator::operator-=( size_t num )
-{
-    while( num > 0 )
+	iter ret = from;
+
+	while( from != to )
 	{
-		--( *this );
-		--num;
+		insertSubtree( position.end(), from );
+		++from;
 	}
-	return ( *this );
+	return ret;
 }
 
-template< class T, class TreeNodeAllocator_ >
-void Tree< T, TreeNodeAllocator_ >::postOrderIterator::descendAll()
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+template< class iter >
+iter Tree< T, TreeNodeAllocator_, TreePolicy_ >::prependChildren( iter position, siblingIterator from, siblingIterator to )
 {
-	assert( this->node != 0 );
-	while( this->node->firstChild )
+	assert( position.node != head );
+	assert( position.node != feet );
+	assert( position.node );
+
+	iter ret = from;
+
+	while( from != to )
 	{
-		this->node = this->node->firstChild;
+	    insertSubtree( position.begin(), from );
+		++from;
 	}
+	return ret;
 }
 
-// BreadthFirstQueuedIterator
-template< class T, class TreeNodeAllocator_ >
-Tree< T, TreeNodeAllocator_ >::breadthFirstQueuedIterator::breadthFirstQueuedIterator()
-: iteratorBase()
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+typename Tree< T, TreeNodeAllocator_, TreePolicy_ >::preOrderIterator Tree< T, TreeNodeAllocator_, TreePolicy_ >::setHead( const T& x )
 {
+	assert( head->nextSibling == feet );
+	return insert( preOrderIterator( feet ), x );
 }
 
-template< class T, class TreeNodeAllocator_ >
-Tree< T, TreeNodeAllocator_ >::breadthFirstQueuedIterator::breadthFirstQueuedIterator( TREE_NODE *tn )
-: iteratorBase( tn )
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+typename Tree< T, TreeNodeAllocator_, TreePolicy_ >::preOrderIterator Tree< T, TreeNodeAllocator_, TreePolicy_ >::setHead( T&& x )
 {
-    traversalQueue.push( tn );
+	assert( head->nextSibling == feet );
+	return insert( preOrderIterator( feet ), std::move( x ) );
 }
 
-template< class T, class TreeNodeAllocator_ >
-Tree< T, TreeNodeAllocator_ >::breadthFirstQueuedIterator::breadthFirstQueuedIterator( const iteratorBase& other )
-: iteratorBase( other.node )
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+template< class iter >
+iter Tree< T, TreeNodeAllocator_, TreePolicy_ >::insert( iter position, const T& x )
 {
-	traversalQueue.push( other.node );
+	return emplace( position, x );
 }
 
-template< class T, class TreeNodeAllocator_ >
-bool Tree< T, TreeNodeAllocator_ >::breadthFirstQueuedIterator::operator==( const breadthFirstQueuedIterator& other ) const
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+typename Tree< T, TreeNodeAllocator_, TreePolicy_ >::siblingIterator Tree< T, TreeNodeAllocator_, TreePolicy_ >::insert( siblingIterator position, const T& x )
 {
-	if( other.node == this->node )
-		return true;
-	else
-		return false;
+	return emplace( position, x );
 }
 
-template< class T, class TreeNodeAllocator_ >
-bool Tree< T, TreeNodeAllocator_ >::breadthFirstQueuedIterator::operator!=( const breadthFirstQueuedIterator& other ) const
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+template< class iter >
+iter Tree< T, TreeNodeAllocator_, TreePolicy_ >::insert( iter position, T&& x )
 {
-	if( other.node != this->node )
-		return true;
-	else
-		return false;
+	return emplace( position, std::move( x ) );
 }
 
-template< class T, class TreeNodeAllocator_ >
-typename Tree< T, TreeNodeAllocator_ >::breadthFirstQueuedIterator& Tree< T, TreeNodeAllocator_ >::breadthFirstQueuedIterator::operator++()
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+typename Tree< T, TreeNodeAllocator_, TreePolicy_ >::siblingIterator Tree< T, TreeNodeAllocator_, TreePolicy_ >::insert( siblingIterator position, T&& x )
 {
-	assert( this->node != 0 );
-
-    siblingIterator sib = this->begin();
-	while( sib != this->end() )
-	{
-		traversalQueue.push( sib.node );
-		++sib;
-	}
-	traversalQueue.pop();
-	if( traversalQueue.size() > 0 )
-		this->node = traversalQueue.front();
-	else
-		this->node = 0;
-	return ( *this );
+	return emplace( position, std::move( x ) );
 }
 
-template< class T, class TreeNodeAllocator_ >
-typename Tree< T, TreeNodeAllocator_ >::breadthFirstQueuedIterator Tree< T, TreeNodeAllocator_ >::breadthFirstQueuedIterator::operator++( int )
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+template< class iter >
+iter Tree< T, TreeNodeAllocator_, TreePolicy_ >::insertSubtree( iter position, const iteratorBase &subtree )
 {
-    breadthFirstQueuedIterator copy = *this;
-	++( *this );
-	return copy;
+	iter it = insert( position, value_type() );
+	return replace( it, subtree );
 }
 
-template< class T, class TreeNodeAllocator_ >
-typename Tree< T, TreeNodeAllocator_ >::breadthFirstQueuedIterator& Tree< T, TreeNodeAllocator_ >::breadthFirstQueuedIterator::operator+=( size_t num )
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+template< class iter >
+iter Tree< T, TreeNodeAllocator_, TreePolicy_ >::insertAfter( iter position, const T& x )
 {
-   while( num > 0 )
-   {
-       ++( *this );
-	   --num;
-   }
-   return ( *this );
+	return emplaceAfter( position, x );
 }
 
-// FixedDepthIterator
-template< class T, class TreeNodeAllocator_ >
-Tree< T, TreeNodeAllocator_ >::fixedDepthIterator::fixedDepthIterator()
-: iteratorBase()
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+template< class iter >
+iter Tree< T, TreeNodeAllocator_, TreePolicy_ >::insertAfter( iter position, T&& x )
 {
+	return emplaceAfter( position, std::move( x ) );
 }
 
-template< class T, class TreeNodeAllocator_ >
-Tree< T, TreeNodeAllocator_ >::fixedDepthIterator::fixedDepthIterator( TREE_NODE *tn )
-: iteratorBase( tn ), topNode( 0 )
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+template< class iter >
+iter Tree< T, TreeNodeAllocator_, TreePolicy_ >::insertSubtreeAfter( iter position, const iteratorBase& subtree )
 {
+	iter it = insertAfter( position, value_type() );
+	return replace( it, subtree );
 }
 
-template< class T, class TreeNodeAllocator_ >
-Tree< T, TreeNodeAllocator_ >::fixedDepthIterator::fixedDepthIterator( const iteratorBase& other )
-: iteratorBase( other.node ), topNode( 0 )
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+template< class iter >
+iter Tree< T, TreeNodeAllocator_, TreePolicy_ >::replace( iter position, const T& x )
 {
+	position.node->data = x;
+	hashChanged( position.node );
+	return position;
 }
 
-template< class T, class TreeNodeAllocator_ >
-Tree< T, TreeNodeAllocator_ >::fixedDepthIterator::fixedDepthIterator( const siblingIterator& other )
-: iteratorBase( other.node ), topNode( 0 )
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+template< class iter >
+iter Tree< T, TreeNodeAllocator_, TreePolicy_ >::replace( iter position, T&& x )
 {
+	position.node->data = std::move( x );
+	hashChanged( position.node );
+	return position;
 }
 
-template< class T, class TreeNodeAllocator_ >
-Tree< T, TreeNodeAllocator_ >::fixedDepthIterator::fixedDepthIterator( const fixedDepthIterator& other )
-: iteratorBase( other.node ), topNode( other.topNode )
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+template< class iter >
+iter Tree< T, TreeNodeAllocator_, TreePolicy_ >::replace( iter position, const iteratorBase& from )
 {
-}
+	assert( position.node != head );
 
-template< class T, class TreeNodeAllocator_ >
-bool Tree< T, TreeNodeAllocator_ >::fixedDepthIterator::operator==( const fixedDepthIterator& other ) const
-{
-	if( other.node == this->node && other.topNode == topNode )
-		return true;
-	else
-		return false;
-}
+	TREE_NODE *currentTo = position.node;
 
-template< class T, class TreeNodeAllocator_ >
-bool Tree< T, TreeNodeAllocator_ >::fixedDepthIterator::operator!=( const fixedDepthIterator& other ) const
-{
-	if( other.node != this->node || other.topNode != topNode )
-		return true;
-	else
-		return false;
+	// copy first, from may lie inside the subtree that is about to go
+	TREE_NODE *tmp = cloneSubtree( from.node );
+
+	linkBefore( currentTo, tmp );
+	unlinkNode( currentTo );
+	destroyChildren( currentTo );
+	destroyNode( currentTo );
+
+	return tmp;
 }
 
-template< class T, class TreeNodeAllocator_ >
-typename Tree< T, TreeNodeAllocator_ >::fixedDepthIterator& Tree< T, TreeNodeAllocator_ >::fixedDepthIterator::operator++()
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+typename Tree< T, TreeNodeAllocator_, TreePolicy_ >::siblingIterator Tree< T, TreeNodeAllocator_, TreePolicy_ >::replace( siblingIterator origBegin,									                   
+																							    siblingIterator origEnd  ,
+                                                                                                siblingIterator newBegin ,
+							                                                                    siblingIterator newEnd     )
 {
-	assert( this->node != 0 );
+    TREE_NODE *origFirst = origBegin.node;
+	TREE_NODE *newFirst  = newBegin.node ;
+    TREE_NODE *origLast  = origFirst;
+	while( ( ++origBegin ) != origEnd )
+	{
+	    origLast = origLast->nextSibling;
+	}
 
-	if( this->node->nextSibling )
+	TREE_NODE *newLast   = newFirst;
+	while( ( ++newBegin ) != newEnd )
 	{
-        this->node = this->node->nextSibling;
+		newLast = newLast->nextSibling;
 	}
-	else
+
+	bool first = true;
+	preOrderIterator ret;
+	while( 1==1 )
 	{
-		int relativeDepth = 0;
-upper:
-		do
-		{
-			if( this->node == this->topNode )
-			{
-				this->node = 0;
-				return *this;
-			}
-            this->node = this->node->parent;
-			if( this->node == 0 )
-				return *this;
-			--relativeDepth;
-		}while( this->node->nextSibling == 0 );
-lower:
-		this->node = this->node->nextSibling;
-		while( this->node->firstChild == 0 )
-		{
-			if( this->node->nextSibling == 0 )
-				goto upper;
-			this->node = this->node->nextSibling;
-			if( this->node == 0 )
-				return *this;
-		}
-		while( relativeDepth < 0 && this->node->firstChild != 0 )
+		preOrderIterator tt = insertSubtree( preOrderIterator( origFirst ), preOrderIterator( newFirst ) );
+		if( first )
 		{
-			this->node = this->node->firstChild;
-			++relativeDepth;
+			ret = tt;
+			first = false;
 		}
-		if( relativeDepth < 0 )
+		if( newFirst == newLast )
 		{
-            if( this->node->nextSibling == 0 )
-				goto upper;
-			else
-				goto lower;
+			break;
 		}
+		newFirst = newFirst->nextSibling;
 	}
-	return *this;
-}
 
-template< class T, class TreeNodeAllocator_ >
-typename Tree< T, TreeNodeAllocator_ >::fixedDepthIterator& Tree< T, TreeNodeAllocator_ >::fixedDepthIterator::operator--()
-{
-	assert( this->node != 0 );
-
-	if( this->node->prevSibling )
-	{
-		this->node = this->node->prevSibling;
-	}
-	else
+    bool last = false;
+	TREE_NODE *next = origFirst;
+	while( 1 == 1 )
 	{
-		int relativeDepth = 0;
-upper:
-		do 
-		{
-            if( this->node == this->topNode )
-			{
-				this->node = 0;
-				return *this;
-			}
-			this->node = this->node->parent;
-			if( this->node == 0 )
-				return *this;
-			--relativeDepth;
-		} while( this->node->prevSibling == 0 );
-lower:
-		this->node = this->node->prevSibling;
-		while( this->node->lastChild == 0 )
-		{
-			if( this->node->prevSibling == 0 )
-				goto upper;
-			this->node = this->node->prevSibling;
-			if( this->node == 0 )
-				return *this;
-		}
-		while( relativeDepth < 0 && this->node->lastChild != 0 )
+		if( next == origLast )
 		{
-            this->node = this->node->lastChild;
-			++relativeDepth;
+			last = true;
 		}
-		if( relativeDepth < 0 )
+		next = next->nextSibling;
+		erase( ( preOrderIterator )origFirst );
+		if( last )
 		{
-			if( this->node->prevSibling == 0 )
-				goto upper;
-			else
-				goto lower;
+			break;
 		}
+		origFirst = next;
 	}
-	return *this;
-}
-
-template< class T, class TreeNodeAllocator_ >
-typename Tree< T, TreeNodeAllocator_ >::fixedDepthIterator Tree< T, TreeNodeAllocator_ >::fixedDepthIterator::operator++( int )
-{
-	fixedDepthIterator copy = *this;
-	++( *this );
-	return copy;
-}
-
-template< class T, class TreeNodeAllocator_ >
-typename Tree< T, TreeNodeAllocator_ >::fixedDepthIterator Tree< T, TreeNodeAllocator_ >::fixedDepthIterator::operator--( int )
-{
-	fixedDepthIterator copy = *this;
-	--( *this );
-	return copy;
-}
-
-template< class T, class TreeNodeAllocator_ >
-typename Tree< T, TreeNodeAllocator_ >::fixedDepthIterator& Tree< T, TreeNodeAllocator_ >::fixedDepthIterator::operator+=( size_t num )
-{
-	while( num > 0 )
-	{
-		++( *this );
-		--num;
-	}
-	return ( *this );
-}
-
-template< class T, class TreeNodeAllocator_ >
-typename Tree< T, TreeNodeAllocator_ >::fixedDepthIterator& Tree< T, TreeNodeAllocator_ >::fixedDepthIterator::operator-=( size_t num )
-{
-	while( num > 0 )
-	{
-		--( *this );
-		--num;
-	}
-	return ( *this );
+	return ret;
 }
 
-// SiblingIterator
-template< class T, class TreeNodeAllocator_ >
-Tree< T, TreeNodeAllocator_ >::siblingIterator::siblingIterator()
-: iteratorBase()
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+template< typename iter, class... Args >
+iter Tree< T, TreeNodeAllocator_, TreePolicy_ >::emplaceChild( iter position, Args&&... args )
 {
-	setParent();
-}
+	assert( position.node != head );
+	assert( position.node != feet );
+	assert( position.node );
 
-template< class T, class TreeNodeAllocator_ >
-Tree< T, TreeNodeAllocator_ >::siblingIterator::siblingIterator( TREE_NODE *tn )
-: iteratorBase( tn )
-{
-    setParent();
+	TREE_NODE *tmp = createNode( std::forward< Args >( args )... );
+	linkLastChild( position.node, tmp );
+	return tmp;
 }
 
-template< class T, class TreeNodeAllocator_ >
-Tree< T, TreeNodeAllocator_ >::siblingIterator::siblingIterator( const iteratorBase& other )
-: iteratorBase( other.node )
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+template< typename iter, class... Args >
+iter Tree< T, TreeNodeAllocator_, TreePolicy_ >::emplaceFirstChild( iter position, Args&&... args )
 {
-	setParent();
+	assert( position.node != head );
+	assert( position.node != feet );
+	assert( position.node );
+
+	TREE_NODE *tmp = createNode( std::forward< Args >( args )... );
+	linkFirstChild( position.node, tmp );
+	return tmp;
 }
 
-template< class T, class TreeNodeAllocator_ >
-Tree< T, TreeNodeAllocator_ >::siblingIterator::siblingIterator( const siblingIterator& other )
-: iteratorBase( other ), parent( other.parent )
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+template< typename iter, class... Args >
+iter Tree< T, TreeNodeAllocator_, TreePolicy_ >::emplace( iter position, Args&&... args )
 {
+	if( position.node == 0 )
+		position.node = feet;
+
+	TREE_NODE *tmp = createNode( std::forward< Args >( args )... );
+	linkBefore( position.node, tmp );
+	return tmp;
 }
 
-template< class T, class TreeNodeAllocator_ >
-bool Tree< T, TreeNodeAllocator_ >::siblingIterator::operator==( const siblingIterator& other ) const
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+template< class... Args >
+typename Tree< T, TreeNodeAllocator_, TreePolicy_ >::siblingIterator Tree< T, TreeNodeAllocator_, TreePolicy_ >::emplace( siblingIterator position, Args&&... args )
 {
-	if( other.node == this->node )
+	TREE_NODE *tmp = createNode( std::forward< Args >( args )... );
+
+	// the end of a sibling range still knows its parent
+	if( position.node == 0 )
 	{
-		return true;
+		linkLastChild( position.parent, tmp );
 	}
 	else
 	{
-		return false;
+		linkBefore( position.node, tmp );
 	}
+	return tmp;
 }
 
-template< class T, class TreeNodeAllocator_ >
-bool Tree< T, TreeNodeAllocator_ >::siblingIterator::operator!=( const siblingIterator& other ) const
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+template< typename iter, class... Args >
+iter Tree< T, TreeNodeAllocator_, TreePolicy_ >::emplaceAfter( iter position, Args&&... args )
 {
-    if( other.node != this->node )
+	TREE_NODE *tmp = createNode( std::forward< Args >( args )... );
+	linkAfter( position.node, tmp );
+	return tmp;
+}
+
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+template< typename iter >
+iter Tree< T, TreeNodeAllocator_, TreePolicy_ >::flatten( iter position )
+{
+	if( position.node->firstChild == 0 )
 	{
-		return true;
+		return position;
 	}
-	else
+
+	this->orderChanged();
+	this->labelsChanged( position.node->parent );
+	hashChanged( position.node );
+
+	TREE_NODE *prevLeaf  = leafBefore( position.node );
+	TREE_NODE *firstLeaf = position.node->firstLeaf();
+
+	if( TreePolicy_::levelLinks )
 	{
-        return false;
+		unthreadLevels( position.node, position.node );
 	}
-}
 
-template< class T, class TreeNodeAllocator_ >
-typename Tree< T, TreeNodeAllocator_ >::siblingIterator& Tree< T, TreeNodeAllocator_ >::siblingIterator::operator++()
-{
-    if( this->node )
-		this->node = this->node->nextSibling;
-	return *this;
-}
+	ptrdiff_t moved = position.node->childCount();
+	position.node->childrenChanged( -moved );
+	if( position.node->parent != 0 )
+	{
+		position.node->parent->childrenChanged( moved );
+	}
 
-template< class T, class TreeNodeAllocator_ >
-typename Tree< T, TreeNodeAllocator_ >::siblingIterator& Tree< T, TreeNodeAllocator_ >::siblingIterator::operator--()
-{
-    if( this->node )
-		this->node = this->node->prevSibling;
+	TREE_NODE *last = 0;
+	TREE_NODE *tmp  = position.node->firstChild;
+	while( tmp )
+	{
+        tmp->parent = position.node->parent;
+		last = tmp;
+		tmp  = tmp->nextSibling;
+	}
+	if( position.node->nextSibling )
+	{
+        last->nextSibling = position.node->nextSibling;
+		position.node->nextSibling->setPrevSibling( last );
+	}
 	else
 	{
-		assert( parent );
-		this->node = parent->lastChild;
+		position.node->parent->setLastChild( last );
 	}
+	position.node->nextSibling = position.node->firstChild;
+	position.node->nextSibling->setPrevSibling( position.node );
+	position.node->firstChild = 0;
+	position.node->setLastChild( 0 );
 
-	return *this;
-}
+	// the children stay below the same ancestors, only position shrinks
+	position.node->growSubtree( 1 - ( ptrdiff_t )position.node->subtreeSize() );
 
-template< class T, class TreeNodeAllocator_ >
-typename Tree< T, TreeNodeAllocator_ >::siblingIterator Tree< T, TreeNodeAllocator_ >::siblingIterator::operator++( int )
-{
-    siblingIterator copy = *this;
-	++( *this );
-	return copy;
-}
+	// position is a leaf now, in front of the leaves that were below it
+	if( TreePolicy_::leafChain )
+	{
+		joinLeaves( prevLeaf, position.node );
+		joinLeaves( position.node, firstLeaf );
+		leafBoundsChanged( position.node, position.node, 0 );
+	}
 
-template< class T, class TreeNodeAllocator_ >
-typename Tree< T, TreeNodeAllocator_ >::siblingIterator Tree< T, TreeNodeAllocator_ >::siblingIterator::operator--( int )
-{
-    siblingIterator copy = *this;
-	--( *this );
-	return copy;
+	// every level below moves up by one, only position has to join the
+	// stretch of its former children
+	if( TreePolicy_::levelLinks )
+	{
+		position.node->setNextAtDepth( position.node->nextSibling );
+		position.node->nextSibling->setPrevAtDepth( position.node );
+		threadLevels( position.node, last );
+	}
+	return position;
 }
 
-template< class T, class TreeNodeAllocator_ >
-typename Tree< T, TreeNodeAllocator_ >::siblingIterator& Tree< T, TreeNodeAllocator_ >::siblingIterator::operator+=( size_t num )
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+template< typename iter >
+iter Tree< T, TreeNodeAllocator_, TreePolicy_ >::reparent( iter position, siblingIterator begin, siblingIterator end )
 {
-	while( num > 0 )
+	TREE_NODE *first = begin.node;
+
+	assert( first != position.node );
+
+	if( begin == end )
 	{
-		++( *this );
-		--num;
+		return begin;
 	}
-	return ( *this );
-}
 
-template< class T, class TreeNodeAllocator_ >
-typename Tree< T, TreeNodeAllocator_ >::siblingIterator& Tree< T, TreeNodeAllocator_ >::siblingIterator::operator-=( size_t num )
-{
-    while( num > 0 )
+	TREE_NODE *cur = first;
+	while( cur != end.node )
 	{
-		--( *this );
-		--num;
+		TREE_NODE *next = cur->nextSibling;
+		unlinkNode( cur );
+		linkLastChild( position.node, cur );
+		cur = next;
 	}
-	return ( *this );
+	return first;
 }
 
-template< class T, class TreeNodeAllocator_ >
-typename Tree< T, TreeNodeAllocator_ >::TREE_NODE *Tree< T, TreeNodeAllocator_ >::siblingIterator::rangeFirst() const
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+template< typename iter > iter Tree< T, TreeNodeAllocator_, TreePolicy_ >::reparent( iter position, iter from )
 {
-    TREE_NODE *tmp = parent->firstChild;
-	return tmp;
+	if( from.node->firstChild == 0 )
+		return position;
+    
+	return reparent( position, siblingIterator( from.node->firstChild ), from.end() );
 }
 
-template< class T, class TreeNodeAllocator_ >
-typename Tree< T, TreeNodeAllocator_ >::TREE_NODE *Tree< T, TreeNodeAllocator_ >::siblingIterator::rangeLast() const
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+template< typename iter > iter Tree< T, TreeNodeAllocator_, TreePolicy_ >::wrap( iter position, const T& x )
 {
-    return parent->lastChild;
-}
+	assert( position.node != 0 );
 
-template< class T, class TreeNodeAllocator_ >
-void Tree< T, TreeNodeAllocator_ >::siblingIterator::setParent()
-{
-	parent = 0;
-	if( this->node == 0 )
-		return;
-	if( this->node->parent != 0 )
-		parent = this->node->parent;
-}
+	siblingIterator fr = position;
+	siblingIterator to = position;
 
-// LeafIterator
-template< class T, class TreeNodeAllocator_ >
-Tree< T, TreeNodeAllocator_ >::leafIterator::leafIterator()
-: iteratorBase( 0 ), topNode( 0 )
-{
-}
+	++to;
 
-template< class T, class TreeNodeAllocator_ >
-Tree< T, TreeNodeAllocator_ >::leafIterator::leafIterator( TREE_NODE *tn, TREE_NODE *top )
-: iteratorBase( tn ), topNode( top )
-{
+	iter ret = insert( position, x );
+	reparent( ret, fr, to );
+	return ret;
 }
 
-template< class T, class TreeNodeAllocator_ >
-Tree< T, TreeNodeAllocator_ >::leafIterator::leafIterator( const iteratorBase& other )
-: iteratorBase( other.node ), topNode( 0 )
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+template< typename iter > iter Tree< T, TreeNodeAllocator_, TreePolicy_ >::moveAfter( iter target, iter source )
 {
-}
+	TREE_NODE *dst = target.node;
+	TREE_NODE *src = source.node;
+	assert( dst );
+	assert( src );
 
-template< class T, class TreeNodeAllocator_ >
-Tree< T, TreeNodeAllocator_ >::leafIterator::leafIterator( const siblingIterator& other )
-: iteratorBase( other.node ), topNode( 0 )
-{
-    if( this->node == 0 )
+	if( dst == src )
 	{
-	    if( other.rangeLast() != 0 )
-			this->node = other.rangeLast();
-		else
-			this->node = other.parent;
-		++( *this );
+		return source;
+	}
+
+	if( dst->nextSibling )
+	{
+		if( dst->nextSibling == src )
+		{
+			return source;
+		}
 	}
+
+	unlinkNode( src );
+	linkAfter( dst, src );
+	return src;
 }
 
-template< class T, class TreeNodeAllocator_ >
-bool Tree< T, TreeNodeAllocator_ >::leafIterator::operator==( const leafIterator& other ) const
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+template< typename iter > iter Tree< T, TreeNodeAllocator_, TreePolicy_ >::moveBefore( iter target, iter source )
 {
-	if( other.node == this->node && other.topNode == this->topNode )
+	TREE_NODE *dst = target.node;
+	TREE_NODE *src = source.node;
+
+	assert( dst );
+	assert( src );
+
+    if( dst == src )
 	{
-		return true;
+		return source;
 	}
-	else
+
+	if( prevSiblingOf( dst ) == src )
 	{
-		return false;
+		return source;
 	}
+
+	unlinkNode( src );
+	linkBefore( dst, src );
+	return src;
 }
 
-template< class T, class TreeNodeAllocator_ >
-bool Tree< T, TreeNodeAllocator_ >::leafIterator::operator!=( const leafIterator& other ) const
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+typename Tree< T, TreeNodeAllocator_, TreePolicy_ >::siblingIterator Tree< T, TreeNodeAllocator_, TreePolicy_ >::moveBefore( siblingIterator target, siblingIterator source )
 {
-    if( other.node != this->node )
+	TREE_NODE *dst = target.node;
+	TREE_NODE *src = source.node;
+	TREE_NODE *dstPrevSibling   ;
+
+	if( dst == 0 )
 	{
-		return true;
+		dstPrevSibling = target.parent->lastChildNode();
+		assert( dstPrevSibling );
 	}
 	else
 	{
-		return false;
+		dstPrevSibling = prevSiblingOf( dst );
 	}
-}
 
-template< class T, class TreeNodeAllocator_ >
-typename Tree< T, TreeNodeAllocator_ >::leafIterator& Tree< T, TreeNodeAllocator_ >::leafIterator::operator++()
-{
-	assert( this->node != 0 );
-	if( this->node->firstChild != 0 )
+	assert( src );
+
+	if( dst == src )
 	{
-		while( this->node->firstChild )
-		{
-			this->node = this->node->first_child;
-		}
+		return source;
 	}
-	else
+
+	if( dstPrevSibling )
 	{
-	    while( this->node->nextSibling == 0 )
+		if( dstPrevSibling == src )
 		{
-			if( this->node->parent == 0 )
-				return *this;
-			this->node = this->node->parent;
-			if( topNode != 0 && this->node == topNode )
-				return *this;
+            return source;
 		}
-		this->node = this->node->nextSibling;
-		while( this->node->firstChild )
-			this->node = this->node->firstChild;
 	}
-	return *this;
-}
 
-template< class T, class TreeNodeAllocator_ >
-typename Tree< T, TreeNodeAllocator_ >::leafIterator& Tree< T, TreeNodeAllocator_ >::leafIterator::operator--()
-{
-    assert( this->node != 0 );
-	while( this->node->prevSibling == 0 )
+	unlinkNode( src );
+	if( dst == 0 )
 	{
-		if( this->node->parent == 0 )
-			return *this;
-		this->node = this->node->parent;
-		if( topNode != 0 && this->node == topNode )
-			return *this;
+		linkLastChild( target.parent, src );
 	}
-	this->node = this->node->prevSibling;
-
-	while( this->node->lastChild )
+	else
 	{
-		this->node = this->node->lastChild;
+		linkBefore( dst, src );
 	}
-
-	return *this;
-}
-
-template< class T, class TreeNodeAllocator_ >
-typename Tree< T, TreeNodeAllocator_ >::leafIterator Tree< T, TreeNodeAllocator_ >::leafIterator::operator++( int )
-{
-    leafIterator copy = *this;
-	++( *this );
-	return copy;
+	return src;
 }
 
-template< class T, class TreeNodeAllocator_ >
-typename Tree< T, TreeNodeAllocator_ >::leafIterator Tree< T, TreeNodeAllocator_ >::leafIterator::operator--( int )
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+template< typename iter > iter Tree< T, TreeNodeAllocator_, TreePolicy_ >::moveOntop( iter target, iter source )
 {
-    leafIterator copy = *this;
-	--( *this );
-	return copy;
-}
+	TREE_NODE *dst = target.node;
+	TREE_NODE *src = source.node;
 
-template< class T, class TreeNodeAllocator_ >
-typename Tree< T, TreeNodeAllocator_ >::leafIterator& Tree< T, TreeNodeAllocator_ >::leafIterator::operator+=( size_t num )
-{
-    while( num > 0 )
-	{
-		++( *this );
-		--num;
-	}
-	return ( *this );
-}
+	assert( dst );
+	assert( src );
 
-template< class T, class TreeNodeAllocator_ >
-typename Tree< T, TreeNodeAllocator_ >::leafIterator& Tree< T, TreeNodeAllocator_ >::leafIterator::operator-=( size_t num )
-{
-	while( num > 0 )
+    if( dst == src )
 	{
-		--( *this );
-		--num;
+		return source;
 	}
-	return ( *this );
-}
 
-//////////////////////////////////////////////////////////////////////////
-/// Methods for Tree Class
-//////////////////////////////////////////////////////////////////////////
-template< class T, class TreeNodeAllocator_ >
-typename Tree< T, TreeNodeAllocator_ >::preOrderIterator Tree< T, TreeNodeAllocator_ >::begin() const
-{
-	return preOrderIterator( head->nextSibling );
+	// hang src in next to target first, target's neighbours may include src
+	unlinkNode( src );
+	linkAfter( dst, src );
+	erase( target );
+	return src;
 }
 
-template< class T, class TreeNodeAllocator_ >
-typename Tree< T, TreeNodeAllocator_ >::preOrderIterator Tree< T, TreeNodeAllocator_ >::end() const
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+void Tree< T, TreeNodeAllocator_, TreePolicy_ >::merge( siblingIterator to1, siblingIterator to2, siblingIterator from1, siblingIterator from2, bool duplicateLeaves )
 {
-    return preOrderIterator( feet );
+	SIBLING_RANGE from( from1, from2 );
+	mergeLevel( to1, to2, &from, &from + 1, duplicateLeaves );
 }
 
-template< class T, class TreeNodeAllocator_ >
-typename Tree< T, TreeNodeAllocator_ >::postOrderIterator Tree< T, TreeNodeAllocator_ >::beginPost() const
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+template< class TreeIterator >
+void Tree< T, TreeNodeAllocator_, TreePolicy_ >::mergeTrees( siblingIterator to1, siblingIterator to2, TreeIterator first, TreeIterator last, bool duplicateLeaves )
 {
-    TREE_NODE *tmp = head->nextSibling;
-	if( tmp != feet )
+	std::vector< SIBLING_RANGE > from;
+	for( ; first != last; ++first )
 	{
-		while( tmp->firstChild )
-		{
-			tmp = tmp->firstChild;
-		}
+		from.push_back( SIBLING_RANGE( siblingIterator( ( *first ).head->nextSibling ), siblingIterator( ( *first ).feet ) ) );
+	}
+	if( !from.empty() )
+	{
+		mergeLevel( to1, to2, from.data(), from.data() + from.size(), duplicateLeaves );
 	}
-	return postOrderIterator( tmp );
-}
-
-template< class T, class TreeNodeAllocator_ >
-typename Tree< T, TreeNodeAllocator_ >::postOrderIterator Tree< T, TreeNodeAllocator_ >::endPost() const
-{
-    return postOrderIterator( feet );
 }
 
-template< class T, class TreeNodeAllocator_ >
-typename Tree< T, TreeNodeAllocator_ >::fixedDepthIterator Tree< T, TreeNodeAllocator_ >::beginFixed( const iteratorBase& pos, size_t dp ) const
+// Levels few source nodes go to are matched with std::find, the others by
+// a hash of the level built once for all the ranges. With several ranges
+// the children of every source node that matched the same node are merged
+// below it in a single call. Nodes copied in go before to2 and later source
+// nodes match them, also when the level was empty.
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+void Tree< T, TreeNodeAllocator_, TreePolicy_ >::mergeLevel( siblingIterator to1, siblingIterator to2, const SIBLING_RANGE *first, const SIBLING_RANGE *last, bool duplicateLeaves )
 {
-	typename Tree< T, TreeNodeAllocator_ >::fixedDepthIterator ret;
-	ret.topNode = pos.node;
-
-    TREE_NODE *tmp = pos.node;
-	size_t curdepth = 0;
+	size_t count = 0;
+	for( const SIBLING_RANGE *from = first; from != last; ++from )
+	{
+		for( siblingIterator it = from->first; it != from->second; ++it )
+		{
+			++count;
+		}
+	}
 
-	while( curdepth < dp )
+	if( !TreeHashable< T >::value || count < mergeHashThreshold )
 	{
-        while( tmp->firstChild == 0 )
+		for( const SIBLING_RANGE *from = first; from != last; ++from )
 		{
-			if( tmp->nextSibling == 0 )
+			for( siblingIterator it = from->first; it != from->second; ++it )
 			{
-				do
+				siblingIterator fnd = std::find( to1, to2, *it );
+				if( fnd == to2 )
 				{
-					if( tmp == ret.topNode )
+					siblingIterator copy = insertSubtree( to2, it );
+					if( to1 == to2 )
 					{
-						throw std::range_error( "tree: beginFixed out of range" );
+						to1 = copy;
 					}
-					tmp = tmp->parent;
-					if( tmp == 0 )
+				}
+				else if( it.begin() == it.end() )
+				{
+					if( duplicateLeaves )
 					{
-						throw std::range_error( "tree: beginFixed out of range" );
+						appendChild( siblingIterator( to1.parent ), *it );
 					}
-					--curdepth;
-				}while( tmp->nextSibling == 0 );
+				}
+				else
+				{
+					SIBLING_RANGE below( it.begin(), it.end() );
+					mergeLevel( fnd.begin(), fnd.end(), &below, &below + 1, duplicateLeaves );
+				}
 			}
-			tmp = tmp->nextSibling;
 		}
-		tmp = tmp->firstChild;
-		++curdepth;
+		return;
 	}
-	ret.node = tmp;
-	return ret;
-}
 
-template< class T, class TreeNodeAllocator_ >
-typename Tree< T, TreeNodeAllocator_ >::fixedDepthIterator Tree< T, TreeNodeAllocator_ >::endFixed( const iteratorBase& pos, size_t dp ) const
-{
-	assert( 1 == 0 ); //////////////////////////////////////////////////////////////////////////
-	TREE_NODE *tmp = pos.node;
-    size_t curdepth = 1;
-	while( curdepth < dp )
+	for( siblingIterator it = to1; it != to2; ++it )
+	{
+		++count;
+	}
+
+	mergeIndex index( count );
+	size_t     hash;
+	for( siblingIterator it = to1; it != to2; ++it )
 	{
-		while( tmp->firstChild == 0 )
+		size_t slot = index.probe( *it, hash );
+		if( index.at( slot ) == mergeIndex::npos )
 		{
-			tmp = tmp->nextSibling;
-			if( tmp == 0 )
-			{			
-				throw std::range_error( "tree: endFixed out of range" );
+			index.add( slot, it.node, hash );
+		}
+	}
+
+	// with several ranges, the nodes matched by source nodes with children
+	// and those children, merged below them once each at the end
+	std::vector< TREE_NODE * >                        targets;
+	std::vector< std::pair< size_t, SIBLING_RANGE > > matched;
+	for( const SIBLING_RANGE *from = first; from != last; ++from )
+	{
+		for( siblingIterator it = from->first; it != from->second; ++it )
+		{
+			size_t slot = index.probe( *it, hash );
+			size_t fnd  = index.at( slot );
+			if( fnd == mergeIndex::npos )
+			{
+				index.add( slot, insertSubtree( to2, it ).node, hash );
+			}
+			else if( it.begin() == it.end() )
+			{
+				if( duplicateLeaves )
+				{
+					appendChild( siblingIterator( to1.parent ), *it );
+				}
+			}
+			else if( last - first == 1 )
+			{
+				siblingIterator target( index.entries[ fnd ].node );
+				SIBLING_RANGE   below( it.begin(), it.end() );
+				mergeLevel( target.begin(), target.end(), &below, &below + 1, duplicateLeaves );
+			}
+			else
+			{
+				typename mergeIndex::entry& match = index.entries[ fnd ];
+				if( match.target == mergeIndex::npos )
+				{
+					match.target = targets.size();
+					targets.push_back( match.node );
+				}
+				matched.push_back( std::make_pair( match.target, SIBLING_RANGE( it.begin(), it.end() ) ) );
 			}
 		}
-		tmp = tmp->firstChild;
-		++curdepth;
 	}
-	return tmp;
-}
+	if( matched.empty() )
+	{
+		return;
+	}
 
-template< class T, class TreeNodeAllocator_ >
-typename Tree< T, TreeNodeAllocator_ >::breadthFirstQueuedIterator Tree< T, TreeNodeAllocator_ >::beginBreadthFirst() const
-{
-    return breadthFirstQueuedIterator( head->nextSibling );
-}
+	// group the children by the node matched, keeping their order
+	std::vector< size_t > start( targets.size() + 1, 0 );
+	for( size_t i = 0; i < matched.size(); ++i )
+	{
+		++start[ matched[ i ].first + 1 ];
+	}
+	for( size_t i = 0; i < targets.size(); ++i )
+	{
+		start[ i + 1 ] += start[ i ];
+	}
 
-template< class T, class TreeNodeAllocator_ >
-typename Tree< T, TreeNodeAllocator_ >::breadthFirstQueuedIterator Tree< T, TreeNodeAllocator_ >::endBreadthFirst() const
-{
-	return breadthFirstQueuedIterator();
-}
+	std::vector< SIBLING_RANGE > below( matched.size() );
+	std::vector< size_t >        fill( start.begin(), start.end() - 1 );
+	for( size_t i = 0; i < matched.size(); ++i )
+	{
+		below[ fill[ matched[ i ].first ]++ ] = matched[ i ].second;
+	}
 
-template< class T, class TreeNodeAllocator_ >
-typename Tree< T, TreeNodeAllocator_ >::siblingIterator Tree< T, TreeNodeAllocator_ >::beginSibling( const iteratorBase& pos ) const
-{
-	assert( pos.node != 0 );
-	if( pos.node->firstChild == 0 )
+	for( size_t i = 0; i < targets.size(); ++i )
 	{
-	    return endSibling( pos );
+		siblingIterator target( targets[ i ] );
+		mergeLevel( target.begin(), target.end(), below.data() + start[ i ], below.data() + start[ i + 1 ], duplicateLeaves );
 	}
-	return pos.node->firstChild;
 }
 
-template< class T, class TreeNodeAllocator_ >
-typename Tree< T, TreeNodeAllocator_ >::siblingIterator Tree< T, TreeNodeAllocator_ >::endSibling( const iteratorBase& pos ) const
-{
-    siblingIterator ret( 0 );
-	ret.parent = pos.node;
-	return ret;
-}
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+const size_t Tree< T, TreeNodeAllocator_, TreePolicy_ >::mergeIndex::npos;
 
-template< class T, class TreeNodeAllocator_ >
-typename Tree< T, TreeNodeAllocator_ >::leafIterator Tree< T, TreeNodeAllocator_ >::beginLeaf() const
+// Open addressing with linear probing in a table at least twice the
+// largest number of entries, so it never fills up or grows.
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+Tree< T, TreeNodeAllocator_, TreePolicy_ >::mergeIndex::mergeIndex( size_t count )
+	: shift( 64 )
 {
-	TREE_NODE *tmp = head->nextSibling;
-	if( tmp != feet )
+	size_t size = 1;
+	while( size < 2 * count )
 	{
-	    while( tmp->firstChild )
-		{
-			tmp = tmp->firstChild;
-		}
+		size *= 2;
+		--shift;
 	}
-	return leafIterator( tmp );
+	slots.assign( size, npos );
+	entries.reserve( count );
 }
 
-template< class T, class TreeNodeAllocator_ >
-typename Tree< T, TreeNodeAllocator_ >::leafIterator Tree< T, TreeNodeAllocator_ >::endLeaf() const
+// The hash is spread by a Fibonacci multiply, as std::hash is often the
+// identity for integers.
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+size_t Tree< T, TreeNodeAllocator_, TreePolicy_ >::mergeIndex::probe( const T& x, size_t& hash ) const
 {
-	return leafIterator( feet );
-}
+	hash = valueHash( x, TreeHashable< T >() );
 
-template< class T, class TreeNodeAllocator_ >
-typename Tree< T, TreeNodeAllocator_ >::leafIterator Tree< T, TreeNodeAllocator_ >::beginLeaf( const iteratorBase& top ) const
-{
-	TREE_NODE *tmp = top.node;
-	while( tmp->firstChild )
+	size_t mask = slots.size() - 1;
+	size_t slot = shift < 64 ? size_t( ( std::uint64_t( hash ) * 0x9E3779B97F4A7C15ull ) >> shift ) : 0;
+	while( slots[ slot ] != npos )
 	{
-		tmp = tmp->firstChild;
+		const entry& e = entries[ slots[ slot ] ];
+		if( e.hash == hash && e.node->data == x )
+		{
+			break;
+		}
+		slot = ( slot + 1 ) & mask;
 	}
-	return leafIterator( tmp, top.node );
+	return slot;
 }
 
-template< class T, class TreeNodeAllocator_ >
-typename Tree< T, TreeNodeAllocator_ >::leafIterator Tree< T, TreeNodeAllocator_ >::endLeaf( const iteratorBase& top ) const
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+void Tree< T, TreeNodeAllocator_, TreePolicy_ >::mergeIndex::add( size_t slot, TREE_NODE *node, size_t hash )
 {
-	return leafIterator( top.node, top.node );
+	entry e = { hash, node, npos };
+	slots[ slot ] = entries.size();
+	entries.push_back( e );
 }
 
-template< class T, class TreeNodeAllocator_ >
-template< typename iter >
-iter Tree< T, TreeNodeAllocator_ >::parent( iter position )
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+void Tree< T, TreeNodeAllocator_, TreePolicy_ >::sort( siblingIterator from, siblingIterator to, bool deep )
 {
-	assert( position.node != 0 );
-	return iter( position.node->parent );
+	std::less< T > comp;
+	sort( from, to, comp, deep );
 }
 
-template< class T, class TreeNodeAllocator_ >
-template< typename iter >
-iter Tree< T, TreeNodeAllocator_ >::previousSibling( iter position ) const
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+template< class StrictWeakOrdering >
+void Tree< T, TreeNodeAllocator_, TreePolicy_ >::sort( siblingIterator from, siblingIterator to, StrictWeakOrdering comp, bool deep )
 {
-	assert( position.node != 0 );
-	iter ret( position );
-	ret.node = position.node->prevSibling;
-	return ret;
+	typedef void SERIAL( std::function< void() > );
+	sortRange( from, to, compareNodes< StrictWeakOrdering >( comp ), deep, ( SERIAL * )0 );
 }
 
-template< class T, class TreeNodeAllocator_ >
-template< typename iter >
-iter Tree< T, TreeNodeAllocator_ >::nextSibling( iter position ) const
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+template< class StrictWeakOrdering, class Pool >
+void Tree< T, TreeNodeAllocator_, TreePolicy_ >::sort( siblingIterator from, siblingIterator to, StrictWeakOrdering comp, bool deep, Pool& pool )
 {
-	assert( position.node != 0 );
-	iter ret( position );
-	ret.node = position.node->nextSibling;
-	return ret;
+	sortRange( from, to, compareNodes< StrictWeakOrdering >( comp ), deep, &pool );
 }
 
-template< class T, class TreeNodeAllocator_ >
-template< typename iter >
-iter Tree< T, TreeNodeAllocator_ >::nextAtSameDepth( iter position ) const
+// The bookkeeping that spans subtrees, the level lists, the leaf chain
+// outside the range and the indexes, is done once for the whole range.
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+template< class Compare, class Pool >
+void Tree< T, TreeNodeAllocator_, TreePolicy_ >::sortRange( siblingIterator from, siblingIterator to, Compare comp, bool deep, Pool *pool )
 {
-    //////////////////////////////////////////////////////////////////////////
-	typename Tree< T, TreeNodeAllocator_ >::fixedDepthIterator tmp( position.node );
-	
-	++tmp;
-	return iter( tmp );
-}
+    if( from == to )
+	{
+		return;
+	}
 
-template< class T, class TreeNodeAllocator_ >
-void Tree< T, TreeNodeAllocator_ >::clear()
-{
-	if( head )
+	// found by walking, reducedLinks has no way back from to
+	TREE_NODE *first = from.node;
+	TREE_NODE *last  = from.node;
+	while( last->nextSibling != to.node )
 	{
-		while( head->nextSibling != feet )
-		{
-			erase( preOrderIterator( head->nextSibling ) ); 
-		}
+		last = last->nextSibling;
 	}
-}
 
-template< class T, class TreeNodeAllocator_ >
-template< class iter >
-iter Tree< T, TreeNodeAllocator_ >::erase( iter it )
-{
-	TREE_NODE *cur = it.node;
-	assert( cur != head );
-	iter ret = it;
-	ret.skipChildren();
-	++ret;
-	eraseChildren( it );
-	if( cur->prevSibling == 0 )
+	TREE_NODE *prev     = prevSiblingOf( first );
+	TREE_NODE *prevLeaf = leafBefore( first );
+	TREE_NODE *nextLeaf = leafAfter(  last  );
+
+	this->orderChanged();
+	this->labelsChanged( first->parent );
+	hashChanged( first->parent );
+
+	if( TreePolicy_::levelLinks )
 	{
-		cur->parent->firstChild = cur->nextSibling;
+		unthreadLevels( first, last );
 	}
-	else
+
+	std::exception_ptr error;
+	sortSiblings( first, last, prev, comp, error );
+
+	if( deep && !error )
 	{
-		cur->prevSibling->nextSibling = cur->nextSibling;
+		if( pool != 0 )
+		{
+			sortInParallel( first, last, comp, error, *pool );
+		}
+		else
+		{
+			for( TREE_NODE *top = first; ; top = top->nextSibling )
+			{
+				sortBelow( top, comp, error );
+				if( top == last )
+				{
+					break;
+				}
+			}
+		}
 	}
 
-	if( cur->nextSibling == 0 )
+	if( TreePolicy_::leafChain )
 	{
-		cur->parent->lastChild = cur->prevSibling;
+		rethreadLeaves( first, last, prevLeaf, nextLeaf );
 	}
-	else
+	if( TreePolicy_::levelLinks )
 	{
-		cur->nextSibling->prevSibling = cur->prevSibling;
+		linkLevels(   first, last );
+		threadLevels( first, last );
 	}
 
-	alloc_.destroy( cur );
-	alloc_.deallocate( cur, 1 );
-	return ret;
+	if( error )
+	{
+		std::rethrow_exception( error );
+	}
 }
 
-
-template< class T, class TreeNodeAllocator_ >
-void Tree< T, TreeNodeAllocator_ >::eraseChildren( const iteratorBase& it )
+// Merge sort on the sibling links as std::list does it: runs of 2^i nodes
+// wait in bins[ i ] and each new node is carried up, merging with every
+// full bin on the way. Runs merge while they are still in cache, and the
+// bins live on the stack.
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+template< class Compare >
+void Tree< T, TreeNodeAllocator_, TreePolicy_ >::sortSiblings( TREE_NODE *&first, TREE_NODE *&last, TREE_NODE *prev, Compare& comp, std::exception_ptr& error )
 {
-	if( it.node == 0 )
+	if( error || first == last )
+	{
 		return;
+	}
 
-	TREE_NODE *cur  = it.node->firstChild;
-	TREE_NODE *prev = 0                  ;
+	TREE_NODE *parent = first->parent     ;
+	TREE_NODE *next   = last->nextSibling ;
+	last->nextSibling = 0;
 
-	while( cur != 0 )
+	TREE_NODE *bins[ 64 ] = {};
+	size_t     fill       = 0;
+	for( TREE_NODE *it = first; it != 0; )
 	{
-		prev = cur;
-		cur  = cur->nextSibling;
-		eraseChildren( preOrderIterator( prev ) );
-		alloc_.destroy( prev );
-		alloc_.deallocate( prev, 1 );
-	}
-	it.node->firstChild = 0;
-	it.node->lastChild  = 0;
-}
+		TREE_NODE *carry = it;
+		it = it->nextSibling;
+		carry->nextSibling = 0;
 
-template< class T, class TreeNodeAllocator_ >
-template< typename iter >
-iter Tree< T, TreeNodeAllocator_ >::appendChild( iter position )
-{
-    assert( position.node != head );
-	assert( position.node != feet );
-	assert( position.node );
+		size_t i = 0;
+		for( ; i < fill && bins[ i ] != 0; ++i )
+		{
+			carry     = mergeSiblings( bins[ i ], carry, comp, error );
+			bins[ i ] = 0;
+		}
+		bins[ i ] = carry;
+		fill      = std::max( fill, i + 1 );
+	}
 
-	TREE_NODE *tmp = alloc_.allocate( 1, 0 );
-	alloc_.construct( tmp, _TreeNode< T >() );
+	TREE_NODE *list = 0;
+	for( size_t i = 0; i < fill; ++i )
+	{
+		if( bins[ i ] != 0 )
+		{
+			list = ( list != 0 ? mergeSiblings( bins[ i ], list, comp, error ) : bins[ i ] );
+		}
+	}
 
-    tmp->firstChild = 0;
-	tmp->lastChild  = 0;
+	first = list;
+	if( prev != 0 )
+	{
+		prev->nextSibling = first;
+	}
+	else
+	{
+		parent->firstChild = first;
+	}
 
-	tmp->parent = position.node;
+	TREE_NODE *before = prev;
+	for( TREE_NODE *it = first; it != 0; it = it->nextSibling )
+	{
+		it->setPrevSibling( before );
+		before = it;
+	}
+	last = before;
 
-	if( position.node->lastChild != 0 )
+	last->nextSibling = next;
+	if( next != 0 )
 	{
-	    position.node->lastChild->nextSibling = tmp;
+		next->setPrevSibling( last );
 	}
 	else
 	{
-	    position.node->firstChild = tmp;
+		parent->setLastChild( last );
+	}
+	if( parent != 0 )
+	{
+		parent->childrenChanged( 0 );
 	}
-
-	tmp->prevSibling = position.node->lastChild;
-	position.node->lastChild = tmp;
-	tmp->nextSibling = 0; 
-	return tmp;
 }
 
-template< class T, class TreeNodeAllocator_ >
-template< typename iter >
-iter Tree< T, TreeNodeAllocator_ >::prependChild( iter position )
+// Merges two sorted lists ended by 0, one before the other, taking from
+// one on ties. A throwing comparison counts as a tie from then on, which
+// still yields a whole list.
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+template< class Compare >
+typename Tree< T, TreeNodeAllocator_, TreePolicy_ >::TREE_NODE *Tree< T, TreeNodeAllocator_, TreePolicy_ >::mergeSiblings( TREE_NODE *one, TREE_NODE *two, Compare& comp, std::exception_ptr& error )
 {
-	assert( position.node != head );
-	assert( position.node != feet );
-	assert( position.node );
+	TREE_NODE *ret  = 0;
+	TREE_NODE *tail = 0;
+	while( one != 0 && two != 0 )
+	{
+		bool before = false;
+		if( !error )
+		{
+			try
+			{
+				before = comp( two, one );
+			}
+			catch( ... )
+			{
+				error = std::current_exception();
+			}
+		}
 
-	TREE_NODE *tmp = alloc_.allocate( 1, 0 );
-	alloc_.construct( tmp, _TreeNode< T >() );
-	
-	tmp->firstChild = 0;
-	tmp->lastChild  = 0;
+		TREE_NODE *e;
+		if( before )
+		{
+			e   = two;
+			two = two->nextSibling;
+		}
+		else
+		{
+			e   = one;
+			one = one->nextSibling;
+		}
+
+		if( tail != 0 )
+		{
+			tail->nextSibling = e;
+		}
+		else
+		{
+			ret = e;
+		}
+		tail = e;
+	}
 
-	tmp->parent = position.node;
-	if( position.node->firstChild != 0 )
+	TREE_NODE *rest = ( one != 0 ? one : two );
+	if( tail == 0 )
 	{
-	    position.node->firstChild->prevSibling = tmp;
+		return rest;
 	}
-	else
+	tail->nextSibling = rest;
+	return ret;
+}
+
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+template< class Compare >
+void Tree< T, TreeNodeAllocator_, TreePolicy_ >::sortChildren( TREE_NODE *node, Compare& comp, std::exception_ptr& error )
+{
+	TREE_NODE *first = node->firstChild;
+	if( first == 0 )
 	{
-		position.node->lastChild = tmp;
+		return;
 	}
+	TREE_NODE *last = node->lastChildNode();
+	sortSiblings( first, last, 0, comp, error );
 
-    tmp->nextSibling = position.node->firstChild;
-	position.node->firstChild = tmp;
-	tmp->prevSibling = 0;
-	return tmp;
+	// no walk up, the nodes above are sorted as well or were forgotten by
+	// sortRange(), and a deep sort may be running below them on other threads
+	node->setSubtreeHash( 0 );
+
+	if( TreePolicy_::leafChain )
+	{
+		TREE_NODE *prevLeaf = 0;
+		for( TREE_NODE *it = first; it != 0; it = it->nextSibling )
+		{
+			if( prevLeaf != 0 )
+			{
+				joinLeaves( prevLeaf, it->firstLeaf() );
+			}
+			prevLeaf = it->lastLeaf();
+		}
+		node->setLeftLeaf(  first->firstLeaf() );
+		node->setRightLeaf( prevLeaf           );
+	}
 }
 
+// Post-order walk; a node is sorted on the way up from its last child,
+// which leaves the order of the nodes above, still to be walked, alone.
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+template< class Compare >
+void Tree< T, TreeNodeAllocator_, TreePolicy_ >::sortBelow( TREE_NODE *top, Compare& comp, std::exception_ptr& error )
+{
+	if( top->firstChild == 0 )
+	{
+		return;
+	}
 
-template< class T, class TreeNodeAllocator_ >
-template< class iter >
-iter Tree< T, TreeNodeAllocator_ >::appendChild( iter position, const T& x )
+	TREE_NODE *cur = top;
+	for( ; ; )
+	{
+		while( cur->firstChild != 0 )
+		{
+			cur = cur->firstChild;
+		}
+		while( cur->nextSibling == 0 )
+		{
+			cur = cur->parent;
+			sortChildren( cur, comp, error );
+			if( cur == top )
+			{
+				return;
+			}
+		}
+		cur = cur->nextSibling;
+	}
+}
+
+// Splits the subtrees below the range a level at a time until there are
+// enough to keep every core busy, sorts those on the pool and the calling
+// thread, and then the nodes split off on the way down, deepest first.
+// The pool may run a task late, after the sort has returned; such a task
+// finds nothing left to claim and only holds on to the job.
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+template< class Compare, class Pool >
+void Tree< T, TreeNodeAllocator_, TreePolicy_ >::sortInParallel( TREE_NODE *first, TREE_NODE *last, Compare& comp, std::exception_ptr& error, Pool& pool )
 {
-	//////////////////////////////////////////////////////////////////////////
-	// note 
+	struct Job
+	{
+		Job( Tree *tree_, const Compare& comp_ ) : tree( tree_ ), comp( comp_ ), next( 0 ), done( 0 ) {}
 
-	assert( position.node != head );
-	assert( position.node != feet );
-	assert( position.node );
+		void work()
+		{
+			for( size_t i = next++; i < tops.size(); i = next++ )
+			{
+				Compare            c( comp );
+				std::exception_ptr e;
+				tree->sortBelow( tops[ i ], c, e );
 
-	TREE_NODE* tmp = alloc_.allocate( 1, 0 );
-	alloc_.construct( tmp, x );
+				std::lock_guard< std::mutex > lock( mutex );
+				if( e && !error )
+				{
+					error = e;
+				}
+				if( ++done == tops.size() )
+				{
+					finished.notify_all();
+				}
+			}
+		}
 
-	tmp->firstChild = 0;
-	tmp->lastChild  = 0;
+		Tree                       *tree    ;
+		Compare                     comp    ;
+		std::vector< TREE_NODE * >  tops    ;
+		std::atomic< size_t >       next    ;
+		size_t                      done    ;
+		std::exception_ptr          error   ;
+		std::mutex                  mutex   ;
+		std::condition_variable     finished;
+	};
 
-	tmp->parent = position.node;
+	size_t workers = std::max( 1u, std::thread::hardware_concurrency() );
 
-	if( position.node->lastChild != 0 )
+	std::shared_ptr< Job > job = std::make_shared< Job >( this, comp );
+	for( TREE_NODE *it = first; ; it = it->nextSibling )
 	{
-		position.node->lastChild->nextSibling = tmp;
+		job->tops.push_back( it );
+		if( it == last )
+		{
+			break;
+		}
 	}
-	else
+
+	std::vector< TREE_NODE * > above;
+	std::vector< TREE_NODE * > level;
+	while( job->tops.size() < 4 * workers )
 	{
-		position.node->firstChild = tmp;
+		level.clear();
+		for( size_t i = 0; i < job->tops.size(); ++i )
+		{
+			TREE_NODE *top = job->tops[ i ];
+			if( top->firstChild != 0 )
+			{
+				above.push_back( top );
+				for( TREE_NODE *child = top->firstChild; child != 0; child = child->nextSibling )
+				{
+					level.push_back( child );
+				}
+			}
+		}
+		if( level.empty() )
+		{
+			break;
+		}
+		job->tops.swap( level );
 	}
-	tmp->prevSibling = position.node->lastChild;
-	position.node->lastChild = tmp;
-	tmp->nextSibling = 0;
-	return tmp;
-}
-
-template< class T, class TreeNodeAllocator_ >
-template< class iter >
-iter Tree< T, TreeNodeAllocator_ >::prependChild( iter position, const T& x )
-{
-	assert( position.node != head );
-	assert( position.node != feet );
-	assert( position.node );
 
-    TREE_NODE* tmp = alloc_.allocate( 1, 0 );
-	alloc_.construct( tmp, x );
-
-	tmp->firstChild = 0;
-	tmp->lastChild  = 0;
-	
-	tmp->parent = position.node;
-
-	if( position.node->firstChild != 0 )
+	// a pool that turns work down only costs parallelism; one that was
+	// passed in gets a task even on a single core
+	size_t helpers = std::min( std::max( workers, size_t( 2 ) ), job->tops.size() ) - 1;
+	for( size_t i = 0; i < helpers; ++i )
 	{
-	    position.node->firstChild->prevSibling = tmp;
+		try
+		{
+			pool( std::function< void() >( [job]() { job->work(); } ) );
+		}
+		catch( ... )
+		{
+			break;
+		}
 	}
-	else
+	job->work();
 	{
-	    position.node->lastChild = tmp;
+		std::unique_lock< std::mutex > lock( job->mutex );
+		while( job->done < job->tops.size() )
+		{
+			job->finished.wait( lock );
+		}
+		error = job->error;
 	}
 
-	tmp->nextSibling = position.node->firstChild;
-	position.node->firstChild = tmp;
-	tmp->prevSibling = 0;
-	return tmp;
+	for( size_t i = above.size(); i-- > 0; )
+	{
+		sortChildren( above[ i ], comp, error );
+	}
 }
 
-template< class T, class TreeNodeAllocator_ >
-template< class iter >
-iter Tree< T, TreeNodeAllocator_ >::appendChild( iter position, iter other )
+// A whole subtree at the start of the range that hashes differently from
+// the one it is compared with cannot match, whatever follows.
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+template< typename iter >
+bool Tree< T, TreeNodeAllocator_, TreePolicy_ >::equal( const iter& one_, const iter& two, const iter& three_ ) const
 {
-	assert( position.node != head );
-	assert( position.node != feet );
-	assert( position.node );
+	if( TreePolicy_::subtreeHashes && TreeHashable< T >::value &&
+		one_ != two && isValid( one_ ) && isValid( three_ ) && !isAncestor( one_, two ) &&
+		hashOf( one_.node ) != hashOf( three_.node ) )
+	{
+		return false;
+	}
 
-	siblingIterator aargh = appendChild( position, value_type() );
-	return replace( aargh, other );
+	std::equal_to< T > comp;
+	return equal( one_, two, three_, comp );
 }
 
-template< class T, class TreeNodeAllocator_ >
-template< class iter >
-iter Tree< T, TreeNodeAllocator_ >::prependChild( iter position, iter other )
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+template< typename iter, class BinaryPredicate >
+bool Tree< T, TreeNodeAllocator_, TreePolicy_ >::equal( const iter& one_, const iter& two, const iter& three_, BinaryPredicate fun ) const
 {
-    assert( position.node != head );
-	assert( position.node != feet );
-	assert( position.node );
+    preOrderIterator one(   one_   );
+	preOrderIterator three( three_ );
 
-	siblingIterator aargh = prependChild( position, value_type() );
-	return replace( aargh, other );
+	while( one != two && isValid( three ) )
+	{
+	    if( !fun( *one, *three ) )
+		{
+			return false;
+		}
+		if( one.numberOfChildren() != three.numberOfChildren() )
+		{
+			return false;
+		}
+		++one;
+		++three;
+	}
+	return true;
 }
 
-template< class T, class TreeNodeAllocator_ >
-template< class iter >
-iter Tree< T, TreeNodeAllocator_ >::appendChildren( iter position, siblingIterator from, siblingIterator to )
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+template< typename iter >
+bool Tree< T, TreeNodeAllocator_, TreePolicy_ >::equalSubTree( const iter& one_, const iter& two_ ) const
 {
-	assert( position.node != head );
-	assert( position.node != feet );
-	assert( position.node );
-
-	iter ret = from;
-
-	while( from != to )
+	if( TreePolicy_::subtreeHashes && TreeHashable< T >::value && hashOf( one_.node ) != hashOf( two_.node ) )
 	{
-		insertSubtree( position.end(), from );
-		++from;
+		return false;
 	}
-	return ret;
+
+	std::equal_to< T > comp;
+	return equalSubTree( one_, two_, comp );
 }
 
-template< class T, class TreeNodeAllocator_ >
-template< class iter >
-iter Tree< T, TreeNodeAllocator_ >::prependChildren( iter position, siblingIterator from, siblingIterator to )
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+template< typename iter, class BinaryPredicate >
+bool Tree< T, TreeNodeAllocator_, TreePolicy_ >::equalSubTree( const iter& one_, const iter& two_, BinaryPredicate fun ) const
 {
-	assert( position.node != head );
-	assert( position.node != feet );
-	assert( position.node );
+	preOrderIterator one( one_ );
+	preOrderIterator two( two_ );
 
-	iter ret = from;
+	if( !fun( *one, *two ) )
+	{
+        return false;
+	}
 
-	while( from != to )
+	if( numberOfChildren( one ) != numberOfChildren( two ) )
 	{
-	    insertSubtree( position.begin(), from );
-		++from;
+		return false;
 	}
-	return ret;
+
+	preOrderIterator last( one );
+	last.skipChildren();
+	++last;
+	return equal( one, last, two, fun );
 }
 
-template< class T, class TreeNodeAllocator_ >
-typename Tree< T, TreeNodeAllocator_ >::preOrderIterator Tree< T, TreeNodeAllocator_ >::setHead( const T& x )
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+size_t Tree< T, TreeNodeAllocator_, TreePolicy_ >::subtreeHash( const iteratorBase& it ) const
 {
-	assert( head->nextSibling == feet );
-	return insert( preOrderIterator( feet ), x );
+	return hashOf( it.node );
 }
 
-template< class T, class TreeNodeAllocator_ >
-template< class iter >
-iter Tree< T, TreeNodeAllocator_ >::insert( iter position, const T& x )
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+void Tree< T, TreeNodeAllocator_, TreePolicy_ >::dataChanged( const iteratorBase& it )
 {
-	if( position.node == 0 )
-		position.node = feet;
-
-	TREE_NODE* tmp = alloc_.allocate( 1, 0 );
-	alloc_.construct( tmp, x );
-
-	tmp->firstChild = 0;
-	tmp->lastChild  = 0;
-
-	tmp->parent      = position.node->parent     ;
-	tmp->nextSibling = position.node             ;
-	tmp->prevSibling = position.node->prevSibling;
-
-	position.node->prevSibling = tmp;
+	hashChanged( it.node );
+}
 
-	if( tmp->prevSibling == 0 )
+// A node with a known hash has known hashes below it, so the first
+// ancestor whose hash is not known ends the walk.
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+void Tree< T, TreeNodeAllocator_, TreePolicy_ >::hashChanged( TREE_NODE *node )
+{
+	if( TreePolicy_::subtreeHashes )
 	{
-		if( tmp->parent )
+		for( ; node != 0 && node->subtreeHash() != 0; node = node->parent )
 		{
-			tmp->parent->firstChild = tmp;
+			node->setSubtreeHash( 0 );
 		}
 	}
-	else
-		tmp->prevSibling->nextSibling = tmp;
-
-	return tmp;
 }
 
-template< class T, class TreeNodeAllocator_ >
-typename Tree< T, TreeNodeAllocator_ >::siblingIterator Tree< T, TreeNodeAllocator_ >::insert( siblingIterator position, const T& x )
+// Pre-order walk that skips the subtrees whose hash is known, folding the
+// hash of a node into its parent's on the way up. open holds the partial
+// hashes of the nodes whose children are being walked. The hash of a node
+// is its data hashed, with the hashes of its children folded in one after
+// the other and the result mixed; 0 is kept for an unknown hash.
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+size_t Tree< T, TreeNodeAllocator_, TreePolicy_ >::hashOf( TREE_NODE *top ) const
 {
-	TREE_NODE *tmp = alloc_.allocate( 1, 0 );
-	alloc_.construct( tmp, x );
-
-	tmp->firstChild = 0;
-	tmp->lastChild  = 0;
-
-	tmp->nextSibling = position.node;
-	if( position.node == 0 )
+	if( top->subtreeHash() != 0 )
 	{
-		tmp->parent      = position.parent     ;
-		tmp->prevSibling = position.rangeLast();
-
-		tmp->parent->lastChild = tmp;
-	}
-	else
-	{
-		tmp->parent      = position.node->parent     ;
-		tmp->prevSibling = position.node->prevSibling;
-
-		position.node->prevSibling = tmp;
+		return top->subtreeHash();
 	}
 
-	if( tmp->prevSibling == 0 )
+	std::vector< std::uint64_t > open;
+	TREE_NODE                   *cur = top;
+	while( true )
 	{
-		if( tmp->parent )
-			tmp->parent->firstChild = tmp;
-	}
-	else
-		tmp->prevSibling->nextSibling = tmp;
-
-	return tmp;
-}
-
-template< class T, class TreeNodeAllocator_ >
-template< class iter >
-iter Tree< T, TreeNodeAllocator_ >::insertSubtree( iter position, const iteratorBase &subtree )
-{
-	iter it = insert( position, value_type() );
-	return replace( it, subtree );
-}
-
-template< class T, class TreeNodeAllocator_ >
-template< class iter >
-iter Tree< T, TreeNodeAllocator_ >::insertAfter( iter position, const T& x )
-{
-	TREE_NODE *tmp = alloc_.allocate( 1, 0 );
-	alloc_.construct( tmp, x );
-	tmp->firstChild = 0;
-	tmp->lastChild  = 0;
+		std::uint64_t hash = cur->subtreeHash();
+		if( hash == 0 )
+		{
+			open.push_back( valueHash( cur->data, TreeHashable< T >() ) * 0x9E3779B97F4A7C15ull );
+			if( cur->firstChild != 0 )
+			{
+				cur = cur->firstChild;
+				continue;
+			}
+		}
 
-	tmp->parent = position.node->parent;
-	tmp->prevSibling = position.node;
-	tmp->nextSibling = position.node->nextSibling;
+		while( true )
+		{
+			if( hash == 0 )
+			{
+				hash = open.back();
+				open.pop_back();
+				hash ^= hash >> 33;
+				hash *= 0xFF51AFD7ED558CCDull;
+				hash ^= hash >> 33;
+				hash  = ( size_t( hash ) != 0 ? hash : 1 );
+				cur->setSubtreeHash( size_t( hash ) );
+			}
+			if( cur == top )
+			{
+				return size_t( hash );
+			}
 
-    position.node->nextSibling = tmp;
+			std::uint64_t& parent = open.back();
+			parent ^= hash + 0x9E3779B97F4A7C15ull + ( parent << 6 ) + ( parent >> 2 );
 
-	if( tmp->nextSibling == 0 )
-	{
-		if( tmp->parent )
-		{
-			tmp->parent->lastChild = tmp;
+			if( cur->nextSibling != 0 )
+			{
+				cur = cur->nextSibling;
+				break;
+			}
+			cur  = cur->parent;
+			hash = 0;
 		}
 	}
-	else
-	{
-		tmp->nextSibling->prevSibling = tmp;
-	}
-	return tmp;
 }
 
-template< class T, class TreeNodeAllocator_ >
-template< class iter >
-iter Tree< T, TreeNodeAllocator_ >::insertSubtreeAfter( iter position, const iteratorBase& subtree )
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+void Tree< T, TreeNodeAllocator_, TreePolicy_ >::write( std::ostream& out ) const
 {
-	iter it = insertAfter( position, value_type() );
-	return replace( it, subtree );
+	TreeCodec< T > codec;
+	write( out, codec );
 }
 
-template< class T, class TreeNodeAllocator_ >
-template< class iter >
-iter Tree< T, TreeNodeAllocator_ >::replace( iter position, const T& x )
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+void Tree< T, TreeNodeAllocator_, TreePolicy_ >::read( std::istream& in )
 {
-	position.node->data = x;
-	return position;
+	TreeCodec< T > codec;
+	read( in, codec );
 }
 
-template< class T, class TreeNodeAllocator_ >
-template< class iter >
-iter Tree< T, TreeNodeAllocator_ >::replace( iter position, const iteratorBase& from )
+// The header is "TREE", the version, a byte of flags that is 0 for now,
+// TreeBinary::byteOrder as this machine stores it, the number of nodes and
+// the number of top nodes.
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+template< class Codec >
+void Tree< T, TreeNodeAllocator_, TreePolicy_ >::write( std::ostream& out, Codec& codec ) const
 {
-	assert( position.node != head );
+	const char header[ 6 ] = { 'T', 'R', 'E', 'E', char( TreeBinary::version ), 0 };
+	TreeBinary::putBytes( out, header, 6 );
+	const std::uint32_t order = TreeBinary::byteOrder;
+	TreeBinary::putBytes( out, reinterpret_cast< const char * >( &order ), sizeof( order ) );
 
-	TREE_NODE *currentFrom = from.node   ;
-	TREE_NODE *startFrom   = from.node   ;
-	TREE_NODE *currentTo   = position.node;
-
-	eraseChildren( position );  
+	size_t tops = 0;
+	for( TREE_NODE *it = head->nextSibling; it != feet; it = it->nextSibling )
+	{
+		++tops;
+	}
+	TreeBinary::putNumber( out, size() );
+	TreeBinary::putNumber( out, tops   );
 
-	TREE_NODE* tmp = alloc_.allocate( 1, 0 );
-	alloc_.construct( tmp, ( *from ) );
+	for( preOrderIterator it = begin(); it != end(); ++it )
+	{
+		TreeBinary::putNumber( out, it.numberOfChildren() );
+		codec.write( out, *it );
+	}
+}
 
-	tmp->firstChild = 0;
-	tmp->lastChild  = 0;
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+template< class Codec >
+void Tree< T, TreeNodeAllocator_, TreePolicy_ >::read( std::istream& in, Codec& codec )
+{
+	clear();
 
-	if( currentTo->prevSibling == 0 )
+	char header[ 6 ];
+	TreeBinary::getBytes( in, header, 6 );
+	if( header[ 0 ] != 'T' || header[ 1 ] != 'R' || header[ 2 ] != 'E' || header[ 3 ] != 'E' )
 	{
-		if( currentTo->parent != 0 )
-			currentTo->parent->firstChild = tmp;
+		throw std::runtime_error( "tree: not a binary tree" );
 	}
-	else
+	if( std::uint8_t( header[ 4 ] ) != TreeBinary::version || header[ 5 ] != 0 )
 	{
-		currentTo->prevSibling->nextSibling = tmp;
+		throw std::runtime_error( "tree: binary tree of an unknown version" );
 	}
-
-	tmp->prevSibling = currentTo->prevSibling;
-	if( currentTo->nextSibling == 0 )
+	std::uint32_t order;
+	TreeBinary::getBytes( in, reinterpret_cast< char * >( &order ), sizeof( order ) );
+	if( order != TreeBinary::byteOrder )
 	{
-		if( currentTo->parent != 0 )
-			currentTo->parent->lastChild = tmp;
+		throw std::runtime_error( "tree: binary tree of the other byte order" );
 	}
-	else
+
+	std::uint64_t count = TreeBinary::getNumber( in );
+	std::uint64_t tops  = TreeBinary::getNumber( in );
+	if( count > std::uint64_t( size_t( -1 ) ) || tops > count )
 	{
-		currentTo->nextSibling->prevSibling = tmp;
+		throw std::runtime_error( "tree: more nodes in binary tree than its header says" );
 	}
+	size_t left = size_t( count );
 
-	tmp->nextSibling = currentTo->nextSibling;
-	tmp->parent      = currentTo->parent     ;
+	// the header is not to be trusted before the nodes are there, so no
+	// more than a block's worth is reserved on its word
+	if( TreeNodeAllocatorTraits< TREE_NODE_ALLOCATOR >::reserves )
+	{
+		TreeNodeAllocatorTraits< TREE_NODE_ALLOCATOR >::reserve( alloc_, left < TreeBinary::reserveLimit ? left : size_t( TreeBinary::reserveLimit ) );
+	}
 
-	alloc_.destroy( currentTo );
-	alloc_.deallocate( currentTo, 1 );
+	std::vector< size_t > open;
+	try
+	{
+		for( size_t i = 0; i < tops; ++i )
+		{
+			linkBefore( feet, readSubtree( in, codec, left, open ) );
+		}
+		if( left != 0 )
+		{
+			throw std::runtime_error( "tree: fewer nodes in binary tree than its header says" );
+		}
+	}
+	catch( ... )
+	{
+		clear();
+		throw;
+	}
+}
 
-	currentTo = tmp;
+// One pre-order walk numbers the nodes; a node's subtree ends where the
+// walk leaves it.
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+FrozenTree< T > Tree< T, TreeNodeAllocator_, TreePolicy_ >::freeze() const
+{
+	typedef typename FrozenTree< T >::index_type index_type;
 
-	TREE_NODE *last = from.node->nextSibling;
+	FrozenTree< T > ret;
+	if( constantTimeSize )
+	{
+		size_t num = size();
+		ret.data_.reserve(   num );
+		ret.parent_.reserve( num );
+		ret.end_.reserve(    num );
+		ret.depth_.reserve(  num );
+	}
 
-	preOrderIterator toit = tmp;
+	std::vector< index_type > path;   // open ancestors of cur
+	TREE_NODE *cur = head->nextSibling;
 
-	do 
+	while( cur != feet )
 	{
-		assert( currentFrom != 0 );
-		if( currentFrom->firstChild != 0 )
+		index_type pos = index_type( ret.data_.size() );
+		ret.data_.push_back(   cur->data );
+		ret.parent_.push_back( path.empty() ? FrozenTree< T >::npos : path.back() );
+		ret.end_.push_back(    0 );
+		ret.depth_.push_back(  index_type( path.size() ) );
+
+		if( cur->firstChild != 0 )
 		{
-			currentFrom = currentFrom->firstChild;
-			toit = appendChild( toit, currentFrom->data ); 
+			path.push_back( pos );
+			cur = cur->firstChild;
+			continue;
 		}
-		else
+
+		ret.end_[ pos ] = pos + 1;
+		while( cur->nextSibling == 0 )
 		{
-			while( currentFrom->nextSibling == 0 && currentFrom != startFrom )
-			{
-				currentFrom = currentFrom->parent;
-				toit = parent( toit );  
-				assert( currentFrom != 0 );
-			}
-			currentFrom = currentFrom->nextSibling;
-			if( currentFrom != last )
-			{
-				toit = appendChild( parent( toit ), currentFrom->data );
-			}
+			cur = cur->parent;
+			ret.end_[ path.back() ] = pos + 1;
+			path.pop_back();
 		}
-	} while ( currentFrom != last );
+		cur = cur->nextSibling;
+	}
 
-	return currentTo;
+	ret.linkChildren();
+	return ret;
 }
 
-template< class T, class TreeNodeAllocator_ >
-typename Tree< T, TreeNodeAllocator_ >::siblingIterator Tree< T, TreeNodeAllocator_ >::replace( siblingIterator origBegin,									                   
-																							    siblingIterator origEnd  ,
-                                                                                                siblingIterator newBegin ,
-							                                                                    siblingIterator newEnd     )
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+Tree< T, TreeNodeAllocator_, TreePolicy_ > Tree< T, TreeNodeAllocator_, TreePolicy_ >::subTree( siblingIterator from, siblingIterator to ) const
 {
-    TREE_NODE *origFirst = origBegin.node;
-	TREE_NODE *newFirst  = newBegin.node ;
-    TREE_NODE *origLast  = origFirst;
-	while( ( ++origBegin ) != origEnd )
+	Tree tmp;
+	tmp.setHead( value_type() );
+	tmp.replace( tmp.begin(), tmp.end(), from, to );
+	return tmp;
+}
+
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+void Tree< T, TreeNodeAllocator_, TreePolicy_ >::subTree( Tree& tmp, siblingIterator from, siblingIterator to ) const
+{
+    tmp.setHead( value_type() );
+	tmp.replace( tmp.begin(), tmp.end(), from, to );
+}
+
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+void Tree< T, TreeNodeAllocator_, TreePolicy_ >::swap( siblingIterator it )
+{
+	TREE_NODE *nxt = it.node->nextSibling;
+	if( nxt && nxt != feet )
 	{
-	    origLast = origLast->nextSibling;
+		unlinkNode( nxt );
+		linkBefore( it.node, nxt );
 	}
+}
 
-	TREE_NODE *newLast   = newFirst;
-	while( ( ++newBegin ) != newEnd )
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+void Tree< T, TreeNodeAllocator_, TreePolicy_ >::swap( preOrderIterator one, preOrderIterator two )
+{
+	if( one.node->nextSibling == two.node )
 	{
-		newLast = newLast->nextSibling;
+		swap( one );
 	}
-
-	bool first = true;
-	preOrderIterator ret;
-	while( 1==1 )
+	else if( two.node->nextSibling == one.node )
 	{
-		preOrderIterator tt = insertSubtree( preOrderIterator( origFirst ), preOrderIterator( newFirst ) );
-		if( first )
+		swap( two );
+	}
+	else
+	{
+		TREE_NODE *nxt1 = one.node->nextSibling;
+		TREE_NODE *nxt2 = two.node->nextSibling;
+		TREE_NODE *par1 = one.node->parent     ;
+		TREE_NODE *par2 = two.node->parent     ;
+
+		// neither is the next sibling of the other, so the place each one
+		// leaves is still there once both are out
+		unlinkNode( one.node );
+		unlinkNode( two.node );
+
+		if( nxt2 )
 		{
-			ret = tt;
-			first = false;
+			linkBefore( nxt2, one.node );
 		}
-		if( newFirst == newLast )
+		else
 		{
-			break;
+			linkLastChild( par2, one.node );
 		}
-		newFirst = newFirst->nextSibling;
-	}
 
-    bool last = false;
-	TREE_NODE *next = origFirst;
-	while( 1 == 1 )
-	{
-		if( next == origLast )
+		if( nxt1 )
 		{
-			last = true;
+			linkBefore( nxt1, two.node );
 		}
-		next = next->nextSibling;
-		erase( ( preOrderIterator )origFirst );
-		if( last )
+		else
 		{
-			break;
+			linkLastChild( par1, two.node );
 		}
-		origFirst = next;
 	}
-	return ret;
 }
 
-template< class T, class TreeNodeAllocator_ >
-template< typename iter >
-iter Tree< T, TreeNodeAllocator_ >::flatten( iter position )
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+size_t Tree< T, TreeNodeAllocator_, TreePolicy_ >::size() const
 {
-	if( position.node->firstChild == 0 )
+	if( TreePolicy_::countNodes )
 	{
-		return position;
+		return this->nodeCount();
 	}
 
-	TREE_NODE *tmp = position.node->firstChild;
-	while( tmp )
-	{
-        tmp->parent = position.node->parent;
-		tmp = tmp->nextSibling;
-	}
-	if( position.node->nextSibling )
-	{
-        position.node->lastChild->nextSibling = position.node->nextSibling;
-		position.node->nextSibling->prevSibling = position.node->lastChild;
-	}
-	else
+	size_t i = 0;
+	preOrderIterator it  = begin();
+	preOrderIterator eit = end()  ;
+
+	while( it != eit )
 	{
-		position.node->parent->lastChild = position.node->lastChild;
+		++i;
+		++it;
 	}
-	position.node->nextSibling = position.node->firstChild;
-	position.node->nextSibling->prevSibling = position.node;
-	position.node->firstChild = 0;
-	position.node->lastChild  = 0;
-	return position;
+	return i;
 }
 
-template< class T, class TreeNodeAllocator_ >
-template< typename iter >
-iter Tree< T, TreeNodeAllocator_ >::reparent( iter position, siblingIterator begin, siblingIterator end )
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+size_t Tree< T, TreeNodeAllocator_, TreePolicy_ >::size( const iteratorBase& top ) const
 {
-	TREE_NODE *first = begin.node;
-	TREE_NODE *last  = first;
-
-	assert( first != position.node );
-
-	if( begin == end )
-	{
-		return begin;
-	}
-	while( ( ++begin ) != end )
+	if( TreePolicy_::subtreeSizes )
 	{
-		last = last->nextSibling;
+		return top.node->subtreeSize();
 	}
 
-    if( first->prevSibling == 0 )
-	{
-		first->parent->firstChild = last->nextSibling;
-	}
-	else
-	{
-		first->prevSibling->nextSibling = last->nextSibling;
-	}
+	size_t i = 0;
+	preOrderIterator it  = top;
+	preOrderIterator eit = top;
 
-	if( last->nextSibling == 0 )
-	{
-		last->parent->lastChild = first->prevSibling;
-	}
-	else
+	eit.skipChildren();
+	++eit;
+	while( it != eit )
 	{
-		last->nextSibling->prevSibling = first->prevSibling;
+		++i;
+		++it;
 	}
+	return i;
+}
 
-	if( position.node->firstChild == 0 )
-	{
-        position.node->firstChild = first;
-		position.node->lastChild  = last ;
-		first->prevSibling = 0;
-	}
-	else
+// Nodes before it in pre-order are the earlier siblings of it and of each
+// of its ancestors with everything below them, plus the ancestors.
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+size_t Tree< T, TreeNodeAllocator_, TreePolicy_ >::rank( const iteratorBase& it ) const
+{
+	size_t ret = 0;
+
+	if( !TreePolicy_::subtreeSizes )
 	{
-		position.node->lastChild->nextSibling = first;
-		first->prevSibling = position.node->lastChild;
-		position.node->lastChild = last;
+		for( preOrderIterator pos = begin(); pos.node != it.node; ++pos )
+		{
+			++ret;
+		}
+		return ret;
 	}
-	last->nextSibling = 0;
 
-    TREE_NODE *pos = first;
-	for( ; ; )
+	for( TREE_NODE *pos = it.node; ; )
 	{
-        pos->parent = position.node;
-		if( pos == last )
+		TREE_NODE *sib = ( pos->parent != 0 ? pos->parent->firstChild : head->nextSibling );
+		for( ; sib != pos; sib = sib->nextSibling )
+		{
+			ret += sib->subtreeSize();
+		}
+		if( pos->parent == 0 )
 		{
 			break;
 		}
-		pos = pos->nextSibling;
+		pos = pos->parent;
+		++ret;
 	}
-	return first;
+	return ret;
 }
 
-template< class T, class TreeNodeAllocator_ >
-template< typename iter > iter Tree< T, TreeNodeAllocator_ >::reparent( iter position, iter from )
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+typename Tree< T, TreeNodeAllocator_, TreePolicy_ >::preOrderIterator Tree< T, TreeNodeAllocator_, TreePolicy_ >::nodeAt( size_t num ) const
 {
-	if( from.node->firstChild == 0 )
-		return position;
-    
-	return reparent( position, from.node->firstChild, end( from ) );
+	preOrderIterator ret = begin();
+	ret += num;
+	return ret;
 }
 
-template< class T, class TreeNodeAllocator_ >
-template< typename iter > iter Tree< T, TreeNodeAllocator_ >::wrap( iter position, const T& x )
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+bool Tree< T, TreeNodeAllocator_, TreePolicy_ >::empty() const
 {
-	assert( position.node != 0 );
-
-	siblingIterator fr = position;
-	siblingIterator to = position;
-
-	++to;
+	return head->nextSibling == feet;
+}
 
-	iter ret = insert( position, x );
-	reparent( ret, fr, to );
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+int Tree< T, TreeNodeAllocator_, TreePolicy_ >::depth( const iteratorBase& it )
+{
+	TREE_NODE *pos = it.node;
+	assert( pos != 0 );
+	
+	int ret = 0;
+    while( pos->parent != 0 )
+	{
+		pos = pos->parent;
+		++ret;
+	}
 	return ret;
 }
 
-template< class T, class TreeNodeAllocator_ >
-template< typename iter > iter Tree< T, TreeNodeAllocator_ >::moveAfter( iter target, iter source )
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+int Tree< T, TreeNodeAllocator_, TreePolicy_ >::depth( const iteratorBase& it, const iteratorBase& root )
 {
-	TREE_NODE *dst = target.node;
-	TREE_NODE *src = source.node;
-	assert( dst );
-	assert( src );
+	TREE_NODE *pos = it.node;
 
-	if( dst == src )
-	{
-		return source;
-	}
+	assert( pos != 0 );
+	int ret = 0;
 
-	if( dst->nextSibling )
+	while( pos->parent != 0 && pos != root.node )
 	{
-		if( dst->nextSibling == src )
-		{
-			return source;
-		}
+        pos = pos->parent;
+		++ret;
 	}
+	return ret;
+}
 
-	if( src->prevSibling != 0 )
-	{
-		src->prevSibling->nextSibling = src->nextSibling;
-	}
-	else
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+size_t Tree< T, TreeNodeAllocator_, TreePolicy_ >::level( const iteratorBase& it ) const
+{
+	assert( it.node != 0 );
+
+	if( TreePolicy_::levelIndex )
 	{
-		src->parent->firstChild = src->nextSibling;
+		return this->nodeDepth( it.node, head->nextSibling, feet );
 	}
+	return size_t( depth( it ) );
+}
 
-	if( src->nextSibling != 0 )
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+typename Tree< T, TreeNodeAllocator_, TreePolicy_ >::preOrderIterator Tree< T, TreeNodeAllocator_, TreePolicy_ >::ancestor( const iteratorBase& it, size_t k ) const
+{
+	TREE_NODE *pos = it.node;
+	assert( pos != 0 );
+
+	if( TreePolicy_::levelIndex )
 	{
-		src->nextSibling->prevSibling = src->prevSibling;
+		pos = this->levelAncestor( pos, k, head->nextSibling, feet );
 	}
 	else
 	{
-		src->parent->lastChild = src->prevSibling;
+		for( ; k > 0 && pos != 0; --k )
+		{
+			pos = pos->parent;
+		}
 	}
+	return ( pos != 0 ? preOrderIterator( pos ) : end() );
+}
 
-	if( dst->nextSibling != 0 )
-	{
-		dst->nextSibling->prevSibling = src;
-	}
-	else
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+int Tree< T, TreeNodeAllocator_, TreePolicy_ >::maxDepth() const
+{
+	int maxd = -1;
+	for( TREE_NODE *it = head->nextSibling; it != feet; it = it->nextSibling )
 	{
-		dst->parent->lastChild = src;
+		maxd = std::max( maxd, maxDepth( it ) );
 	}
-
-	src->nextSibling = dst->nextSibling;
-	dst->nextSibling = src             ;
-	src->prevSibling = dst             ;
-	src->parent      = dst->parent     ;
-	return src;
+	return maxd;
 }
 
-template< class T, class TreeNodeAllocator_ >
-template< typename iter > iter Tree< T, TreeNodeAllocator_ >::moveBefore( iter target, iter source )
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+int Tree< T, TreeNodeAllocator_, TreePolicy_ >::maxDepth( const iteratorBase& pos ) const
 {
-	TREE_NODE *dst = target.node;
-	TREE_NODE *src = source.node;
-
-	assert( dst );
-	assert( src );
+	TREE_NODE *tmp = pos.node;
 
-    if( dst == src )
+	if( tmp == 0 || tmp == head || tmp == feet )
 	{
-		return source;
+		return -1;
 	}
 
-	if( dst->prevSibling )
+    int curdepth = 0;
+	int maxdepth = 0;
+
+	// pre-order walk of the subtree, never leaving it
+	while( true )
 	{
-		if( dst->prevSibling == src )
+		if( tmp->firstChild != 0 )
 		{
-			return source;
+			tmp = tmp->firstChild;
+			++curdepth;
+			maxdepth = std::max( curdepth, maxdepth );
+			continue;
 		}
-	}
 
-	if( src->prevSibling != 0 )
-	{
-		src->prevSibling->nextSibling = src->nextSibling;
+		while( tmp != pos.node && tmp->nextSibling == 0 )
+		{
+			tmp = tmp->parent;
+			--curdepth;
+		}
+
+		if( tmp == pos.node )
+		{
+            return maxdepth;
+		}
+
+		tmp = tmp->nextSibling;
 	}
-	else
+}
+
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+size_t Tree< T, TreeNodeAllocator_, TreePolicy_ >::numberOfChildren( const iteratorBase& it )
+{
+	if( TreePolicy_::childIndex )
 	{
-		src->parent->firstChild = src->nextSibling;
+		return it.node->childCount();
 	}
 
-	if( src->nextSibling != 0 ) 
+	TREE_NODE *pos = it.node->firstChild;
+	if( pos == 0 )
 	{
-		src->nextSibling->prevSibling = src->prevSibling;
+		return 0;
 	}
-	else
+
+	size_t ret = 1;
+
+	while( ( pos = pos->nextSibling ) )
 	{
-		src->parent->lastChild = src->prevSibling;
+		++ret;
 	}
 
-	if( dst->prevSibling != 0 )
+	return ret;
+}
+
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+size_t Tree< T, TreeNodeAllocator_, TreePolicy_ >::numberOfSiblings( const iteratorBase& it ) const
+{
+	if( TreePolicy_::childIndex && it.node->parent != 0 )
 	{
-		dst->prevSibling->nextSibling = src;
+		return it.node->parent->childCount() - 1;
 	}
-	else
+
+	TREE_NODE *pos = ( it.node->parent != 0 ? it.node->parent->firstChild : head->nextSibling );
+
+	size_t ret = 0;
+
+	while( pos != 0 && pos != feet )
 	{
-		dst->parent->firstChild = src;
+	    ++ret;
+		pos = pos->nextSibling;
 	}
 
-	src->prevSibling = dst->prevSibling;
-	dst->prevSibling = src             ;
-	src->nextSibling = dst             ;
-	src->parent      = dst->parent     ;
-	return src;
+	return ret - 1;
 }
 
-template< class T, class TreeNodeAllocator_ >
-typename Tree< T, TreeNodeAllocator_ >::siblingIterator Tree< T, TreeNodeAllocator_ >::moveBefore( siblingIterator target, siblingIterator source )
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+bool Tree< T, TreeNodeAllocator_, TreePolicy_ >::isInSubTree( const iteratorBase& it, const iteratorBase& begin, const iteratorBase& end ) const
 {
-	TREE_NODE *dst = target.node;
-	TREE_NODE *src = source.node;
-	TREE_NODE *dstPrevSibling   ;
-
-	if( dst == 0 )
+	if( TreePolicy_::intervalLabels )
 	{
-		dstPrevSibling = target.parent->lastChild;
-		assert( dstPrevSibling );
+		// entry labels follow pre-order
+		if( !isValid( it ) || !isValid( begin ) )
+		{
+			return false;
+		}
+		this->refreshLabels( head->nextSibling, feet );
+		bool bounded = isValid( end ) && end.node->entryLabel() >= begin.node->entryLabel();
+		return it.node->entryLabel() >= begin.node->entryLabel() &&
+		       ( !bounded || it.node->entryLabel() < end.node->entryLabel() );
 	}
-	else
+
+	// the walk ends at end or, past feet, at the end of the tree
+	preOrderIterator tmp = begin;
+	while( tmp != end && tmp.node != 0 )
 	{
-		dstPrevSibling = dst->prevSibling;
+		if( tmp == it )
+		{
+			return true;
+		}
+		++tmp;
 	}
+	return false;
+}
 
-	assert( src );
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+bool Tree< T, TreeNodeAllocator_, TreePolicy_ >::isAncestor( const iteratorBase& one, const iteratorBase& two ) const
+{
+	if( !isValid( one ) || !isValid( two ) )
+	{
+		return false;
+	}
 
-	if( dst == src )
+	if( TreePolicy_::intervalLabels )
 	{
-		return source;
+		this->refreshLabels( head->nextSibling, feet );
+		return one.node->entryLabel() < two.node->entryLabel() &&
+		       two.node->exitLabel()  < one.node->exitLabel();
 	}
 
-	if( dstPrevSibling )
+	for( TREE_NODE *it = two.node->parent; it != 0; it = it->parent )
 	{
-		if( dstPrevSibling == src )
+		if( it == one.node )
 		{
-            return source;
+			return true;
 		}
 	}
+	return false;
+}
+
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+bool Tree< T, TreeNodeAllocator_, TreePolicy_ >::isDescendant( const iteratorBase& one, const iteratorBase& two ) const
+{
+	return isAncestor( two, one );
+}
 
-	if( src->prevSibling != 0 )
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+bool Tree< T, TreeNodeAllocator_, TreePolicy_ >::isValid( const iteratorBase& it ) const
+{
+	if( it.node == 0 || it.node == feet || it.node == head ) 
 	{
-		src->prevSibling->nextSibling = src->nextSibling;
+		return false;
 	}
 	else
 	{
-		src->parent->firstChild = src->nextSibling;
+		return true;
 	}
+}
 
-	if( src->nextSibling != 0 )
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+typename Tree< T, TreeNodeAllocator_, TreePolicy_ >::preOrderIterator Tree< T, TreeNodeAllocator_, TreePolicy_ >::lowestCommonAncestor( const iteratorBase& one, const iteratorBase& two ) const
+{
+	TREE_NODE *a = one.node->parent;
+	TREE_NODE *b = two.node->parent;
+	if( a == 0 || b == 0 )
 	{
-		src->nextSibling->prevSibling = src->prevSibling;
+		return end();
 	}
-	else
+
+	if( TreePolicy_::lcaIndex )
 	{
-		src->parent->lastChild = src->prevSibling;
+		TREE_NODE *ret = this->commonAncestor( a, b, head->nextSibling, feet );
+		return ( ret != 0 ? preOrderIterator( ret ) : end() );
 	}
 
-	if( dstPrevSibling != 0 )
+	// bring both to the same depth, then climb in step
+	size_t da = level( preOrderIterator( a ) );
+	size_t db = level( preOrderIterator( b ) );
+	for( ; da > db; --da )
 	{
-		dstPrevSibling->nextSibling = src;
+		a = a->parent;
 	}
-	else
+	for( ; db > da; --db )
 	{
-		target.parent->firstChild = src;
+		b = b->parent;
 	}
-
-	src->prevSibling = dstPrevSibling;
-	
-	if( dst )
+	while( a != b )
 	{
-		dst->prevSibling = src;
-		src->parent = dst->parent;
+		a = a->parent;
+		b = b->parent;
 	}
-
-    src->nextSibling = dst;
-	return src;
+	return ( a != 0 ? preOrderIterator( a ) : end() );
 }
 
-template< class T, class TreeNodeAllocator_ >
-template< typename iter > iter Tree< T, TreeNodeAllocator_ >::moveOntop( iter target, iter source )
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+size_t Tree< T, TreeNodeAllocator_, TreePolicy_ >::index( siblingIterator it ) const
 {
-	TREE_NODE *dst = target.node;
-	TREE_NODE *src = source.node;
-
-	assert( dst );
-	assert( src );
-
-    if( dst == src )
+	if( TreePolicy_::childIndex && it.node->parent != 0 && it.node->parent->wide() )
 	{
-		return source;
+		return it.node->parent->indexOf( it.node );
 	}
 
-	TREE_NODE *bPrevSibling = dst->prevSibling;
-	TREE_NODE *bNextSibling = dst->nextSibling;
-	TREE_NODE *bParent      = dst->parent     ;
-
-    erase( target );
-
-	if( src->prevSibling != 0 )
-	{
-		src->prevSibling->nextSibling = src->nextSibling;
-	}
-	else
+	size_t ind = 0;
+	TREE_NODE *pos = ( it.node->parent != 0 ? it.node->parent->firstChild : head->nextSibling );
+	while( pos != it.node )
 	{
-		src->parent->firstChild = src->nextSibling;
+		pos = pos->nextSibling;
+		++ind;
 	}
+	return ind;
+}
 
-	if( src->nextSibling != 0 )
-	{
-		src->nextSibling->prevSibling = src->prevSibling;
-	}
-	else
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+typename Tree< T, TreeNodeAllocator_, TreePolicy_ >::siblingIterator Tree< T, TreeNodeAllocator_, TreePolicy_ >::child( const iteratorBase& it, size_t num )
+{
+	if( TreePolicy_::childIndex && it.node->wide() )
 	{
-		src->parent->lastChild = src->prevSibling;
+		assert( num <= it.node->childCount() );
+		return it.node->childAt( num );
 	}
 
-    if( bPrevSibling != 0 )
+	TREE_NODE *tmp = it.node->firstChild;
+	while( num-- )
 	{
-		bPrevSibling->nextSibling = src;
+		assert( tmp != 0 );
+		tmp = tmp->nextSibling;
 	}
-	else
+	return tmp;
+}
+
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+typename Tree< T, TreeNodeAllocator_, TreePolicy_ >::siblingIterator Tree< T, TreeNodeAllocator_, TreePolicy_ >::sibling( const iteratorBase& it, size_t num )
+{
+	TREE_NODE *tmp;
+	if( it.node->parent == 0 )
 	{
-		bParent->firstChild = src;
+        tmp = head->nextSibling;
+		while( num )
+		{
+			tmp = tmp->nextSibling;
+			--num;
+		}
 	}
-
-	if( bNextSibling != 0 )
+	else if( TreePolicy_::childIndex && it.node->parent->wide() )
 	{
-		bNextSibling->prevSibling = src;
+		assert( num <= it.node->parent->childCount() );
+		tmp = it.node->parent->childAt( num );
 	}
 	else
 	{
-	    bParent->lastChild = src;
+		tmp = it.node->parent->firstChild;
+		while( num )
+		{
+			assert( tmp != 0 );
+			tmp = tmp->nextSibling;
+			--num;
+		}
 	}
-
-	src->prevSibling = bPrevSibling;
-	src->nextSibling = bNextSibling;
-	src->parent      = bParent;
-	return src;
+	return tmp;
 }
 
-template< class T, class TreeNodeAllocator_ >
-void Tree< T, TreeNodeAllocator_ >::merge( siblingIterator to1, siblingIterator to2, siblingIterator from1, siblingIterator from2, bool duplicateLeaves )
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+void Tree< T, TreeNodeAllocator_, TreePolicy_ >::debug_verify_consistency() const
 {
-	siblingIterator fnd;
-	while( from1 != from2 )
+	preOrderIterator it = begin();
+
+	while( it != end() )
 	{
-		if( ( fnd = std::find( to1, to2, ( *from1) ) ) != to2 )
+		if( it.node->parent != 0 )
 		{
-			if( from1.begin() == from1.end() )
+			if( prevSiblingOf( it.node ) == 0 )
 			{
-                if( duplicateLeaves )
-				{
-					appendChild( parent( to1 ), ( *from1 ) );
-				}
+				assert( it.node->parent->firstChild == it.node );
 			}
 			else
 			{
-				merge( fnd.begin(), fnd.end(), from1.begin(), from1.end(), duplicateLeaves );
+                assert( prevSiblingOf( it.node )->nextSibling == it.node );
+			}
+
+			if( it.node->nextSibling == 0 )
+			{
+				assert( it.node->parent->lastChildNode() == it.node );
+			}
+			else
+			{
+				assert( prevSiblingOf( it.node->nextSibling ) == it.node );
 			}
 		}
-		else
-		{
-			insertSubtree( to2, from1 );
-		}
-		++from1;
+		++it;
 	}
 }
 
-template< class T, class TreeNodeAllocator_ >
-void Tree< T, TreeNodeAllocator_ >::sort( siblingIterator from, siblingIterator to, bool deep )
+//////////////////////////////////////////////////////////////////////////
+/// TreeDag
+//////////////////////////////////////////////////////////////////////////
+// Trees with their equal subtrees stored once. add() hash-conses a Tree
+// bottom up: a node is its data and the list of its children, each a node
+// stored before it, and equal nodes are one node. The trees added keep
+// their numbers and can be walked in place, in pre-order or leaf by leaf,
+// or expanded back into a Tree. T needs a std::hash.
+template< class T >
+class TreeDag
 {
-	std::less< T > comp;
-	sort( from, to, comp, deep );
-}
+public:
+	typedef T             value_type;
+	typedef std::uint32_t index_type;
 
-template< class T, class TreeNodeAllocator_ >
-template< class StrictWeakOrdering >
-void Tree< T, TreeNodeAllocator_ >::sort( siblingIterator from, siblingIterator to, StrictWeakOrdering comp, bool deep )
-{
-    if( from == to )
-	{
-		return;
-	}
+	static const index_type npos = index_type( -1 );
 
-	std::multiset< TREE_NODE *, compareNodes<StrictWeakOrdering> > nodes( comp );
-	siblingIterator it  = from;
-	siblingIterator it2 = to  ;
+	class iteratorBase    ;
+	class preOrderIterator;
+	class leafIterator    ;
 
-	while( it != to )
+	// A node of the expansion of one tree, held as the path of links to it
+	// from a top node: path[ 0 ] is into roots_, the others into children_.
+	class iteratorBase
 	{
-		nodes.insert( it.node );
-		++it;
-	}
-	--it2;
+	public:
+		typedef T                         value_type       ;
+		typedef const T*                  pointer          ;
+		typedef const T&                  reference        ;
+		typedef size_t                    size_type        ;
+		typedef ptrdiff_t                 difference_type  ;
+		typedef std::forward_iterator_tag iterator_category;
 
-    TREE_NODE *prev = from.node->prevSibling;
-	TREE_NODE *next = it2.node->nextSibling ;
+		iteratorBase(                                         );
+		iteratorBase( const TreeDag *, index_type, index_type );
 
-	typename std::multiset< TREE_NODE *, compareNodes<StrictWeakOrdering> >::iterator nit = nodes.begin();
-	typename std::multiset< TREE_NODE *, compareNodes<StrictWeakOrdering> >::iterator eit = nodes.end();
+		const T& operator*()  const;
+		const T* operator->() const;
 
-	if( prev == 0 )
-	{
-        if( ( *nit )->parent != 0 )
-		{
-			( *nit )->parent->firstChild = ( *nit );
-		}
-	}
-	else
-	{
-		prev->nextSibling = ( *nit );
-	}
+		bool operator==( const iteratorBase& ) const;
+		bool operator!=( const iteratorBase& ) const;
 
-	--eit;
+		index_type node(             ) const;   // the stored node, one for equal subtrees
+		size_t     depth(            ) const;
+		size_t     numberOfChildren( ) const;
 
-	while( nit != eit )
-	{
-        ( *nit )->prevSibling = prev;
-		if( prev )
-		{
-			prev->nextSibling = ( *nit );
-		}
-		prev = ( *nit );
-		++nit;
-	}
-    
-	if( prev )
-	{
-		prev->nextSibling = ( *eit );
-	}
+		const TreeDag            *dag  ;
+		std::vector< index_type > path ;   // empty at the end
+		index_type                limit;   // end of the top nodes of the tree in roots_
 
-	( *eit )->nextSibling = next;
-	( *eit )->prevSibling = prev;
+	protected:
+		void step( bool descend );   // to the next node in pre-order
+	};
 
-    if( next == 0 )
-	{
-		if( ( *eit )->parent != 0 )
-		{
-			( *eit )->parent->lastChild = ( *eit );
-		}
-	}
-	else
+	class preOrderIterator : public iteratorBase
 	{
-		next->prevSibling = ( *eit );
-	}
+	public:
+		preOrderIterator(                                         );
+		preOrderIterator( const TreeDag *, index_type, index_type );
+
+		preOrderIterator& operator++(     );
+		preOrderIterator  operator++( int );
+
+		void skipChildren();
+
+	private:
+		bool skipCurrentChildren;
+	};
 
-	if( deep )
+	class leafIterator : public iteratorBase
 	{
-        siblingIterator bcs( *nodes.begin() );
-		siblingIterator ecs( *eit );
-		++ecs;
-        while( bcs != ecs )
-		{
-			sort( begin( bcs ), end( bcs ), comp, deep );
-			++bcs;
-		}
-	}
-}
+	public:
+		leafIterator(                                         );
+		leafIterator( const TreeDag *, index_type, index_type );
 
-template< class T, class TreeNodeAllocator_ >
-template< typename iter >
-bool Tree< T, TreeNodeAllocator_ >::equal( const iter& one_, const iter& two, const iter& three_ ) const
+		leafIterator& operator++(     );
+		leafIterator  operator++( int );
+	};
+
+	TreeDag();
+
+	// adds the top nodes of a tree and everything below them, returns the
+	// number of the tree
+	template< class TreeNodeAllocator_, class TreePolicy_ >
+	size_t add( const Tree< T, TreeNodeAllocator_, TreePolicy_ >& );
+
+	template< class TreeNodeAllocator_, class TreePolicy_ >
+	void      expand( size_t, Tree< T, TreeNodeAllocator_, TreePolicy_ >& ) const;
+	Tree< T > expand( size_t                                             ) const;
+
+	size_t size(          ) const;   // nodes stored, not those of the trees
+	size_t numberOfTrees( ) const;
+	bool   empty(         ) const;
+
+	void clear();
+
+	preOrderIterator begin(     size_t ) const;
+	preOrderIterator end(       size_t ) const;
+	leafIterator     beginLeaf( size_t ) const;
+	leafIterator     endLeaf(   size_t ) const;
+
+private:
+	static_assert( TreeHashable< T >::value, "TreeDag needs a std::hash of T" );
+
+	// the node with data x and the children first to last, stored if new
+	index_type intern( const T& x, const index_type *first, const index_type *last );
+	void       rehash( size_t );
+
+	std::vector< T             > data_      ;
+	std::vector< index_type    > childBegin_;   // children of i are children_[ childBegin_[ i ] ]
+	std::vector< index_type    > children_  ;   // up to children_[ childBegin_[ i + 1 ] ]
+	std::vector< index_type    > roots_     ;   // top nodes of the trees, tree t has
+	std::vector< index_type    > treeBegin_ ;   // roots_[ treeBegin_[ t ] ] up to treeBegin_[ t + 1 ]
+	std::vector< std::uint64_t > hash_      ;
+	std::vector< index_type    > slots_     ;   // open addressing into the nodes, npos if free
+};
+
+template< class T >
+const typename TreeDag< T >::index_type TreeDag< T >::npos;
+
+// IteratorBase
+template< class T >
+TreeDag< T >::iteratorBase::iteratorBase()
+: dag( 0 ), limit( 0 )
 {
-	std::equal_to< T > comp;
-	return equal( one_, two, three_, comp );
 }
 
-template< class T, class TreeNodeAllocator_ >
-template< typename iter, class BinaryPredicate >
-bool Tree< T, TreeNodeAllocator_ >::equal( const iter& one_, const iter& two, const iter& three_, BinaryPredicate fun ) const
+template< class T >
+TreeDag< T >::iteratorBase::iteratorBase( const TreeDag *dg, index_type first, index_type lm )
+: dag( dg ), limit( lm )
 {
-    preOrderIterator one(   one_   );
-	preOrderIterator three( three_ );
-
-	while( one != two && isValid( three ) )
+	if( first < limit )
 	{
-	    if( !fun( *one, *three ) )
-		{
-			return false;
-		}
-		if( one.numberOfChildren() != three.numberOfChildren() )
-		{
-			return false;
-		}
-		++one;
-		++three;
+		path.push_back( first );
 	}
-	return true;
 }
 
-template< class T, class TreeNodeAllocator_ >
-template< typename iter >
-bool Tree< T, TreeNodeAllocator_ >::equalSubTree( const iter& one_, const iter& two_ ) const
+template< class T >
+const T& TreeDag< T >::iteratorBase::operator*() const
 {
-	std::equal_to< T > comp;
-	return equalSubTree( one_, two_, comp );
+	return dag->data_[ node() ];
 }
 
-template< class T, class TreeNodeAllocator_ >
-template< typename iter, class BinaryPredicate >
-bool Tree< T, TreeNodeAllocator_ >::equalSubTree( const iter& one_, const iter& two_, BinaryPredicate fun ) const
+template< class T >
+const T* TreeDag< T >::iteratorBase::operator->() const
 {
-	preOrderIterator one( one_ );
-	preOrderIterator two( two_ );
+	return &( dag->data_[ node() ] );
+}
 
-	if( !fun( *one, *two ) )
-	{
-        return false;
-	}
+template< class T >
+bool TreeDag< T >::iteratorBase::operator==( const iteratorBase& other ) const
+{
+	return path == other.path;
+}
 
-	if( numberOfChildren( one ) != numberOfChildren( two ) )
-	{
-		return false;
-	}
+template< class T >
+bool TreeDag< T >::iteratorBase::operator!=( const iteratorBase& other ) const
+{
+	return path != other.path;
+}
 
-	return equal( begin( one ), end( one ), begin( two ), fun );
+template< class T >
+typename TreeDag< T >::index_type TreeDag< T >::iteratorBase::node() const
+{
+	return path.size() == 1 ? dag->roots_[ path[ 0 ] ] : dag->children_[ path.back() ];
 }
 
-template< class T, class TreeNodeAllocator_ >
-Tree< T, TreeNodeAllocator_ > Tree< T, TreeNodeAllocator_ >::subTree( siblingIterator from, siblingIterator to ) const
+template< class T >
+size_t TreeDag< T >::iteratorBase::depth() const
 {
-	Tree tmp;
-	tmp.setHead( value_type() );
-	tmp.replace( tmp.begin(), tmp.end(), from, to );
-	return tmp;
+	return path.size() - 1;
 }
 
-template< class T, class TreeNodeAllocator_ >
-void Tree< T, TreeNodeAllocator_ >::subTree( Tree& tmp, siblingIterator from, siblingIterator to ) const
+template< class T >
+size_t TreeDag< T >::iteratorBase::numberOfChildren() const
 {
-    tmp.setHead( value_type() );
-	tmp.replace( tmp.begin(), tmp.end(), from, to );
+	index_type n = node();
+	return dag->childBegin_[ n + 1 ] - dag->childBegin_[ n ];
 }
 
-template< class T, class TreeNodeAllocator_ >
-void Tree< T, TreeNodeAllocator_ >::swap( siblingIterator it )
+// Down to the first child, or on to the next sibling of the node or of
+// the nearest ancestor that has one. The links of the siblings of a node
+// are next to each other, so a sibling is one link further.
+template< class T >
+void TreeDag< T >::iteratorBase::step( bool descend )
 {
-	TREE_NODE *nxt = it.node->nextSibling;
-	if( nxt )
+	index_type n = node();
+	if( descend && dag->childBegin_[ n ] != dag->childBegin_[ n + 1 ] )
 	{
-		if( it.node->prevSibling )
-		{
-			it.node->prevSibling->nextSibling = nxt;
-		}
-		else
-		{
-			it.node->parent->firstChild = nxt;
-		}
-        nxt->prevSibling = it.node->prevSibling;
-		TREE_NODE *nxtnxt = nxt->nextSibling;
+		path.push_back( dag->childBegin_[ n ] );
+		return;
+	}
+
+	while( !path.empty() )
+	{
+		index_type next = path.back() + 1;
+		path.pop_back();
 
-		if( nxtnxt )
+		index_type stop = limit;
+		if( !path.empty() )
 		{
-			nxtnxt->prevSibling = it.node;
+			stop = dag->childBegin_[ node() + 1 ];
 		}
-		else
+		if( next < stop )
 		{
-			it.node->parent->lastChild = it.node;
+			path.push_back( next );
+			return;
 		}
-		nxt->nextSibling     = it.node;
-		it.node->prevSibling = nxt    ;
-		it.node->nextSibling = nxtnxt ;
 	}
 }
 
-template< class T, class TreeNodeAllocator_ >
-void Tree< T, TreeNodeAllocator_ >::swap( preOrderIterator one, preOrderIterator two )
+// PreOrderIterator
+template< class T >
+TreeDag< T >::preOrderIterator::preOrderIterator()
+: iteratorBase(), skipCurrentChildren( false )
+{
+}
+
+template< class T >
+TreeDag< T >::preOrderIterator::preOrderIterator( const TreeDag *dg, index_type first, index_type lm )
+: iteratorBase( dg, first, lm ), skipCurrentChildren( false )
 {
-	if( one.node->nextSibling == two.node )
+}
+
+template< class T >
+typename TreeDag< T >::preOrderIterator& TreeDag< T >::preOrderIterator::operator++()
+{
+	this->step( !skipCurrentChildren );
+	skipCurrentChildren = false;
+	return *this;
+}
+
+template< class T >
+typename TreeDag< T >::preOrderIterator TreeDag< T >::preOrderIterator::operator++( int )
+{
+	preOrderIterator copy = *this;
+	++( *this );
+	return copy;
+}
+
+// The next operator++ jumps over the subtree of the current node.
+template< class T >
+void TreeDag< T >::preOrderIterator::skipChildren()
+{
+	skipCurrentChildren = true;
+}
+
+// LeafIterator
+template< class T >
+TreeDag< T >::leafIterator::leafIterator()
+: iteratorBase()
+{
+}
+
+template< class T >
+TreeDag< T >::leafIterator::leafIterator( const TreeDag *dg, index_type first, index_type lm )
+: iteratorBase( dg, first, lm )
+{
+	while( !this->path.empty() && this->numberOfChildren() != 0 )
 	{
-		swap( one );
+		this->step( true );
 	}
-	else if( two.node->nextSibling == one.node )
+}
+
+template< class T >
+typename TreeDag< T >::leafIterator& TreeDag< T >::leafIterator::operator++()
+{
+	do
 	{
-		swap( two );
+		this->step( true );
 	}
-	else
-	{
-		TREE_NODE *nxt1 = one.node->nextSibling;
-		TREE_NODE *nxt2 = two.node->nextSibling;
-		TREE_NODE *pre1 = one.node->prevSibling;
-        TREE_NODE *pre2 = two.node->prevSibling;
-		TREE_NODE *par1 = one.node->parent     ;
-		TREE_NODE *par2 = two.node->parent     ;
+	while( !this->path.empty() && this->numberOfChildren() != 0 );
+	return *this;
+}
+
+template< class T >
+typename TreeDag< T >::leafIterator TreeDag< T >::leafIterator::operator++( int )
+{
+	leafIterator copy = *this;
+	++( *this );
+	return copy;
+}
 
-		one.node->parent = par2;
-		one.node->nextSibling = nxt2;
+// TreeDag
+template< class T >
+TreeDag< T >::TreeDag()
+: childBegin_( 1, 0 ), treeBegin_( 1, 0 )
+{
+}
 
-		if( nxt2 )
+// Post-order walk, so the children of a node are stored before it. done
+// holds the stored children of the nodes on the path to cur, open where
+// those of each such node start.
+template< class T >
+template< class TreeNodeAllocator_, class TreePolicy_ >
+size_t TreeDag< T >::add( const Tree< T, TreeNodeAllocator_, TreePolicy_ >& tree )
+{
+	std::vector< index_type > done;
+	std::vector< size_t     > open;
+
+	decltype( tree.head ) cur = tree.head->nextSibling;
+	while( cur != tree.feet )
+	{
+		open.push_back( done.size() );
+		if( cur->firstChild != 0 )
 		{
-			nxt2->prevSibling = one.node;
+			cur = cur->firstChild;
+			continue;
 		}
-		else
+
+		while( true )
 		{
-            par2->lastChild = one.node;
+			size_t     start = open.back();
+			index_type node  = intern( cur->data, done.data() + start, done.data() + done.size() );
+			open.pop_back();
+			done.resize( start );
+			done.push_back( node );
+
+			if( open.empty() || cur->nextSibling != 0 )
+			{
+				cur = cur->nextSibling;
+				break;
+			}
+			cur = cur->parent;
 		}
+	}
 
-		one.node->prevSibling = pre2;
+	roots_.insert( roots_.end(), done.begin(), done.end() );
+	treeBegin_.push_back( index_type( roots_.size() ) );
+	return treeBegin_.size() - 2;
+}
 
-		if( pre2 )
-		{
-			pre2->nextSibling = one.node;
-		}
-		else
-		{
-			par2->firstChild = one.node;
-		}
+template< class T >
+template< class TreeNodeAllocator_, class TreePolicy_ >
+void TreeDag< T >::expand( size_t t, Tree< T, TreeNodeAllocator_, TreePolicy_ >& out ) const
+{
+	typedef typename Tree< T, TreeNodeAllocator_, TreePolicy_ >::preOrderIterator outIterator;
 
-		two.node->parent = par1;
-		two.node->nextSibling = nxt1;
-		if( nxt1 )
-		{
-			nxt1->prevSibling = two.node;
-		}
-		else
+	out.clear();
+	std::vector< outIterator > path;   // the nodes made for the path of it
+	for( preOrderIterator it = begin( t ); it != end( t ); ++it )
+	{
+		size_t depth = it.depth();
+		if( depth > 0 )
 		{
-			par1->lastChild = two.node;
+			path.resize( depth );
+			path.push_back( out.appendChild( path.back(), *it ) );
 		}
-
-		two.node->prevSibling = pre1;
-
-		if( pre1 )
+		else if( path.empty() )
 		{
-			pre1->nextSibling = two.node;
+			path.push_back( out.setHead( *it ) );
 		}
 		else
 		{
-			par1->firstChild = two.node;
+			outIterator top = path[ 0 ];
+			path.clear();
+			path.push_back( out.insertAfter( top, *it ) );
 		}
 	}
 }
 
-template< class T, class TreeNodeAllocator_ >
-size_t Tree< T, TreeNodeAllocator_ >::size() const
+template< class T >
+Tree< T > TreeDag< T >::expand( size_t t ) const
 {
-	size_t i = 0;
-	preOrderIterator it  = begin();
-	preOrderIterator eit = end()  ;
-
-	while( it != eit )
-	{
-		++i;
-		++it;
-	}
-	return i;
+	Tree< T > ret;
+	expand( t, ret );
+	return ret;
 }
 
-template< class T, class TreeNodeAllocator_ >
-size_t Tree< T, TreeNodeAllocator_ >::size( const iteratorBase& top ) const
+template< class T >
+size_t TreeDag< T >::size() const
 {
-	size_t i = 0;
-	preOrderIterator it  = top;
-	preOrderIterator eit = top;
-
-	eit.skipChildren();
-	++eit;
-	while( it != eit )
-	{
-		++i;
-		++it;
-	}
-	return i;
+	return data_.size();
 }
 
-template< class T, class TreeNodeAllocator_ >
-bool Tree< T, TreeNodeAllocator_ >::empty() const
+template< class T >
+size_t TreeDag< T >::numberOfTrees() const
 {
-	preOrderIterator it  = begin();
-	preOrderIterator eit = end()  ;
-	return ( it == eit );
+	return treeBegin_.size() - 1;
 }
 
-template< class T, class TreeNodeAllocator_ >
-int Tree< T, TreeNodeAllocator_ >::depth( const iteratorBase& it )
+template< class T >
+bool TreeDag< T >::empty() const
 {
-	TREE_NODE *pos = it.node;
-	assert( pos != 0 );
-	
-	int ret = 0;
-    while( pos->parent != 0 )
-	{
-		pos = pos->parent;
-		++ret;
-	}
-	return ret;
+	return treeBegin_.size() == 1;
 }
 
-template< class T, class TreeNodeAllocator_ >
-int Tree< T, TreeNodeAllocator_ >::depth( const iteratorBase& it, const iteratorBase& root )
+template< class T >
+void TreeDag< T >::clear()
 {
-	TREE_NODE *pos = it.node;
+	data_.clear();
+	childBegin_.assign( 1, 0 );
+	children_.clear();
+	roots_.clear();
+	treeBegin_.assign( 1, 0 );
+	hash_.clear();
+	slots_.clear();
+}
 
-	assert( pos != 0 );
-	int ret = 0;
+template< class T >
+typename TreeDag< T >::preOrderIterator TreeDag< T >::begin( size_t t ) const
+{
+	return preOrderIterator( this, treeBegin_[ t ], treeBegin_[ t + 1 ] );
+}
 
-	while( pos->parent != 0 && pos != root.node )
-	{
-        pos = pos->parent;
-		++ret;
-	}
-	return ret;
+template< class T >
+typename TreeDag< T >::preOrderIterator TreeDag< T >::end( size_t t ) const
+{
+	return preOrderIterator( this, treeBegin_[ t + 1 ], treeBegin_[ t + 1 ] );
 }
 
-template< class T, class TreeNodeAllocator_ >
-int Tree< T, TreeNodeAllocator_ >::maxDepth() const
+template< class T >
+typename TreeDag< T >::leafIterator TreeDag< T >::beginLeaf( size_t t ) const
 {
-	int maxd = -1;
-	for( TREE_NODE *it = head->nextSibling; it != feet; it = it->nextSibling )
-	{
-		maxd = std::max( maxd, maxDepth( it ) );
-	}
-	return maxd;
+	return leafIterator( this, treeBegin_[ t ], treeBegin_[ t + 1 ] );
 }
 
-template< class T, class TreeNodeAllocator_ >
-int Tree< T, TreeNodeAllocator_ >::maxDepth( const iteratorBase& pos ) const
+template< class T >
+typename TreeDag< T >::leafIterator TreeDag< T >::endLeaf( size_t t ) const
 {
-	TREE_NODE *tmp = pos.node;
+	return leafIterator( this, treeBegin_[ t + 1 ], treeBegin_[ t + 1 ] );
+}
 
-	if( tmp == 0 || tmp == head || tmp == feet )
+// The children are folded in by number, which is as good as by content
+// since equal nodes are one node.
+template< class T >
+typename TreeDag< T >::index_type TreeDag< T >::intern( const T& x, const index_type *first, const index_type *last )
+{
+	std::uint64_t hash = std::hash< T >()( x ) * 0x9E3779B97F4A7C15ull;
+	for( const index_type *it = first; it != last; ++it )
 	{
-		return -1;
+		hash ^= *it + 0x9E3779B97F4A7C15ull + ( hash << 6 ) + ( hash >> 2 );
 	}
+	hash ^= hash >> 33;
+	hash *= 0xFF51AFD7ED558CCDull;
+	hash ^= hash >> 33;
 
-    int curdepth = 0;
-	int maxdepth = 0;
+	if( 2 * ( data_.size() + 1 ) > slots_.size() )
+	{
+		rehash( slots_.empty() ? 64 : 2 * slots_.size() );
+	}
 
-	while( true )
+	size_t mask = slots_.size() - 1;
+	size_t slot = size_t( hash ) & mask;
+	size_t num  = size_t( last - first );
+	for( ; slots_[ slot ] != npos; slot = ( slot + 1 ) & mask )
 	{
-		while( tmp->firstChild == 0 )
+		index_type node = slots_[ slot ];
+		if( hash_[ node ] == hash && data_[ node ] == x &&
+			childBegin_[ node + 1 ] - childBegin_[ node ] == num &&
+			std::equal( first, last, children_.begin() + childBegin_[ node ] ) )
 		{
-			if( tmp == pos.node )
-			{
-				return maxdepth;
-			}
-
-			if( tmp->nextSibling == 0 )
-			{
-				do 
-				{
-					tmp = tmp->parent;
-
-                    if( tmp == 0 )
-					{
-						return maxdepth;
-					}
-					--curdepth;
-				} while( tmp->nextSibling == 0 );
-			}
-
-			if( tmp == pos.node )
-			{
-                return maxdepth;
-			}
-
-			tmp = tmp->firstChild;
-			++curdepth;
-			maxdepth = std::max( curdepth, maxdepth );
+			return node;
 		}
 	}
+
+	assert( data_.size() < npos );
+	index_type node = index_type( data_.size() );
+	data_.push_back( x );
+	children_.insert( children_.end(), first, last );
+	childBegin_.push_back( index_type( children_.size() ) );
+	hash_.push_back( hash );
+	slots_[ slot ] = node;
+	return node;
 }
 
-template< class T, class TreeNodeAllocator_ >
-size_t Tree< T, TreeNodeAllocator_ >::numberOfChildren( const iteratorBase& it )
+template< class T >
+void TreeDag< T >::rehash( size_t num )
 {
-	TREE_NODE *pos = it.node->firstChild;
-	if( pos == 0 )
+	slots_.assign( num, npos );
+	size_t mask = num - 1;
+	for( size_t node = 0; node < data_.size(); ++node )
 	{
-		return 0;
+		size_t slot = size_t( hash_[ node ] ) & mask;
+		while( slots_[ slot ] != npos )
+		{
+			slot = ( slot + 1 ) & mask;
+		}
+		slots_[ slot ] = index_type( node );
 	}
+}
 
-	size_t ret = 1;
-
-	while( ( pos = pos->nextSibling ) )
+//////////////////////////////////////////////////////////////////////////
+/// TreeBracketReader
+//////////////////////////////////////////////////////////////////////////
+// Thrown by TreeBracketReader, offset is the byte of the input where the
+// trouble was found.
+class TreeParseError : public std::runtime_error
+{
+public:
+	TreeParseError( const std::string& what, std::uint64_t at )
+	: std::runtime_error( what + " at byte " + std::to_string( at ) ), offset( at )
 	{
-		++ret;
 	}
 
-	return ret;
-}
+	std::uint64_t offset;
+};
 
-template< class T, class TreeNodeAllocator_ >
-size_t Tree< T, TreeNodeAllocator_ >::numberOfSiblings( const iteratorBase& it ) const
+// Reads trees in the bracketed form of the Penn Treebank,
+//     ( (S (NP (DT the) (NN dog)) (VP (VBZ barks))) )
+// one top-level bracket after the other. A bracket is a node labelled with
+// the token that follows it, or with an empty label if a bracket follows;
+// any other token is a leaf. Bytes up to the space character separate
+// tokens.
+//
+// The input is taken from a buffer in place, or from a stream a chunk at
+// a time. Labels are cut from the bytes in hand and the nodes made from
+// them with T( const char *, size_t ), built and linked as Tree::read()
+// does, so nothing is allocated per token but the nodes.
+class TreeBracketReader
 {
-	TREE_NODE *pos = it.node;
+public:
+	explicit TreeBracketReader( std::istream&, size_t chunk = size_t( 1 ) << 20 );
+	TreeBracketReader( const char *data, size_t bytes );
 
-	size_t ret = 0;
+	// replaces the content of the tree with the next tree of the input,
+	// false and an empty tree at the end of the input. On bad input throws
+	// TreeParseError and leaves the tree empty.
+	template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+	bool next( Tree< T, TreeNodeAllocator_, TreePolicy_ >& );
 
-	while( pos->nextSibling         && 
-		   pos->nextSibling != head && 
-		   pos->nextSibling != feet    )
-	{
-	    ++ret;
-		pos = pos->nextSibling;
-	}
+	std::uint64_t offset() const;   // bytes of the input read so far
 
-	pos = it.node;
-	while( pos->prevSibling         && 
-		   pos->prevSibling != head && 
-		   pos->prevSibling != feet    )
-	{
-		++ret;
-		pos = pos->prevSibling;
-	}
+private:
+	TreeBracketReader(            const TreeBracketReader& );   // not copyable
+	TreeBracketReader& operator=( const TreeBracketReader& );
+
+	static bool isSpace(     char c ) { return static_cast< unsigned char >( c ) <= ' '; }
+	static bool isDelimiter( char c ) { return isSpace( c ) || c == '(' || c == ')'; }
+
+	bool skipSpace();                                   // false at the end of the input
+	void token( const char *&first, size_t& bytes );   // good until the next call
+	bool refill( const char *&keep );                   // keeps the bytes from keep on
+
+	std::istream      *in_  ;   // 0 when reading a buffer
+	std::vector< char > buf_ ;
+	const char        *data_;   // the bytes in hand
+	const char        *cur_ ;
+	const char        *lim_ ;
+	std::uint64_t      base_;   // offset of data_ in the input
+};
 
-	return ret;
+inline TreeBracketReader::TreeBracketReader( std::istream& in, size_t chunk )
+: in_( &in ), buf_( std::max( chunk, size_t( 1 ) ) ), data_( buf_.data() ), cur_( data_ ), lim_( data_ ), base_( 0 )
+{
 }
 
-template< class T, class TreeNodeAllocator_ >
-bool Tree< T, TreeNodeAllocator_ >::isInSubTree( const iteratorBase& it, const iteratorBase& begin, const iteratorBase& end ) const
+inline TreeBracketReader::TreeBracketReader( const char *data, size_t bytes )
+: in_( 0 ), data_( data ), cur_( data ), lim_( data + bytes ), base_( 0 )
 {
-	preOrderIterator tmp = begin;
-	while( tmp != end )
-	{
-		if( tmp == it )
-		{
-			return true;
-		}
-		++tmp;
-	}
-	return false;
 }
 
-template< class T, class TreeNodeAllocator_ >
-bool Tree< T, TreeNodeAllocator_ >::isValid( const iteratorBase& it ) const
+inline std::uint64_t TreeBracketReader::offset() const
 {
-	if( it.node == 0 || it.node == feet || it.node == head ) 
-	{
-		return false;
-	}
-	else
-	{
-		return true;
-	}
+	return base_ + std::uint64_t( cur_ - data_ );
 }
 
-template< class T, class TreeNodeAllocator_ >
-typename Tree< T, TreeNodeAllocator_ >::preOrderIterator Tree< T, TreeNodeAllocator_ >::lowestCommonAncestor( const iteratorBase& one, const iteratorBase& two ) const
+inline bool TreeBracketReader::skipSpace()
 {
-	std::set< preOrderIterator, iteratorBaseLess > parents;
-
-	preOrderIterator walk = one;
-	do 
-	{
-		walk = parent( walk );
-		parents.insert( walk );
-	} while( isValid( parent( walk ) ) );
-
-	walk = two;
-	do 
+	for( ; ; )
 	{
-		walk = parent( walk );
-		if( parents.find( walk ) != parents.end() )
+		const char *cur = cur_;
+		const char *lim = lim_;
+		while( cur < lim && isSpace( *cur ) )
 		{
-			break;
+			++cur;
 		}
-	} while( isValid( parent( walk ) ) );
-
-	return walk;
+		cur_ = cur;
+		if( cur_ < lim_ )
+		{
+			return true;
+		}
+		if( !refill( cur_ ) )
+		{
+			return false;
+		}
+	}
 }
 
-template< class T, class TreeNodeAllocator_ >
-size_t Tree< T, TreeNodeAllocator_ >::index( siblingIterator it ) const
+inline void TreeBracketReader::token( const char *&first, size_t& bytes )
 {
-	size_t ind = 0;
-	if( it.node->parent == 0 )
+	first = cur_;
+	for( ; ; )
 	{
-		while( it.node->prevSibling != head )
+		const char *cur = cur_;
+		const char *lim = lim_;
+		while( cur < lim && !isDelimiter( *cur ) )
 		{
-			it.node = it.node->prevSibling;
-			++ind;
+			++cur;
 		}
-	}
-	else
-	{
-		while( it.node->prevSibling != 0 )
+		cur_ = cur;
+		if( cur_ < lim_ || !refill( first ) )
 		{
-			it.node = it.node->prevSibling;
-			++ind;
+			break;
 		}
 	}
-	return ind;
+	bytes = size_t( cur_ - first );
 }
 
-template< class T, class TreeNodeAllocator_ >
-typename Tree< T, TreeNodeAllocator_ >::siblingIterator Tree< T, TreeNodeAllocator_ >::child( const iteratorBase& it, size_t num )
+// Moves the bytes kept to the front of the buffer, keep with them, and
+// fills the rest from the stream, doubling the buffer if a single token
+// fills it.
+inline bool TreeBracketReader::refill( const char *&keep )
 {
-	TREE_NODE *tmp = it.node->firstChild;
-	while( num-- )
+	if( in_ == 0 )
 	{
-		assert( tmp != 0 );
-		tmp = tmp->nextSibling;
+		return false;
 	}
-	return tmp;
+
+	size_t kept = size_t( lim_ - keep );
+	size_t at   = size_t( cur_ - keep );
+	base_ += std::uint64_t( keep - data_ );
+	std::memmove( buf_.data(), keep, kept );
+	if( kept == buf_.size() )
+	{
+		buf_.resize( 2 * buf_.size() );
+	}
+
+	std::streamsize got = in_->rdbuf()->sgetn( buf_.data() + kept, std::streamsize( buf_.size() - kept ) );
+	data_ = buf_.data();
+	cur_  = data_ + at;
+	lim_  = data_ + kept + size_t( got > 0 ? got : 0 );
+	keep  = data_;
+	return got > 0;
 }
 
-template< class T, class TreeNodeAllocator_ >
-typename Tree< T, TreeNodeAllocator_ >::siblingIterator Tree< T, TreeNodeAllocator_ >::sibling( const iteratorBase& it, size_t num )
+// The nodes open on the current path are kept with the last child each
+// has so far, a node is done when its bracket closes.
+template< class T, class TreeNodeAllocator_, class TreePolicy_ >
+bool TreeBracketReader::next( Tree< T, TreeNodeAllocator_, TreePolicy_ >& tree )
 {
-	TREE_NODE *tmp;
-	if( it.node->parent == 0 )
+	typedef typename Tree< T, TreeNodeAllocator_, TreePolicy_ >::TREE_NODE TREE_NODE;
+
+	tree.clear();
+
+	if( !skipSpace() )
 	{
-        tmp = head->nextSibling;
-		while( num )
-		{
-			tmp = tmp->nextSibling;
-			--num;
-		}
+		return false;
 	}
-	else
+	if( *cur_ != '(' )
 	{
-		tmp = it.node->parent->firstChild;
-		while( num )
-		{
-			assert( tmp != 0 );
-			tmp = tmp->nextSibling;
-			--num;
-		}
+		throw TreeParseError( *cur_ == ')' ? "tree: unmatched )" : "tree: text outside brackets", offset() );
 	}
-	return tmp;
-}
 
-template< class T, class TreeNodeAllocator_ >
-void Tree< T, TreeNodeAllocator_ >::debug_verify_consistency() const
-{
-	preOrderIterator it = begin();
+	std::vector< std::pair< TREE_NODE *, TREE_NODE * > > open;
+	TREE_NODE *top  = 0;
+	TREE_NODE *leaf = 0;   // last leaf done, for leafChain
 
-	while( it != end() )
+	try
 	{
-		if( it.node->parent != 0 )
+		for( ; ; )
 		{
-			if( it.node->prevSibling == 0 )
+			if( !skipSpace() )
 			{
-				assert( it.node->parent->firstChild == it.node );
+				throw TreeParseError( "tree: input ends inside a tree", offset() );
 			}
-			else
+
+			const char *first;
+			size_t      bytes;
+			if( *cur_ == '(' )
 			{
-                assert( it.node->prevSibling->nextSibling == it.node );
-			}
+				++cur_;
+				if( !skipSpace() )
+				{
+					throw TreeParseError( "tree: input ends inside a tree", offset() );
+				}
+				if( isDelimiter( *cur_ ) )
+				{
+					first = cur_;
+					bytes = 0;
+				}
+				else
+				{
+					token( first, bytes );
+				}
 
-			if( it.node->nextSibling == 0 )
+				TREE_NODE *tmp = tree.createNode( first, bytes );
+				if( top == 0 )
+				{
+					top = tmp;
+				}
+				else
+				{
+					tree.buildChild( open.back().first, open.back().second, tmp );
+					open.back().second = tmp;
+				}
+				open.push_back( std::make_pair( tmp, static_cast< TREE_NODE * >( 0 ) ) );
+			}
+			else if( *cur_ == ')' )
 			{
-				assert( it.node->parent->lastChild == it.node );
+				++cur_;
+				TREE_NODE *done = open.back().first;
+				open.pop_back();
+				if( open.empty() )
+				{
+					break;
+				}
+				tree.buildDone( done, leaf );
 			}
 			else
 			{
-				assert( it.node->nextSibling->prevSibling == it.node );
+				token( first, bytes );
+				TREE_NODE *tmp = tree.createNode( first, bytes );
+				tree.buildChild( open.back().first, open.back().second, tmp );
+				open.back().second = tmp;
+				tree.buildDone( tmp, leaf );
 			}
 		}
-		++it;
 	}
+	catch( ... )
+	{
+		if( top != 0 )
+		{
+			tree.destroyChildren( top );
+			tree.destroyNode( top );
+		}
+		throw;
+	}
+
+	tree.buildTop( top, leaf );
+	tree.linkBefore( tree.feet, top );
+	return true;
 }
 
 #endif
@@ -0,0 +1,1043 @@
+/* NiuTrans - SMT platform
+ * Copyright (C) 2011, NEU-NLPLab (http://www.nlplab.com/). All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/*
+ * $Id:
+ * treebank.h
+ *
+ * $Version:
+ * 1.1.0
+ *
+ * $Created by:
+ * Qiang Li (email: liqiangneu@gmail.com)
+ *
+ * $Last Modified by:
+ *
+ */
+
+#ifndef _TREEBANK_H_
+#define _TREEBANK_H_
+
+// TreeBank and TreeBankWriter, kept apart from tree.h so that plain trees
+// do not pull in the system headers for mapping files.
+
+#include "tree.h"
+
+#include <cstdint>
+#include <cstring>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#if defined( __unix__ ) || defined( __APPLE__ )
+#define _TREE_MMAP_
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#include <fstream>
+#endif
+
+//////////////////////////////////////////////////////////////////////////
+/// TreeBank
+//////////////////////////////////////////////////////////////////////////
+// Trees of string labels in one file that is used in place. A
+// TreeBankWriter collects trees and writes the file, a TreeBank maps it
+// and hands out every tree as a read-only view, without making any nodes.
+// A tree is laid out as a FrozenTree is, its nodes numbered in pre-order
+// with the subtree of node i the range [ i, subtreeEnd( i ) ). The file is
+//
+//   header       "TREEBANK", version, byte order mark and the counts
+//   treeBegin    uint64 x ( trees + 1 ), first node of every tree
+//   end          uint32 x nodes, subtree ends,
+//   parent       uint32 x nodes, parents, npos at the top level,
+//   label        uint32 x nodes, label numbers,
+//   labelBegin   uint64 x labels, where the characters of each label begin
+//   characters   the labels, each ended by a NUL
+//
+// with ends and parents counted from the first node of the tree, and the
+// tables of 64-bit numbers starting at multiples of 8 bytes. Numbers are
+// in the byte order of the machine that wrote the file.
+//
+// open() checks the header only, so that it costs the same for any size
+// of file; check() walks all of it, for files that cannot be trusted.
+class TreeBank
+{
+public:
+	typedef const char   *value_type;
+	typedef std::uint32_t index_type;
+
+	static const index_type    npos      = index_type( -1 );
+	static const std::uint32_t version   = 1;
+	static const std::uint32_t byteOrder = 0x01020304;
+
+	struct header
+	{
+		char          magic[ 8 ];
+		std::uint32_t version   ;
+		std::uint32_t order     ;   // byteOrder as the writer saw it
+		std::uint64_t trees     ;
+		std::uint64_t nodes     ;
+		std::uint64_t labels    ;
+		std::uint64_t characters;
+	};
+
+	// offsets of the tables in the file, and its size
+	struct layout
+	{
+		explicit layout( const header& );
+
+		std::uint64_t treeBegin ;
+		std::uint64_t end       ;
+		std::uint64_t parent    ;
+		std::uint64_t label     ;
+		std::uint64_t labelBegin;
+		std::uint64_t characters;
+		std::uint64_t size      ;
+	};
+
+	class treeView         ;
+	class iteratorBase     ;
+	class preOrderIterator ;
+	class postOrderIterator;
+	class siblingIterator  ;
+	class leafIterator     ;
+
+	// One tree of the bank. A view is a few pointers into the file and is
+	// good for as long as the bank is open.
+	class treeView
+	{
+	public:
+		treeView();
+
+		size_t size( ) const;
+		bool   empty() const;
+
+		preOrderIterator  begin(     ) const;
+		preOrderIterator  end(       ) const;
+		postOrderIterator beginPost( ) const;
+		postOrderIterator endPost(   ) const;
+		siblingIterator   beginSibling( const iteratorBase& ) const;
+		siblingIterator   endSibling(   const iteratorBase& ) const;
+		leafIterator      beginLeaf(    ) const;
+		leafIterator      endLeaf(      ) const;
+		leafIterator      beginLeaf( const iteratorBase& top ) const;
+		leafIterator      endLeaf(   const iteratorBase& top ) const;
+
+		preOrderIterator parent( const iteratorBase& ) const;   // end() for top level nodes
+
+		size_t size(             const iteratorBase& ) const;
+		size_t depth(            const iteratorBase& ) const;
+		size_t numberOfChildren( const iteratorBase& ) const;
+
+		index_type  subtreeEnd(  index_type ) const;
+		index_type  parentIndex( index_type ) const;   // npos at the top level
+		index_type  labelIndex(  index_type ) const;   // number in the label table
+		const char *label(       index_type ) const;
+
+	private:
+		friend class TreeBank;
+
+		treeView( const TreeBank *, std::uint64_t first, index_type size );
+
+		const TreeBank   *bank   ;
+		const index_type *end_   ;
+		const index_type *parent_;
+		const index_type *label_ ;
+		index_type        size_  ;
+	};
+
+	class iteratorBase
+	{
+	public:
+		typedef const char*               value_type       ;
+		typedef const char* const*        pointer          ;
+		typedef const char*               reference        ;
+		typedef size_t                    size_type        ;
+		typedef ptrdiff_t                 difference_type  ;
+		typedef std::forward_iterator_tag iterator_category;
+
+		iteratorBase(                              );
+		iteratorBase( const treeView&, index_type );
+
+		const char *operator*() const;   // the label, NUL ended
+		index_type  label(    ) const;   // its number in the label table
+
+		bool operator==( const iteratorBase& ) const;
+		bool operator!=( const iteratorBase& ) const;
+
+		size_t numberOfChildren() const;
+
+		siblingIterator begin() const;
+		siblingIterator end(  ) const;
+
+		treeView   tree;
+		index_type pos ;   // pre-order number of the node
+	};
+
+	class preOrderIterator : public iteratorBase
+	{
+	public:
+		typedef std::bidirectional_iterator_tag iterator_category;
+
+		preOrderIterator(                              );
+		preOrderIterator( const treeView&, index_type );
+		preOrderIterator( const iteratorBase&         );
+
+		preOrderIterator& operator++(     );
+		preOrderIterator& operator--(     );
+		preOrderIterator  operator++( int );
+		preOrderIterator  operator--( int );
+
+		void skipChildren();
+
+	private:
+		bool skipCurrentChildren;
+	};
+
+	class postOrderIterator : public iteratorBase
+	{
+	public:
+		postOrderIterator(                              );
+		postOrderIterator( const treeView&, index_type );
+		postOrderIterator( const iteratorBase&         );
+
+		postOrderIterator& operator++(     );
+		postOrderIterator  operator++( int );
+
+		void descendAll();
+	};
+
+	class siblingIterator : public iteratorBase
+	{
+	public:
+		siblingIterator(                              );
+		siblingIterator( const treeView&, index_type );
+		siblingIterator( const iteratorBase&         );
+
+		siblingIterator& operator++(     );
+		siblingIterator  operator++( int );
+	};
+
+	class leafIterator : public iteratorBase
+	{
+	public:
+		leafIterator(                                          );
+		leafIterator( const treeView&, index_type, index_type );
+
+		leafIterator& operator++(     );
+		leafIterator  operator++( int );
+
+	private:
+		index_type limit;   // end of the subtree the leaves are taken from
+	};
+
+	TreeBank();
+	explicit TreeBank( const std::string& path );
+	~TreeBank();
+
+	void open( const std::string& path        );   // maps the file
+	void open( const void *data, size_t bytes );   // a treebank in memory, used in place
+	void close();
+	bool isOpen() const;
+
+	size_t numberOfTrees(  ) const;
+	size_t size(           ) const;   // nodes of all trees
+	size_t numberOfLabels( ) const;
+
+	const char *label( index_type ) const;
+
+	treeView operator[]( size_t ) const;
+
+	void check() const;
+
+private:
+	TreeBank(            const TreeBank& );   // not copyable
+	TreeBank& operator=( const TreeBank& );
+
+	void attach( const char *, size_t );
+
+	void               *map_       ;   // the mapping made by open(), if any
+	size_t              mapBytes_  ;
+	std::vector< char > copy_      ;   // the file, where it cannot be mapped
+	const header       *head_      ;
+	const std::uint64_t *treeBegin_ ;
+	const index_type    *end_       ;
+	const index_type    *parent_    ;
+	const index_type    *label_     ;
+	const std::uint64_t *labelBegin_;
+	const char          *characters_;
+};
+
+// Layout
+inline TreeBank::layout::layout( const header& h )
+{
+	treeBegin  = sizeof( header );
+	end        = treeBegin + ( h.trees + 1 ) * sizeof( std::uint64_t );
+	parent     = end       + h.nodes * sizeof( index_type );
+	label      = parent    + h.nodes * sizeof( index_type );
+	labelBegin = ( label   + h.nodes * sizeof( index_type ) + 7 ) & ~std::uint64_t( 7 );
+	characters = labelBegin + h.labels * sizeof( std::uint64_t );
+	size       = characters + h.characters;
+}
+
+// TreeView
+inline TreeBank::treeView::treeView()
+: bank( 0 ), end_( 0 ), parent_( 0 ), label_( 0 ), size_( 0 )
+{
+}
+
+inline TreeBank::treeView::treeView( const TreeBank *bk, std::uint64_t first, index_type sz )
+: bank( bk ), end_( bk->end_ + first ), parent_( bk->parent_ + first ), label_( bk->label_ + first ), size_( sz )
+{
+}
+
+inline size_t TreeBank::treeView::size() const
+{
+	return size_;
+}
+
+inline bool TreeBank::treeView::empty() const
+{
+	return size_ == 0;
+}
+
+inline TreeBank::preOrderIterator TreeBank::treeView::begin() const
+{
+	return preOrderIterator( *this, 0 );
+}
+
+inline TreeBank::preOrderIterator TreeBank::treeView::end() const
+{
+	return preOrderIterator( *this, size_ );
+}
+
+inline TreeBank::postOrderIterator TreeBank::treeView::beginPost() const
+{
+	postOrderIterator ret( *this, 0 );
+	ret.descendAll();
+	return ret;
+}
+
+inline TreeBank::postOrderIterator TreeBank::treeView::endPost() const
+{
+	return postOrderIterator( *this, size_ );
+}
+
+inline TreeBank::siblingIterator TreeBank::treeView::beginSibling( const iteratorBase& pos ) const
+{
+	return pos.begin();
+}
+
+inline TreeBank::siblingIterator TreeBank::treeView::endSibling( const iteratorBase& pos ) const
+{
+	return pos.end();
+}
+
+inline TreeBank::leafIterator TreeBank::treeView::beginLeaf() const
+{
+	return leafIterator( *this, 0, size_ );
+}
+
+inline TreeBank::leafIterator TreeBank::treeView::endLeaf() const
+{
+	return leafIterator( *this, size_, size_ );
+}
+
+// A childless top has no leaves below it, as in Tree.
+inline TreeBank::leafIterator TreeBank::treeView::beginLeaf( const iteratorBase& top ) const
+{
+	if( end_[ top.pos ] == top.pos + 1 )
+	{
+		return endLeaf( top );
+	}
+	return leafIterator( *this, top.pos, end_[ top.pos ] );
+}
+
+inline TreeBank::leafIterator TreeBank::treeView::endLeaf( const iteratorBase& top ) const
+{
+	return leafIterator( *this, end_[ top.pos ], end_[ top.pos ] );
+}
+
+inline TreeBank::preOrderIterator TreeBank::treeView::parent( const iteratorBase& it ) const
+{
+	if( parent_[ it.pos ] == npos )
+	{
+		return end();
+	}
+	return preOrderIterator( *this, parent_[ it.pos ] );
+}
+
+inline size_t TreeBank::treeView::size( const iteratorBase& it ) const
+{
+	return end_[ it.pos ] - it.pos;
+}
+
+inline size_t TreeBank::treeView::depth( const iteratorBase& it ) const
+{
+	size_t ret = 0;
+	for( index_type pos = parent_[ it.pos ]; pos != npos; pos = parent_[ pos ] )
+	{
+		++ret;
+	}
+	return ret;
+}
+
+inline size_t TreeBank::treeView::numberOfChildren( const iteratorBase& it ) const
+{
+	return it.numberOfChildren();
+}
+
+inline TreeBank::index_type TreeBank::treeView::subtreeEnd( index_type pos ) const
+{
+	return end_[ pos ];
+}
+
+inline TreeBank::index_type TreeBank::treeView::parentIndex( index_type pos ) const
+{
+	return parent_[ pos ];
+}
+
+inline TreeBank::index_type TreeBank::treeView::labelIndex( index_type pos ) const
+{
+	return label_[ pos ];
+}
+
+inline const char *TreeBank::treeView::label( index_type pos ) const
+{
+	return bank->label( label_[ pos ] );
+}
+
+// IteratorBase
+inline TreeBank::iteratorBase::iteratorBase()
+: pos( 0 )
+{
+}
+
+inline TreeBank::iteratorBase::iteratorBase( const treeView& tr, index_type ps )
+: tree( tr ), pos( ps )
+{
+}
+
+inline const char *TreeBank::iteratorBase::operator*() const
+{
+	return tree.label( pos );
+}
+
+inline TreeBank::index_type TreeBank::iteratorBase::label() const
+{
+	return tree.labelIndex( pos );
+}
+
+inline bool TreeBank::iteratorBase::operator==( const iteratorBase& other ) const
+{
+	return pos == other.pos;
+}
+
+inline bool TreeBank::iteratorBase::operator!=( const iteratorBase& other ) const
+{
+	return pos != other.pos;
+}
+
+inline size_t TreeBank::iteratorBase::numberOfChildren() const
+{
+	size_t ret = 0;
+	for( index_type it = pos + 1; it < tree.subtreeEnd( pos ); it = tree.subtreeEnd( it ) )
+	{
+		++ret;
+	}
+	return ret;
+}
+
+inline TreeBank::siblingIterator TreeBank::iteratorBase::begin() const
+{
+	return siblingIterator( tree, pos + 1 );
+}
+
+inline TreeBank::siblingIterator TreeBank::iteratorBase::end() const
+{
+	return siblingIterator( tree, tree.subtreeEnd( pos ) );
+}
+
+// PreOrderIterator
+inline TreeBank::preOrderIterator::preOrderIterator()
+: iteratorBase(), skipCurrentChildren( false )
+{
+}
+
+inline TreeBank::preOrderIterator::preOrderIterator( const treeView& tr, index_type ps )
+: iteratorBase( tr, ps ), skipCurrentChildren( false )
+{
+}
+
+inline TreeBank::preOrderIterator::preOrderIterator( const iteratorBase& other )
+: iteratorBase( other ), skipCurrentChildren( false )
+{
+}
+
+inline TreeBank::preOrderIterator& TreeBank::preOrderIterator::operator++()
+{
+	if( skipCurrentChildren )
+	{
+		this->pos = this->tree.subtreeEnd( this->pos );
+		skipCurrentChildren = false;
+	}
+	else
+	{
+		++this->pos;
+	}
+	return *this;
+}
+
+inline TreeBank::preOrderIterator& TreeBank::preOrderIterator::operator--()
+{
+	--this->pos;
+	return *this;
+}
+
+inline TreeBank::preOrderIterator TreeBank::preOrderIterator::operator++( int )
+{
+	preOrderIterator copy = *this;
+	++( *this );
+	return copy;
+}
+
+inline TreeBank::preOrderIterator TreeBank::preOrderIterator::operator--( int )
+{
+	preOrderIterator copy = *this;
+	--( *this );
+	return copy;
+}
+
+inline void TreeBank::preOrderIterator::skipChildren()
+{
+	skipCurrentChildren = true;
+}
+
+// PostOrderIterator
+inline TreeBank::postOrderIterator::postOrderIterator()
+: iteratorBase()
+{
+}
+
+inline TreeBank::postOrderIterator::postOrderIterator( const treeView& tr, index_type ps )
+: iteratorBase( tr, ps )
+{
+}
+
+inline TreeBank::postOrderIterator::postOrderIterator( const iteratorBase& other )
+: iteratorBase( other )
+{
+}
+
+// The next sibling's leftmost leaf if there is a next sibling, else the
+// parent.
+inline TreeBank::postOrderIterator& TreeBank::postOrderIterator::operator++()
+{
+	index_type up    = this->tree.parentIndex( this->pos );
+	index_type limit = up == npos ? index_type( this->tree.size() ) : this->tree.subtreeEnd( up );
+	index_type next  = this->tree.subtreeEnd( this->pos );
+
+	if( next < limit )
+	{
+		this->pos = next;
+		descendAll();
+	}
+	else
+	{
+		this->pos = ( up == npos ? limit : up );
+	}
+	return *this;
+}
+
+inline TreeBank::postOrderIterator TreeBank::postOrderIterator::operator++( int )
+{
+	postOrderIterator copy = *this;
+	++( *this );
+	return copy;
+}
+
+inline void TreeBank::postOrderIterator::descendAll()
+{
+	while( this->pos < this->tree.size() && this->tree.subtreeEnd( this->pos ) != this->pos + 1 )
+	{
+		++this->pos;
+	}
+}
+
+// SiblingIterator
+inline TreeBank::siblingIterator::siblingIterator()
+: iteratorBase()
+{
+}
+
+inline TreeBank::siblingIterator::siblingIterator( const treeView& tr, index_type ps )
+: iteratorBase( tr, ps )
+{
+}
+
+inline TreeBank::siblingIterator::siblingIterator( const iteratorBase& other )
+: iteratorBase( other )
+{
+}
+
+inline TreeBank::siblingIterator& TreeBank::siblingIterator::operator++()
+{
+	this->pos = this->tree.subtreeEnd( this->pos );
+	return *this;
+}
+
+inline TreeBank::siblingIterator TreeBank::siblingIterator::operator++( int )
+{
+	siblingIterator copy = *this;
+	++( *this );
+	return copy;
+}
+
+// LeafIterator
+inline TreeBank::leafIterator::leafIterator()
+: iteratorBase(), limit( 0 )
+{
+}
+
+inline TreeBank::leafIterator::leafIterator( const treeView& tr, index_type ps, index_type lm )
+: iteratorBase( tr, ps ), limit( lm )
+{
+	while( this->pos < limit && tr.subtreeEnd( this->pos ) != this->pos + 1 )
+	{
+		++this->pos;
+	}
+}
+
+inline TreeBank::leafIterator& TreeBank::leafIterator::operator++()
+{
+	++this->pos;
+	while( this->pos < limit && this->tree.subtreeEnd( this->pos ) != this->pos + 1 )
+	{
+		++this->pos;
+	}
+	return *this;
+}
+
+inline TreeBank::leafIterator TreeBank::leafIterator::operator++( int )
+{
+	leafIterator copy = *this;
+	++( *this );
+	return copy;
+}
+
+// TreeBank
+inline TreeBank::TreeBank()
+: map_( 0 ), mapBytes_( 0 ), head_( 0 ), treeBegin_( 0 ), end_( 0 ), parent_( 0 ), label_( 0 ), labelBegin_( 0 ), characters_( 0 )
+{
+}
+
+inline TreeBank::TreeBank( const std::string& path )
+: map_( 0 ), mapBytes_( 0 ), head_( 0 ), treeBegin_( 0 ), end_( 0 ), parent_( 0 ), label_( 0 ), labelBegin_( 0 ), characters_( 0 )
+{
+	open( path );
+}
+
+inline TreeBank::~TreeBank()
+{
+	close();
+}
+
+inline void TreeBank::open( const std::string& path )
+{
+	close();
+
+#ifdef _TREE_MMAP_
+	int fd = ::open( path.c_str(), O_RDONLY );
+	if( fd < 0 )
+	{
+		throw std::runtime_error( "tree: cannot open treebank " + path );
+	}
+
+	struct stat st;
+	void *map = MAP_FAILED;
+	if( ::fstat( fd, &st ) == 0 && st.st_size > 0 )
+	{
+		map = ::mmap( 0, size_t( st.st_size ), PROT_READ, MAP_SHARED, fd, 0 );
+	}
+	::close( fd );
+	if( map == MAP_FAILED )
+	{
+		throw std::runtime_error( "tree: cannot map treebank " + path );
+	}
+	map_      = map;
+	mapBytes_ = size_t( st.st_size );
+
+	try
+	{
+		attach( static_cast< const char * >( map_ ), mapBytes_ );
+	}
+	catch( ... )
+	{
+		close();
+		throw;
+	}
+#else
+	std::ifstream in( path.c_str(), std::ios::binary );
+	if( !in.seekg( 0, std::ios::end ) )
+	{
+		throw std::runtime_error( "tree: cannot open treebank " + path );
+	}
+	copy_.resize( size_t( in.tellg() ) );
+	in.seekg( 0, std::ios::beg );
+	if( !in.read( copy_.data(), std::streamsize( copy_.size() ) ) )
+	{
+		close();
+		throw std::runtime_error( "tree: cannot read treebank " + path );
+	}
+
+	try
+	{
+		attach( copy_.data(), copy_.size() );
+	}
+	catch( ... )
+	{
+		close();
+		throw;
+	}
+#endif
+}
+
+inline void TreeBank::open( const void *data, size_t bytes )
+{
+	close();
+	attach( static_cast< const char * >( data ), bytes );
+}
+
+inline void TreeBank::close()
+{
+#ifdef _TREE_MMAP_
+	if( map_ != 0 )
+	{
+		::munmap( map_, mapBytes_ );
+	}
+#endif
+	map_      = 0;
+	mapBytes_ = 0;
+	std::vector< char >().swap( copy_ );
+
+	head_       = 0;
+	treeBegin_  = 0;
+	end_        = 0;
+	parent_     = 0;
+	label_      = 0;
+	labelBegin_ = 0;
+	characters_ = 0;
+}
+
+inline bool TreeBank::isOpen() const
+{
+	return head_ != 0;
+}
+
+inline size_t TreeBank::numberOfTrees() const
+{
+	return head_ == 0 ? 0 : size_t( head_->trees );
+}
+
+inline size_t TreeBank::size() const
+{
+	return head_ == 0 ? 0 : size_t( head_->nodes );
+}
+
+inline size_t TreeBank::numberOfLabels() const
+{
+	return head_ == 0 ? 0 : size_t( head_->labels );
+}
+
+inline const char *TreeBank::label( index_type num ) const
+{
+	return characters_ + labelBegin_[ num ];
+}
+
+inline TreeBank::treeView TreeBank::operator[]( size_t num ) const
+{
+	if( num >= numberOfTrees() )
+	{
+		throw std::range_error( "tree: no such tree in treebank" );
+	}
+
+	std::uint64_t first = treeBegin_[ num     ];
+	std::uint64_t last  = treeBegin_[ num + 1 ];
+	if( first > last || last > head_->nodes || last - first >= npos )
+	{
+		throw std::runtime_error( "tree: bad tree in treebank" );
+	}
+	return treeView( this, first, index_type( last - first ) );
+}
+
+// The counts are bounded before the layout is worked out from them, so
+// that it cannot overflow.
+inline void TreeBank::attach( const char *data, size_t bytes )
+{
+	if( bytes < sizeof( header ) || std::memcmp( data, "TREEBANK", 8 ) != 0 )
+	{
+		throw std::runtime_error( "tree: not a treebank" );
+	}
+	if( reinterpret_cast< std::uintptr_t >( data ) % 8 != 0 )
+	{
+		throw std::runtime_error( "tree: treebank not aligned to 8 bytes" );
+	}
+
+	const header *h = reinterpret_cast< const header * >( data );
+	if( h->version != version )
+	{
+		throw std::runtime_error( "tree: treebank of an unknown version" );
+	}
+	if( h->order != byteOrder )
+	{
+		throw std::runtime_error( "tree: treebank of the other byte order" );
+	}
+
+	const std::uint64_t most = std::uint64_t( 1 ) << 48;
+	if( h->trees >= most || h->nodes >= most || h->labels >= most || h->characters >= most )
+	{
+		throw std::runtime_error( "tree: bad treebank header" );
+	}
+	layout at( *h );
+	if( at.size != bytes )
+	{
+		throw std::runtime_error( "tree: treebank of the wrong size" );
+	}
+
+	const std::uint64_t *treeBegin = reinterpret_cast< const std::uint64_t * >( data + at.treeBegin );
+	if( treeBegin[ 0 ] != 0 || treeBegin[ h->trees ] != h->nodes || ( h->characters > 0 && data[ at.size - 1 ] != '\0' ) )
+	{
+		throw std::runtime_error( "tree: bad treebank header" );
+	}
+
+	head_       = h;
+	treeBegin_  = treeBegin;
+	end_        = reinterpret_cast< const index_type    * >( data + at.end        );
+	parent_     = reinterpret_cast< const index_type    * >( data + at.parent     );
+	label_      = reinterpret_cast< const index_type    * >( data + at.label      );
+	labelBegin_ = reinterpret_cast< const std::uint64_t * >( data + at.labelBegin );
+	characters_ = data + at.characters;
+}
+
+// Rebuilds the parents of every tree from the subtree ends with a stack,
+// as they have to be for a well formed tree, and checks every number that
+// the views use to index the file.
+inline void TreeBank::check() const
+{
+	for( size_t l = 0; l < numberOfLabels(); ++l )
+	{
+		if( labelBegin_[ l ] >= head_->characters )
+		{
+			throw std::runtime_error( "tree: bad label in treebank" );
+		}
+	}
+
+	std::vector< index_type > path;   // the nodes whose subtrees hold pos
+	for( size_t t = 0; t < numberOfTrees(); ++t )
+	{
+		treeView tree = ( *this )[ t ];
+		path.clear();
+		for( index_type pos = 0; pos < tree.size(); ++pos )
+		{
+			while( !path.empty() && tree.subtreeEnd( path.back() ) <= pos )
+			{
+				path.pop_back();
+			}
+			index_type up    = path.empty() ? index_type( npos ) : path.back();
+			index_type limit = path.empty() ? index_type( tree.size() ) : tree.subtreeEnd( up );
+			if( tree.parentIndex( pos ) != up || tree.subtreeEnd( pos ) <= pos || tree.subtreeEnd( pos ) > limit )
+			{
+				throw std::runtime_error( "tree: bad tree in treebank" );
+			}
+			if( tree.labelIndex( pos ) >= head_->labels )
+			{
+				throw std::runtime_error( "tree: bad label in treebank" );
+			}
+			path.push_back( pos );
+		}
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// TreeBankWriter
+//////////////////////////////////////////////////////////////////////////
+// Collects trees for a TreeBank, all in memory, and writes the file.
+// Equal labels are stored once.
+class TreeBankWriter
+{
+public:
+	typedef TreeBank::index_type index_type;
+
+	TreeBankWriter();
+
+	// adds the top nodes of a tree and everything below them, returns the
+	// number of the tree
+	template< class TreeNodeAllocator_, class TreePolicy_ >
+	size_t add( const Tree< std::string, TreeNodeAllocator_, TreePolicy_ >& );
+
+	size_t numberOfTrees( ) const;
+	size_t size(          ) const;   // nodes of all trees
+
+	void write( std::ostream& ) const;
+	void clear();
+
+private:
+	index_type intern( const std::string& );
+
+	std::vector< std::uint64_t >                   treeBegin_ ;
+	std::vector< index_type    >                   end_       ;
+	std::vector< index_type    >                   parent_    ;
+	std::vector< index_type    >                   label_     ;
+	std::vector< std::uint64_t >                   labelBegin_;
+	std::string                                    characters_;
+	std::unordered_map< std::string, index_type >  labels_    ;
+};
+
+inline TreeBankWriter::TreeBankWriter()
+: treeBegin_( 1, 0 )
+{
+}
+
+// The walk of TreeDag::add(), in pre-order; a node's subtree ends when the
+// walk leaves it.
+template< class TreeNodeAllocator_, class TreePolicy_ >
+size_t TreeBankWriter::add( const Tree< std::string, TreeNodeAllocator_, TreePolicy_ >& tree )
+{
+	const size_t first = end_.size();
+	std::vector< index_type > open;
+
+	try
+	{
+		decltype( tree.head ) cur = tree.head->nextSibling;
+		while( cur != tree.feet )
+		{
+			if( end_.size() - first >= TreeBank::npos )
+			{
+				throw std::runtime_error( "tree: tree too large for treebank" );
+			}
+			index_type pos = index_type( end_.size() - first );
+			label_.push_back( intern( cur->data ) );
+			parent_.push_back( open.empty() ? index_type( TreeBank::npos ) : open.back() );
+			end_.push_back( 0 );
+			open.push_back( pos );
+
+			if( cur->firstChild != 0 )
+			{
+				cur = cur->firstChild;
+				continue;
+			}
+
+			while( true )
+			{
+				end_[ first + open.back() ] = index_type( end_.size() - first );
+				open.pop_back();
+
+				if( open.empty() || cur->nextSibling != 0 )
+				{
+					cur = cur->nextSibling;
+					break;
+				}
+				cur = cur->parent;
+			}
+		}
+	}
+	catch( ... )
+	{
+		end_.resize(    first );
+		parent_.resize( first );
+		label_.resize(  first );
+		throw;
+	}
+
+	treeBegin_.push_back( end_.size() );
+	return treeBegin_.size() - 2;
+}
+
+inline size_t TreeBankWriter::numberOfTrees() const
+{
+	return treeBegin_.size() - 1;
+}
+
+inline size_t TreeBankWriter::size() const
+{
+	return end_.size();
+}
+
+inline void TreeBankWriter::write( std::ostream& out ) const
+{
+	TreeBank::header h;
+	std::memcpy( h.magic, "TREEBANK", 8 );
+	h.version    = TreeBank::version;
+	h.order      = TreeBank::byteOrder;
+	h.trees      = numberOfTrees();
+	h.nodes      = size();
+	h.labels     = labelBegin_.size();
+	h.characters = characters_.size();
+
+	TreeBank::layout at( h );
+	const char       pad[ 8 ] = {};
+
+	TreeBinary::putBytes( out, reinterpret_cast< const char * >( &h ), sizeof( h ) );
+	TreeBinary::putBytes( out, reinterpret_cast< const char * >( treeBegin_.data() ), std::streamsize( treeBegin_.size() * sizeof( std::uint64_t ) ) );
+	TreeBinary::putBytes( out, reinterpret_cast< const char * >( end_.data()       ), std::streamsize( end_.size()       * sizeof( index_type    ) ) );
+	TreeBinary::putBytes( out, reinterpret_cast< const char * >( parent_.data()    ), std::streamsize( parent_.size()    * sizeof( index_type    ) ) );
+	TreeBinary::putBytes( out, reinterpret_cast< const char * >( label_.data()     ), std::streamsize( label_.size()     * sizeof( index_type    ) ) );
+	TreeBinary::putBytes( out, pad, std::streamsize( at.labelBegin - at.label - label_.size() * sizeof( index_type ) ) );
+	TreeBinary::putBytes( out, reinterpret_cast< const char * >( labelBegin_.data() ), std::streamsize( labelBegin_.size() * sizeof( std::uint64_t ) ) );
+	TreeBinary::putBytes( out, characters_.data(), std::streamsize( characters_.size() ) );
+}
+
+inline void TreeBankWriter::clear()
+{
+	treeBegin_.assign( 1, 0 );
+	end_.clear();
+	parent_.clear();
+	label_.clear();
+	labelBegin_.clear();
+	characters_.clear();
+	labels_.clear();
+}
+
+inline TreeBankWriter::index_type TreeBankWriter::intern( const std::string& x )
+{
+	std::unordered_map< std::string, index_type >::const_iterator it = labels_.find( x );
+	if( it != labels_.end() )
+	{
+		return it->second;
+	}
+
+	if( x.find( '\0' ) != std::string::npos )
+	{
+		throw std::runtime_error( "tree: label with a NUL byte in treebank" );
+	}
+	if( labelBegin_.size() >= TreeBank::npos )
+	{
+		throw std::runtime_error( "tree: too many labels for treebank" );
+	}
+	index_type ret = index_type( labelBegin_.size() );
+	labelBegin_.push_back( characters_.size() );
+	characters_.append( x.c_str(), x.size() + 1 );
+	labels_.insert( std::make_pair( x, ret ) );
+	return ret;
+}
+
+#endif
@@ -0,0 +1,121 @@
+/*
+ * TreeArenaAllocator on its own and as the allocator of a Tree: nodes
+ * survive moves and swaps of their tree, copies of a tree get an arena of
+ * their own, and clear() hands the arena back in one step. Iterators to
+ * the end of a tree stay valid across clear(), whatever the allocator.
+ */
+#include <string>
+#include <type_traits>
+#include "tree.h"
+#include "check.h"
+
+typedef TreeArenaAllocator< _TreeNode< int > > arena;
+typedef Tree< std::string, TreeArenaAllocator< std::string > > arenaTree;
+typedef Tree< int, TreeArenaAllocator< _TreeNode< int > > > bulkTree;   // cleared in one step
+
+// an arena only frees what it handed out, so it moves but does not copy
+static_assert( !std::is_copy_constructible< arena >::value, "arena copies" );
+static_assert( !std::is_copy_assignable<    arena >::value, "arena copies" );
+static_assert(  std::is_move_constructible< arena >::value, "arena does not move" );
+static_assert(  std::is_move_assignable<    arena >::value, "arena does not move" );
+
+static void fill( arenaTree& tr, int n )
+{
+	arenaTree::preOrderIterator top = tr.setHead( "top" );
+	for( int i = 0; i < n; ++i )
+	{
+		tr.appendChild( top, std::string( size_t( i % 40 ), 'x' ) );
+	}
+}
+
+int main()
+{
+	// allocation, the free list and reserve()
+	{
+		arena a;
+		CHECK( a == a && a.capacity() == 0 );
+		arena::pointer p = a.allocate( 1 );
+		arena::pointer q = a.allocate( 1 );
+		CHECK( p != q );
+		a.deallocate( p, 1 );
+		CHECK( a.allocate( 1 ) == p );
+
+		size_t before = a.capacity();
+		a.reserve( 100000 );
+		CHECK( a.capacity() >= before + 100000 - 64 );
+
+		arena b( std::move( a ) );
+		CHECK( a.capacity() == 0 && b.capacity() >= 100000 );
+		arena c;
+		CHECK( !( b == c ) && b != c );
+	}
+
+	// trees keep their nodes through moves and swaps
+	arenaTree one, two;
+	fill( one, 1000 );
+	fill( two, 10 );
+	arenaTree::preOrderIterator kept = one.begin();
+	++kept;
+	one.swap( two );
+	CHECK( two.size() == 1001 && one.size() == 11 );
+	CHECK( *kept == "" && two.numberOfChildren( two.begin() ) == 1000 );
+
+	arenaTree moved( std::move( two ) );
+	CHECK( moved.size() == 1001 );
+	two = std::move( one );
+	CHECK( two.size() == 11 );
+
+	// a copy is built in its own arena and outlives the original
+	arenaTree *original = new arenaTree;
+	fill( *original, 500 );
+	arenaTree copy( *original );
+	delete original;
+	CHECK( copy.size() == 501 );
+	size_t total = 0;
+	for( arenaTree::preOrderIterator it = copy.begin(); it != copy.end(); ++it )
+	{
+		total += it->size();
+	}
+	size_t want = 3;
+	for( int i = 0; i < 500; ++i )
+	{
+		want += size_t( i % 40 );
+	}
+	CHECK( total == want );
+
+	// clear() drops everything, the tree is usable afterwards
+	copy.clear();
+	CHECK( copy.empty() );
+	fill( copy, 3 );
+	CHECK( copy.size() == 4 );
+
+	// end() taken before clear() still ends the tree after it, also when
+	// the arena is dropped in bulk
+	{
+		bulkTree tr;
+		bulkTree::preOrderIterator top = tr.setHead( 0 );
+		for( int i = 1; i < 1000; ++i )
+		{
+			tr.appendChild( top, i );
+		}
+		const bulkTree::preOrderIterator  end     = tr.end();
+		const bulkTree::postOrderIterator endPost = tr.endPost();
+		const bulkTree::leafIterator      endLeaf = tr.endLeaf();
+		tr.clear();
+		CHECK( tr.empty() && tr.size() == 0 );
+		CHECK( tr.begin() == end && tr.end() == end );
+		CHECK( tr.endPost() == endPost && tr.endLeaf() == endLeaf );
+
+		tr.setHead( 1 );
+		tr.appendChild( tr.begin(), 2 );
+		int sum = 0;
+		for( bulkTree::preOrderIterator it = tr.begin(); it != end; ++it )
+		{
+			sum += *it;
+		}
+		CHECK( sum == 3 && tr.end() == end );
+		tr.clear();
+		CHECK( tr.begin() == end );
+	}
+	return 0;
+}
@@ -0,0 +1,283 @@
+/*
+ * TreeBank: every tree written by a TreeBankWriter comes back unchanged,
+ * from memory and from a file, and damaged files are refused, by open()
+ * where the header is wrong and by check() where the tables are.
+ */
+#include "treebank.h"
+#include "check.h"
+#include "trees.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+typedef Tree< std::string > tree;
+
+// a file's bytes at an address aligned to 8, as a mapping would be
+struct buffer
+{
+	explicit buffer( const std::string& bytes )
+	: words( bytes.size() / 8 + 1 ), size( bytes.size() )
+	{
+		std::memcpy( data(), bytes.data(), bytes.size() );
+	}
+
+	char *data() { return reinterpret_cast< char * >( words.data() ); }
+
+	std::vector< std::uint64_t > words;
+	size_t                       size ;
+};
+
+static std::vector< tree > someTrees()
+{
+	std::vector< tree > ret;
+
+	// children c0 c1 c2 c0 c1, the first two without leaves
+	tree first = fan( "a", 5 );
+	int  n     = 0;
+	for( tree::siblingIterator c = first.beginSibling( first.begin() ); c != first.endSibling( first.begin() ); ++c, ++n )
+	{
+		*c = "c" + std::to_string( n % 3 );
+		if( n < 2 )
+		{
+			first.eraseChildren( c );
+		}
+	}
+	ret.push_back( first );
+	ret.push_back( tree() );
+	tree several = fan( "b", 3 );
+	several.insertSubtreeAfter( several.begin(), fan( "c", 2 ).begin() );
+	several.insertAfter( several.begin(), std::string( "" ) );   // an empty label
+	ret.push_back( several );
+	tree chain( std::string( "0" ) );
+	tree::preOrderIterator low = chain.begin();
+	for( int i = 1; i < 1000; ++i )
+	{
+		low = chain.appendChild( low, std::to_string( i % 7 ) );
+	}
+	ret.push_back( chain );
+	return ret;
+}
+
+static std::string written( const std::vector< tree >& trees )
+{
+	TreeBankWriter writer;
+	for( size_t t = 0; t < trees.size(); ++t )
+	{
+		CHECK( writer.add( trees[ t ] ) == t );
+	}
+	std::ostringstream out;
+	writer.write( out );
+	return out.str();
+}
+
+// the view gives the labels, parents, depths and sizes of the tree
+static void checkTree( const TreeBank::treeView& view, const tree& tr )
+{
+	CHECK( view.size() == tr.size() );
+	CHECK( view.empty() == tr.empty() );
+
+	TreeBank::preOrderIterator it = view.begin();
+	for( tree::preOrderIterator ref = tr.begin(); ref != tr.end(); ++ref, ++it )
+	{
+		CHECK( it != view.end() );
+		CHECK( *ref == *it );
+		CHECK( view.depth( it ) == size_t( tr.depth( ref ) ) );
+		CHECK( view.size( it ) == tr.size( ref ) );
+		CHECK( view.numberOfChildren( it ) == tr.numberOfChildren( ref ) );
+
+		tree::preOrderIterator up = tr.parent( ref );
+		if( tr.isValid( up ) )
+		{
+			CHECK( *view.parent( it ) == *up );
+			CHECK( view.depth( view.parent( it ) ) + 1 == view.depth( it ) );
+		}
+		else
+		{
+			CHECK( view.parent( it ) == view.end() );
+		}
+
+		// the leaves below the node, none below a leaf
+		TreeBank::leafIterator below = view.beginLeaf( it );
+		for( tree::leafIterator low = tr.beginLeaf( ref ); low != tr.endLeaf( ref ); ++low, ++below )
+		{
+			CHECK( below != view.endLeaf( it ) );
+			CHECK( *low == *below );
+		}
+		CHECK( below == view.endLeaf( it ) );
+	}
+	CHECK( it == view.end() );
+
+	TreeBank::postOrderIterator post = view.beginPost();
+	for( tree::postOrderIterator ref = tr.beginPost(); ref != tr.endPost(); ++ref, ++post )
+	{
+		CHECK( post != view.endPost() );
+		CHECK( *ref == *post );
+	}
+	CHECK( post == view.endPost() );
+
+	TreeBank::leafIterator leaf = view.beginLeaf();
+	for( tree::leafIterator ref = tr.beginLeaf(); ref != tr.endLeaf(); ++ref, ++leaf )
+	{
+		CHECK( leaf != view.endLeaf() );
+		CHECK( *ref == *leaf );
+	}
+	CHECK( leaf == view.endLeaf() );
+}
+
+static void checkBank( const TreeBank& bank, const std::vector< tree >& trees )
+{
+	CHECK( bank.isOpen() );
+	CHECK( bank.numberOfTrees() == trees.size() );
+	size_t nodes = 0;
+	for( size_t t = 0; t < trees.size(); ++t )
+	{
+		checkTree( bank[ t ], trees[ t ] );
+		nodes += trees[ t ].size();
+	}
+	CHECK( bank.size() == nodes );
+	bank.check();
+	CHECK_THROWS( std::range_error, bank[ trees.size() ] );
+}
+
+// open() or check() throws, and a failed open() leaves the bank closed
+static void damaged( const std::string& bytes, bool byOpen )
+{
+	buffer   buf( bytes );
+	TreeBank bank;
+	if( byOpen )
+	{
+		CHECK_THROWS( std::runtime_error, bank.open( buf.data(), buf.size ) );
+		CHECK( !bank.isOpen() );
+		CHECK( bank.numberOfTrees() == 0 );
+	}
+	else
+	{
+		bank.open( buf.data(), buf.size );
+		CHECK_THROWS( std::runtime_error, bank.check() );
+	}
+}
+
+template< class Field >
+static std::string with( std::string bytes, std::uint64_t offset, Field value )
+{
+	std::memcpy( &bytes[ size_t( offset ) ], &value, sizeof( value ) );
+	return bytes;
+}
+
+static void damagedAll( const std::string& good )
+{
+	TreeBank::header h;
+	std::memcpy( &h, good.data(), sizeof( h ) );
+	TreeBank::layout at( h );
+
+	// the header
+	damaged( "", true );
+	damaged( good.substr( 0, sizeof( h ) - 1 ), true );
+	damaged( "TREEWOOD" + good.substr( 8 ), true );
+	damaged( with( good, offsetof( TreeBank::header, version ), TreeBank::version + 1 ), true );
+	damaged( good.substr( 0, good.size() - 1 ), true );
+	damaged( good + '\0', true );
+	damaged( with( good, offsetof( TreeBank::header, nodes ), h.nodes + 1 ), true );
+	damaged( with( good, offsetof( TreeBank::header, trees ), ~std::uint64_t( 0 ) ), true );
+	damaged( with( good, offsetof( TreeBank::header, labels ), std::uint64_t( 1 ) << 60 ), true );
+	damaged( with( good, at.size - 1, 'x' ), true );   // the last label is not ended
+
+	// a file written on a machine of the other byte order
+	std::uint32_t other = TreeBank::byteOrder;
+	std::reverse( reinterpret_cast< char * >( &other ), reinterpret_cast< char * >( &other ) + sizeof( other ) );
+	damaged( with( good, offsetof( TreeBank::header, order ), other ), true );
+
+	// not aligned to 8 bytes
+	buffer   buf( " " + good );
+	TreeBank bank;
+	CHECK_THROWS( std::runtime_error, bank.open( buf.data() + 1, good.size() ) );
+
+	// the tables, which only check() reads through
+	const TreeBank::index_type bad = 1000000;
+	damaged( with( good, at.end,        bad ), false );
+	damaged( with( good, at.end,        TreeBank::index_type( 0 ) ), false );
+	damaged( with( good, at.parent,     TreeBank::index_type( 1 ) ), false );
+	damaged( with( good, at.parent + 4, TreeBank::npos ), false );
+	damaged( with( good, at.label,      bad ), false );
+	damaged( with( good, at.labelBegin, h.characters ), false );
+	damaged( with( good, at.treeBegin + 8, h.nodes + 1 ), false );
+}
+
+int main()
+{
+	std::vector< tree > trees = someTrees();
+	const std::string   bytes = written( trees );
+
+	// from memory
+	buffer   buf( bytes );
+	TreeBank bank;
+	CHECK( !bank.isOpen() );
+	bank.open( buf.data(), buf.size );
+	checkBank( bank, trees );
+
+	// equal labels are stored once: a, b, c, c0..c2, x, y, "", 0..6
+	CHECK( bank.numberOfLabels() == 16 );
+	TreeBank::preOrderIterator top = bank[ 0 ].begin();
+	TreeBank::preOrderIterator c   = top;
+	++c;
+	CHECK( std::string( *c ) == "c0" );
+	CHECK( std::string( bank.label( c.label() ) ) == "c0" );
+
+	// siblings, and skipping the children of a node
+	std::string children;
+	for( TreeBank::siblingIterator s = bank[ 0 ].beginSibling( top ); s != bank[ 0 ].endSibling( top ); ++s )
+	{
+		children += *s;
+		children += " ";
+	}
+	CHECK( children == "c0 c1 c2 c0 c1 " );
+	TreeBank::preOrderIterator skip = bank[ 2 ].begin();
+	skip.skipChildren();
+	++skip;
+	CHECK( std::string( *skip ) == "" );
+
+	bank.close();
+	CHECK( !bank.isOpen() );
+	CHECK( bank.numberOfTrees() == 0 );
+
+	// from a file
+	const char *path = "bank_test.tmp";
+	{
+		std::ofstream out( path, std::ios::binary );
+		out.write( bytes.data(), std::streamsize( bytes.size() ) );
+	}
+	{
+		TreeBank file( path );
+		checkBank( file, trees );
+		file.open( path );   // again, over the open one
+		checkBank( file, trees );
+	}
+	std::remove( path );
+	CHECK_THROWS( std::runtime_error, bank.open( path ) );
+	CHECK( !bank.isOpen() );
+
+	// an empty bank
+	std::string none = written( std::vector< tree >() );
+	buffer      noneBuf( none );
+	bank.open( noneBuf.data(), noneBuf.size );
+	checkBank( bank, std::vector< tree >() );
+
+	damagedAll( bytes );
+
+	// a label the file cannot hold leaves the writer as it was
+	TreeBankWriter writer;
+	writer.add( trees[ 0 ] );
+	tree nul( std::string( "a\0b", 3 ) );
+	CHECK_THROWS( std::runtime_error, writer.add( nul ) );
+	CHECK( writer.numberOfTrees() == 1 );
+	CHECK( writer.size() == trees[ 0 ].size() );
+	writer.clear();
+	CHECK( writer.numberOfTrees() == 0 && writer.size() == 0 );
+	return 0;
+}
@@ -0,0 +1,158 @@
+/*
+ * The binary form: trees come back from write() and read() unchanged, and
+ * damaged input, or input of the other byte order, throws
+ * std::runtime_error and leaves the tree empty, even when its header asks
+ * for more nodes than memory could hold.
+ */
+#include "tree.h"
+#include "check.h"
+
+#include <sstream>
+#include <string>
+
+typedef Tree< int >                                             ints;
+typedef Tree< std::string >                                     strings;
+typedef Tree< int, TreeArenaAllocator< _TreeNode< int > > >     arenaInts;
+
+struct Everything : TreeDefaultPolicy
+{
+	static const bool countNodes   = true;
+	static const bool subtreeSizes = true;
+	static const bool leafChain    = true;
+	static const bool levelLinks   = true;
+};
+
+template< class TR >
+static void build( TR& tr, int width )
+{
+	typename TR::preOrderIterator top = tr.setHead( typename TR::value_type() );
+	for( int i = 0; i < width; ++i )
+	{
+		typename TR::preOrderIterator child = tr.appendChild( top, typename TR::value_type() );
+		for( int j = 0; j < i % 4; ++j )
+		{
+			tr.appendChild( child, typename TR::value_type() );
+		}
+	}
+	tr.insertAfter( top, typename TR::value_type() );
+	tr.insertAfter( top, typename TR::value_type() );
+
+	int n = 0;
+	for( typename TR::preOrderIterator it = tr.begin(); it != tr.end(); ++it )
+	{
+		std::ostringstream num;
+		num << n++;
+		std::istringstream( num.str() ) >> *it;
+	}
+}
+
+template< class TR >
+static void roundTrip( int width )
+{
+	TR tr;
+	build( tr, width );
+
+	std::stringstream io;
+	tr.write( io );
+
+	TR back;
+	build( back, 3 );   // read() replaces what was there
+	back.read( io );
+	CHECK( back.size() == tr.size() );
+	CHECK( back.equal( back.begin(), back.end(), tr.begin() ) );
+	back.debug_verify_consistency();
+
+	// an empty tree
+	TR none;
+	std::stringstream empty;
+	none.write( empty );
+	back.read( empty );
+	CHECK( back.empty() );
+}
+
+// the byte order mark as the other kind of machine stores it
+static std::string otherOrder()
+{
+	const std::uint32_t order = TreeBinary::byteOrder;
+	std::string bytes( reinterpret_cast< const char * >( &order ), sizeof( order ) );
+	return std::string( bytes.rbegin(), bytes.rend() );
+}
+
+// header: "TREE", the version, the flags, the byte order, the node count,
+// the top count
+static std::string header( std::uint64_t count, std::uint64_t tops )
+{
+	std::ostringstream out;
+	const char start[ 4 ] = { 'T', 'R', 'E', 'E' };
+	out.write( start, 4 );
+	TreeBinary::putNumber( out, TreeBinary::version );
+	out.put( 0 );
+	const std::uint32_t order = TreeBinary::byteOrder;
+	out.write( reinterpret_cast< const char * >( &order ), sizeof( order ) );
+	TreeBinary::putNumber( out, count );
+	TreeBinary::putNumber( out, tops );
+	return out.str();
+}
+
+template< class TR >
+static void damaged( const std::string& bytes )
+{
+	TR tr;
+	build( tr, 5 );
+	std::istringstream in( bytes );
+	CHECK_THROWS( std::runtime_error, tr.read( in ) );
+	CHECK( tr.empty() );
+	CHECK( tr.size() == 0 );
+
+	// still usable
+	build( tr, 2 );
+	CHECK( tr.size() == 6 );
+}
+
+template< class TR >
+static void damagedAll()
+{
+	std::stringstream io;
+	TR tr;
+	build( tr, 6 );
+	tr.write( io );
+	const std::string good = io.str();
+
+	damaged< TR >( "" );
+	damaged< TR >( "TRE" );
+	damaged< TR >( "WOOD" + good.substr( 4 ) );
+	damaged< TR >( good.substr( 0, 4 ) + char( TreeBinary::version + 1 ) + good.substr( 5 ) );
+	damaged< TR >( good.substr( 0, 6 ) + otherOrder() + good.substr( 10 ) );
+	damaged< TR >( good.substr( 0, 8 ) );
+	damaged< TR >( good.substr( 0, good.size() - 1 ) );   // cut short
+	damaged< TR >( good.substr( 0, good.size() / 2 ) );
+
+	// counts that do not match the nodes
+	damaged< TR >( header( 5, 1 ) );
+	damaged< TR >( header( 1, 2 ) );
+	damaged< TR >( header( 0, 1 ) );
+
+	// counts far beyond memory, with nothing after them
+	damaged< TR >( header( std::uint64_t( 1 ) << 40, 1 ) );
+	damaged< TR >( header( ( std::uint64_t( 1 ) << 60 ) + 63, 1 ) );
+	damaged< TR >( header( ~std::uint64_t( 0 ), 1 ) );
+}
+
+int main()
+{
+	roundTrip< ints    >( 0  );
+	roundTrip< ints    >( 50 );
+	roundTrip< strings >( 50 );
+	roundTrip< arenaInts >( 50 );
+	roundTrip< Tree< std::string, std::allocator< std::string >, Everything > >( 50 );
+
+	damagedAll< ints      >();
+	damagedAll< strings   >();
+	damagedAll< arenaInts >();
+
+	// the arena refuses a size that would wrap instead of allocating too little
+	TreeArenaAllocator< _TreeNode< int > > arena;
+	CHECK_THROWS( std::bad_alloc, arena.reserve( ( size_t( 1 ) << 60 ) + 63 ) );
+	CHECK_THROWS( std::bad_alloc, arena.reserve( size_t( -1 ) ) );
+	return 0;
+}
@@ -0,0 +1,143 @@
+/*
+ * TreeBracketReader: the same trees, offsets and errors come out of a
+ * buffer and out of a stream read in chunks of any size, down to a byte,
+ * and bad input throws TreeParseError with the offset of the trouble and
+ * leaves the tree empty.
+ */
+#include "tree.h"
+#include "check.h"
+#include "trees.h"
+
+#include <sstream>
+#include <string>
+#include <vector>
+
+struct Leaves : TreeDefaultPolicy
+{
+	static const bool countNodes = true;
+	static const bool leafChain  = true;
+	static const bool levelLinks = true;
+};
+
+typedef Tree< std::string >                                    tree;
+typedef Tree< std::string, std::allocator< std::string >, Leaves > leafTree;
+
+// every tree of the input with the offset after it, or the error's
+// message and offset at the end
+template< class TR >
+static std::vector< std::string > readAll( TreeBracketReader& reader )
+{
+	std::vector< std::string > ret;
+	TR tr;
+	try
+	{
+		while( reader.next( tr ) )
+		{
+			tr.debug_verify_consistency();
+			ret.push_back( show( tr, " " ) + " @" + std::to_string( reader.offset() ) );
+		}
+		CHECK( tr.empty() );
+		ret.push_back( "end @" + std::to_string( reader.offset() ) );
+	}
+	catch( TreeParseError& e )
+	{
+		CHECK( tr.empty() );
+		CHECK( tr.size() == 0 );
+		ret.push_back( std::string( e.what() ) + " @" + std::to_string( e.offset ) );
+	}
+	return ret;
+}
+
+// the buffer, and the stream in chunks of every size up to past the input
+template< class TR >
+static std::vector< std::string > readEveryWay( const std::string& input )
+{
+	TreeBracketReader          fromBuffer( input.data(), input.size() );
+	std::vector< std::string > ret = readAll< TR >( fromBuffer );
+
+	for( size_t chunk = 1; chunk <= input.size() + 1; ++chunk )
+	{
+		std::istringstream in( input );
+		TreeBracketReader  fromStream( in, chunk );
+		CHECK( readAll< TR >( fromStream ) == ret );
+	}
+	std::istringstream in( input );
+	TreeBracketReader  fromStream( in );
+	CHECK( readAll< TR >( fromStream ) == ret );
+	return ret;
+}
+
+static void check( const std::string& input, const std::vector< std::string >& expect )
+{
+	CHECK( readEveryWay< tree >( input ) == expect );
+	CHECK( readEveryWay< leafTree >( input ) == expect );
+}
+
+int main()
+{
+	// nothing, and nothing but space
+	check( "",       { "end @0" } );
+	check( " \n\t ", { "end @4" } );
+
+	// one tree and several, with any space between the tokens
+	check( "(a b c)", { "a(b c) @7", "end @7" } );
+	check( "(S (NP (DT the) (NN dog)) (VP (VBZ barks)))\n( a )(b(c d)e)",
+	       { "S(NP(DT(the) NN(dog)) VP(VBZ(barks))) @43",
+	         "a @49",
+	         "b(c(d) e) @58",
+	         "end @58" } );
+
+	// a bracket that follows a bracket has an empty label, as in the Penn
+	// Treebank; so has one that is closed at once
+	check( "( (S (NP x)) )\n()", { "(S(NP(x))) @14", " @17", "end @17" } );
+
+	// a label longer than the chunk, which the buffer grows to hold
+	std::string longLabel( 5000, 'x' );
+	check( "(" + longLabel + " (y " + longLabel + "))",
+	       { longLabel + "(y(" + longLabel + ")) @10007", "end @10007" } );
+
+	// a deep chain, and a wide node
+	std::string deep, wide = "(w";
+	for( int i = 0; i < 20000; ++i )
+	{
+		deep += "(n ";
+		wide += " l";
+	}
+	deep += std::string( 20000, ')' );
+	wide += ")";
+	{
+		TreeBracketReader reader( deep.data(), deep.size() );
+		tree              tr;
+		CHECK( reader.next( tr ) );
+		CHECK( tr.size() == 20000 );
+		CHECK( tr.maxDepth() == 19999 );
+		CHECK( !reader.next( tr ) );
+
+		std::istringstream in( wide );
+		TreeBracketReader  chunked( in, 16 );
+		CHECK( chunked.next( tr ) );
+		CHECK( tr.numberOfChildren( tr.begin() ) == 20000 );
+		CHECK( chunked.offset() == wide.size() );
+	}
+
+	// errors, after the trees before them
+	check( "x",              { "tree: text outside brackets at byte 0 @0" } );
+	check( "  )",            { "tree: unmatched ) at byte 2 @2" } );
+	check( "(a b))",         { "a(b) @5", "tree: unmatched ) at byte 5 @5" } );
+	check( "(a (b c)",       { "tree: input ends inside a tree at byte 8 @8" } );
+	check( "(a b) (c",       { "a(b) @5", "tree: input ends inside a tree at byte 8 @8" } );
+	check( "(",              { "tree: input ends inside a tree at byte 1 @1" } );
+	check( "(a b) leaf (c)", { "a(b) @5", "tree: text outside brackets at byte 6 @6" } );
+
+	// an error leaves the offset at the trouble
+	{
+		std::string       input = "(a b)) (c d)";
+		TreeBracketReader reader( input.data(), input.size() );
+		tree              tr;
+		CHECK( reader.next( tr ) );
+		CHECK_THROWS( TreeParseError, reader.next( tr ) );
+		CHECK( tr.empty() );
+		CHECK( reader.offset() == 5 );
+	}
+	return 0;
+}
@@ -0,0 +1,182 @@
+/*
+ * breadthFirstQueuedIterator: copies share one queue but keep their own
+ * positions, it++ hands back the old one, and a sole iterator that drops
+ * the prefix it has passed still walks the nodes in breadth-first order.
+ * A forest is walked level by level across all of its trees.
+ */
+#include "tree.h"
+#include "check.h"
+
+#include <cstdlib>
+#include <queue>
+#include <vector>
+
+struct Reduced : TreeDefaultPolicy
+{
+	static const bool reducedLinks = true;
+};
+
+// breadth-first order worked out with a plain queue, the top level first
+template< class TR >
+static std::vector< int > expected( const TR& tr )
+{
+	std::vector< int > ret;
+	std::queue< typename TR::siblingIterator > open;
+	for( typename TR::siblingIterator it = tr.begin(); it != tr.end(); ++it )
+	{
+		open.push( it );
+	}
+	while( !open.empty() )
+	{
+		typename TR::siblingIterator it = open.front();
+		open.pop();
+		ret.push_back( *it );
+		for( typename TR::siblingIterator c = tr.beginSibling( it ); c != tr.endSibling( it ); ++c )
+		{
+			open.push( c );
+		}
+	}
+	return ret;
+}
+
+template< class TR >
+static std::vector< int > walk( typename TR::breadthFirstQueuedIterator it, const TR& tr )
+{
+	std::vector< int > ret;
+	for( ; it != tr.endBreadthFirst(); ++it )
+	{
+		ret.push_back( *it );
+	}
+	return ret;
+}
+
+template< class TR >
+static void number( TR& tr )
+{
+	int num = 0;
+	for( typename TR::preOrderIterator it = tr.begin(); it != tr.end(); ++it )
+	{
+		*it = num++;
+	}
+}
+
+// a top level of tops nodes, each with wide children and random ones below
+template< class TR >
+static void build( TR& tr, int tops, int wide, int more )
+{
+	std::vector< typename TR::preOrderIterator > nodes;
+	nodes.push_back( tr.setHead( 0 ) );
+	for( int i = 1; i < tops; ++i )
+	{
+		nodes.push_back( tr.insertAfter( nodes.back(), 0 ) );
+	}
+	for( int i = 0; i < tops; ++i )
+	{
+		for( int j = 0; j < wide; ++j )
+		{
+			nodes.push_back( tr.appendChild( nodes[ size_t( i ) ], 0 ) );
+		}
+	}
+	for( int i = 0; i < more; ++i )
+	{
+		tr.appendChild( nodes[ size_t( std::rand() ) % nodes.size() ], 0 );
+	}
+	number( tr );
+}
+
+template< class TR >
+static void run()
+{
+	typedef typename TR::breadthFirstQueuedIterator bfs;
+
+	// an empty tree has nothing to walk
+	{
+		TR tr;
+		CHECK( tr.beginBreadthFirst() == tr.endBreadthFirst() );
+		CHECK( walk( tr.beginBreadthFirst(), tr ).empty() );
+	}
+
+	// a forest, each level across every tree; from a node, its subtree only
+	{
+		TR tr;
+		typename TR::preOrderIterator a = tr.setHead( 0 );
+		typename TR::preOrderIterator b = tr.insertAfter( a, 0 );
+		typename TR::preOrderIterator c = tr.insertAfter( b, 0 );
+		tr.appendChild( tr.appendChild( a, 0 ), 0 );
+		tr.appendChild( a, 0 );
+		tr.appendChild( tr.appendChild( tr.appendChild( c, 0 ), 0 ), 0 );
+		number( tr );
+		// pre-order: a=0 ( 1 ( 2 ) 3 ) b=4 c=5 ( 6 ( 7 ( 8 ) ) )
+		const int want[] = { 0, 4, 5, 1, 3, 6, 2, 7, 8 };
+		CHECK( walk( tr.beginBreadthFirst(), tr ) == std::vector< int >( want, want + 9 ) );
+		CHECK( walk( tr.beginBreadthFirst(), tr ) == expected( tr ) );
+
+		const int belowA[] = { 0, 1, 3, 2 };
+		CHECK( walk( bfs( a ), tr ) == std::vector< int >( belowA, belowA + 4 ) );
+		CHECK( walk( bfs( b ), tr ) == std::vector< int >( 1, 4 ) );
+	}
+
+	for( unsigned seed = 1; seed <= 3; ++seed )
+	{
+		std::srand( seed );
+		TR tr;
+		build( tr, int( seed ), 300, 2000 );
+		const std::vector< int > want = expected( tr );
+		CHECK( want.size() == tr.size() );
+
+		// a sole iterator drops what it has passed, the order stays
+		CHECK( walk( tr.beginBreadthFirst(), tr ) == want );
+
+		// advancing one copy leaves the other where it was
+		bfs it = tr.beginBreadthFirst();
+		it += 5;
+		bfs copy = it;
+		CHECK( *copy == want[ 5 ] );
+		it += 700;
+		CHECK( *it == want[ 705 ] && *copy == want[ 5 ] );
+		++copy;
+		CHECK( *copy == want[ 6 ] && *it == want[ 705 ] );
+
+		// it++ returns the old position, and both go on from theirs
+		bfs old = it++;
+		CHECK( *old == want[ 705 ] && *it == want[ 706 ] );
+		++old;
+		CHECK( old == it );
+
+		// each walks the rest in order while the others hold still
+		std::vector< int > rest = walk( copy, tr );
+		CHECK( rest == std::vector< int >( want.begin() + 6, want.end() ) );
+		rest = walk( it, tr );
+		CHECK( rest == std::vector< int >( want.begin() + 706, want.end() ) );
+
+		// once the other copies are gone the survivor drops the prefix,
+		// and a copy made after that still starts where it is
+		copy = bfs();
+		old  = bfs();
+		it += 1000;
+		CHECK( *it == want[ 1706 ] );
+		bfs late = it;
+		it += 100;
+		CHECK( walk( late, tr ) == std::vector< int >( want.begin() + 1706, want.end() ) );
+		CHECK( walk( it,   tr ) == std::vector< int >( want.begin() + 1806, want.end() ) );
+	}
+
+	// a chain, one node a level
+	{
+		TR tr;
+		typename TR::preOrderIterator it = tr.setHead( 0 );
+		for( int i = 0; i < 500; ++i )
+		{
+			it = tr.appendChild( it, 0 );
+		}
+		number( tr );
+		CHECK( walk( tr.beginBreadthFirst(), tr ) == expected( tr ) );
+	}
+}
+
+int main()
+{
+	run< Tree< int > >();
+	run< Tree< int, std::allocator< int >, Reduced > >();
+	return 0;
+}
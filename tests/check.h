@@ -0,0 +1,39 @@
+/*
+ * Small checking helpers shared by the test programs. A failed CHECK
+ * prints where it failed and ends the program with a non-zero status.
+ */
+#ifndef _TREE_TEST_CHECK_H_
+#define _TREE_TEST_CHECK_H_
+
+#include <cstdio>
+#include <cstdlib>
+
+#define CHECK( cond )                                                              \
+	do                                                                             \
+	{                                                                              \
+		if( !( cond ) )                                                            \
+		{                                                                          \
+			std::fprintf( stderr, "%s:%d: CHECK( %s ) failed\n", __FILE__, __LINE__, #cond ); \
+			std::exit( 1 );                                                        \
+		}                                                                          \
+	}                                                                              \
+	while( 0 )
+
+// CHECK that expr throws an exception of type E
+#define CHECK_THROWS( E, expr )                                                    \
+	do                                                                             \
+	{                                                                              \
+		bool threw_ = false;                                                       \
+		try                                                                        \
+		{                                                                          \
+			expr;                                                                  \
+		}                                                                          \
+		catch( E& )                                                                \
+		{                                                                          \
+			threw_ = true;                                                         \
+		}                                                                          \
+		CHECK( threw_ && #expr );                                                  \
+	}                                                                              \
+	while( 0 )
+
+#endif
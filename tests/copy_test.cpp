@@ -0,0 +1,117 @@
+/*
+ * Copies whose data throws part way: nothing may leak, and the tree copied
+ * into is left empty but usable.
+ */
+#include "tree.h"
+#include "check.h"
+
+#include <stdexcept>
+
+struct Counted
+{
+	static int live     ;   // instances alive now
+	static int copiesLeft;  // copies allowed before one throws, < 0 for any
+
+	int value;
+
+	Counted() : value( -1 ) { ++live; }
+	Counted( int v ) : value( v ) { ++live; }
+	Counted( const Counted& other ) : value( other.value )
+	{
+		if( copiesLeft == 0 )
+		{
+			throw std::runtime_error( "copy" );
+		}
+		if( copiesLeft > 0 )
+		{
+			--copiesLeft;
+		}
+		++live;
+	}
+	~Counted() { --live; }
+};
+
+int Counted::live       =  0;
+int Counted::copiesLeft = -1;
+
+static bool operator==( const Counted& x, const Counted& y )
+{
+	return x.value == y.value;
+}
+
+struct CopyPolicy : TreeDefaultPolicy
+{
+	static const bool countNodes   = true;
+	static const bool subtreeSizes = true;
+	static const bool leafChain    = true;
+	static const bool levelLinks   = true;
+};
+
+// two tops, each with a few levels of children
+template< class TR >
+static void build( TR& tr )
+{
+	typename TR::preOrderIterator top = tr.setHead( Counted( 0 ) );
+	for( int i = 1; i <= 4; ++i )
+	{
+		typename TR::preOrderIterator child = tr.appendChild( top, Counted( i ) );
+		for( int j = 0; j < 3; ++j )
+		{
+			tr.appendChild( tr.appendChild( child, Counted( 10 * i + j ) ), Counted( 100 * i + j ) );
+		}
+	}
+	tr.insertAfter( top, Counted( 1000 ) );
+	tr.appendChild( ++tr.beginSibling( top ), Counted( 1001 ) );
+}
+
+template< class TR >
+static void run()
+{
+	{
+		TR a;
+		build( a );
+		const int inA = Counted::live;
+		const size_t n = a.size();
+
+		// every copy that throws after k nodes, in the constructor and in
+		// operator=
+		for( size_t k = 0; k < n; ++k )
+		{
+			Counted::copiesLeft = int( k );
+			CHECK_THROWS( std::runtime_error, TR b( a ) );
+			Counted::copiesLeft = -1;
+			CHECK( Counted::live == inA );
+
+			TR c;
+			const int withC = Counted::live;
+			build( c );
+			Counted::copiesLeft = int( k );
+			CHECK_THROWS( std::runtime_error, c = a );
+			Counted::copiesLeft = -1;
+			CHECK( Counted::live == withC );
+			CHECK( c.empty() );
+			CHECK( c.size() == 0 );
+			CHECK( c.begin() == c.end() );
+
+			// and c works as before
+			build( c );
+			CHECK( c.size() == n );
+			c = a;
+			CHECK( c.size() == n );
+			CHECK( c.equal( c.begin(), c.end(), a.begin() ) );
+		}
+
+		Counted::copiesLeft = -1;
+		TR d( a );
+		CHECK( d.size() == n );
+		CHECK( d.equal( d.begin(), d.end(), a.begin() ) );
+	}
+	CHECK( Counted::live == 0 );
+}
+
+int main()
+{
+	run< Tree< Counted > >();
+	run< Tree< Counted, std::allocator< Counted >, CopyPolicy > >();
+	return 0;
+}
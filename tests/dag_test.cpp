@@ -0,0 +1,138 @@
+/*
+ * TreeDag: equal subtrees are stored once, and every tree added comes back
+ * unchanged, whether walked in place or expanded into a Tree.
+ */
+#include "tree.h"
+#include "check.h"
+#include "trees.h"
+
+#include <string>
+
+typedef Tree< std::string > tree;
+
+struct Counting : TreeDefaultPolicy
+{
+	static const bool countNodes = true;
+};
+
+// the in-place walk gives the data, depth and fanout of the tree's walk
+static void checkWalk( const TreeDag< std::string >& dag, size_t t, const tree& tr )
+{
+	std::vector< size_t > left;   // children still to come on each level, for the depth
+
+	TreeDag< std::string >::preOrderIterator it = dag.begin( t );
+	for( tree::preOrderIterator ref = tr.begin(); ref != tr.end(); ++ref, ++it )
+	{
+		CHECK( it != dag.end( t ) );
+		CHECK( *it == *ref );
+		CHECK( it.depth() == left.size() );
+		CHECK( it.numberOfChildren() == tr.numberOfChildren( ref ) );
+
+		if( tr.numberOfChildren( ref ) != 0 )
+		{
+			left.push_back( tr.numberOfChildren( ref ) );
+		}
+		else
+		{
+			while( !left.empty() && --left.back() == 0 )
+			{
+				left.pop_back();
+			}
+		}
+	}
+	CHECK( it == dag.end( t ) );
+
+	TreeDag< std::string >::leafIterator leaf = dag.beginLeaf( t );
+	for( tree::leafIterator ref = tr.beginLeaf(); ref != tr.endLeaf(); ++ref, ++leaf )
+	{
+		CHECK( leaf != dag.endLeaf( t ) );
+		CHECK( *leaf == *ref );
+	}
+	CHECK( leaf == dag.endLeaf( t ) );
+
+	tree back = dag.expand( t );
+	CHECK( back.size() == tr.size() );
+	CHECK( back.equal( back.begin(), back.end(), tr.begin() ) );
+}
+
+int main()
+{
+	TreeDag< std::string > dag;
+	CHECK( dag.empty() );
+
+	// a, c, x, y and c( x y ) under two tops with the same children
+	tree one = fan( "a", 3 );
+	tree two = fan( "b", 3 );
+	CHECK( dag.add( one ) == 0 );
+	CHECK( dag.add( two ) == 1 );
+	CHECK( dag.numberOfTrees() == 2 );
+	CHECK( dag.size() == 5 );   // x, y, c( x y ), a( ... ), b( ... )
+
+	// the children share one stored node, within a tree and across trees
+	TreeDag< std::string >::preOrderIterator first = dag.begin( 0 );
+	++first;
+	TreeDag< std::string >::preOrderIterator other = dag.begin( 1 );
+	++other;
+	++other;
+	++other;
+	++other;
+	CHECK( *first == "c" && *other == "c" );
+	CHECK( first.node() == other.node() );
+
+	// adding the same tree again stores nothing new
+	CHECK( dag.add( one ) == 2 );
+	CHECK( dag.size() == 5 );
+
+	// a tree of several tops, with a different fanout
+	tree three = fan( "a", 2 );
+	three.insertSubtreeAfter( three.begin(), fan( "a", 3 ).begin() );
+	three.insertAfter( three.begin(), std::string( "x" ) );
+	CHECK( dag.add( three ) == 3 );
+	CHECK( dag.size() == 6 );   // only a( c c ) is new
+
+	// an empty tree
+	tree none;
+	CHECK( dag.add( none ) == 4 );
+	CHECK( dag.begin( 4 ) == dag.end( 4 ) );
+	CHECK( dag.expand( 4 ).empty() );
+
+	checkWalk( dag, 0, one   );
+	checkWalk( dag, 1, two   );
+	checkWalk( dag, 2, one   );
+	checkWalk( dag, 3, three );
+	checkWalk( dag, 4, none  );
+
+	// skipping the children of a node
+	TreeDag< std::string >::preOrderIterator skip = dag.begin( 0 );
+	++skip;
+	skip.skipChildren();
+	++skip;
+	CHECK( *skip == "c" && skip.depth() == 1 );
+
+	// enough distinct trees to grow the table many times over, and a chain
+	// deeper than a recursive walk could go
+	for( int i = 0; i < 2000; ++i )
+	{
+		dag.add( fan( std::to_string( i ), i % 5 ) );
+	}
+	CHECK( dag.size() == 6 + 2000 );   // a new top each, the children are shared
+	tree chain( std::string( "0" ) );
+	tree::preOrderIterator low = chain.begin();
+	for( int i = 1; i < 200000; ++i )
+	{
+		low = chain.appendChild( low, std::string( i % 2 ? "p" : "q" ) );
+	}
+	size_t deep = dag.add( chain );
+	checkWalk( dag, deep, chain );
+	checkWalk( dag, 3, three );
+
+	// into a tree of another policy
+	Tree< std::string, std::allocator< std::string >, Counting > counted;
+	dag.expand( 3, counted );
+	CHECK( counted.size() == three.size() );
+
+	dag.clear();
+	CHECK( dag.empty() );
+	CHECK( dag.numberOfTrees() == 0 );
+	return 0;
+}
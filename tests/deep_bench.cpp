@@ -0,0 +1,94 @@
+/*
+ * The deep-tree paths on a chain of a million nodes: eraseChildren() below
+ * the top, clear() and the copy constructor, with std::allocator and with
+ * the arena. A flat tree of as many nodes, every node a child of the top,
+ * is timed alongside: the chain may cost more in cache misses, but none of
+ * the three recurses or grows with the depth in any other way.
+ */
+#include "tree.h"
+
+#include <chrono>
+#include <cstdio>
+
+static const int nodes  = 1000000;
+static const int rounds = 5;
+
+typedef std::chrono::steady_clock clock_;
+
+static double msSince( clock_::time_point start )
+{
+	return std::chrono::duration< double, std::milli >( clock_::now() - start ).count();
+}
+
+template< class TR >
+static void buildChain( TR& tr )
+{
+	typename TR::preOrderIterator it = tr.setHead( 0 );
+	for( int i = 1; i < nodes; ++i )
+	{
+		it = tr.appendChild( it, i );
+	}
+}
+
+template< class TR >
+static void buildFlat( TR& tr )
+{
+	typename TR::preOrderIterator top = tr.setHead( 0 );
+	for( int i = 1; i < nodes; ++i )
+	{
+		tr.appendChild( top, i );
+	}
+}
+
+// only the operation is timed, each round on a freshly built tree
+template< class TR >
+static void run( const char *name, void ( *build )( TR& ) )
+{
+	double erase = 0, clear = 0, copy = 0;
+	long   sum   = 0;
+
+	for( int r = 0; r < rounds; ++r )
+	{
+		TR tr;
+		build( tr );
+		clock_::time_point start = clock_::now();
+		tr.eraseChildren( tr.begin() );
+		erase += msSince( start );
+		sum   += long( tr.size() );
+	}
+
+	for( int r = 0; r < rounds; ++r )
+	{
+		TR tr;
+		build( tr );
+		clock_::time_point start = clock_::now();
+		tr.clear();
+		clear += msSince( start );
+		sum   += long( tr.size() );
+	}
+
+	TR tr;
+	build( tr );
+	for( int r = 0; r < rounds; ++r )
+	{
+		clock_::time_point start = clock_::now();
+		TR other( tr );
+		copy += msSince( start );
+		sum  += *other.begin();
+	}
+
+	std::printf( "%-22s eraseChildren %7.1f ms  clear %7.1f ms  copy %7.1f ms  (%ld)\n",
+	             name, erase / rounds, clear / rounds, copy / rounds, sum );
+}
+
+int main()
+{
+	typedef Tree< int >                                           plain;
+	typedef Tree< int, TreeArenaAllocator< _TreeNode< int > > >   arena;
+
+	run< plain >( "chain, std::allocator", buildChain< plain > );
+	run< plain >( "flat, std::allocator",  buildFlat<  plain > );
+	run< arena >( "chain, arena",          buildChain< arena > );
+	run< arena >( "flat, arena",           buildFlat<  arena > );
+	return 0;
+}
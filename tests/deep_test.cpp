@@ -0,0 +1,62 @@
+/*
+ * Trees far deeper than the stack would allow a recursive walk: a chain of
+ * a million nodes is built, copied, erased and destroyed.
+ */
+#include "tree.h"
+#include "check.h"
+
+static const size_t depthOfChain = 1000000;
+
+template< class TR >
+static void buildChain( TR& tr, size_t depth )
+{
+	tr.clear();
+	typename TR::preOrderIterator it = tr.setHead( 0 );
+	for( size_t i = 1; i < depth; ++i )
+	{
+		it = tr.appendChild( it, int( i ) );
+	}
+}
+
+template< class TR >
+static void run()
+{
+	TR tr;
+	buildChain( tr, depthOfChain );
+	CHECK( tr.size() == depthOfChain );
+
+	// eraseChildren() below the top, then below a node halfway down
+	tr.eraseChildren( tr.begin() );
+	CHECK( tr.size() == 1 );
+	CHECK( tr.numberOfChildren( tr.begin() ) == 0 );
+
+	buildChain( tr, depthOfChain );
+	typename TR::preOrderIterator half = tr.begin();
+	half += depthOfChain / 2;
+	CHECK( *half == int( depthOfChain / 2 ) );
+	tr.eraseChildren( half );
+	CHECK( tr.size() == depthOfChain / 2 + 1 );
+
+	// copying and assigning walk the chain as well
+	buildChain( tr, depthOfChain );
+	TR copy( tr );
+	CHECK( copy.size() == depthOfChain );
+	CHECK( *--copy.end() == int( depthOfChain - 1 ) );
+
+	TR assigned;
+	assigned = copy;
+	CHECK( assigned.size() == depthOfChain );
+
+	// erase() of the top, clear() and the destructors of the others
+	tr.erase( tr.begin() );
+	CHECK( tr.empty() );
+	copy.clear();
+	CHECK( copy.empty() );
+}
+
+int main()
+{
+	run< Tree< int > >();
+	run< Tree< int, TreeArenaAllocator< _TreeNode< int > > > >();
+	return 0;
+}
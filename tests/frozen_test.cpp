@@ -0,0 +1,261 @@
+/*
+ * FrozenTree against the Tree it was made from: every traversal visits the
+ * same nodes in the same order, and parent(), depth(), child() and size()
+ * agree at every node. The data of each node is its pre-order number, so
+ * a frozen node and a tree node are the same node when their data is.
+ */
+#include "tree.h"
+#include "check.h"
+
+#include <cstdlib>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+struct Levels : TreeDefaultPolicy
+{
+	static const bool childIndex = true;
+	static const bool leafChain  = true;
+	static const bool levelLinks = true;
+};
+
+typedef Tree< int >                                  plain;
+typedef Tree< int, std::allocator< int >, Levels >   levels;
+
+// the data of a pre-order walk, or the visited range of any other iterator
+template< class It >
+static std::vector< int > walk( It from, It to )
+{
+	std::vector< int > ret;
+	for( ; from != to; ++from )
+	{
+		ret.push_back( *from );
+	}
+	return ret;
+}
+
+template< class TR >
+static void number( TR& tr )
+{
+	int num = 0;
+	for( typename TR::preOrderIterator it = tr.begin(); it != tr.end(); ++it )
+	{
+		*it = num++;
+	}
+}
+
+// fixed-depth walk below top, or { -1 } when there is no node that deep
+template< class TR, class It >
+static std::vector< int > fixed( const TR& tr, const It& top, size_t dp )
+{
+	try
+	{
+		return walk( tr.beginFixed( top, dp ), tr.endFixed( top, dp ) );
+	}
+	catch( std::range_error& )
+	{
+		return std::vector< int >( 1, -1 );
+	}
+}
+
+template< class TR >
+static void compare( const TR& tr )
+{
+	typedef FrozenTree< int > frozen;
+	const frozen fr = tr.freeze();
+
+	CHECK( fr.size()  == tr.size()  );
+	CHECK( fr.empty() == tr.empty() );
+	CHECK( walk( fr.begin(),     fr.end()     ) == walk( tr.begin(),     tr.end()     ) );
+	CHECK( walk( fr.beginPost(), fr.endPost() ) == walk( tr.beginPost(), tr.endPost() ) );
+	CHECK( walk( fr.beginLeaf(), fr.endLeaf() ) == walk( tr.beginLeaf(), tr.endLeaf() ) );
+
+	// the top level
+	std::vector< int > tops;
+	for( typename TR::siblingIterator it = tr.begin(); it != tr.end(); ++it )
+	{
+		tops.push_back( *it );
+	}
+	std::vector< int > frozenTops;
+	for( frozen::siblingIterator it = fr.begin(); it != fr.end(); ++it )
+	{
+		frozenTops.push_back( *it );
+	}
+	CHECK( frozenTops == tops );
+
+	// skipChildren
+	std::vector< int > skipped, frozenSkipped;
+	for( typename TR::preOrderIterator it = tr.begin(); it != tr.end(); ++it )
+	{
+		skipped.push_back( *it );
+		if( *it % 3 == 0 )
+		{
+			it.skipChildren();
+		}
+	}
+	for( frozen::preOrderIterator it = fr.begin(); it != fr.end(); ++it )
+	{
+		frozenSkipped.push_back( *it );
+		if( *it % 3 == 0 )
+		{
+			it.skipChildren();
+		}
+	}
+	CHECK( frozenSkipped == skipped );
+
+	frozen::preOrderIterator fit = fr.begin();
+	for( typename TR::preOrderIterator it = tr.begin(); it != tr.end(); ++it, ++fit )
+	{
+		CHECK( fit != fr.end() && *fit == *it );
+
+		typename TR::preOrderIterator par = TR::parent( it );
+		CHECK( fr.parent( fit ) == ( par == 0 ? fr.end() : frozen::preOrderIterator( &fr, frozen::index_type( *par ) ) ) );
+		if( par != 0 )
+		{
+			CHECK( *fr.parent( fit ) == *par );
+		}
+
+		CHECK( fr.depth( fit ) == size_t( tr.depth( it ) ) );
+		CHECK( fr.size( fit )  == tr.size( it ) );
+		CHECK( fr.numberOfChildren( fit ) == it.numberOfChildren() );
+		CHECK( fit.numberOfChildren()     == it.numberOfChildren() );
+		CHECK( fr.subtreeEnd( fit.pos ) == fit.pos + tr.size( it ) );
+
+		// the children, by sibling iterator and by child()
+		const std::vector< int > children = walk( tr.beginSibling( it ), tr.endSibling( it ) );
+		CHECK( walk( fr.beginSibling( fit ), fr.endSibling( fit ) ) == children );
+		CHECK( walk( fit.begin(), fit.end() ) == children );
+		for( size_t n = 0; n < children.size(); ++n )
+		{
+			CHECK( *fr.child( fit, n ) == children[ n ] );
+			CHECK( *TR::child( it, n ) == children[ n ] );
+		}
+
+		CHECK( walk( fr.beginLeaf( fit ), fr.endLeaf( fit ) ) == walk( tr.beginLeaf( it ), tr.endLeaf( it ) ) );
+
+		// every depth below the node, and one too deep
+		size_t below = 0;
+		typename TR::preOrderIterator sub = it;
+		for( size_t n = tr.size( it ); n > 0; --n, ++sub )
+		{
+			below = std::max( below, size_t( tr.depth( sub ) - tr.depth( it ) ) );
+		}
+		for( size_t dp = 0; dp <= below + 1; ++dp )
+		{
+			const std::vector< int > want = fixed( tr, it, dp );
+			CHECK( fixed( fr, fit, dp ) == want );
+			CHECK( ( want == std::vector< int >( 1, -1 ) ) == ( dp > below ) );
+		}
+	}
+	CHECK( fit == fr.end() );
+
+	// pre-order backwards and by steps
+	if( !fr.empty() )
+	{
+		std::vector< int > back;
+		frozen::preOrderIterator it = fr.end();
+		do
+		{
+			--it;
+			back.push_back( *it );
+		}
+		while( it != fr.begin() );
+		CHECK( back.size() == fr.size() && back.front() == int( fr.size() ) - 1 && back.back() == 0 );
+
+		frozen::preOrderIterator step = fr.begin();
+		step += fr.size() - 1;
+		CHECK( *step == int( fr.size() ) - 1 );
+		step -= fr.size() - 1;
+		CHECK( step == fr.begin() );
+	}
+}
+
+// random shapes: node i goes below a random earlier node, or to the top level
+template< class TR >
+static void randomForest( TR& tr, int n, int tops, unsigned seed )
+{
+	std::srand( seed );
+	std::vector< typename TR::preOrderIterator > nodes;
+	nodes.push_back( tr.setHead( 0 ) );
+	for( int i = 1; i < tops; ++i )
+	{
+		nodes.push_back( tr.insertAfter( nodes.back(), 0 ) );
+	}
+	for( int i = tops; i < n; ++i )
+	{
+		nodes.push_back( tr.appendChild( nodes[ size_t( std::rand() ) % nodes.size() ], 0 ) );
+	}
+	number( tr );
+}
+
+template< class TR >
+static void run()
+{
+	// empty
+	{
+		TR tr;
+		compare( tr );
+		const FrozenTree< int > fr = tr.freeze();
+		CHECK( fr.begin() == fr.end() && fr.beginPost() == fr.endPost() && fr.beginLeaf() == fr.endLeaf() );
+	}
+
+	// a single node
+	{
+		TR tr;
+		tr.setHead( 0 );
+		compare( tr );
+	}
+
+	// a forest of small trees, leaves at the top level among them
+	{
+		TR tr;
+		typename TR::preOrderIterator a = tr.setHead( 0 );
+		typename TR::preOrderIterator b = tr.insertAfter( a, 0 );
+		typename TR::preOrderIterator c = tr.insertAfter( b, 0 );
+		tr.insertAfter( c, 0 );
+		typename TR::preOrderIterator a1 = tr.appendChild( a, 0 );
+		tr.appendChild( a1, 0 );
+		tr.appendChild( tr.appendChild( a1, 0 ), 0 );
+		tr.appendChild( a, 0 );
+		tr.appendChild( tr.appendChild( c, 0 ), 0 );
+		tr.appendChild( c, 0 );
+		number( tr );
+		compare( tr );
+	}
+
+	// a chain and a wide node
+	{
+		TR tr;
+		typename TR::preOrderIterator it = tr.setHead( 0 );
+		for( int i = 0; i < 50; ++i )
+		{
+			it = tr.appendChild( it, 0 );
+		}
+		number( tr );
+		compare( tr );
+
+		TR wide;
+		typename TR::preOrderIterator top = wide.setHead( 0 );
+		for( int i = 0; i < 40; ++i )
+		{
+			wide.appendChild( top, 0 );
+		}
+		number( wide );
+		compare( wide );
+	}
+
+	// random forests
+	for( unsigned seed = 1; seed <= 5; ++seed )
+	{
+		TR tr;
+		randomForest( tr, 200, int( seed ), seed );
+		compare( tr );
+	}
+}
+
+int main()
+{
+	run< plain  >();
+	run< levels >();
+	return 0;
+}
@@ -0,0 +1,169 @@
+/*
+ * Every public member of a Tree whose nodes link by TreeNodePool index.
+ * The explicit instantiation compiles all members that are not templates,
+ * the calls below the member templates; each result is checked on the way.
+ */
+#include "tree.h"
+#include "check.h"
+#include "trees.h"
+
+#include <functional>
+#include <sstream>
+#include <string>
+
+struct IndexPolicy : TreeDefaultPolicy
+{
+	static const bool indexLinks = true;
+};
+
+typedef Tree< std::string, std::allocator< std::string >, IndexPolicy > tree;
+
+template class Tree< std::string, std::allocator< std::string >, IndexPolicy >;
+
+// runs a task on the spot
+struct InlinePool
+{
+	void operator()( const std::function< void() >& task ) { task(); }
+};
+
+int main()
+{
+	tree tr( std::string( "a" ) );
+	tree::preOrderIterator top = tr.begin();
+
+	tr.appendChild( top, std::string( "d" ) );
+	std::string c( "c" );
+	tr.prependChild( top, c );
+	tr.appendChild( top );
+	*tr.child( top, 2 ) = "e";
+	*tr.prependChild( top ) = "b";
+	tr.emplaceChild( top, 1, 'f' );
+	CHECK( show( tr ) == "a(bcdef)" );
+
+	// sorting the children, the call that failed to compile
+	tr.sort( tr.beginSibling( top ), tr.endSibling( top ), std::greater< std::string >() );
+	CHECK( show( tr ) == "a(fedcb)" );
+	tr.sort( tr.beginSibling( top ), tr.endSibling( top ) );
+	CHECK( show( tr ) == "a(bcdef)" );
+	InlinePool pool;
+	tr.sort( tr.beginSibling( top ), tr.endSibling( top ), std::less< std::string >(), true, pool );
+
+	tree::siblingIterator b = tr.beginSibling( top );
+	tree::siblingIterator d = tr.child( top, 2 );
+	tr.emplaceFirstChild( b, "b1" );
+	tr.emplaceAfter( tree::preOrderIterator( b ), "b+" );
+	tr.emplace( d, "cc" );
+	tr.emplace( tree::preOrderIterator( d ), "c+" );
+	tr.insert( tree::preOrderIterator( d ), std::string( "c-" ) );
+	tr.insert( d, c );
+	tr.insertAfter( d, std::string( "d+" ) );
+	CHECK( show( tr ) == "a(b(b1)b+cccc+c-cdd+ef)" );
+
+	CHECK( *tr.previousSibling( d ) == "c" );
+	CHECK( *tr.nextSibling( d ) == "d+" );
+	CHECK( *tr.parent( d ) == "a" );
+	CHECK( tr.nextAtSameDepth( tree::preOrderIterator( d ) ) == tr.nextSibling( tree::preOrderIterator( d ) ) );
+	CHECK( tr.index( d ) == 7 );
+	CHECK( *tr.sibling( d, 0 ) == "b" );
+	CHECK( tr.numberOfSiblings( d ) == 10 );
+	CHECK( tr.depth( d ) == 1 );
+	CHECK( tr.maxDepth() == 2 );
+	CHECK( *tr.ancestor( d, 1 ) == "a" );
+	CHECK( tr.isAncestor( top, d ) && tr.isDescendant( d, top ) );
+	CHECK( tr.lowestCommonAncestor( d, b ) == top );
+	CHECK( tr.isInSubTree( d, tr.beginSibling( top ), tr.endSibling( top ) ) );
+	CHECK( tr.isValid( d ) );
+	CHECK( tr.size() == 13 );
+	CHECK( tr.size( b ) == 2 );
+	CHECK( tr.rank( d ) == 9 );
+	CHECK( tr.nodeAt( 9 ) == d );
+
+	// removing and replacing
+	tr.erase( tree::siblingIterator( tr.previousSibling( d ) ) );
+	tr.erase( tree::preOrderIterator( tr.nextSibling( d ) ) );
+	tr.erase( tree::siblingIterator( tr.child( top, 1 ) ) );
+	tr.erase( tree::siblingIterator( tr.child( top, 1 ) ) );
+	tr.erase( tree::siblingIterator( tr.child( top, 1 ) ) );
+	tr.erase( tree::siblingIterator( tr.child( top, 1 ) ) );
+	tr.erase( tree::siblingIterator( tr.child( top, 1 ) ) );
+	CHECK( show( tr ) == "a(b(b1)def)" );
+	d = tr.replace( d, std::string( "D" ) );
+	d = tr.replace( tree::preOrderIterator( d ), c );
+	d = tr.replace( tree::preOrderIterator( d ), tree::preOrderIterator( b ) );
+	CHECK( show( tr ) == "a(b(b1)b(b1)ef)" );
+	tr.replace( d, tr.endSibling( top ), b, tr.nextSibling( b ) );
+	CHECK( show( tr ) == "a(b(b1)b(b1))" );
+
+	// whole subtrees
+	tree other( tr );
+	tree::preOrderIterator otop = other.begin();
+	tr.appendChild( top, tree::preOrderIterator( other.beginSibling( otop ) ) );
+	tr.prependChild( top, tree::preOrderIterator( other.beginSibling( otop ) ) );
+	tr.appendChildren( top, other.beginSibling( otop ), other.endSibling( otop ) );
+	tr.prependChildren( top, other.beginSibling( otop ), other.endSibling( otop ) );
+	CHECK( tr.size() == 17 );
+	tr.eraseChildren( top );
+	tr.insertSubtree( tree::preOrderIterator( tr.appendChild( top, std::string( "x" ) ) ), otop );
+	tr.insertSubtreeAfter( tr.beginSibling( top ), otop );
+	CHECK( show( tr ) == "a(a(b(b1)b(b1))a(b(b1)b(b1))x)" );
+
+	// moving nodes around, the first source is the second child
+	tree::siblingIterator second = tr.child( top, 1 );
+	tr.flatten( tr.beginSibling( top ) );
+	CHECK( show( tr ) == "a(ab(b1)b(b1)a(b(b1)b(b1))x)" );
+	tr.reparent( second, tr.beginSibling( top ), second );
+	CHECK( show( tr ) == "a(a(b(b1)b(b1)ab(b1)b(b1))x)" );
+	tr.reparent( second, tr.nextSibling( second ) );
+	CHECK( show( tr ) == "a(a(b(b1)b(b1)ab(b1)b(b1))x)" );
+	tr.wrap( second, std::string( "w" ) );
+	CHECK( show( tr ) == "a(w(a(b(b1)b(b1)ab(b1)b(b1)))x)" );
+	tr.moveAfter( tr.child( top, 1 ), tr.beginSibling( top ) );
+	CHECK( show( tr ) == "a(xw(a(b(b1)b(b1)ab(b1)b(b1))))" );
+	tr.moveBefore( tree::preOrderIterator( tr.child( top, 1 ) ), tree::preOrderIterator( tr.child( top, 0 ) ) );
+	tr.moveBefore( tr.child( top, 1 ), tr.child( top, 0 ) );
+	CHECK( show( tr ) == "a(xw(a(b(b1)b(b1)ab(b1)b(b1))))" );
+	tr.moveOntop( tr.child( top, 0 ), tr.child( top, 1 ) );
+	CHECK( show( tr ) == "a(w(a(b(b1)b(b1)ab(b1)b(b1))))" );
+	tree::siblingIterator w = tr.beginSibling( top );
+	tr.appendChild( top, std::string( "y" ) );
+	tr.swap( w );
+	CHECK( show( tr ) == "a(yw(a(b(b1)b(b1)ab(b1)b(b1))))" );
+	tr.swap( tree::preOrderIterator( w ), tree::preOrderIterator( tr.beginSibling( top ) ) );
+	CHECK( show( tr ) == "a(w(a(b(b1)b(b1)ab(b1)b(b1)))y)" );
+
+	// merging an equal tree changes nothing, comparing, copying out
+	tree more( tr );
+	tr.merge( tr.begin(), tr.end(), more.begin(), more.end() );
+	tr.mergeTrees( tr.begin(), tr.end(), &more, &more + 1 );
+	CHECK( tr.equal( tr.begin(), tr.end(), more.begin() ) );
+	CHECK( tr.equal( tr.begin(), tr.end(), more.begin(), std::equal_to< std::string >() ) );
+	CHECK( tr.equalSubTree( tr.begin(), more.begin() ) );
+	CHECK( tr.equalSubTree( tr.begin(), more.begin(), std::equal_to< std::string >() ) );
+	CHECK( tr.subtreeHash( tr.begin() ) == more.subtreeHash( more.begin() ) );
+	tree part = tr.subTree( tr.beginSibling( top ), tr.endSibling( top ) );
+	tree into;
+	tr.subTree( into, tr.beginSibling( top ), tr.endSibling( top ) );
+	CHECK( show( part ) == "w(a(b(b1)b(b1)ab(b1)b(b1)))y" );
+	CHECK( show( into ) == show( part ) );
+	CHECK( tr.freeze().size() == tr.size() );
+
+	// the binary form both ways
+	std::stringstream io;
+	tr.write( io );
+	tree back;
+	back.read( io );
+	CHECK( show( back ) == show( tr ) );
+
+	// every iterator
+	size_t post = 0, breadth = 0, leaves = 0, fixed = 0;
+	for( tree::postOrderIterator it = tr.beginPost(); it != tr.endPost(); ++it ) ++post;
+	for( tree::breadthFirstQueuedIterator it = tr.beginBreadthFirst(); it != tr.endBreadthFirst(); ++it ) ++breadth;
+	for( tree::leafIterator it = tr.beginLeaf(); it != tr.endLeaf(); ++it ) ++leaves;
+	for( tree::fixedDepthIterator it = tr.beginFixed( top, 2 ); it != tr.endFixed( top, 2 ); ++it ) ++fixed;
+	CHECK( post == 13 && breadth == 13 && leaves == 6 && fixed == 1 );
+
+	tr.debug_verify_consistency();
+	tr.clear();
+	CHECK( tr.empty() );
+	return 0;
+}
@@ -0,0 +1,76 @@
+/*
+ * isInSubTree() with interval labels gives the pre-order walk's answer for
+ * every kind of range end: a node, the end of a sibling range, end() and
+ * an end that lies before the begin.
+ */
+#include "tree.h"
+#include "check.h"
+
+struct Intervals : TreeDefaultPolicy
+{
+	static const bool intervalLabels = true;
+};
+
+//  0
+//  +- 1
+//  |  +- 2
+//  |  +- 3
+//  +- 4
+//     +- 5
+//  6
+template< class TR >
+static void build( TR& tr )
+{
+	typename TR::preOrderIterator top = tr.setHead( 0 );
+	typename TR::preOrderIterator one = tr.appendChild( top, 1 );
+	tr.appendChild( one, 2 );
+	tr.appendChild( one, 3 );
+	tr.appendChild( tr.appendChild( top, 4 ), 5 );
+	tr.insertAfter( top, 6 );
+}
+
+template< class TR >
+static typename TR::preOrderIterator at( const TR& tr, int value )
+{
+	typename TR::preOrderIterator it = tr.begin();
+	while( *it != value )
+	{
+		++it;
+	}
+	return it;
+}
+
+template< class TR >
+static void run()
+{
+	TR tr;
+	build( tr );
+	typename TR::preOrderIterator one  = at( tr, 1 );
+	typename TR::preOrderIterator four = at( tr, 4 );
+
+	// a sibling range to the last child, its end has no node
+	typename TR::siblingIterator last = tr.endSibling( one );
+	CHECK( last.node == 0 );
+	CHECK(  tr.isInSubTree( at( tr, 3 ), tr.beginSibling( one ), last ) );
+	CHECK(  tr.isInSubTree( at( tr, 2 ), tr.beginSibling( one ), last ) );
+	CHECK( !tr.isInSubTree( one        , tr.beginSibling( one ), last ) );
+	CHECK(  tr.isInSubTree( at( tr, 6 ), tr.beginSibling( one ), last ) );   // open to the end
+
+	// a node as the end, and end()
+	CHECK(  tr.isInSubTree( at( tr, 3 ), one, four ) );
+	CHECK( !tr.isInSubTree( four       , one, four ) );
+	CHECK(  tr.isInSubTree( at( tr, 6 ), one, tr.end() ) );
+
+	// an end before the begin leaves the range open as well
+	CHECK(  tr.isInSubTree( at( tr, 5 ), four, one ) );
+	CHECK(  tr.isInSubTree( at( tr, 6 ), four, one ) );
+	CHECK( !tr.isInSubTree( at( tr, 2 ), four, one ) );
+	CHECK( !tr.isInSubTree( four       , four, four ) );   // empty
+}
+
+int main()
+{
+	run< Tree< int > >();
+	run< Tree< int, std::allocator< int >, Intervals > >();
+	return 0;
+}
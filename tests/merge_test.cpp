@@ -0,0 +1,163 @@
+/*
+ * merge() and mergeTrees(). Levels that take 16 or more nodes are matched
+ * by hash when the data has a std::hash, and with std::find when it does
+ * not; both must give the same tree. mergeTrees() must give what one
+ * merge() per tree gives.
+ */
+#include "tree.h"
+#include "check.h"
+#include "trees.h"
+
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+// a label without a std::hash, so merge() always scans
+struct Label
+{
+	Label() {}
+	Label( const std::string& t ) : text( t ) {}
+	bool operator==( const Label& other ) const { return text == other.text; }
+	std::string text;
+};
+
+static_assert(  TreeHashable< std::string >::value, "std::string has no std::hash" );
+static_assert( !TreeHashable< Label       >::value, "Label has a std::hash" );
+
+typedef Tree< std::string > hashed;
+typedef Tree< Label       > scanned;
+
+static std::string text( const Label& x ) { return x.text; }
+
+template< class TR >
+static size_t widest( const TR& tr )
+{
+	size_t ret = 0;
+	for( typename TR::preOrderIterator it = tr.begin(); it != tr.end(); ++it )
+	{
+		ret = std::max( ret, it.numberOfChildren() );
+	}
+	return ret;
+}
+
+static std::string letter( int range )
+{
+	return std::string( 1, char( 'a' + std::rand() % range ) );
+}
+
+// an "S" with a wide level of repeated labels below it, some of them with
+// children and grandchildren of their own
+template< class TR >
+static TR sentence( int wide )
+{
+	TR tr;
+	typename TR::preOrderIterator top = tr.setHead( std::string( "S" ) );
+	for( int i = 0; i < wide; ++i )
+	{
+		typename TR::preOrderIterator child = tr.appendChild( top, letter( 12 ) );
+		int below = std::rand() % 3 == 0 ? 0 : std::rand() % 20;
+		for( int j = 0; j < below; ++j )
+		{
+			typename TR::preOrderIterator grand = tr.appendChild( child, letter( 8 ) );
+			if( std::rand() % 4 == 0 )
+			{
+				tr.appendChild( grand, letter( 3 ) );
+			}
+		}
+	}
+	return tr;
+}
+
+// the same random trees for both types
+static void sentences( std::vector< hashed >& one, std::vector< scanned >& two, int count, unsigned seed )
+{
+	std::srand( seed );
+	for( int i = 0; i < count; ++i )
+	{
+		one.push_back( sentence< hashed >( 16 + std::rand() % 24 ) );
+	}
+	std::srand( seed );
+	for( int i = 0; i < count; ++i )
+	{
+		two.push_back( sentence< scanned >( 16 + std::rand() % 24 ) );
+	}
+	for( int i = 0; i < count; ++i )
+	{
+		CHECK( show( one[ size_t( i ) ], " " ) == show( two[ size_t( i ) ], " " ) );
+		CHECK( widest( one[ size_t( i ) ] ) >= 16 );
+	}
+}
+
+// the trees merged one merge() at a time into a copy of into
+template< class TR >
+static std::string oneByOne( const TR& into, const std::vector< TR >& trees, bool duplicateLeaves )
+{
+	TR tr( into );
+	for( size_t i = 0; i < trees.size(); ++i )
+	{
+		tr.merge( tr.begin(), tr.end(), trees[ i ].begin(), trees[ i ].end(), duplicateLeaves );
+	}
+	return show( tr, " " );
+}
+
+template< class TR >
+static std::string allAtOnce( const TR& into, const std::vector< TR >& trees, bool duplicateLeaves )
+{
+	TR tr( into );
+	tr.mergeTrees( tr.begin(), tr.end(), trees.begin(), trees.end(), duplicateLeaves );
+	return show( tr, " " );
+}
+
+int main()
+{
+	for( unsigned seed = 1; seed <= 4; ++seed )
+	{
+		std::vector< hashed  > one;
+		std::vector< scanned > two;
+		sentences( one, two, 6, seed );
+
+		// into an empty tree, into the first tree and into a forest
+		hashed  emptyOne, firstOne( one[ 0 ] ), forestOne( one[ 1 ] );
+		scanned emptyTwo, firstTwo( two[ 0 ] ), forestTwo( two[ 1 ] );
+		forestOne.insertAfter( forestOne.begin(), std::string( "T" ) );
+		forestTwo.insertAfter( forestTwo.begin(), std::string( "T" ) );
+
+		for( int dup = 0; dup < 2; ++dup )
+		{
+			const std::string want[ 3 ] = { oneByOne( emptyTwo,  two, dup != 0 ),
+			                                oneByOne( firstTwo,  two, dup != 0 ),
+			                                oneByOne( forestTwo, two, dup != 0 ) };
+
+			CHECK( oneByOne(  emptyOne,  one, dup != 0 ) == want[ 0 ] );
+			CHECK( oneByOne(  firstOne,  one, dup != 0 ) == want[ 1 ] );
+			CHECK( oneByOne(  forestOne, one, dup != 0 ) == want[ 2 ] );
+			CHECK( allAtOnce( emptyOne,  one, dup != 0 ) == want[ 0 ] );
+			CHECK( allAtOnce( firstOne,  one, dup != 0 ) == want[ 1 ] );
+			CHECK( allAtOnce( forestOne, one, dup != 0 ) == want[ 2 ] );
+			CHECK( allAtOnce( emptyTwo,  two, dup != 0 ) == want[ 0 ] );
+			CHECK( allAtOnce( firstTwo,  two, dup != 0 ) == want[ 1 ] );
+			CHECK( allAtOnce( forestTwo, two, dup != 0 ) == want[ 2 ] );
+		}
+	}
+
+	// a wide level below the top, merged into a node without children
+	{
+		hashed  dst( std::string( "S" ) ), src( std::string( "S" ) );
+		scanned ref( std::string( "S" ) ), refSrc( std::string( "S" ) );
+		for( int i = 0; i < 40; ++i )
+		{
+			src.appendChild(    src.begin(),    std::to_string( i % 20 ) );
+			refSrc.appendChild( refSrc.begin(), std::to_string( i % 20 ) );
+		}
+		dst.merge( dst.begin().begin(), dst.begin().end(), src.begin().begin(), src.begin().end(), true );
+		ref.merge( ref.begin().begin(), ref.begin().end(), refSrc.begin().begin(), refSrc.begin().end(), true );
+		std::string want = "S(0";
+		for( int i = 1; i < 40; ++i )
+		{
+			want += " " + std::to_string( i % 20 );
+		}
+		CHECK( show( dst, " " ) == want + ")" );
+		CHECK( show( ref, " " ) == want + ")" );
+	}
+	return 0;
+}
@@ -0,0 +1,100 @@
+/*
+ * Moved-from trees: the source of a move construction is left empty with
+ * sentinels of its own, so it can be queried, filled, copied to and moved
+ * again like a new tree.
+ */
+#include <string>
+#include <utility>
+#include <vector>
+#include "tree.h"
+#include "check.h"
+
+struct MovePolicy : TreeDefaultPolicy
+{
+	static const bool countNodes   = true;
+	static const bool subtreeSizes = true;
+	static const bool childIndex   = true;
+	static const bool leafChain    = true;
+	static const bool levelLinks   = true;
+};
+
+template< class TR >
+static void fill( TR& tr, int n )
+{
+	typename TR::preOrderIterator top = tr.setHead( "top" );
+	for( int i = 0; i < n; ++i )
+	{
+		tr.appendChild( tr.appendChild( top, "c" + std::to_string( i ) ), "leaf" );
+	}
+}
+
+template< class TR >
+static std::string show( const TR& tr )
+{
+	std::string out;
+	for( typename TR::preOrderIterator it = tr.begin(); it != tr.end(); ++it )
+	{
+		out += *it + " ";
+	}
+	return out;
+}
+
+template< class TR >
+static void run()
+{
+	TR one;
+	fill( one, 3 );
+	const std::string was = show( one );
+
+	TR two( std::move( one ) );
+	CHECK( show( two ) == was );
+
+	// the source is an empty tree
+	CHECK( one.empty() );
+	CHECK( one.size() == 0 );
+	CHECK( one.begin() == one.end() );
+	CHECK( one.beginLeaf() == one.endLeaf() );
+	CHECK( show( one ) == "" );
+	one.clear();
+	CHECK( one.empty() );
+
+	// and can be filled again, copied to, moved from and moved to
+	fill( one, 2 );
+	CHECK( one.size() == 5 );
+	CHECK( show( one ) == "top c0 leaf c1 leaf " );
+	CHECK( show( two ) == was );
+
+	TR three( std::move( one ) );
+	CHECK( one.empty() && three.size() == 5 );
+	one = two;
+	CHECK( show( one ) == was );
+
+	TR four( std::move( one ) );
+	one = std::move( four );
+	CHECK( show( one ) == was && one.size() == 7 );
+
+	TR five( std::move( three ) );
+	three.setHead( "again" );
+	CHECK( three.size() == 1 && show( three ) == "again " );
+
+	// trees in a vector survive reallocation
+	std::vector< TR > many;
+	for( int i = 0; i < 100; ++i )
+	{
+		many.push_back( TR() );
+		fill( many.back(), i % 4 );
+	}
+	for( int i = 0; i < 100; ++i )
+	{
+		CHECK( many[ size_t( i ) ].size() == size_t( 1 + 2 * ( i % 4 ) ) );
+	}
+}
+
+int main()
+{
+	run< Tree< std::string > >();
+	run< Tree< std::string, std::allocator< std::string >, MovePolicy > >();
+	run< Tree< std::string, TreeArenaAllocator< std::string > > >();
+	run< Tree< std::string, TreeArenaAllocator< std::string >, MovePolicy > >();
+	return 0;
+}
@@ -0,0 +1,264 @@
+/*
+ * Every policy against a plain Tree: the same random edits are made to
+ * both, and after each one the shapes and the answers to every query the
+ * policy speeds up must agree.
+ */
+#include "tree.h"
+#include "check.h"
+#include "trees.h"
+
+#include <cstdlib>
+#include <string>
+
+typedef Tree< int > plain;
+
+struct Counting     : TreeDefaultPolicy { static const bool countNodes     = true; };
+struct Sizes        : TreeDefaultPolicy { static const bool subtreeSizes   = true; };
+struct Indexed      : TreeDefaultPolicy { static const bool childIndex     = true;
+                                          static const size_t childIndexThreshold = 2; };
+struct IndexLinks   : TreeDefaultPolicy { static const bool indexLinks     = true; };
+struct Reduced      : TreeDefaultPolicy { static const bool reducedLinks   = true; };
+struct Leaves       : TreeDefaultPolicy { static const bool leafChain      = true; };
+struct Levels       : TreeDefaultPolicy { static const bool levelLinks     = true; };
+struct Lca          : TreeDefaultPolicy { static const bool lcaIndex       = true; };
+struct Intervals    : TreeDefaultPolicy { static const bool intervalLabels = true; };
+struct LevelIndex   : TreeDefaultPolicy { static const bool levelIndex     = true; };
+struct Hashes       : TreeDefaultPolicy { static const bool subtreeHashes  = true; };
+struct Everything   : TreeDefaultPolicy
+{
+	static const bool countNodes     = true;
+	static const bool subtreeSizes   = true;
+	static const bool childIndex     = true;
+	static const size_t childIndexThreshold = 2;
+	static const bool leafChain      = true;
+	static const bool levelLinks     = true;
+	static const bool lcaIndex       = true;
+	static const bool intervalLabels = true;
+	static const bool levelIndex     = true;
+	static const bool subtreeHashes  = true;
+};
+
+// the k-th node in pre-order, walked to without any index
+template< class TR >
+static typename TR::preOrderIterator at( const TR& tr, size_t k )
+{
+	typename TR::preOrderIterator it = tr.begin();
+	while( k-- != 0 )
+	{
+		++it;
+	}
+	return it;
+}
+
+template< class TR >
+static size_t rankOf( const TR& tr, typename TR::iteratorBase node )
+{
+	size_t k = 0;
+	for( typename TR::preOrderIterator it = tr.begin(); it != tr.end() && it.node != node.node; ++it )
+	{
+		++k;
+	}
+	return k;
+}
+
+// one random edit at pre-order positions a and b, made the same way to both
+template< class TR >
+static void edit( TR& tr, unsigned op, size_t a, size_t b, int value )
+{
+	typename TR::preOrderIterator x = at( tr, a );
+	typename TR::preOrderIterator y = at( tr, b );
+
+	switch( op )
+	{
+	case 0:  tr.appendChild( x, value );                        break;
+	case 1:  tr.prependChild( x, value );                       break;
+	case 2:  tr.insertAfter( x, value );                        break;
+	case 3:  tr.insert( x, value );                             break;
+	case 4:  tr.emplaceChild( x, value );                       break;
+	case 5:  tr.wrap( x, value );                               break;
+	case 6:  if( tr.size() > 20 ) tr.erase( x );                break;
+	case 7:  if( tr.size( x ) < 10 ) tr.eraseChildren( x );     break;
+	case 8:  tr.flatten( x );                                   break;
+	case 9:  tr.sort( tr.beginSibling( x ), tr.endSibling( x ) ); break;
+	case 10: if( !tr.isInSubTree( y, x, tr.nextSibling( x ) ) && !tr.isInSubTree( x, y, tr.nextSibling( y ) ) )
+	         {
+	             tr.moveAfter( x, y );
+	         }
+	         break;
+	case 11: if( !tr.isInSubTree( x, y, tr.nextSibling( y ) ) && !tr.isAncestor( y, x ) && x != y )
+	         {
+	             tr.appendChild( x, y );   // a copy of y below x
+	         }
+	         break;
+	case 12: *x = value; tr.dataChanged( x );                   break;
+	default: tr.replace( x, value );                            break;
+	}
+}
+
+template< class TR >
+static void compare( const plain& ref, const TR& tr )
+{
+	CHECK( show( tr, " " ) == show( ref, " " ) );
+	CHECK( tr.size() == ref.size() );
+	CHECK( tr.maxDepth() == ref.maxDepth() );
+
+	const size_t n = ref.size();
+	for( size_t k = 0; k < n; ++k )
+	{
+		typename plain::preOrderIterator r = at( ref, k );
+		typename TR::preOrderIterator    t = at( tr, k );
+
+		CHECK( tr.size( t ) == ref.size( r ) );
+		CHECK( tr.rank( t ) == k );
+		CHECK( tr.nodeAt( k ) == t );
+		CHECK( tr.depth( t ) == ref.depth( r ) );
+		CHECK( tr.level( t ) == size_t( ref.depth( r ) ) );
+		CHECK( tr.numberOfChildren( t ) == ref.numberOfChildren( r ) );
+		CHECK( tr.numberOfSiblings( t ) == ref.numberOfSiblings( r ) );
+		CHECK( tr.index( t ) == ref.index( r ) );
+		CHECK( tr.maxDepth( t ) == ref.maxDepth( r ) );
+
+		for( size_t i = 0; i < ref.numberOfChildren( r ); ++i )
+		{
+			CHECK( *tr.child( t, i ) == *ref.child( r, i ) );
+		}
+		for( int up = 0; up <= ref.depth( r ) + 1; ++up )
+		{
+			CHECK( rankOf( tr, tr.ancestor( t, up ) ) == rankOf( ref, ref.ancestor( r, up ) ) );
+		}
+
+		// against a few other nodes
+		for( size_t j = k % 3; j < n; j += 7 )
+		{
+			typename plain::preOrderIterator ro = at( ref, j );
+			typename TR::preOrderIterator    to = at( tr, j );
+
+			CHECK( tr.isAncestor(   t, to ) == ref.isAncestor(   r, ro ) );
+			CHECK( tr.isDescendant( t, to ) == ref.isDescendant( r, ro ) );
+			CHECK( tr.isInSubTree( to, t, tr.nextSibling( t ) ) == ref.isInSubTree( ro, r, ref.nextSibling( r ) ) );
+			CHECK( rankOf( tr, tr.lowestCommonAncestor( t, to ) ) == rankOf( ref, ref.lowestCommonAncestor( r, ro ) ) );
+			CHECK( tr.equalSubTree( t, to ) == ref.equalSubTree( r, ro ) );
+		}
+
+		// the leaves below and the nodes two levels down
+		std::string leaves, expect;
+		for( typename TR::leafIterator it = tr.beginLeaf( t ); it != tr.endLeaf( t ); ++it )
+		{
+			leaves += std::to_string( *it ) + " ";
+		}
+		for( typename plain::leafIterator it = ref.beginLeaf( r ); it != ref.endLeaf( r ); ++it )
+		{
+			expect += std::to_string( *it ) + " ";
+		}
+		CHECK( leaves == expect );
+
+		if( ref.maxDepth( r ) >= 2 )
+		{
+			std::string fixed, fixedExpect;
+			for( typename TR::fixedDepthIterator it = tr.beginFixed( t, 2 ); it != tr.endFixed( t, 2 ); ++it )
+			{
+				fixed += std::to_string( *it ) + " ";
+			}
+			for( typename plain::fixedDepthIterator it = ref.beginFixed( r, 2 ); it != ref.endFixed( r, 2 ); ++it )
+			{
+				fixedExpect += std::to_string( *it ) + " ";
+			}
+			CHECK( fixed == fixedExpect );
+		}
+	}
+
+	std::string breadth, breadthExpect;
+	for( typename TR::breadthFirstQueuedIterator it = tr.beginBreadthFirst(); it != tr.endBreadthFirst(); ++it )
+	{
+		breadth += std::to_string( *it ) + " ";
+	}
+	for( typename plain::breadthFirstQueuedIterator it = ref.beginBreadthFirst(); it != ref.endBreadthFirst(); ++it )
+	{
+		breadthExpect += std::to_string( *it ) + " ";
+	}
+	CHECK( breadth == breadthExpect );
+
+	std::string post, postExpect;
+	for( typename TR::postOrderIterator it = tr.beginPost(); it != tr.endPost(); ++it )
+	{
+		post += std::to_string( *it ) + " ";
+	}
+	for( typename plain::postOrderIterator it = ref.beginPost(); it != ref.endPost(); ++it )
+	{
+		postExpect += std::to_string( *it ) + " ";
+	}
+	CHECK( post == postExpect );
+}
+
+template< class Policy >
+static void run( unsigned seed )
+{
+	typedef Tree< int, std::allocator< int >, Policy > TR;
+
+	std::srand( seed );
+	plain ref( 0 );
+	TR    tr(  0 );
+	int   value = 1;
+
+	for( int step = 0; step < 200; ++step )
+	{
+		unsigned op = unsigned( std::rand() ) % 14;
+		size_t   a  = size_t( std::rand() ) % ref.size();
+		size_t   b  = size_t( std::rand() ) % ref.size();
+
+		// the top stays alone at the top level
+		if( a == 0 && ( op == 2 || op == 3 || op == 5 || op == 6 || op == 8 || op == 10 ) )
+		{
+			continue;
+		}
+		if( op == 10 && b == 0 )
+		{
+			continue;
+		}
+
+		edit( ref, op, a, b, value % 17 );
+		edit( tr,  op, a, b, value % 17 );
+		++value;
+
+		compare( ref, tr );
+		tr.debug_verify_consistency();
+	}
+
+	// copies, moves and a clear keep the bookkeeping right
+	TR copy( tr );
+	compare( ref, copy );
+	TR moved( std::move( copy ) );
+	compare( ref, moved );
+	copy = moved;
+	compare( ref, copy );
+	tr.clear();
+	CHECK( tr.empty() );
+	CHECK( tr.size() == 0 );
+}
+
+template< class Policy >
+static void runAll()
+{
+	for( unsigned seed = 1; seed <= 3; ++seed )
+	{
+		run< Policy >( seed );
+	}
+}
+
+int main()
+{
+	runAll< TreeDefaultPolicy >();
+	runAll< Counting   >();
+	runAll< Sizes      >();
+	runAll< Indexed    >();
+	runAll< IndexLinks >();
+	runAll< Reduced    >();
+	runAll< Leaves     >();
+	runAll< Levels     >();
+	runAll< Lca        >();
+	runAll< Intervals  >();
+	runAll< LevelIndex >();
+	runAll< Hashes     >();
+	runAll< Everything >();
+	return 0;
+}
@@ -0,0 +1,112 @@
+/*
+ * The reduced-link node against the full node: node size, and the time to
+ * build, walk, copy and free a tree of a million nodes with each. Without a
+ * lastChild link appendChild() walks the children, so the fanout is kept
+ * small; much wider trees build slower with the reduced node.
+ */
+#include "tree.h"
+
+#include <chrono>
+#include <cstdio>
+
+struct Reduced : TreeDefaultPolicy
+{
+	static const bool reducedLinks = true;
+};
+
+struct Indexed : TreeDefaultPolicy
+{
+	static const bool indexLinks = true;
+};
+
+struct IndexedReduced : TreeDefaultPolicy
+{
+	static const bool indexLinks   = true;
+	static const bool reducedLinks = true;
+};
+
+static const int nodes  = 1000000;
+static const int fanout = 8;
+static const int rounds = 5;
+
+typedef std::chrono::steady_clock clock_;
+
+static double msSince( clock_::time_point start )
+{
+	return std::chrono::duration< double, std::milli >( clock_::now() - start ).count() / rounds;
+}
+
+// breadth first, every node gets fanout children until there are enough
+template< class TR >
+static void build( TR& tr )
+{
+	std::vector< typename TR::preOrderIterator > open;
+	open.push_back( tr.setHead( 0 ) );
+	int made = 1;
+	for( size_t next = 0; made < nodes; ++next )
+	{
+		for( int i = 0; i < fanout && made < nodes; ++i )
+		{
+			open.push_back( tr.appendChild( open[ next ], made++ ) );
+		}
+	}
+}
+
+template< class Policy >
+static void run( const char *name )
+{
+	typedef Tree< int, std::allocator< int >, Policy > TR;
+
+	long sum = 0;
+
+	clock_::time_point start = clock_::now();
+	for( int r = 0; r < rounds; ++r )
+	{
+		TR tr;
+		build( tr );
+	}
+	double buildFree = msSince( start );
+
+	TR tr;
+	build( tr );
+
+	start = clock_::now();
+	for( int r = 0; r < rounds; ++r )
+	{
+		for( typename TR::preOrderIterator it = tr.begin(); it != tr.end(); ++it )
+		{
+			sum += *it;
+		}
+	}
+	double pre = msSince( start );
+
+	start = clock_::now();
+	for( int r = 0; r < rounds; ++r )
+	{
+		for( typename TR::postOrderIterator it = tr.beginPost(); it != tr.endPost(); ++it )
+		{
+			sum += *it;
+		}
+	}
+	double post = msSince( start );
+
+	start = clock_::now();
+	for( int r = 0; r < rounds; ++r )
+	{
+		TR copy( tr );
+		sum += copy.size( copy.begin() );
+	}
+	double copyFree = msSince( start );
+
+	std::printf( "%-16s %3u bytes/node  build+free %7.1f ms  pre-order %6.1f ms  post-order %6.1f ms  copy+free %7.1f ms  (%ld)\n",
+	             name, unsigned( sizeof( _TreeNode< int, Policy > ) ), buildFree, pre, post, copyFree, sum );
+}
+
+int main()
+{
+	run< TreeDefaultPolicy >( "full"           );
+	run< Reduced           >( "reduced"        );
+	run< Indexed           >( "index"          );
+	run< IndexedReduced    >( "index, reduced" );
+	return 0;
+}
@@ -0,0 +1,356 @@
+/*
+ * sort(): stable for equal keys, right for lists longer than one bin and
+ * for deep sorts, and the same when a deep sort runs on a pool of real
+ * threads. The bookkeeping of the policies survives the sort.
+ */
+#include "tree.h"
+#include "check.h"
+
+#include <condition_variable>
+#include <cstdlib>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// sorted by key only, id tells equal keys apart
+struct Item
+{
+	Item() : key( 0 ), id( 0 ) {}
+	Item( int k, int i ) : key( k ), id( i ) {}
+	int key;
+	int id;
+};
+
+struct ByKey
+{
+	bool operator()( const Item& one, const Item& two ) const { return one.key < two.key; }
+};
+
+struct Everything : TreeDefaultPolicy
+{
+	static const bool countNodes   = true;
+	static const bool subtreeSizes = true;
+	static const bool childIndex   = true;
+	static const size_t childIndexThreshold = 2;
+	static const bool leafChain    = true;
+	static const bool levelLinks   = true;
+};
+
+typedef Tree< Item >                                       plain;
+typedef Tree< Item, std::allocator< Item >, Everything >   policed;
+
+// a pool of worker threads that run the tasks handed to it
+class ThreadPool
+{
+public:
+	explicit ThreadPool( size_t threads ) : stopping( false ), tasks( 0 ), finished( 0 )
+	{
+		for( size_t i = 0; i < threads; ++i )
+		{
+			workers.push_back( std::thread( [ this ]() { run(); } ) );
+		}
+	}
+
+	~ThreadPool()
+	{
+		{
+			std::lock_guard< std::mutex > lock( mutex );
+			stopping = true;
+		}
+		wake.notify_all();
+		for( size_t i = 0; i < workers.size(); ++i )
+		{
+			workers[ i ].join();
+		}
+	}
+
+	void operator()( const std::function< void() >& task )
+	{
+		{
+			std::lock_guard< std::mutex > lock( mutex );
+			queue.push_back( task );
+			++tasks;
+		}
+		wake.notify_one();
+	}
+
+	// waits until every task handed out so far has run, returns how many
+	size_t drain()
+	{
+		std::unique_lock< std::mutex > lock( mutex );
+		while( finished != tasks )
+		{
+			idle.wait( lock );
+		}
+		return tasks;
+	}
+
+	std::set< std::thread::id > ranOn;   // read after drain()
+
+private:
+	void run()
+	{
+		for( ; ; )
+		{
+			std::function< void() > task;
+			{
+				std::unique_lock< std::mutex > lock( mutex );
+				while( !stopping && queue.empty() )
+				{
+					wake.wait( lock );
+				}
+				if( queue.empty() )
+				{
+					return;
+				}
+				task = queue.front();
+				queue.pop_front();
+				ranOn.insert( std::this_thread::get_id() );
+			}
+			task();
+
+			std::lock_guard< std::mutex > lock( mutex );
+			if( ++finished == tasks )
+			{
+				idle.notify_all();
+			}
+		}
+	}
+
+	std::vector< std::thread >             workers ;
+	std::deque< std::function< void() > > queue   ;
+	std::mutex                             mutex   ;
+	std::condition_variable                wake    ;
+	std::condition_variable                idle    ;
+	bool                                   stopping;
+	size_t                                 tasks   ;
+	size_t                                 finished;
+};
+
+// turns every task down
+struct RefusingPool
+{
+	void operator()( const std::function< void() >& ) { throw std::runtime_error( "busy" ); }
+};
+
+// pre-order as key.id, children in brackets
+template< class TR >
+static std::string show( const TR& tr, typename TR::siblingIterator node )
+{
+	std::string ret = std::to_string( node->key ) + "." + std::to_string( node->id );
+	if( node.numberOfChildren() != 0 )
+	{
+		ret += "(";
+		for( typename TR::siblingIterator c = tr.beginSibling( node ); c != tr.endSibling( node ); ++c )
+		{
+			ret += show( tr, c ) + " ";
+		}
+		ret += ")";
+	}
+	return ret;
+}
+
+// what a stable sort of the children gives, below node as well if deep
+template< class TR >
+static std::string sorted( const TR& tr, typename TR::siblingIterator node, bool deep )
+{
+	std::string ret = std::to_string( node->key ) + "." + std::to_string( node->id );
+	if( node.numberOfChildren() != 0 )
+	{
+		std::vector< std::pair< int, std::string > > children;
+		for( typename TR::siblingIterator c = tr.beginSibling( node ); c != tr.endSibling( node ); ++c )
+		{
+			children.push_back( std::make_pair( c->key, deep ? sorted( tr, c, true ) : show( tr, c ) ) );
+		}
+		std::stable_sort( children.begin(), children.end(),
+		                  []( const std::pair< int, std::string >& one, const std::pair< int, std::string >& two ) { return one.first < two.first; } );
+		ret += "(";
+		for( size_t i = 0; i < children.size(); ++i )
+		{
+			ret += children[ i ].second + " ";
+		}
+		ret += ")";
+	}
+	return ret;
+}
+
+// a node with wide children of few keys, each with random subtrees below
+template< class TR >
+static void build( TR& tr, int wide, int levels, int keys )
+{
+	int id = 0;
+	typename TR::preOrderIterator top = tr.setHead( Item( 0, id++ ) );
+	std::vector< typename TR::preOrderIterator > open( 1, top );
+	for( int level = 0; level < levels; ++level )
+	{
+		std::vector< typename TR::preOrderIterator > next;
+		for( size_t i = 0; i < open.size(); ++i )
+		{
+			int children = ( level == 0 ? wide : std::rand() % 6 );
+			for( int c = 0; c < children; ++c )
+			{
+				next.push_back( tr.appendChild( open[ i ], Item( std::rand() % keys, id++ ) ) );
+			}
+		}
+		open.swap( next );
+	}
+}
+
+// the leaves, levels, sizes and child index agree with the shape
+template< class TR >
+static void checkBookkeeping( const TR& tr )
+{
+	std::vector< int > leaves;
+	size_t count = 0;
+	for( typename TR::preOrderIterator it = tr.begin(); it != tr.end(); ++it, ++count )
+	{
+		if( it.numberOfChildren() == 0 )
+		{
+			leaves.push_back( it->id );
+		}
+		size_t below = 1, n = 0;
+		for( typename TR::siblingIterator c = tr.beginSibling( it ); c != tr.endSibling( it ); ++c, ++n )
+		{
+			below += tr.size( c );
+			CHECK( TR::child( it, n ) == c );
+		}
+		CHECK( tr.size( it ) == below );
+	}
+	CHECK( tr.size() == count );
+
+	std::vector< int > chained;
+	for( typename TR::leafIterator it = tr.beginLeaf(); it != tr.endLeaf(); ++it )
+	{
+		chained.push_back( it->id );
+	}
+	CHECK( chained == leaves );
+
+	// the second level, left to right
+	std::vector< int > level, linked;
+	for( typename TR::siblingIterator it = tr.beginSibling( tr.begin() ); it != tr.endSibling( tr.begin() ); ++it )
+	{
+		for( typename TR::siblingIterator c = tr.beginSibling( it ); c != tr.endSibling( it ); ++c )
+		{
+			level.push_back( c->id );
+		}
+	}
+	if( !level.empty() )
+	{
+		for( typename TR::fixedDepthIterator it = tr.beginFixed( tr.begin(), 2 ); it != tr.endFixed( tr.begin(), 2 ); ++it )
+		{
+			linked.push_back( it->id );
+		}
+	}
+	CHECK( linked == level );
+}
+
+template< class TR >
+static void run()
+{
+	// stability and lengths around and well past the bin sizes
+	const int lengths[] = { 0, 1, 2, 3, 4, 5, 7, 8, 9, 15, 16, 17, 31, 33, 100, 1000, 4097 };
+	for( size_t l = 0; l < sizeof( lengths ) / sizeof( lengths[ 0 ] ); ++l )
+	{
+		for( int keys = 1; keys <= 64; keys *= 8 )
+		{
+			TR tr;
+			build( tr, lengths[ l ], 1, keys );
+			const std::string want = sorted( tr, tr.begin(), false );
+			tr.sort( tr.beginSibling( tr.begin() ), tr.endSibling( tr.begin() ), ByKey() );
+			CHECK( show( tr, tr.begin() ) == want );
+			checkBookkeeping( tr );
+
+			int key = -1, id = -1;
+			for( typename TR::siblingIterator it = tr.beginSibling( tr.begin() ); it != tr.endSibling( tr.begin() ); ++it )
+			{
+				CHECK( it->key > key || ( it->key == key && it->id > id ) );
+				key = it->key;
+				id  = it->id;
+			}
+		}
+	}
+
+	// part of a level, the nodes around it stay put
+	{
+		TR tr;
+		build( tr, 40, 2, 5 );
+		typename TR::siblingIterator from = TR::child( tr.begin(), 10 );
+		typename TR::siblingIterator to   = TR::child( tr.begin(), 30 );
+		std::vector< std::string > before;
+		for( typename TR::siblingIterator it = tr.beginSibling( tr.begin() ); it != tr.endSibling( tr.begin() ); ++it )
+		{
+			before.push_back( show( tr, it ) );
+		}
+		tr.sort( from, to, ByKey() );
+		std::vector< std::string > after;
+		for( typename TR::siblingIterator it = tr.beginSibling( tr.begin() ); it != tr.endSibling( tr.begin() ); ++it )
+		{
+			after.push_back( show( tr, it ) );
+		}
+		CHECK( after.size() == 40 );
+		CHECK( std::equal( after.begin(), after.begin() + 10, before.begin() ) );
+		CHECK( std::equal( after.begin() + 30, after.end(), before.begin() + 30 ) );
+		CHECK( std::is_permutation( after.begin() + 10, after.begin() + 30, before.begin() + 10 ) );
+		checkBookkeeping( tr );
+	}
+
+	// deep sorts of several levels, serial, inline, refused and on threads
+	for( unsigned seed = 1; seed <= 3; ++seed )
+	{
+		TR tr;
+		std::srand( seed );
+		build( tr, 50, 5, 4 );
+		const std::string want = sorted( tr, tr.begin(), true );
+
+		TR serial( tr );
+		serial.sort( serial.beginSibling( serial.begin() ), serial.endSibling( serial.begin() ), ByKey(), true );
+		CHECK( show( serial, serial.begin() ) == want );
+		checkBookkeeping( serial );
+
+		TR refused( tr );
+		RefusingPool busy;
+		refused.sort( refused.beginSibling( refused.begin() ), refused.endSibling( refused.begin() ), ByKey(), true, busy );
+		CHECK( show( refused, refused.begin() ) == want );
+
+		ThreadPool pool( 4 );
+		TR threaded( tr );
+		threaded.sort( threaded.beginSibling( threaded.begin() ), threaded.endSibling( threaded.begin() ), ByKey(), true, pool );
+		CHECK( show( threaded, threaded.begin() ) == want );
+		checkBookkeeping( threaded );
+		CHECK( pool.drain() > 0 );
+
+		// the whole top level, a forest, with the default order on keys
+		TR forest( tr );
+		forest.insertAfter( forest.begin(), Item( -1, -1 ) );
+		forest.sort( forest.begin(), forest.end(), ByKey(), true, pool );
+		CHECK( forest.begin()->key == -1 );
+		CHECK( show( forest, ++forest.begin() ) == want );
+	}
+}
+
+int main()
+{
+	run< plain   >();
+	run< policed >();
+
+	// the tasks ran on the pool's threads, not the caller's
+	{
+		ThreadPool pool( 2 );
+		plain tr;
+		std::srand( 7 );
+		build( tr, 200, 4, 3 );
+		const std::string want = sorted( tr, tr.begin(), true );
+		tr.sort( tr.beginSibling( tr.begin() ), tr.endSibling( tr.begin() ), ByKey(), true, pool );
+		CHECK( show( tr, tr.begin() ) == want );
+		CHECK( pool.drain() > 0 );
+		CHECK( !pool.ranOn.empty() );
+		CHECK( pool.ranOn.count( std::this_thread::get_id() ) == 0 );
+	}
+	return 0;
+}
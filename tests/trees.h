@@ -0,0 +1,66 @@
+/*
+ * Trees and pictures of trees shared by the test programs: fan() builds a
+ * small tree of strings, show() writes any tree in pre-order with the
+ * children of a node in brackets after it.
+ */
+#ifndef _TREE_TEST_TREES_H_
+#define _TREE_TEST_TREES_H_
+
+#include "tree.h"
+
+#include <functional>
+#include <string>
+
+// a top with n children c, each of which has the leaves x and y
+inline Tree< std::string > fan( const std::string& top, int n )
+{
+	Tree< std::string > tr( top );
+	for( int i = 0; i < n; ++i )
+	{
+		Tree< std::string >::preOrderIterator c = tr.appendChild( tr.begin(), std::string( "c" ) );
+		tr.appendChild( c, std::string( "x" ) );
+		tr.appendChild( c, std::string( "y" ) );
+	}
+	return tr;
+}
+
+// the data of a node as show() writes it; a test with data of another
+// type declares its own text() next to that type
+inline std::string text( const std::string& x ) { return x; }
+inline std::string text( int x )                { return std::to_string( x ); }
+
+// pre-order, the children of a node in brackets after it and the nodes of
+// a level apart by sep: "a(b(c)d)e", or "a(b(c) d) e" with sep " "
+template< class TR >
+std::string show( const TR& tr, const std::string& sep = "" )
+{
+	std::string ret;
+	std::function< void( typename TR::siblingIterator ) > add = [ & ]( typename TR::siblingIterator node )
+	{
+		ret += text( *node );
+		if( node.numberOfChildren() != 0 )
+		{
+			ret += "(";
+			for( typename TR::siblingIterator c = tr.beginSibling( node ); c != tr.endSibling( node ); ++c )
+			{
+				if( c != tr.beginSibling( node ) )
+				{
+					ret += sep;
+				}
+				add( c );
+			}
+			ret += ")";
+		}
+	};
+	for( typename TR::siblingIterator it = tr.begin(); it != tr.end(); ++it )
+	{
+		if( it != tr.begin() )
+		{
+			ret += sep;
+		}
+		add( it );
+	}
+	return ret;
+}
+
+#endif